@@ -277,6 +277,34 @@ void sipe_backend_ft_start(struct sipe_file_transfer *ft,
 			   struct sipe_backend_fd *fd,
 			   const char* ip, unsigned port);
 
+/**
+ * Trigger file transfer data exchange
+ *
+ * For file transfers started without file descriptor the backend doesn't
+ * poll for data. Instead the core calls this function when it is able to
+ * accept (sending) or provide (receiving) more data. The backend will then
+ * call @c ft_write or @c ft_read of @c ft.
+ *
+ * Must not be called from inside @c ft_read or @c ft_write.
+ *
+ * @param ft file transfer data
+ */
+void sipe_backend_ft_ready(struct sipe_file_transfer *ft);
+
+/**
+ * Select the connection event that drives an outgoing file transfer
+ *
+ * By default the backend calls @c ft_write of an outgoing transfer when
+ * the connection is writable. While the core waits for a message from the
+ * peer it asks to be called when the connection is readable instead.
+ *
+ * @param ft       file transfer data
+ * @param readable @c TRUE to call @c ft_write when the connection is readable,
+ *                 @c FALSE to call it when the connection is writable
+ */
+void sipe_backend_ft_watch_readable(struct sipe_file_transfer *ft,
+				    gboolean readable);
+
 /**
  * Check whether file transfer is incoming or outgoing
  *
@@ -624,6 +652,9 @@ typedef enum {
   SIPE_SETTING_GROUPCHAT_USER,
   SIPE_SETTING_RDP_CLIENT,
   SIPE_SETTING_USER_AGENT,
+  SIPE_SETTING_FT_BLOCK_SIZE,
+  SIPE_SETTING_HTTP_CONNECTIONS,
+  SIPE_SETTING_HTTP_PIPELINE_DEPTH,
   SIPE_SETTING_LAST
 } sipe_setting;
 const gchar *sipe_backend_setting(struct sipe_core_public *sipe_public,
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2011-2016 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2011-2018 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2010 pier11 <pier11@operamail.com>
  * Copyright (C) 2008 Novell, Inc.
  *
@@ -130,6 +130,7 @@ gboolean sip_sec_ntlm_tests(void)
 	struct sipmsg *msg;
 	struct sipmsg_breakdown msgbd;
 	gchar *msg_str;
+	GString *signature_input = g_string_new(NULL);
 	const char *password2;
 	const char *user2;
 	const char *domain2;
@@ -506,6 +507,11 @@ Response:
 	msgbd.msg = msg;
 	sipmsg_breakdown_parse(&msgbd, "SIP Communications Service", "ocs1.ocs.provo.novell.com", NULL);
 	msg_str = sipmsg_breakdown_get_string(2, &msgbd);
+	assert_equal (msg_str,
+		      (guchar *) sipmsg_signature_input(signature_input, 2, msg,
+							"SIP Communications Service", "ocs1.ocs.provo.novell.com",
+							NULL, NULL, NULL),
+		      strlen(msg_str) + 1, FALSE);
 	sip_sec_ntlm_sipe_signature_make (NEGOTIATE_FLAGS_CONNLESS & ~NTLMSSP_NEGOTIATE_EXTENDED_SESSIONSECURITY,
 		msg_str, 0, exported_session_key2, exported_session_key2, mac);
 	sipmsg_breakdown_free(&msgbd);
@@ -765,6 +771,11 @@ Message (length 352):
 	sipmsg_breakdown_parse(&msgbd, "SIP Communications Service", "cosmo-ocs-r2.cosmo.local", NULL);
 	msg_str = sipmsg_breakdown_get_string(4, &msgbd);
 	assert_equal (request_sig, (guchar *)msg_str, strlen(request_sig), FALSE);
+	assert_equal (request_sig,
+		      (guchar *) sipmsg_signature_input(signature_input, 4, msg,
+							"SIP Communications Service", "cosmo-ocs-r2.cosmo.local",
+							NULL, NULL, NULL),
+		      strlen(request_sig) + 1, FALSE);
 	sip_sec_ntlm_sipe_signature_make (flags, msg_str, 0, client_sign_key, client_seal_key, mac);
 	sipmsg_breakdown_free(&msgbd);
 	assert_equal ("0100000029618e9651b65a7764000000", mac, 16, TRUE);
@@ -777,6 +788,11 @@ Message (length 352):
 	sipmsg_breakdown_parse(&msgbd, "SIP Communications Service", "cosmo-ocs-r2.cosmo.local", NULL);
 	msg_str = sipmsg_breakdown_get_string(4, &msgbd);
 	assert_equal (response_sig, (guchar *)msg_str, strlen(response_sig), FALSE);
+	assert_equal (response_sig,
+		      (guchar *) sipmsg_signature_input(signature_input, 4, msg,
+							"SIP Communications Service", "cosmo-ocs-r2.cosmo.local",
+							NULL, NULL, NULL),
+		      strlen(response_sig) + 1, FALSE);
 	// server keys here
 	sip_sec_ntlm_sipe_signature_make (flags, msg_str, 0, server_sign_key, server_seal_key, mac);
 	sipmsg_breakdown_free(&msgbd);
@@ -865,6 +881,11 @@ Message (length 352):
 	msg_str = sipmsg_breakdown_get_string(4, &msgbd);
 
 	assert_equal (response_sig, (guchar *)msg_str, strlen(response_sig), FALSE);
+	assert_equal (response_sig,
+		      (guchar *) sipmsg_signature_input(signature_input, 4, msg,
+							"SIP Communications Service", "LOC-COMPANYT-FE03.COMPANY.COM",
+							NULL, NULL, NULL),
+		      strlen(response_sig) + 1, FALSE);
 
 	sipmsg_breakdown_free(&msgbd);
 	}
@@ -884,6 +905,8 @@ Message (length 352):
 
 	/* end tests from MS-SIPRE */
 
+	g_string_free(signature_input, TRUE);
+
 	printf ("\nFinished With Tests; %d successs %d failures\n", successes, failures);
 
 	sip_sec_destroy__ntlm();
@@ -0,0 +1,562 @@
+/**
+ * @file sip-transport-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Tests for the parallel DNS SRV & A autodiscovery
+ *
+ *  - connection attempts are started in service list order, a lower
+ *    priority candidate only after the stagger timeout
+ *  - no more than SIP_RESOLVE_MAX_ATTEMPTS attempts run in parallel
+ *  - a failed attempt triggers the next candidate, the first established
+ *    connection becomes the transport and drops everything else
+ *  - duplicates are dropped and the SIP domain is the last resort
+ *
+ * The backend DNS, transport & schedule functions record the requests,
+ * i.e. the tester answers queries and fires the timer explicitly.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "sip-transport.c"
+
+#include "sipe-mime.h"
+
+#define MAX_QUERIES  8
+#define MAX_ATTEMPTS 8
+
+/*
+ * Fake backend
+ */
+struct sipe_dns_query {
+	sipe_dns_resolved_cb callback;
+	gpointer data;
+	gchar *name;
+	guint port;
+	gboolean answered;
+	gboolean cancelled;
+};
+
+struct fake_connection {
+	struct sipe_transport_connection public;
+	transport_error_cb *error;
+	gchar *server_name;
+	guint server_port;
+	gboolean dropped;
+	gboolean disconnected;
+};
+
+static struct sipe_dns_query *queries[MAX_QUERIES];
+static guint query_count;
+static struct fake_connection *attempts[MAX_ATTEMPTS];
+static guint attempt_count;
+static sipe_schedule_action timer_action;
+static guint timer_mseconds;
+static guint connection_errors;
+/* backend answers queries synchronously */
+static gboolean synchronous_dns;
+/* backend reports errors for the next connection attempts synchronously */
+static guint synchronous_errors;
+
+static struct sipe_dns_query *fake_query(const gchar *name,
+					 guint port,
+					 sipe_dns_resolved_cb callback,
+					 gpointer data)
+{
+	struct sipe_dns_query *query = g_new0(struct sipe_dns_query, 1);
+
+	query->callback = callback;
+	query->data     = data;
+	query->name     = g_strdup(name);
+	query->port     = port;
+	if (query_count < MAX_QUERIES)
+		queries[query_count] = query;
+	query_count++;
+
+	if (synchronous_dns) {
+		query->answered = TRUE;
+		if (port)
+			callback(data, "192.0.2.1", port);
+		else
+			callback(data, name, 5061);
+		return(NULL);
+	}
+
+	return(query);
+}
+
+struct sipe_dns_query *sipe_backend_dns_query_srv(SIPE_UNUSED_PARAMETER struct sipe_core_public *sipe_public,
+						  const gchar *protocol,
+						  const gchar *transport,
+						  const gchar *domain,
+						  sipe_dns_resolved_cb callback,
+						  gpointer data)
+{
+	gchar *name = g_strdup_printf("_%s._%s.%s", protocol, transport, domain);
+	struct sipe_dns_query *query = fake_query(name, 0, callback, data);
+	g_free(name);
+	return(query);
+}
+
+struct sipe_dns_query *sipe_backend_dns_query_a(SIPE_UNUSED_PARAMETER struct sipe_core_public *sipe_public,
+						const gchar *hostname,
+						guint port,
+						sipe_dns_resolved_cb callback,
+						gpointer data)
+{
+	return(fake_query(hostname, port, callback, data));
+}
+
+void sipe_backend_dns_query_cancel(struct sipe_dns_query *query)
+{
+	query->cancelled = TRUE;
+}
+
+struct sipe_transport_connection *sipe_backend_transport_connect(SIPE_UNUSED_PARAMETER struct sipe_core_public *sipe_public,
+								 const sipe_connect_setup *setup)
+{
+	struct fake_connection *conn = g_new0(struct fake_connection, 1);
+
+	conn->public.user_data = setup->user_data;
+	conn->public.type      = setup->type;
+	conn->error            = setup->error;
+	conn->server_name      = g_strdup(setup->server_name);
+	conn->server_port      = setup->server_port;
+	if (attempt_count < MAX_ATTEMPTS)
+		attempts[attempt_count] = conn;
+	attempt_count++;
+
+	if (synchronous_errors) {
+		synchronous_errors--;
+		conn->dropped = TRUE;
+		setup->error(&conn->public, "synchronous error");
+	}
+
+	return(&conn->public);
+}
+
+void sipe_backend_transport_disconnect(struct sipe_transport_connection *conn)
+{
+	if (conn)
+		((struct fake_connection *) conn)->disconnected = TRUE;
+}
+
+gchar *sipe_backend_transport_ip_address(SIPE_UNUSED_PARAMETER struct sipe_transport_connection *conn) { return(g_strdup("192.0.2.10")); }
+void sipe_backend_transport_message(SIPE_UNUSED_PARAMETER struct sipe_transport_connection *conn,
+				    SIPE_UNUSED_PARAMETER const gchar *buffer) {}
+void sipe_backend_transport_flush(SIPE_UNUSED_PARAMETER struct sipe_transport_connection *conn) {}
+
+void sipe_schedule_mseconds(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			    SIPE_UNUSED_PARAMETER const gchar *name,
+			    SIPE_UNUSED_PARAMETER gpointer payload,
+			    guint milliseconds,
+			    sipe_schedule_action action,
+			    SIPE_UNUSED_PARAMETER GDestroyNotify destroy)
+{
+	timer_action   = action;
+	timer_mseconds = milliseconds;
+}
+
+void sipe_schedule_seconds(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			   SIPE_UNUSED_PARAMETER const gchar *name,
+			   SIPE_UNUSED_PARAMETER gpointer payload,
+			   SIPE_UNUSED_PARAMETER guint seconds,
+			   SIPE_UNUSED_PARAMETER sipe_schedule_action action,
+			   SIPE_UNUSED_PARAMETER GDestroyNotify destroy) {}
+
+void sipe_schedule_cancel(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			  const gchar *name)
+{
+	if (sipe_strequal(name, "<+sip-resolve>"))
+		timer_action = NULL;
+}
+
+void sipe_backend_connection_error(SIPE_UNUSED_PARAMETER struct sipe_core_public *sipe_public,
+				   SIPE_UNUSED_PARAMETER sipe_connection_error error,
+				   SIPE_UNUSED_PARAMETER const gchar *msg)
+{
+	connection_errors++;
+}
+
+/*
+ * Stubs
+ */
+gboolean sipe_backend_debug_enabled(void)
+{
+	return(FALSE);
+}
+
+void sipe_backend_debug_literal(SIPE_UNUSED_PARAMETER sipe_debug_level level,
+				SIPE_UNUSED_PARAMETER const gchar *msg)
+{
+}
+
+void sipe_backend_debug(SIPE_UNUSED_PARAMETER sipe_debug_level level,
+			SIPE_UNUSED_PARAMETER const gchar *format,
+			...)
+{
+}
+
+void sipe_backend_chat_rejoin_all(SIPE_UNUSED_PARAMETER struct sipe_core_public *sipe_public) {}
+void sipe_backend_connection_completed(SIPE_UNUSED_PARAMETER struct sipe_core_public *sipe_public) {}
+gboolean sipe_backend_connection_is_disconnecting(SIPE_UNUSED_PARAMETER struct sipe_core_public *sipe_public) { return(FALSE); }
+gchar *sipe_backend_markup_css_property(SIPE_UNUSED_PARAMETER const gchar *style,
+					SIPE_UNUSED_PARAMETER const gchar *option) { return(NULL); }
+void sipe_mime_parts_foreach(SIPE_UNUSED_PARAMETER const gchar *type,
+			     SIPE_UNUSED_PARAMETER const gchar *body,
+			     SIPE_UNUSED_PARAMETER sipe_mime_parts_cb callback,
+			     SIPE_UNUSED_PARAMETER gpointer user_data) {}
+
+void sipe_core_backend_initialized(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+				   SIPE_UNUSED_PARAMETER guint authentication) {}
+void sipe_core_connection_cleanup(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) {}
+const gchar *sipe_core_user_agent(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) { return("SIPE tests"); }
+
+void process_incoming_bye(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			  SIPE_UNUSED_PARAMETER struct sipmsg *msg) {}
+void process_incoming_cancel(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			     SIPE_UNUSED_PARAMETER struct sipmsg *msg) {}
+void process_incoming_info(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			   SIPE_UNUSED_PARAMETER struct sipmsg *msg) {}
+void process_incoming_invite(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			     SIPE_UNUSED_PARAMETER struct sipmsg *msg) {}
+void process_incoming_message(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			      SIPE_UNUSED_PARAMETER struct sipmsg *msg) {}
+void process_incoming_notify(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			     SIPE_UNUSED_PARAMETER struct sipmsg *msg) {}
+void process_incoming_options(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			      SIPE_UNUSED_PARAMETER struct sipmsg *msg) {}
+void process_incoming_refer(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			    SIPE_UNUSED_PARAMETER struct sipmsg *msg) {}
+
+SipSecContext sip_sec_create_context(SIPE_UNUSED_PARAMETER guint type,
+				     SIPE_UNUSED_PARAMETER gboolean sso,
+				     SIPE_UNUSED_PARAMETER gboolean http,
+				     SIPE_UNUSED_PARAMETER const gchar *username,
+				     SIPE_UNUSED_PARAMETER const gchar *password) { return(NULL); }
+gboolean sip_sec_init_context_step(SIPE_UNUSED_PARAMETER SipSecContext context,
+				   SIPE_UNUSED_PARAMETER const gchar *target,
+				   SIPE_UNUSED_PARAMETER const gchar *input_toked_base64,
+				   SIPE_UNUSED_PARAMETER gchar **output_toked_base64,
+				   SIPE_UNUSED_PARAMETER guint *expires) { return(FALSE); }
+gboolean sip_sec_context_is_ready(SIPE_UNUSED_PARAMETER SipSecContext context) { return(FALSE); }
+void sip_sec_destroy_context(SIPE_UNUSED_PARAMETER SipSecContext context) {}
+gchar *sip_sec_make_signature(SIPE_UNUSED_PARAMETER SipSecContext context,
+			      SIPE_UNUSED_PARAMETER const gchar *message) { return(NULL); }
+gboolean sip_sec_verify_signature(SIPE_UNUSED_PARAMETER SipSecContext context,
+				  SIPE_UNUSED_PARAMETER const gchar *message,
+				  SIPE_UNUSED_PARAMETER const gchar *signature_hex) { return(FALSE); }
+gboolean sip_sec_requires_password(SIPE_UNUSED_PARAMETER guint authentication,
+				   SIPE_UNUSED_PARAMETER gboolean sso) { return(FALSE); }
+gchar *sip_sec_digest_authorization(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+				    SIPE_UNUSED_PARAMETER const gchar *header,
+				    SIPE_UNUSED_PARAMETER const gchar *method,
+				    SIPE_UNUSED_PARAMETER const gchar *target) { return(NULL); }
+const gchar *sipmsg_signature_input(SIPE_UNUSED_PARAMETER GString *buffer,
+				    SIPE_UNUSED_PARAMETER int version,
+				    SIPE_UNUSED_PARAMETER const struct sipmsg *msg,
+				    SIPE_UNUSED_PARAMETER const gchar *realm,
+				    SIPE_UNUSED_PARAMETER const gchar *target,
+				    SIPE_UNUSED_PARAMETER const gchar *protocol,
+				    SIPE_UNUSED_PARAMETER const gchar *rand,
+				    SIPE_UNUSED_PARAMETER const gchar *num) { return(NULL); }
+
+gboolean sipe_certificate_init(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) { return(FALSE); }
+gpointer sipe_certificate_tls_dsk_find(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+				       SIPE_UNUSED_PARAMETER const gchar *target) { return(NULL); }
+gboolean sipe_certificate_tls_dsk_generate(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+					   SIPE_UNUSED_PARAMETER const gchar *target,
+					   SIPE_UNUSED_PARAMETER const gchar *uri) { return(FALSE); }
+GSList *sipe_lync_autodiscover_pop(SIPE_UNUSED_PARAMETER GSList *servers) { return(NULL); }
+void sipe_lync_autodiscover_start(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+				  SIPE_UNUSED_PARAMETER sipe_lync_autodiscover_callback *callback,
+				  SIPE_UNUSED_PARAMETER gpointer callback_data) {}
+gboolean sipe_lync_autodiscover_invalidate(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) { return(FALSE); }
+void sipe_subscription_self_events(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) {}
+
+char *generateUUIDfromEPID(SIPE_UNUSED_PARAMETER const gchar *epid) { return(NULL); }
+char *sipe_get_epid(SIPE_UNUSED_PARAMETER const char *self_sip_uri,
+		    SIPE_UNUSED_PARAMETER const char *hostname,
+		    SIPE_UNUSED_PARAMETER const char *ip_address) { return(NULL); }
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+static void check(gboolean ok, const gchar *test, const gchar *what)
+{
+	if (ok) {
+		succeeded++;
+	} else {
+		printf("%s FAILED: %s\n", test, what);
+		failed++;
+	}
+}
+
+static void check_attempt(const gchar *test,
+			  guint index,
+			  const gchar *server_name,
+			  guint server_port)
+{
+	struct fake_connection *conn = (index < attempt_count) ? attempts[index] : NULL;
+
+	if (conn &&
+	    sipe_strequal(conn->server_name, server_name) &&
+	    (conn->server_port == server_port)) {
+		succeeded++;
+	} else {
+		printf("%s FAILED: attempt %u expected '%s:%u' got '%s:%u'\n",
+		       test, index + 1, server_name, server_port,
+		       conn ? conn->server_name : "(none)",
+		       conn ? conn->server_port : 0);
+		failed++;
+	}
+}
+
+static void answer(guint index, const gchar *hostname, guint port)
+{
+	struct sipe_dns_query *query = queries[index];
+
+	query->answered = TRUE;
+	query->callback(query->data, hostname, port);
+}
+
+static void fire_timer(struct sipe_core_private *sipe_private)
+{
+	sipe_schedule_action action = timer_action;
+
+	timer_action = NULL;
+	if (action)
+		action(sipe_private, NULL);
+}
+
+/* backend reports connection error for attempt, i.e. drops it */
+static void connection_failed(guint index)
+{
+	struct fake_connection *conn = attempts[index];
+
+	conn->dropped = TRUE;
+	conn->error(&conn->public, "connection refused");
+}
+
+static struct sipe_core_private *setup(void)
+{
+	struct sipe_core_private *sipe_private = g_new0(struct sipe_core_private, 1);
+
+	sipe_private->public.sip_domain = g_strdup("contoso.com");
+	sipe_private->transport_type    = SIPE_TRANSPORT_TLS;
+
+	query_count       = 0;
+	attempt_count     = 0;
+	timer_action      = NULL;
+	connection_errors = 0;
+	synchronous_dns    = FALSE;
+	synchronous_errors = 0;
+
+	return(sipe_private);
+}
+
+static void teardown(const gchar *test, struct sipe_core_private *sipe_private)
+{
+	guint i;
+
+	sip_transport_disconnect(sipe_private);
+	check(!sipe_private->resolve && !timer_action,
+	      test, "resolver state left after disconnect");
+
+	/* the backend must not see requests for dropped objects */
+	for (i = 0; (i < query_count) && (i < MAX_QUERIES); i++) {
+		struct sipe_dns_query *query = queries[i];
+
+		check(!(query->answered && query->cancelled),
+		      test, "answered query cancelled");
+		check(query->answered || query->cancelled,
+		      test, "pending query leaked");
+		g_free(query->name);
+		g_free(query);
+	}
+	for (i = 0; (i < attempt_count) && (i < MAX_ATTEMPTS); i++) {
+		struct fake_connection *conn = attempts[i];
+
+		check(!(conn->dropped && conn->disconnected),
+		      test, "dropped connection disconnected");
+		check(conn->dropped || conn->disconnected,
+		      test, "connection leaked");
+		g_free(conn->server_name);
+		g_free(conn);
+	}
+
+	g_free(sipe_private->public.sip_domain);
+	g_free(sipe_private);
+}
+
+/* priority order, stagger timeout & parallel attempts limit */
+static void test_ordering(void)
+{
+	const gchar *test = "ordering";
+	struct sipe_core_private *sipe_private = setup();
+	struct sipe_transport_connection unknown;
+	struct fake_connection *winner;
+
+	sip_resolve_start(sipe_private, services[SIPE_TRANSPORT_TLS]);
+	check(query_count == 5, test, "not all queries issued at once");
+	check(sipe_strequal(queries[0]->name, "_sipinternaltls._tcp.contoso.com") &&
+	      sipe_strequal(queries[1]->name, "_sip._tls.contoso.com") &&
+	      sipe_strequal(queries[2]->name, "sipinternal.contoso.com") &&
+	      (queries[2]->port == 5061) &&
+	      sipe_strequal(queries[3]->name, "sipexternal.contoso.com") &&
+	      (queries[3]->port == 443) &&
+	      sipe_strequal(queries[4]->name, "sip.contoso.com") &&
+	      (queries[4]->port == 443),
+	      test, "unexpected query list");
+	check(attempt_count == 0, test, "connection attempt before answer");
+
+	/* lower priority answer must wait for the higher priority query... */
+	answer(1, "edge.contoso.com", 443);
+	check(attempt_count == 0, test, "lower priority candidate connected first");
+
+	/* ... which then gets its attempt immediately */
+	answer(0, "pool.contoso.com", 5061);
+	check_attempt(test, 0, "pool.contoso.com", 5061);
+	check(attempt_count == 1, test, "more than one attempt started");
+	check((timer_action != NULL) && (timer_mseconds == SIP_RESOLVE_STAGGER_MS),
+	      test, "stagger timer not armed");
+
+	/* stagger timeout: next candidate in parallel */
+	fire_timer(sipe_private);
+	check_attempt(test, 1, "edge.contoso.com", 443);
+	check(attempt_count == 2, test, "unexpected attempts after timeout");
+
+	/* A records keep the host name */
+	answer(2, "192.0.2.2", 5061);
+	check(attempt_count == 2, test, "attempt started without timeout");
+	fire_timer(sipe_private);
+	check_attempt(test, 2, "sipinternal.contoso.com", 5061);
+
+	/* limit reached: timeout doesn't start another attempt */
+	answer(3, "192.0.2.3", 443);
+	fire_timer(sipe_private);
+	check(attempt_count == SIP_RESOLVE_MAX_ATTEMPTS, test, "too many parallel attempts");
+
+	/* failed attempt makes room for the next candidate */
+	connection_failed(0);
+	check_attempt(test, 3, "sipexternal.contoso.com", 443);
+	check(connection_errors == 0, test, "error reported while candidates remain");
+
+	/* unknown connection isn't ours */
+	memset(&unknown, 0, sizeof(unknown));
+	check(!sip_resolve_failed(sipe_private, &unknown), test, "unknown connection accepted");
+
+	/* first established connection wins */
+	winner = attempts[1];
+	sip_resolve_winner(sipe_private, &winner->public);
+	check(sipe_private->transport &&
+	      (sipe_private->transport->connection == &winner->public) &&
+	      sipe_strequal(sipe_private->transport->server_name, "edge.contoso.com"),
+	      test, "winner isn't the transport");
+	check(!sipe_private->resolve, test, "resolver not dropped");
+	check(!winner->disconnected &&
+	      attempts[2]->disconnected &&
+	      attempts[3]->disconnected,
+	      test, "losing attempts not disconnected");
+	check(queries[4]->cancelled, test, "pending query not cancelled");
+	check(!timer_action, test, "stagger timer not cancelled");
+
+	teardown(test, sipe_private);
+}
+
+/* duplicates are dropped, SIP domain is the last resort */
+static void test_fallback(void)
+{
+	const gchar *test = "fallback";
+	struct sipe_core_private *sipe_private = setup();
+
+	sip_resolve_start(sipe_private, services[SIPE_TRANSPORT_TLS]);
+	answer(0, "pool.contoso.com", 5061);
+	answer(1, "POOL.contoso.com", 5061);
+	answer(2, NULL, 0);
+	answer(3, NULL, 0);
+	answer(4, NULL, 0);
+	fire_timer(sipe_private);
+	check(attempt_count == 1, test, "duplicate host connected");
+
+	/* all candidates failed */
+	connection_failed(0);
+	check(!sipe_private->resolve, test, "resolver not dropped");
+	check_attempt(test, 1, "contoso.com", 5061);
+	check(sipe_private->transport &&
+	      (sipe_private->transport->connection == &attempts[1]->public),
+	      test, "fallback isn't the transport");
+	check(connection_errors == 0, test, "error reported before fallback");
+
+	/* fallback failure is reported to the user, i.e. it isn't dropped */
+	attempts[1]->error(&attempts[1]->public, "connection refused");
+	check(connection_errors == 1, test, "fallback failure not reported");
+
+	teardown(test, sipe_private);
+}
+
+/* backend answers & fails from inside the request */
+static void test_synchronous(void)
+{
+	const gchar *test = "synchronous";
+	struct sipe_core_private *sipe_private = setup();
+
+	synchronous_dns    = TRUE;
+	synchronous_errors = 1;
+	sip_resolve_start(sipe_private, services[SIPE_TRANSPORT_TLS]);
+	check(query_count == 5, test, "not all queries issued");
+	check_attempt(test, 0, "_sipinternaltls._tcp.contoso.com", 5061);
+	check_attempt(test, 1, "_sip._tls.contoso.com", 5061);
+	check(attempt_count == 2, test, "unexpected attempts");
+	check(sipe_private->resolve && !sipe_private->transport,
+	      test, "failed attempt became the transport");
+	check(connection_errors == 0, test, "synchronous error reported");
+
+	/* later failure continues with the A records */
+	connection_failed(1);
+	check_attempt(test, 2, "sipinternal.contoso.com", 5061);
+
+	teardown(test, sipe_private);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
+{
+	test_ordering();
+	test_fallback();
+	test_synchronous();
+
+	printf("Result: %d PASSED %d FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
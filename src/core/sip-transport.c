@@ -72,6 +72,7 @@
 #include "sipe-core-private.h"
 #include "sipe-certificate.h"
 #include "sipe-dialog.h"
+#include "sipe-framer.h"
 #include "sipe-incoming.h"
 #include "sipe-lync-autodiscover.h"
 #include "sipe-nls.h"
@@ -111,7 +112,10 @@ struct sip_transport {
 	gchar *uri_address;   	     /* URI X.X.X.X (IPv4), [X:X:...:X] (IPv6) */
 	const gchar *sdp_marker;     /* SDP address marker: "IP4" or "IP6"     */
 
-	GSList *transactions;
+	GHashTable *transactions; /* struct transaction_key -> transaction */
+	GString *output;          /* reusable buffer for outgoing messages */
+	GString *signature_input; /* reusable buffer for message signing */
+	struct sipe_framer *framer; /* splits input stream into messages */
 
 	struct sip_auth registrar;
 	struct sip_auth proxy;
@@ -169,26 +173,31 @@ static void sipe_make_signature(struct sipe_core_private *sipe_private,
 {
 	struct sip_transport *transport = sipe_private->transport;
 	if (sip_sec_context_is_ready(transport->registrar.gssapi_context)) {
-		struct sipmsg_breakdown msgbd;
-		gchar *signature_input_str;
-		msgbd.msg = msg;
-		sipmsg_breakdown_parse(&msgbd, transport->registrar.realm, transport->registrar.target,
-				       transport->registrar.protocol);
-		msgbd.rand = g_strdup_printf("%08x", g_random_int());
+		const gchar *signature_input_str;
+		gchar rand_str[9];
+		gchar num_str[12];
+
+		g_snprintf(rand_str, sizeof(rand_str), "%08x", g_random_int());
 		transport->registrar.ntlm_num++;
-		msgbd.num = g_strdup_printf("%d", transport->registrar.ntlm_num);
-		signature_input_str = sipmsg_breakdown_get_string(transport->registrar.version, &msgbd);
+		g_snprintf(num_str, sizeof(num_str), "%d", transport->registrar.ntlm_num);
+
+		signature_input_str = sipmsg_signature_input(transport->signature_input,
+							     transport->registrar.version,
+							     msg,
+							     transport->registrar.realm,
+							     transport->registrar.target,
+							     transport->registrar.protocol,
+							     rand_str,
+							     num_str);
 		if (signature_input_str != NULL) {
 			char *signature_hex = sip_sec_make_signature(transport->registrar.gssapi_context, signature_input_str);
 			g_free(msg->signature);
 			msg->signature = signature_hex;
 			g_free(msg->rand);
-			msg->rand = g_strdup(msgbd.rand);
+			msg->rand = g_strdup(rand_str);
 			g_free(msg->num);
-			msg->num = g_strdup(msgbd.num);
-			g_free(signature_input_str);
+			msg->num = g_strdup(num_str);
 		}
-		sipmsg_breakdown_free(&msgbd);
 	}
 }
 
@@ -507,6 +516,16 @@ static void send_sip_message(struct sip_transport *transport,
 	sipe_backend_transport_message(transport->connection, string);
 }
 
+/* serializes structured SIP message into reusable buffer and sends it */
+static void send_sipmsg(struct sip_transport *transport,
+			const struct sipmsg *msg)
+{
+	if (!transport->output)
+		transport->output = g_string_sized_new(2048);
+	sipmsg_serialize(msg, transport->output);
+	send_sip_message(transport, transport->output->str);
+}
+
 static void start_keepalive_timer(struct sipe_core_private *sipe_private,
 				  guint seconds);
 static void keepalive_timeout(struct sipe_core_private *sipe_private,
@@ -588,14 +607,88 @@ void sip_transport_response(struct sipe_core_private *sipe_private,
 	g_string_free(outstr, TRUE);
 }
 
+/*
+ * Transaction key: (Call-ID, CSeq number, CSeq method)
+ *
+ * Strings are compared case insensitive, i.e. the same as the old
+ * "<Call-ID><CSeq>" string compare, but the CSeq is normalized.
+ * Strings point into the header values of the SIP message.
+ */
+struct transaction_key {
+	const gchar *call_id;
+	gsize call_id_length;
+	const gchar *method;
+	gsize method_length;
+	guint cseq;
+};
+
+static gboolean transaction_key_from_msg(struct transaction_key *key,
+					 const struct sipmsg *msg)
+{
+	const gchar *call_id = sipmsg_find_header_id(msg, SIPMSG_HEADER_CALL_ID);
+	const gchar *cseq = sipmsg_find_header_id(msg, SIPMSG_HEADER_CSEQ);
+	gchar *method;
+
+	if (!call_id || !cseq)
+		return(FALSE);
+
+	key->call_id        = call_id;
+	key->call_id_length = strlen(call_id);
+	key->cseq           = strtoul(cseq, &method, 10);
+	while ((*method == ' ') || (*method == '\t'))
+		method++;
+	key->method         = method;
+	key->method_length  = strlen(method);
+	while (key->method_length &&
+	       ((method[key->method_length - 1] == ' ') ||
+		(method[key->method_length - 1] == '\t')))
+		key->method_length--;
+
+	return(TRUE);
+}
+
+static guint transaction_key_hash(gconstpointer data)
+{
+	const struct transaction_key *key = data;
+	guint hash = key->cseq;
+	gsize i;
+
+	for (i = 0; i < key->call_id_length; i++)
+		hash = (hash << 5) + hash + g_ascii_tolower(key->call_id[i]);
+	for (i = 0; i < key->method_length; i++)
+		hash = (hash << 5) + hash + g_ascii_tolower(key->method[i]);
+
+	return(hash);
+}
+
+static gboolean transaction_key_equal(gconstpointer a, gconstpointer b)
+{
+	const struct transaction_key *key1 = a;
+	const struct transaction_key *key2 = b;
+
+	return((key1->cseq           == key2->cseq)           &&
+	       (key1->call_id_length == key2->call_id_length) &&
+	       (key1->method_length  == key2->method_length)  &&
+	       (g_ascii_strncasecmp(key1->call_id,
+				    key2->call_id,
+				    key1->call_id_length) == 0)        &&
+	       (g_ascii_strncasecmp(key1->method,
+				    key2->method,
+				    key1->method_length) == 0));
+}
+
 static void transactions_remove(struct sipe_core_private *sipe_private,
 				struct transaction *trans)
 {
 	struct sip_transport *transport = sipe_private->transport;
-	if (transport->transactions) {
-		transport->transactions = g_slist_remove(transport->transactions,
-							 trans);
-		SIPE_DEBUG_INFO("SIP transactions count:%d after removal", g_slist_length(transport->transactions));
+	if (g_hash_table_size(transport->transactions)) {
+		struct transaction_key key;
+
+		if (transaction_key_from_msg(&key, trans->msg) &&
+		    (g_hash_table_lookup(transport->transactions, &key) == trans))
+			g_hash_table_remove(transport->transactions, &key);
+		SIPE_DEBUG_INFO("SIP transactions count:%d after removal",
+				g_hash_table_size(transport->transactions));
 
 		if (trans->msg) sipmsg_free(trans->msg);
 		if (trans->payload) {
@@ -612,31 +705,40 @@ static void transactions_remove(struct sipe_core_private *sipe_private,
 	}
 }
 
+static void transactions_add(struct sipe_core_private *sipe_private,
+			     struct transaction *trans)
+{
+	struct sip_transport *transport = sipe_private->transport;
+	struct transaction_key *key = g_new(struct transaction_key, 1);
+	struct transaction *old;
+
+	/* key points into headers of trans->msg */
+	transaction_key_from_msg(key, trans->msg);
+
+	/* SHOULD NOT HAPPEN: Call-ID & CSeq are unique per request */
+	old = g_hash_table_lookup(transport->transactions, key);
+	if (old) {
+		SIPE_DEBUG_ERROR("transactions_add: dropping old transaction with same key %s",
+				 old->key);
+		transactions_remove(sipe_private, old);
+	}
+
+	g_hash_table_insert(transport->transactions, key, trans);
+	SIPE_DEBUG_INFO("SIP transactions count:%d after addition",
+			g_hash_table_size(transport->transactions));
+}
+
 static struct transaction *transactions_find(struct sip_transport *transport,
 					     struct sipmsg *msg)
 {
-	GSList *transactions = transport->transactions;
-	const gchar *call_id = sipmsg_find_header(msg, "Call-ID");
-	const gchar *cseq = sipmsg_find_header(msg, "CSeq");
-	gchar *key;
+	struct transaction_key key;
 
-	if (!call_id || !cseq) {
+	if (!transaction_key_from_msg(&key, msg)) {
 		SIPE_DEBUG_ERROR_NOFORMAT("transaction_find: no Call-ID or CSeq!");
 		return NULL;
 	}
 
-	key = g_strdup_printf("<%s><%s>", call_id, cseq);
-	while (transactions) {
-		struct transaction *trans = transactions->data;
-		if (!g_ascii_strcasecmp(trans->key, key)) {
-			g_free(key);
-			return trans;
-		}
-		transactions = transactions->next;
-	}
-	g_free(key);
-
-	return NULL;
+	return(g_hash_table_lookup(transport->transactions, &key));
 }
 
 static void transaction_timeout_cb(struct sipe_core_private *sipe_private,
@@ -659,31 +761,16 @@ struct transaction *sip_transport_request_timeout(struct sipe_core_private *sipe
 						  TransCallback timeout_callback)
 {
 	struct sip_transport *transport = sipe_private->transport;
-	char *buf;
 	struct sipmsg *msg;
 	gchar *ourtag     = dialog && dialog->ourtag    ? g_strdup(dialog->ourtag)    : NULL;
-	gchar *theirtag   = dialog && dialog->theirtag  ? g_strdup(dialog->theirtag)  : NULL;
-	gchar *theirepid  = dialog && dialog->theirepid ? g_strdup(dialog->theirepid) : NULL;
+	const gchar *theirtag  = dialog ? dialog->theirtag  : NULL;
+	const gchar *theirepid = dialog ? dialog->theirepid : NULL;
 	gchar *callid     = dialog && dialog->callid    ? g_strdup(dialog->callid)    : gencallid();
 	gchar *branch     = dialog && dialog->callid    ? NULL : genbranch();
-	gchar *route      = g_strdup("");
 	const gchar *epid = transport->epid;
 	int cseq          = dialog ? ++dialog->cseq : 1 /* as Call-Id is new in this case */;
 	struct transaction *trans = NULL;
 
-	if (dialog && dialog->routes)
-	{
-		GSList *iter = dialog->routes;
-
-		while(iter)
-		{
-			char *tmp = route;
-			route = g_strdup_printf("%sRoute: %s\r\n", route, (char *)iter->data);
-			g_free(tmp);
-			iter = g_slist_next(iter);
-		}
-	}
-
 	if (!ourtag && !dialog) {
 		ourtag = gentag();
 	}
@@ -698,59 +785,48 @@ struct transaction *sip_transport_request_timeout(struct sipe_core_private *sipe
 		cseq = ++transport->cseq;
 	}
 
-	buf = g_strdup_printf("%s %s SIP/2.0\r\n"
-			"Via: SIP/2.0/%s %s:%d%s%s\r\n"
-			"From: <sip:%s>%s%s;epid=%s\r\n"
-			"To: <%s>%s%s%s%s\r\n"
-			"Max-Forwards: 70\r\n"
-			"CSeq: %d %s\r\n"
-			"User-Agent: %s\r\n"
-			"Call-ID: %s\r\n"
-			"%s%s"
-			"Content-Length: %" G_GSIZE_FORMAT "\r\n\r\n%s",
-			method,
-			dialog && dialog->request ? dialog->request : url,
-			TRANSPORT_DESCRIPTOR,
-			transport->uri_address,
-			transport->connection->client_port,
-			branch ? ";branch=" : "",
-			branch ? branch : "",
-			sipe_private->username,
-			ourtag ? ";tag=" : "",
-			ourtag ? ourtag : "",
-			epid,
-			to,
-			theirtag ? ";tag=" : "",
-			theirtag ? theirtag : "",
-			theirepid ? ";epid=" : "",
-			theirepid ? theirepid : "",
-			cseq,
-			method,
-			sipe_core_user_agent(sipe_private),
-			callid,
-			route,
-			addheaders ? addheaders : "",
-			body ? (gsize) strlen(body) : 0,
-			body ? body : "");
-
-
-	//printf ("parsing msg buf:\n%s\n\n", buf);
-	msg = sipmsg_parse_msg(buf);
-
-	g_free(buf);
+	/* build request directly, i.e. without formatting & parsing it */
+	msg = sipmsg_new_request(method,
+				 dialog && dialog->request ? dialog->request : url);
+	sipmsg_add_header_printf_now(msg, "Via", "SIP/2.0/%s %s:%d%s%s",
+				     TRANSPORT_DESCRIPTOR,
+				     transport->uri_address,
+				     transport->connection->client_port,
+				     branch ? ";branch=" : "",
+				     branch ? branch : "");
+	sipmsg_add_header_printf_now(msg, "From", "<sip:%s>%s%s;epid=%s",
+				     sipe_private->username,
+				     ourtag ? ";tag=" : "",
+				     ourtag ? ourtag : "",
+				     epid);
+	sipmsg_add_header_printf_now(msg, "To", "<%s>%s%s%s%s",
+				     to,
+				     theirtag ? ";tag=" : "",
+				     theirtag ? theirtag : "",
+				     theirepid ? ";epid=" : "",
+				     theirepid ? theirepid : "");
+	sipmsg_add_header_now(msg, "Max-Forwards", "70");
+	sipmsg_add_header_printf_now(msg, "CSeq", "%d %s", cseq, method);
+	sipmsg_add_header_now(msg, "User-Agent", sipe_core_user_agent(sipe_private));
+	sipmsg_add_header_now(msg, "Call-ID", callid);
+	if (dialog) {
+		GSList *iter;
+		for (iter = dialog->routes; iter; iter = iter->next)
+			sipmsg_add_header_now(msg, "Route", iter->data);
+	}
+	sipmsg_add_header_lines_now(msg, addheaders);
+	sipmsg_set_body(msg, body);
+	sipmsg_add_header_printf_now(msg, "Content-Length",
+				     "%d", msg->bodylen);
+
 	g_free(ourtag);
-	g_free(theirtag);
-	g_free(theirepid);
 	g_free(branch);
-	g_free(route);
 
 	sign_outgoing_message(sipe_private, msg);
 
 	/* The authentication scheme is not ready so we can't send the message.
 	   This should only happen for REGISTER messages. */
 	if (!transport->auth_incomplete) {
-		buf = sipmsg_to_string(msg);
-
 		/* add to ongoing transactions */
 		/* ACK isn't supposed to be answered ever. So we do not keep transaction for it. */
 		if (!sipe_strequal(method, "ACK")) {
@@ -768,13 +844,10 @@ struct transaction *sip_transport_request_timeout(struct sipe_core_private *sipe
 						      transaction_timeout_cb,
 						      NULL);
 			}
-			transport->transactions = g_slist_append(transport->transactions,
-								 trans);
-			SIPE_DEBUG_INFO("SIP transactions count:%d after addition", g_slist_length(transport->transactions));
+			transactions_add(sipe_private, trans);
 		}
 
-		send_sip_message(transport, buf);
-		g_free(buf);
+		send_sipmsg(transport, msg);
 	}
 
 	if (!trans) sipmsg_free(msg);
@@ -877,21 +950,21 @@ struct transaction *sip_transport_service(struct sipe_core_private *sipe_private
 				     callback);
 }
 
-void sip_transport_subscribe(struct sipe_core_private *sipe_private,
-			     const gchar *uri,
-			     const gchar *addheaders,
-			     const gchar *body,
-			     struct sip_dialog *dialog,
-			     TransCallback callback)
+struct transaction *sip_transport_subscribe(struct sipe_core_private *sipe_private,
+					    const gchar *uri,
+					    const gchar *addheaders,
+					    const gchar *body,
+					    struct sip_dialog *dialog,
+					    TransCallback callback)
 {
-	sip_transport_request(sipe_private,
-			      "SUBSCRIBE",
-			      uri,
-			      uri,
-			      addheaders,
-			      body,
-			      dialog,
-			      callback);
+	return(sip_transport_request(sipe_private,
+				     "SUBSCRIBE",
+				     uri,
+				     uri,
+				     addheaders,
+				     body,
+				     dialog,
+				     callback));
 }
 
 void sip_transport_update(struct sipe_core_private *sipe_private,
@@ -1436,6 +1509,36 @@ void sip_transport_deregister(struct sipe_core_private *sipe_private)
 	do_register(sipe_private, TRUE);
 }
 
+/* NOTE: doesn't drop the backend connection */
+static void sip_transport_free(struct sipe_core_private *sipe_private,
+			       struct sip_transport *transport)
+{
+	sipe_auth_free(&transport->registrar);
+	sipe_auth_free(&transport->proxy);
+
+	g_free(transport->server_name);
+	g_free(transport->uri_address);
+	g_free(transport->ip_address);
+	g_free(transport->epid);
+	if (transport->output)
+		g_string_free(transport->output, TRUE);
+	g_string_free(transport->signature_input, TRUE);
+	sipe_framer_free(transport->framer);
+
+	if (transport->transactions) {
+		GList *transactions = g_hash_table_get_values(transport->transactions);
+		GList *entry;
+
+		for (entry = transactions; entry; entry = entry->next)
+			transactions_remove(sipe_private, entry->data);
+		g_list_free(transactions);
+		g_hash_table_destroy(transport->transactions);
+	}
+
+	g_free(transport);
+}
+
+static void sip_resolve_free(struct sipe_core_private *sipe_private);
 void sip_transport_disconnect(struct sipe_core_private *sipe_private)
 {
 	struct sip_transport *transport = sipe_private->transport;
@@ -1448,31 +1551,15 @@ void sip_transport_disconnect(struct sipe_core_private *sipe_private)
 			      transport->connection);
 
 		sipe_backend_transport_disconnect(transport->connection);
-
-		sipe_auth_free(&transport->registrar);
-		sipe_auth_free(&transport->proxy);
-
-		g_free(transport->server_name);
-		g_free(transport->uri_address);
-		g_free(transport->ip_address);
-		g_free(transport->epid);
-
-		while (transport->transactions)
-			transactions_remove(sipe_private,
-					    transport->transactions->data);
-
-		g_free(transport);
+		sip_transport_free(sipe_private, transport);
 	}
 
-	sipe_private->transport    = NULL;
-	sipe_private->service_data = NULL;
-	sipe_private->address_data = NULL;
+	sipe_private->transport = NULL;
 
 	sipe_schedule_cancel(sipe_private, "<+keepalive-timeout>");
 
-	if (sipe_private->dns_query)
-		sipe_backend_dns_query_cancel(sipe_private->dns_query);
-
+	/* drop pending DNS queries & connection attempts */
+	sip_resolve_free(sipe_private);
 }
 
 void sip_transport_authentication_completed(struct sipe_core_private *sipe_private)
@@ -1546,8 +1633,6 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 					transport->registrar.retries++;
 					SIPE_DEBUG_INFO("process_input_message: RE-REGISTER CSeq: %d", transport->cseq);
 				} else {
-					gchar *resend;
-
 					/* Are we registered? */
 					if (transport->reregister_set) {
 						SIPE_DEBUG_INFO_NOFORMAT("process_input_message: 401 response to non-REGISTER message. Retrying with new authentication.");
@@ -1564,9 +1649,7 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 					}
 
 					/* Resend request */
-					resend = sipmsg_to_string(trans->msg);
-					send_sip_message(sipe_private->transport, resend);
-					g_free(resend);
+					send_sipmsg(sipe_private->transport, trans->msg);
 
 					/* Transaction not yet completed */
 					trans = NULL;
@@ -1604,17 +1687,13 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 						}
 
 						if (auth) {
-							gchar *resend;
-
 							/* replace old proxy authentication with new one */
 							sipmsg_remove_header_now(trans->msg, "Proxy-Authorization");
 							sipmsg_add_header_now(trans->msg, "Proxy-Authorization", auth);
 							g_free(auth);
 
 							/* resend request with proxy authentication */
-							resend = sipmsg_to_string(trans->msg);
-							send_sip_message(sipe_private->transport, resend);
-							g_free(resend);
+							send_sipmsg(sipe_private->transport, trans->msg);
 
 							/* Transaction not yet completed */
 							trans = NULL;
@@ -1644,7 +1723,7 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 				 * Redirect case: sipe_private->transport is
 				 * the new transport with empty queue
 				 */
-				if (sipe_private->transport->transactions) {
+				if (g_hash_table_size(sipe_private->transport->transactions)) {
 					SIPE_DEBUG_INFO("process_input_message: removing CSeq %d", transport->cseq);
 					transactions_remove(sipe_private, trans);
 				}
@@ -1664,51 +1743,12 @@ static void sip_transport_input(struct sipe_transport_connection *conn)
 {
 	struct sipe_core_private *sipe_private = conn->user_data;
 	struct sip_transport *transport = sipe_private->transport;
-	gchar *cur = conn->buffer;
-
-	/* according to the RFC remove CRLF at the beginning */
-	while (*cur == '\r' || *cur == '\n') {
-		cur++;
-	}
-	if (cur != conn->buffer)
-		sipe_utils_shrink_buffer(conn, cur);
+	struct sipmsg *msg;
 
-	/* Received a full Header? */
+	/* Received a full message? */
 	transport->processing_input = TRUE;
 	while (transport->processing_input &&
-	       ((cur = strstr(conn->buffer, "\r\n\r\n")) != NULL)) {
-		struct sipmsg *msg;
-		guint remainder;
-
-		cur += 2;
-		cur[0] = '\0';
-		msg = sipmsg_parse_header(conn->buffer);
-
-		cur += 2;
-		remainder = conn->buffer_used - (cur - conn->buffer);
-		if (msg && remainder >= (guint) msg->bodylen) {
-			char *dummy = g_malloc(msg->bodylen + 1);
-			memcpy(dummy, cur, msg->bodylen);
-			dummy[msg->bodylen] = '\0';
-			msg->body = dummy;
-			cur += msg->bodylen;
-			sipe_utils_message_debug(conn,
-						 "SIP",
-						 conn->buffer,
-						 msg->body,
-						 FALSE);
-			sipe_utils_shrink_buffer(conn, cur);
-		} else {
-			if (msg) {
-				SIPE_DEBUG_INFO("sipe_transport_input: body too short (%d < %d, strlen %d) - ignoring message", remainder, msg->bodylen, (int)strlen(conn->buffer));
-				sipmsg_free(msg);
-                        }
-
-			/* restore header for next try */
-			cur[-2] = '\r';
-			return;
-		}
-
+	       ((msg = sipe_framer_next(transport->framer, conn)) != NULL)) {
 		/* Fatal header parse error? */
 		if (msg->response == SIPMSG_RESPONSE_FATAL_ERROR) {
 			/* can't proceed -> drop connection */
@@ -1719,13 +1759,17 @@ static void sip_transport_input(struct sipe_transport_connection *conn)
 
 		/* Verify the signature before processing it */
 		} else if (sip_sec_context_is_ready(transport->registrar.gssapi_context)) {
-			struct sipmsg_breakdown msgbd;
-			gchar *signature_input_str;
+			const gchar *signature_input_str;
 			gchar *rspauth;
-			msgbd.msg = msg;
-			sipmsg_breakdown_parse(&msgbd, transport->registrar.realm, transport->registrar.target,
-					       transport->registrar.protocol);
-			signature_input_str = sipmsg_breakdown_get_string(transport->registrar.version, &msgbd);
+
+			signature_input_str = sipmsg_signature_input(transport->signature_input,
+								     transport->registrar.version,
+								     msg,
+								     transport->registrar.realm,
+								     transport->registrar.target,
+								     transport->registrar.protocol,
+								     NULL,
+								     NULL);
 
 			rspauth = sipmsg_find_part_of_header(sipmsg_find_header(msg, "Authentication-Info"), "rspauth=\"", "\"", NULL);
 
@@ -1756,10 +1800,8 @@ static void sip_transport_input(struct sipe_transport_connection *conn)
 				}
 				SIPE_DEBUG_INFO_NOFORMAT("sip_transport_input: message without authentication data - ignoring");
 			}
-			g_free(signature_input_str);
 
 			g_free(rspauth);
-			sipmsg_breakdown_free(&msgbd);
 		} else {
 			process_input_message(sipe_private, msg);
 		}
@@ -1772,11 +1814,20 @@ static void sip_transport_input(struct sipe_transport_connection *conn)
 	}
 }
 
+static void sip_resolve_winner(struct sipe_core_private *sipe_private,
+			       struct sipe_transport_connection *conn);
 static void sip_transport_connected(struct sipe_transport_connection *conn)
 {
 	struct sipe_core_private *sipe_private = conn->user_data;
-	struct sip_transport *transport = sipe_private->transport;
-	gchar *self_sip_uri = sip_uri_self(sipe_private);
+	struct sip_transport *transport;
+	gchar *self_sip_uri;
+
+	/* first established connection wins the race */
+	if (sipe_private->resolve)
+		sip_resolve_winner(sipe_private, conn);
+
+	transport    = sipe_private->transport;
+	self_sip_uri = sip_uri_self(sipe_private);
 
 	SIPE_LOG_INFO("sip_transport_connected: %s:%u(%p)",
 		      transport->server_name, transport->server_port, conn);
@@ -1785,9 +1836,6 @@ static void sip_transport_connected(struct sipe_transport_connection *conn)
 		sipe_private->lync_autodiscover_servers =
 			sipe_lync_autodiscover_pop(sipe_private->lync_autodiscover_servers);
 
-	sipe_private->service_data = NULL;
-	sipe_private->address_data = NULL;
-
 	/*
 	 * Initial keepalive timeout during REGISTER phase
 	 *
@@ -1812,24 +1860,19 @@ static void sip_transport_connected(struct sipe_transport_connection *conn)
 }
 
 static void resolve_next_lync(struct sipe_core_private *sipe_private);
-static void resolve_next_service(struct sipe_core_private *sipe_private,
-				 const struct sip_service_data *start);
-static void resolve_next_address(struct sipe_core_private *sipe_private,
-				 gboolean initial);
+static gboolean sip_resolve_failed(struct sipe_core_private *sipe_private,
+				   struct sipe_transport_connection *conn);
 static void sip_transport_error(struct sipe_transport_connection *conn,
 				const gchar *msg)
 {
 	struct sipe_core_private *sipe_private = conn->user_data;
 
+	/* This failed attempt was based on a DNS SRV or A record */
+	if (sip_resolve_failed(sipe_private, conn)) {
+		/* next attempt has already been triggered */
 	/* This failed attempt was based on a Lync Autodiscover result */
-	if (sipe_private->lync_autodiscover_servers) {
+	} else if (sipe_private->lync_autodiscover_servers) {
 		resolve_next_lync(sipe_private);
-	/* This failed attempt was based on a DNS SRV record */
-	} else if (sipe_private->service_data) {
-		resolve_next_service(sipe_private, NULL);
-	/* This failed attempt was based on a DNS A record */
-	} else if (sipe_private->address_data) {
-		resolve_next_address(sipe_private, FALSE);
 	} else {
 		sipe_backend_connection_error(SIPE_CORE_PUBLIC,
 					      SIPE_CONNECTION_ERROR_NETWORK,
@@ -1838,10 +1881,10 @@ static void sip_transport_error(struct sipe_transport_connection *conn,
 }
 
 /* server_name must be g_alloc()'ed */
-static void sipe_server_register(struct sipe_core_private *sipe_private,
-				 guint type,
-				 gchar *server_name,
-				 guint server_port)
+static struct sip_transport *sip_transport_new(struct sipe_core_private *sipe_private,
+					       guint type,
+					       gchar *server_name,
+					       guint server_port)
 {
 	sipe_connect_setup setup = {
 		type,
@@ -1856,11 +1899,29 @@ static void sipe_server_register(struct sipe_core_private *sipe_private,
 	struct sip_transport *transport = g_new0(struct sip_transport, 1);
 
 	transport->auth_retry   = TRUE;
+	transport->transactions = g_hash_table_new_full(transaction_key_hash,
+							transaction_key_equal,
+							g_free,
+							NULL);
+	transport->framer       = sipe_framer_new("SIP");
+	transport->signature_input = g_string_sized_new(512);
 	transport->server_name  = server_name;
 	transport->server_port  = setup.server_port;
 	transport->connection   = sipe_backend_transport_connect(SIPE_CORE_PUBLIC,
 								 &setup);
-	sipe_private->transport = transport;
+	return(transport);
+}
+
+/* server_name must be g_alloc()'ed */
+static void sipe_server_register(struct sipe_core_private *sipe_private,
+				 guint type,
+				 gchar *server_name,
+				 guint server_port)
+{
+	sipe_private->transport = sip_transport_new(sipe_private,
+						    type,
+						    server_name,
+						    server_port);
 }
 
 struct sip_service_data {
@@ -1915,10 +1976,9 @@ static const struct sip_address_data addresses[] = {
 	{ "sipinternal", 5061 },
 	{ "sipexternal",  443 },
 /*
- * Our implementation supports only one port per host name. If the host name
- * resolves OK, we abort the search and try to connect. If we would know if we
- * are trying to connect from "Intranet" or "Internet" then we could choose
- * between those two ports.
+ * Our implementation supports only one port per host name. If we would know
+ * if we are trying to connect from "Intranet" or "Internet" then we could
+ * choose between those two ports.
  *
  * We drop port 5061 in order to cover the "Internet" case.
  *
@@ -1928,135 +1988,408 @@ static const struct sip_address_data addresses[] = {
 	{ NULL,             0 }
 };
 
-static void sipe_core_dns_resolved(struct sipe_core_public *sipe_public,
-				   const gchar *hostname, guint port)
+/*
+ * Parallel autodiscovery
+ *
+ * All DNS SRV & A queries are issued at once. Connection attempts are
+ * started in priority order, i.e. SRV records in the order of the service
+ * list followed by the A records. When a higher priority query hasn't
+ * answered yet or the started connection attempt hasn't completed after
+ * SIP_RESOLVE_STAGGER_MS, the next resolved candidate gets its connection
+ * attempt in parallel. The first established connection wins and all
+ * other queries & attempts are dropped.
+ */
+#ifndef SIP_RESOLVE_STAGGER_MS
+#define SIP_RESOLVE_STAGGER_MS   250
+#endif
+#ifndef SIP_RESOLVE_MAX_ATTEMPTS
+#define SIP_RESOLVE_MAX_ATTEMPTS   3
+#endif
+
+#define SIP_RESOLVE_PENDING    0
+#define SIP_RESOLVE_RESOLVED   1
+#define SIP_RESOLVE_CONNECTING 2
+#define SIP_RESOLVE_FAILED     3
+
+struct sip_resolve_candidate {
+	struct sip_resolve *resolve;
+	struct sipe_dns_query *query;
+	struct sip_transport *transport;
+	gchar *hostname;
+	guint port;
+	guint type;
+	guint state;
+	gboolean srv;
+};
+
+struct sip_resolve {
+	struct sipe_core_private *sipe_private;
+	struct sip_resolve_candidate *candidates;
+	guint count;
+	gboolean starting;       /* suppress advance while queries are issued */
+	gboolean connecting;     /* inside sipe_backend_transport_connect() */
+	gboolean connect_failed; /* synchronous connection error */
+	gboolean timer_armed;
+	gboolean waited;         /* stagger timeout expired */
+};
+
+static void sip_resolve_free(struct sipe_core_private *sipe_private)
 {
-	struct sipe_core_private *sipe_private = SIPE_CORE_PRIVATE;
-	gboolean service = sipe_private->service_data != NULL;
+	struct sip_resolve *resolve = sipe_private->resolve;
+	guint i;
 
-	sipe_private->dns_query = NULL;
+	if (!resolve)
+		return;
+	sipe_private->resolve = NULL;
 
-	if (hostname) {
-		gchar *host;
-		guint type;
+	if (resolve->timer_armed)
+		sipe_schedule_cancel(sipe_private, "<+sip-resolve>");
 
-		if (service) {
-			host = g_strdup(hostname);
-			type = sipe_private->service_data->type;
-		} else {
-			/* DNS A resolver returns an IP address */
-			host = g_strdup_printf("%s.%s",
-					       sipe_private->address_data->prefix,
-					       sipe_private->public.sip_domain);
-			port = sipe_private->address_data->port;
-			type = sipe_private->transport_type;
-			if (type == SIPE_TRANSPORT_AUTO)
-				type = SIPE_TRANSPORT_TLS;
+	for (i = 0; i < resolve->count; i++) {
+		struct sip_resolve_candidate *candidate = resolve->candidates + i;
+
+		if (candidate->query)
+			sipe_backend_dns_query_cancel(candidate->query);
+		if (candidate->transport) {
+			sipe_backend_transport_disconnect(candidate->transport->connection);
+			sip_transport_free(sipe_private, candidate->transport);
 		}
+		g_free(candidate->hostname);
+	}
+
+	g_free(resolve->candidates);
+	g_free(resolve);
+}
 
-		SIPE_DEBUG_INFO("sipe_core_dns_resolved - %s hostname: %s port: %d",
-				service ? "SRV" : "A", hostname, port);
-		sipe_server_register(sipe_private, type, host, port);
+static void sip_resolve_connect(struct sip_resolve_candidate *candidate)
+{
+	struct sip_resolve *resolve = candidate->resolve;
+	struct sip_transport *transport;
+
+	SIPE_LOG_INFO("sip_resolve_connect: trying %s record '%s:%u'",
+		      candidate->srv ? "SRV" : "A",
+		      candidate->hostname, candidate->port);
+
+	candidate->state       = SIP_RESOLVE_CONNECTING;
+	resolve->connecting     = TRUE;
+	resolve->connect_failed = FALSE;
+	transport = sip_transport_new(resolve->sipe_private,
+				      candidate->type,
+				      g_strdup(candidate->hostname),
+				      candidate->port);
+	resolve->connecting     = FALSE;
+
+	if (!transport->connection || resolve->connect_failed) {
+		/* backend has already dropped the connection */
+		sip_transport_free(resolve->sipe_private, transport);
+		candidate->state = SIP_RESOLVE_FAILED;
 	} else {
-		if (service)
-			resolve_next_service(SIPE_CORE_PRIVATE, NULL);
-		else
-			resolve_next_address(SIPE_CORE_PRIVATE, FALSE);
+		candidate->transport = transport;
 	}
 }
 
-static void resolve_next_lync(struct sipe_core_private *sipe_private)
+static void sip_resolve_timeout(struct sipe_core_private *sipe_private,
+				gpointer data);
+static void sip_resolve_advance(struct sip_resolve *resolve)
 {
-	struct sipe_lync_autodiscover_data *lync_data = sipe_private->lync_autodiscover_servers->data;
-	guint type = sipe_private->transport_type;
+	struct sipe_core_private *sipe_private = resolve->sipe_private;
+	gboolean pending;
+	gboolean resolved;
+	guint attempts;
 
-	if (lync_data) {
-		/* Try to connect to next server on the list */
+	if (resolve->starting)
+		return;
+
+	while (TRUE) {
+		struct sip_resolve_candidate *next = NULL;
+		guint i;
+
+		pending  = FALSE;
+		resolved = FALSE;
+		attempts = 0;
+		for (i = 0; i < resolve->count; i++) {
+			struct sip_resolve_candidate *candidate = resolve->candidates + i;
+
+			switch (candidate->state) {
+			case SIP_RESOLVE_PENDING:
+				pending = TRUE;
+				break;
+			case SIP_RESOLVE_RESOLVED:
+				resolved = TRUE;
+				/* don't skip higher priority queries too early */
+				if (!next && (!pending || resolve->waited))
+					next = candidate;
+				break;
+			case SIP_RESOLVE_CONNECTING:
+				attempts++;
+				break;
+			}
+		}
+
+		if (!next ||
+		    ((attempts > 0) &&
+		     (!resolve->waited || (attempts >= SIP_RESOLVE_MAX_ATTEMPTS))))
+			break;
+
+		sip_resolve_connect(next);
+		if (next->state == SIP_RESOLVE_CONNECTING) {
+			/* give this attempt some time before starting another */
+			resolve->waited = FALSE;
+			if (resolve->timer_armed)
+				sipe_schedule_cancel(sipe_private, "<+sip-resolve>");
+			resolve->timer_armed = FALSE;
+		}
+	}
+
+	if (!pending && !resolved && (attempts == 0)) {
+		guint type = sipe_private->transport_type;
+
+		/* We tried all services & addresses */
+		sip_resolve_free(sipe_private);
+
+		/* Try connecting to the SIP hostname directly */
+		SIPE_LOG_INFO_NOFORMAT("no SRV or A records found; using SIP domain as fallback");
 		if (type == SIPE_TRANSPORT_AUTO)
 			type = SIPE_TRANSPORT_TLS;
 
-		sipe_server_register(sipe_private,
-				     type,
-				     g_strdup(lync_data->server),
-				     lync_data->port);
+		sipe_server_register(sipe_private, type,
+				     g_strdup(sipe_private->public.sip_domain),
+				     0);
+
+	} else if (!resolve->timer_armed && !resolve->waited) {
+		resolve->timer_armed = TRUE;
+		sipe_schedule_mseconds(sipe_private,
+				       "<+sip-resolve>",
+				       NULL,
+				       SIP_RESOLVE_STAGGER_MS,
+				       sip_resolve_timeout,
+				       NULL);
+	}
+}
+
+static void sip_resolve_timeout(struct sipe_core_private *sipe_private,
+				SIPE_UNUSED_PARAMETER gpointer data)
+{
+	struct sip_resolve *resolve = sipe_private->resolve;
+
+	if (resolve) {
+		resolve->timer_armed = FALSE;
+		resolve->waited      = TRUE;
+		sip_resolve_advance(resolve);
+	}
+}
+
+static void sip_resolve_dns_cb(struct sip_resolve_candidate *candidate,
+			       const gchar *hostname,
+			       guint port)
+{
+	struct sip_resolve *resolve = candidate->resolve;
 
+	candidate->query = NULL;
+
+	if (hostname) {
+		guint i;
+
+		SIPE_DEBUG_INFO("sip_resolve_dns_cb - %s hostname: %s port: %d",
+				candidate->srv ? "SRV" : "A", hostname, port);
+
+		/* DNS A resolver returns an IP address: keep host name */
+		if (candidate->srv) {
+			candidate->hostname = g_strdup(hostname);
+			candidate->port     = port;
+		}
+		candidate->state = SIP_RESOLVE_RESOLVED;
+
+		/* multiple records often point to the same server */
+		for (i = 0; i < resolve->count; i++) {
+			struct sip_resolve_candidate *other = resolve->candidates + i;
+
+			if ((other != candidate)                      &&
+			    ((other->state == SIP_RESOLVE_RESOLVED) ||
+			     (other->state == SIP_RESOLVE_CONNECTING)) &&
+			    (other->port == candidate->port)           &&
+			    (other->type == candidate->type)           &&
+			    sipe_strcase_equal(other->hostname, candidate->hostname)) {
+				SIPE_DEBUG_INFO("sip_resolve_dns_cb - dropping duplicate %s:%u",
+						candidate->hostname, candidate->port);
+				candidate->state = SIP_RESOLVE_FAILED;
+				break;
+			}
+		}
 	} else {
-		/* We tried all servers -> try DNS SRV next */
-		SIPE_LOG_INFO_NOFORMAT("no Lync Autodiscover servers found; trying SRV records next");
-		resolve_next_service(sipe_private, services[type]);
+		candidate->state = SIP_RESOLVE_FAILED;
 	}
 
-	sipe_private->lync_autodiscover_servers =
-		sipe_lync_autodiscover_pop(sipe_private->lync_autodiscover_servers);
+	sip_resolve_advance(resolve);
 }
 
-static void resolve_next_service(struct sipe_core_private *sipe_private,
-				 const struct sip_service_data *start)
+static void sip_resolve_start(struct sipe_core_private *sipe_private,
+			      const struct sip_service_data *service)
 {
-	if (start) {
-		sipe_private->service_data = start;
-	} else {
-		sipe_private->service_data++;
-		if (sipe_private->service_data->protocol == NULL) {
+	struct sip_resolve *resolve = g_new0(struct sip_resolve, 1);
+	const struct sip_address_data *address;
+	guint type = sipe_private->transport_type;
+	guint count = 0;
+	guint i;
+
+	/* failed connection from previous step (already dropped by backend) */
+	if (sipe_private->transport) {
+		sip_transport_free(sipe_private, sipe_private->transport);
+		sipe_private->transport = NULL;
+	}
+	sip_resolve_free(sipe_private);
 
-			/* We tried all services */
-			sipe_private->service_data = NULL;
+	if (type == SIPE_TRANSPORT_AUTO)
+		type = SIPE_TRANSPORT_TLS;
 
-			/* Try A records list next */
-			SIPE_LOG_INFO_NOFORMAT("no SRV records found; trying A records next");
-			resolve_next_address(sipe_private, TRUE);
-			return;
+	for (i = 0; service[i].protocol; i++, count++);
+	for (address = addresses; address->prefix; address++, count++);
+
+	resolve->sipe_private = sipe_private;
+	resolve->candidates   = g_new0(struct sip_resolve_candidate, count);
+	resolve->count        = count;
+	resolve->starting     = TRUE;
+	sipe_private->resolve = resolve;
+
+	for (i = 0; service[i].protocol; i++) {
+		struct sip_resolve_candidate *candidate = resolve->candidates + i;
+
+		candidate->resolve = resolve;
+		candidate->type    = service[i].type;
+		candidate->srv     = TRUE;
+	}
+	for (address = addresses; address->prefix; address++, i++) {
+		struct sip_resolve_candidate *candidate = resolve->candidates + i;
+
+		candidate->resolve  = resolve;
+		candidate->hostname = g_strdup_printf("%s.%s",
+						      address->prefix,
+						      sipe_private->public.sip_domain);
+		candidate->port     = address->port;
+		candidate->type     = type;
+	}
+
+	/* NOTE: some backends call the callback synchronously */
+	for (i = 0; i < count; i++) {
+		struct sip_resolve_candidate *candidate = resolve->candidates + i;
+		struct sipe_dns_query *query;
+
+		if (candidate->srv)
+			query = sipe_backend_dns_query_srv(SIPE_CORE_PUBLIC,
+							   service[i].protocol,
+							   service[i].transport,
+							   sipe_private->public.sip_domain,
+							   (sipe_dns_resolved_cb) sip_resolve_dns_cb,
+							   candidate);
+		else
+			query = sipe_backend_dns_query_a(SIPE_CORE_PUBLIC,
+							 candidate->hostname,
+							 candidate->port,
+							 (sipe_dns_resolved_cb) sip_resolve_dns_cb,
+							 candidate);
+
+		if (candidate->state == SIP_RESOLVE_PENDING) {
+			if (query)
+				candidate->query = query;
+			else
+				candidate->state = SIP_RESOLVE_FAILED;
 		}
 	}
 
-	/* Try to resolve next service */
-	sipe_private->dns_query = sipe_backend_dns_query_srv(
-					SIPE_CORE_PUBLIC,
-					sipe_private->service_data->protocol,
-					sipe_private->service_data->transport,
-					sipe_private->public.sip_domain,
-					(sipe_dns_resolved_cb) sipe_core_dns_resolved,
-					SIPE_CORE_PUBLIC);
+	resolve->starting = FALSE;
+	sip_resolve_advance(resolve);
 }
 
-static void resolve_next_address(struct sipe_core_private *sipe_private,
-				 gboolean initial)
+static void sip_resolve_winner(struct sipe_core_private *sipe_private,
+			       struct sipe_transport_connection *conn)
 {
-	gchar *hostname;
+	struct sip_resolve *resolve = sipe_private->resolve;
+	guint i;
 
-	if (initial) {
-		sipe_private->address_data = addresses;
-	} else {
-		sipe_private->address_data++;
-		if (sipe_private->address_data->prefix == NULL) {
-			guint type = sipe_private->transport_type;
+	for (i = 0; i < resolve->count; i++) {
+		struct sip_resolve_candidate *candidate = resolve->candidates + i;
 
-			/* We tried all addresss */
-			sipe_private->address_data = NULL;
+		if (candidate->transport &&
+		    (candidate->transport->connection == conn)) {
+			sipe_private->transport = candidate->transport;
+			candidate->transport    = NULL;
+			sip_resolve_free(sipe_private);
+			return;
+		}
+	}
+}
 
-			/* Try connecting to the SIP hostname directly */
-			SIPE_LOG_INFO_NOFORMAT("no SRV or A records found; using SIP domain as fallback");
-			if (type == SIPE_TRANSPORT_AUTO)
-				type = SIPE_TRANSPORT_TLS;
+static gboolean sip_resolve_failed(struct sipe_core_private *sipe_private,
+				   struct sipe_transport_connection *conn)
+{
+	struct sip_resolve *resolve = sipe_private->resolve;
+	guint i;
 
-			sipe_server_register(sipe_private, type,
-					     g_strdup(sipe_private->public.sip_domain),
-					     0);
-			return;
+	if (!resolve)
+		return(FALSE);
+
+	/* error reported from inside sipe_backend_transport_connect() */
+	if (resolve->connecting) {
+		resolve->connect_failed = TRUE;
+		return(TRUE);
+	}
+
+	for (i = 0; i < resolve->count; i++) {
+		struct sip_resolve_candidate *candidate = resolve->candidates + i;
+
+		if (candidate->transport &&
+		    (candidate->transport->connection == conn)) {
+			SIPE_LOG_INFO("sip_resolve_failed: connection to '%s:%u' failed",
+				      candidate->hostname, candidate->port);
+			/* backend has already dropped the connection */
+			sip_transport_free(sipe_private, candidate->transport);
+			candidate->transport = NULL;
+			candidate->state     = SIP_RESOLVE_FAILED;
+			sip_resolve_advance(resolve);
+			return(TRUE);
 		}
 	}
 
-	/* Try to resolve next address */
-	hostname = g_strdup_printf("%s.%s",
-				   sipe_private->address_data->prefix,
-				   sipe_private->public.sip_domain);
-	sipe_private->dns_query = sipe_backend_dns_query_a(
-					SIPE_CORE_PUBLIC,
-					hostname,
-					sipe_private->address_data->port,
-					(sipe_dns_resolved_cb) sipe_core_dns_resolved,
-					SIPE_CORE_PUBLIC);
-	g_free(hostname);
+	return(FALSE);
+}
+
+static void lync_autodiscover_cb(struct sipe_core_private *sipe_private,
+				 GSList *servers,
+				 gpointer callback_data);
+static void resolve_next_lync(struct sipe_core_private *sipe_private)
+{
+	struct sipe_lync_autodiscover_data *lync_data = sipe_private->lync_autodiscover_servers->data;
+	guint type = sipe_private->transport_type;
+	gboolean retry = FALSE;
+
+	if (lync_data) {
+		/* Try to connect to next server on the list */
+		if (type == SIPE_TRANSPORT_AUTO)
+			type = SIPE_TRANSPORT_TLS;
+
+		sipe_server_register(sipe_private,
+				     type,
+				     g_strdup(lync_data->server),
+				     lync_data->port);
+
+	} else if (sipe_lync_autodiscover_invalidate(sipe_private)) {
+		/* Cached servers are outdated -> repeat Lync Autodiscover */
+		SIPE_LOG_INFO_NOFORMAT("cached Lync Autodiscover servers failed; repeating Lync Autodiscover");
+		retry = TRUE;
+
+	} else {
+		/* We tried all servers -> try DNS SRV next */
+		SIPE_LOG_INFO_NOFORMAT("no Lync Autodiscover servers found; trying SRV records next");
+		sip_resolve_start(sipe_private, services[type]);
+	}
+
+	sipe_private->lync_autodiscover_servers =
+		sipe_lync_autodiscover_pop(sipe_private->lync_autodiscover_servers);
+
+	if (retry)
+		sipe_lync_autodiscover_start(sipe_private,
+					     lync_autodiscover_cb,
+					     NULL);
 }
 
 static void lync_autodiscover_cb(struct sipe_core_private *sipe_private,
@@ -99,12 +99,12 @@ struct transaction *sip_transport_service(struct sipe_core_private *sipe_private
 					  const gchar *addheaders,
 					  const gchar *body,
 					  TransCallback callback);
-void sip_transport_subscribe(struct sipe_core_private *sipe_private,
-			     const gchar *uri,
-			     const gchar *addheaders,
-			     const gchar *body,
-			     struct sip_dialog *dialog,
-			     TransCallback callback);
+struct transaction *sip_transport_subscribe(struct sipe_core_private *sipe_private,
+					    const gchar *uri,
+					    const gchar *addheaders,
+					    const gchar *body,
+					    struct sip_dialog *dialog,
+					    TransCallback callback);
 void sip_transport_update(struct sipe_core_private *sipe_private,
 			  struct sip_dialog *dialog,
 			  TransCallback callback);
@@ -55,18 +55,28 @@
 #include "sipe-utils.h"
 #include "sdpmsg.h"
 
+/* size of each relay buffer between RDP channel and media stream */
+#define RDP_RELAY_BUFFER_SIZE 0x10000
+
 struct sipe_appshare {
 	struct sipe_media_stream *stream;
 	GSocket *socket;
-	GIOChannel *channel;
 	guint rdp_channel_readable_watch_id;
 	guint rdp_channel_writable_watch_id;
 	guint monitor_id;
 	struct sipe_user_ask_ctx *ask_ctx;
 
-	gchar rdp_channel_buffer[0x800];
-	gchar *rdp_channel_buffer_pos;
+	/* media stream -> RDP channel */
+	guint8 *rdp_channel_buffer;
+	guint8 *rdp_channel_buffer_pos;
 	gsize rdp_channel_buffer_len;
+	/* RDP channel -> media stream */
+	guint8 *stream_buffer;
+
+	/* throughput counters */
+	guint64 bytes_to_rdp_channel;
+	guint64 bytes_to_stream;
+	GTimer *relay_timer;
 
 	struct sipe_rdp_client client;
 
@@ -76,34 +86,57 @@ struct sipe_appshare {
 };
 
 static void
-sipe_appshare_free(struct sipe_appshare *appshare)
+rdp_channel_remove_watch(guint *watch_id)
 {
-	if (appshare->rdp_channel_readable_watch_id != 0) {
-		g_source_destroy(g_main_context_find_source_by_id(NULL,
-				appshare->rdp_channel_readable_watch_id));
+	if (*watch_id != 0) {
+		g_source_remove(*watch_id);
+		*watch_id = 0;
 	}
+}
 
-	if (appshare->rdp_channel_writable_watch_id != 0) {
-		g_source_destroy(g_main_context_find_source_by_id(NULL,
-				appshare->rdp_channel_writable_watch_id));
-	}
+static guint
+rdp_channel_add_watch(struct sipe_appshare *appshare,
+		      GIOCondition condition,
+		      GSocketSourceFunc callback)
+{
+	GSource *source = g_socket_create_source(appshare->socket,
+						 condition,
+						 NULL);
+	guint watch_id;
 
-	if (appshare->channel) {
-		GError *error = NULL;
+	g_source_set_callback(source, (GSourceFunc) callback, appshare, NULL);
+	watch_id = g_source_attach(source, NULL);
+	g_source_unref(source);
 
-		g_io_channel_shutdown(appshare->channel, TRUE, &error);
-		if (error) {
-			SIPE_DEBUG_ERROR("Error shutting down RDP channel: %s",
-					 error->message);
-			g_error_free(error);
-		}
-		g_io_channel_unref(appshare->channel);
-	}
+	return watch_id;
+}
+
+static void
+sipe_appshare_free(struct sipe_appshare *appshare)
+{
+	rdp_channel_remove_watch(&appshare->rdp_channel_readable_watch_id);
+	rdp_channel_remove_watch(&appshare->rdp_channel_writable_watch_id);
 
 	if (appshare->socket) {
 		g_object_unref(appshare->socket);
 	}
 
+	if (appshare->relay_timer) {
+		gdouble elapsed = g_timer_elapsed(appshare->relay_timer, NULL);
+
+		if (elapsed <= 0)
+			elapsed = 1;
+		SIPE_DEBUG_INFO("RDP relay: %" G_GUINT64_FORMAT " bytes to RDP channel (%.0f KB/s), %" G_GUINT64_FORMAT " bytes to media stream (%.0f KB/s) in %.1f seconds",
+				appshare->bytes_to_rdp_channel,
+				appshare->bytes_to_rdp_channel / elapsed / 1024,
+				appshare->bytes_to_stream,
+				appshare->bytes_to_stream / elapsed / 1024,
+				elapsed);
+		g_timer_destroy(appshare->relay_timer);
+	}
+	g_free(appshare->rdp_channel_buffer);
+	g_free(appshare->stream_buffer);
+
 #ifdef HAVE_APPSHARE_SERVER
 	if (appshare->server) {
 		if (appshare->server->ipcSocket) {
@@ -129,78 +162,91 @@ sipe_appshare_free(struct sipe_appshare *appshare)
 }
 
 static gboolean
-rdp_channel_readable_cb(GIOChannel *channel,
+rdp_channel_readable_cb(GSocket *socket,
 			GIOCondition condition,
 			gpointer data)
 {
 	struct sipe_appshare *appshare = data;
-	GError *error = NULL;
-	gchar *buffer;
-	gsize bytes_read;
+	struct sipe_media_call *call = appshare->stream->call;
 
 	if (condition & G_IO_HUP) {
-		struct sipe_media_call *call = appshare->stream->call;
-
 		SIPE_DEBUG_INFO_NOFORMAT("Received HUP from RDP client.");
+		appshare->rdp_channel_readable_watch_id = 0;
 		sipe_backend_media_hangup(call->backend_private, TRUE);
 		return FALSE;
 	}
 
-	buffer = g_malloc(2048);
 	while (sipe_media_stream_is_writable(appshare->stream)) {
-		GIOStatus status;
-
-		status = g_io_channel_read_chars(channel,
-						 buffer, 2048,
-						 &bytes_read, &error);
-		if (error) {
-			struct sipe_media_call *call = appshare->stream->call;
+		GError *error = NULL;
+		gssize bytes_read = g_socket_receive(socket,
+						     (gchar *) appshare->stream_buffer,
+						     RDP_RELAY_BUFFER_SIZE,
+						     NULL,
+						     &error);
+
+		if (bytes_read < 0) {
+			if (g_error_matches(error, G_IO_ERROR,
+					    G_IO_ERROR_WOULD_BLOCK)) {
+				g_error_free(error);
+				return TRUE;
+			}
 
 			SIPE_DEBUG_ERROR("Error reading from RDP channel: %s",
 					 error->message);
 			g_error_free(error);
+			appshare->rdp_channel_readable_watch_id = 0;
 			sipe_backend_media_hangup(call->backend_private, TRUE);
-			g_free(buffer);
 			return FALSE;
 		}
 
-		if (status == G_IO_STATUS_EOF) {
-			struct sipe_media_call *call = appshare->stream->call;
-
+		if (bytes_read == 0) {
+			/* EOF */
+			appshare->rdp_channel_readable_watch_id = 0;
 			sipe_backend_media_hangup(call->backend_private, TRUE);
-			g_free(buffer);
 			return FALSE;
 		}
 
-		if (bytes_read == 0) {
-			break;
-		}
-
-		sipe_media_stream_write(appshare->stream, (guint8 *)buffer,
+		sipe_media_stream_write(appshare->stream,
+					appshare->stream_buffer,
 					bytes_read);
-		SIPE_DEBUG_INFO("Written: %" G_GSIZE_FORMAT "\n", bytes_read);
+		appshare->bytes_to_stream += bytes_read;
 	}
-	g_free(buffer);
 
-	return TRUE;
+	/* Media stream is congested. Stop reading from the RDP channel
+	 * until writable_cb() is called. */
+	appshare->rdp_channel_readable_watch_id = 0;
+	return FALSE;
+}
+
+static void
+rdp_relay_start(struct sipe_appshare *appshare)
+{
+	appshare->rdp_channel_buffer = g_malloc(RDP_RELAY_BUFFER_SIZE);
+	appshare->stream_buffer      = g_malloc(RDP_RELAY_BUFFER_SIZE);
+	appshare->relay_timer        = g_timer_new();
+
+	appshare->rdp_channel_readable_watch_id =
+			rdp_channel_add_watch(appshare, G_IO_IN | G_IO_HUP,
+					      rdp_channel_readable_cb);
 }
 
 static gboolean
-socket_connect_cb(SIPE_UNUSED_PARAMETER GIOChannel *channel,
+socket_connect_cb(SIPE_UNUSED_PARAMETER GSocket *socket,
 		  SIPE_UNUSED_PARAMETER GIOCondition condition,
 		  gpointer data)
 {
 	struct sipe_appshare *appshare = data;
+	struct sipe_media_call *call = appshare->stream->call;
 	GError *error = NULL;
 	GSocket *data_socket;
-	int fd;
 
 	SIPE_DEBUG_INFO_NOFORMAT("RDP client has connected.");
 
+	/* listen watch is removed when we return */
+	appshare->rdp_channel_readable_watch_id = 0;
+
 	data_socket = g_socket_accept(appshare->socket, NULL, &error);
 	if (error) {
-		struct sipe_media_call *call = appshare->stream->call;
-
 		SIPE_DEBUG_ERROR("Error accepting RDP client connection: %s",
 				 error->message);
 		g_error_free(error);
@@ -208,47 +254,11 @@ socket_connect_cb(SIPE_UNUSED_PARAMETER GIOChannel *channel,
 		return FALSE;
 	}
 
-	g_io_channel_shutdown(appshare->channel, TRUE, &error);
-	if (error) {
-		struct sipe_media_call *call = appshare->stream->call;
-
-		SIPE_DEBUG_ERROR("Error shutting down RDP channel: %s",
-				 error->message);
-		g_error_free(error);
-		g_object_unref(data_socket);
-		sipe_backend_media_hangup(call->backend_private, TRUE);
-		return FALSE;
-	}
-	g_io_channel_unref(appshare->channel);
-
 	g_object_unref(appshare->socket);
 	appshare->socket = data_socket;
+	g_socket_set_blocking(appshare->socket, FALSE);
 
-	fd = g_socket_get_fd(appshare->socket);
-	if (fd < 0) {
-		struct sipe_media_call *call = appshare->stream->call;
-
-		SIPE_DEBUG_ERROR_NOFORMAT("Invalid file descriptor for RDP client connection socket");
-		sipe_backend_media_hangup(call->backend_private, TRUE);
-		return FALSE;
-	}
-	appshare->channel = g_io_channel_unix_new(fd);
-
-	// No encoding for binary data
-	g_io_channel_set_encoding(appshare->channel, NULL, &error);
-	if (error) {
-		struct sipe_media_call *call = appshare->stream->call;
-
-		SIPE_DEBUG_ERROR("Error setting RDP channel encoding: %s",
-				 error->message);
-		g_error_free(error);
-		sipe_backend_media_hangup(call->backend_private, TRUE);
-		return FALSE;
-	}
-
-	appshare->rdp_channel_readable_watch_id =
-			g_io_add_watch(appshare->channel, G_IO_IN | G_IO_HUP,
-				       rdp_channel_readable_cb, appshare);
+	rdp_relay_start(appshare);
 
 	return FALSE;
 }
@@ -260,7 +270,6 @@ launch_rdp_client(struct sipe_appshare *appshare)
 	struct sipe_media_call *call = appshare->stream->call;
 	GSocketAddress *address;
 	GError *error = NULL;
-	int fd;
 
 	address = client->get_listen_address_cb(client);
 	if (!address) {
@@ -302,17 +311,9 @@ launch_rdp_client(struct sipe_appshare *appshare)
 		return;
 	}
 
-	fd = g_socket_get_fd(appshare->socket);
-	if (fd < 0) {
-		SIPE_DEBUG_ERROR_NOFORMAT("Invalid file descriptor for RDP client listen socket");
-		sipe_backend_media_hangup(call->backend_private, TRUE);
-		return;
-	}
-	appshare->channel = g_io_channel_unix_new(fd);
-
 	appshare->rdp_channel_readable_watch_id =
-			g_io_add_watch(appshare->channel, G_IO_IN,
-				       socket_connect_cb, appshare);
+			rdp_channel_add_watch(appshare, G_IO_IN,
+					      socket_connect_cb);
 
 	address = g_socket_get_local_address(appshare->socket, &error);
 	if (error) {
@@ -333,43 +334,71 @@ launch_rdp_client(struct sipe_appshare *appshare)
 	g_object_unref(address);
 }
 
-static gssize
-rdp_client_channel_write(struct sipe_appshare *appshare)
+static gboolean
+rdp_channel_writable_cb(GSocket *socket,
+			GIOCondition condition,
+			gpointer data);
+
+/*
+ * Relay data from media stream to RDP channel until either side would block
+ *
+ * @return FALSE on error
+ */
+static gboolean
+rdp_relay_stream_to_channel(struct sipe_appshare *appshare)
 {
-	gsize bytes_written;
-	GError *error = NULL;
+	while (TRUE) {
+		GError *error = NULL;
+		gssize bytes_written;
+
+		if (appshare->rdp_channel_buffer_len == 0) {
+			gssize bytes_read =
+				sipe_backend_media_stream_read(appshare->stream,
+							       appshare->rdp_channel_buffer,
+							       RDP_RELAY_BUFFER_SIZE);
+			if (bytes_read < 0) {
+				return FALSE;
+			}
+			if (bytes_read == 0) {
+				return TRUE;
+			}
 
-	g_io_channel_write_chars(appshare->channel,
-				 appshare->rdp_channel_buffer_pos,
-				 appshare->rdp_channel_buffer_len,
-				 &bytes_written, &error);
-	if (error) {
-		SIPE_DEBUG_ERROR("Couldn't write data to RDP client: %s",
-				 error->message);
-		g_error_free(error);
-		return -1;
-	}
+			appshare->rdp_channel_buffer_pos = appshare->rdp_channel_buffer;
+			appshare->rdp_channel_buffer_len = bytes_read;
+		}
 
-	g_io_channel_flush(appshare->channel, &error);
-	if (error) {
-		if (g_error_matches(error, G_IO_CHANNEL_ERROR,
-				    G_IO_CHANNEL_ERROR_PIPE)) {
-			/* Ignore broken pipe here and wait for the call to be
-			 * hung up upon G_IO_HUP in client_channel_cb(). */
+		bytes_written = g_socket_send(appshare->socket,
+					      (gchar *) appshare->rdp_channel_buffer_pos,
+					      appshare->rdp_channel_buffer_len,
+					      NULL,
+					      &error);
+		if (bytes_written < 0) {
+			if (!g_error_matches(error, G_IO_ERROR,
+					     G_IO_ERROR_WOULD_BLOCK)) {
+				SIPE_DEBUG_ERROR("Couldn't write data to RDP client: %s",
+						 error->message);
+				g_error_free(error);
+				return FALSE;
+			}
 			g_error_free(error);
-			return 0;
+			bytes_written = 0;
 		}
 
-		SIPE_DEBUG_ERROR("Couldn't flush RDP channel: %s",
-				 error->message);
-		g_error_free(error);
-		return -1;
+		appshare->rdp_channel_buffer_pos += bytes_written;
+		appshare->rdp_channel_buffer_len -= bytes_written;
+		appshare->bytes_to_rdp_channel   += bytes_written;
+
+		if (appshare->rdp_channel_buffer_len != 0) {
+			/* Schedule writing of the buffer's remainder to when
+			 * RDP channel becomes writable again. */
+			if (appshare->rdp_channel_writable_watch_id == 0) {
+				appshare->rdp_channel_writable_watch_id =
+					rdp_channel_add_watch(appshare, G_IO_OUT,
+							      rdp_channel_writable_cb);
+			}
+			return TRUE;
+		}
 	}
-
-	appshare->rdp_channel_buffer_pos += bytes_written;
-	appshare->rdp_channel_buffer_len -= bytes_written;
-
-	return bytes_written;
 }
 
 static void
@@ -382,73 +411,46 @@ delayed_hangup_cb(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
 }
 
 static gboolean
-rdp_channel_writable_cb(SIPE_UNUSED_PARAMETER GIOChannel *channel,
+rdp_channel_writable_cb(SIPE_UNUSED_PARAMETER GSocket *socket,
 			SIPE_UNUSED_PARAMETER GIOCondition condition,
 			gpointer data)
 {
 	struct sipe_appshare *appshare = data;
 	struct sipe_media_call *call = appshare->stream->call;
 
-	if (rdp_client_channel_write(appshare) < 0) {
-		sipe_backend_media_hangup(call->backend_private, TRUE);
-		return FALSE;
-	}
+	/* watch is removed when we return, relay adds a new one if needed */
+	appshare->rdp_channel_writable_watch_id = 0;
 
-	if (appshare->rdp_channel_buffer_len == 0) {
-		// Writing done, disconnect writable watch.
-		appshare->rdp_channel_writable_watch_id = 0;
-		return FALSE;
+	/* Flush the buffer and continue with data queued in the stream. */
+	if (!rdp_relay_stream_to_channel(appshare)) {
+		sipe_backend_media_hangup(call->backend_private, TRUE);
 	}
 
-	return TRUE;
+	return FALSE;
 }
 
 static void
 read_cb(struct sipe_media_stream *stream)
 {
 	struct sipe_appshare *appshare = sipe_media_stream_get_data(stream);
-	gint bytes_read = 0;
-	gssize bytes_written = 0;
 
-	if (appshare->rdp_channel_writable_watch_id != 0) {
-		// Data still in the buffer. Let the client read it first.
+	if (!appshare->rdp_channel_buffer ||
+	    appshare->rdp_channel_writable_watch_id != 0) {
+		/* RDP client not connected yet or data still in the buffer.
+		 * Let the client read it first. */
 		return;
 	}
 
-	while (bytes_read == (gint)bytes_written) {
-		bytes_read = sipe_backend_media_stream_read(stream,
-				(guint8 *)appshare->rdp_channel_buffer,
-				sizeof (appshare->rdp_channel_buffer));
-		if (bytes_read == 0) {
-			return;
-		}
-
-		appshare->rdp_channel_buffer_pos = appshare->rdp_channel_buffer;
-		appshare->rdp_channel_buffer_len = bytes_read;
-
-		bytes_written = rdp_client_channel_write(appshare);
-
-		if (bytes_written < 0) {
-			/* Don't deallocate stream while in its read callback.
-			 * Schedule call hangup to be executed after we're back
-			 * in the message loop. */
-			sipe_schedule_seconds(sipe_media_get_sipe_core_private(stream->call),
-					      "appshare delayed hangup",
-					      stream->call->backend_private,
-					      0,
-					      delayed_hangup_cb,
-					      NULL);
-			return;
-		}
-	}
-
-	if (bytes_read != (gint)bytes_written) {
-		/* Schedule writing of the buffer's remainder to when
-		 * RDP channel becomes writable again. */
-		appshare->rdp_channel_writable_watch_id =
-				g_io_add_watch(appshare->channel, G_IO_OUT,
-					       rdp_channel_writable_cb,
-					       appshare);
+	if (!rdp_relay_stream_to_channel(appshare)) {
+		/* Don't deallocate stream while in its read callback.
+		 * Schedule call hangup to be executed after we're back
+		 * in the message loop. */
+		sipe_schedule_seconds(sipe_media_get_sipe_core_private(stream->call),
+				      "appshare delayed hangup",
+				      stream->call->backend_private,
+				      0,
+				      delayed_hangup_cb,
+				      NULL);
 	}
 }
 
@@ -459,6 +461,12 @@ writable_cb(struct sipe_media_stream *stream)
 
 	if (!appshare->socket) {
 		launch_rdp_client(appshare);
+	} else if (appshare->stream_buffer &&
+		   appshare->rdp_channel_readable_watch_id == 0) {
+		/* Media stream no longer congested, resume relay. */
+		appshare->rdp_channel_readable_watch_id =
+				rdp_channel_add_watch(appshare, G_IO_IN | G_IO_HUP,
+						      rdp_channel_readable_cb);
 	}
 }
 
@@ -821,21 +829,8 @@ candidate_pairs_established_cb(struct sipe_media_stream *stream)
 		return;
 	}
 
-	appshare->channel = g_io_channel_unix_new(g_socket_get_fd(appshare->socket));
-
-	// No encoding for binary data
-	g_io_channel_set_encoding(appshare->channel, NULL, &error);
-	if (error) {
-		SIPE_DEBUG_ERROR("Error setting RDP channel encoding: %s",
-				 error->message);
-		g_error_free(error);
-		sipe_backend_media_hangup(stream->call->backend_private, TRUE);
-		return;
-	}
-
-	appshare->rdp_channel_readable_watch_id =
-			g_io_add_watch(appshare->channel, G_IO_IN | G_IO_HUP,
-				       rdp_channel_readable_cb, appshare);
+	rdp_relay_start(appshare);
+	stream->writable_cb = writable_cb;
 
 	// Appshare structure initialized; don't call this again.
 	stream->candidate_pairs_established_cb = NULL;
@@ -0,0 +1,226 @@
+/**
+ * @file sipe-buddy-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Tests for the buddy URI hash table keys
+ *
+ * sipe_buddy_find_by_uri() looks up contacts with the normalized URI
+ * returned by sipe_utils_uri_key(), i.e. URIs that only differ in case
+ * must map to the same key.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <glib.h>
+
+#include "sip-transport.h"
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-utils.h"
+#include "uuid.h"
+
+#define TEST_CONTACTS   1000
+#define KEY_BUFFER_SIZE 256
+
+/* stub functions for backend API */
+void sipe_backend_debug_literal(sipe_debug_level level,
+				const gchar *msg)
+{
+	printf("DEBUG %d: %s\n", level, msg);
+}
+void sipe_backend_debug(sipe_debug_level level,
+			const gchar *format,
+			...)
+{
+	va_list args;
+	gchar *msg;
+	va_start(args, format);
+	msg = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	sipe_backend_debug_literal(level, msg);
+	g_free(msg);
+}
+gboolean sipe_backend_debug_enabled(void)
+{
+	return TRUE;
+}
+
+const gchar *sip_transport_epid(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) { return(NULL); }
+char *generateUUIDfromEPID(SIPE_UNUSED_PARAMETER const gchar *epid) { return(NULL); }
+char *sipe_get_epid(SIPE_UNUSED_PARAMETER const char *self_sip_uri,
+		    SIPE_UNUSED_PARAMETER const char *hostname,
+		    SIPE_UNUSED_PARAMETER const char *ip_address) { return(NULL); }
+
+/* test helpers */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+static void assert_key(const gchar *uri,
+		       gsize size,
+		       const gchar *expected,
+		       gboolean in_buffer)
+{
+	gchar buffer[KEY_BUFFER_SIZE];
+	gchar *key = sipe_utils_uri_key(uri,
+					size ? buffer : NULL,
+					size);
+
+	if (sipe_strequal(key, expected) &&
+	    ((key == buffer) == in_buffer)) {
+		succeeded++;
+	} else {
+		printf("[%s]\nkey FAILED: '%s' (%s) expected: '%s' (%s)\n",
+		       uri, key,
+		       (key == buffer) ? "buffer" : "allocated",
+		       expected,
+		       in_buffer ? "buffer" : "allocated");
+		failed++;
+	}
+
+	if (key != buffer)
+		g_free(key);
+}
+
+/* URIs must map to the same key */
+static void assert_same_key(const gchar *uri1,
+			    const gchar *uri2)
+{
+	gchar *key1 = sipe_utils_uri_key(uri1, NULL, 0);
+	gchar *key2 = sipe_utils_uri_key(uri2, NULL, 0);
+
+	if (sipe_strequal(key1, key2)) {
+		succeeded++;
+	} else {
+		printf("[%s] [%s]\nsame key FAILED: '%s' != '%s'\n",
+		       uri1, uri2, key1, key2);
+		failed++;
+	}
+
+	g_free(key2);
+	g_free(key1);
+}
+
+static const gchar *lookup(GHashTable *table, const gchar *uri)
+{
+	gchar buffer[KEY_BUFFER_SIZE];
+	gchar *key = sipe_utils_uri_key(uri, buffer, sizeof(buffer));
+	const gchar *value = g_hash_table_lookup(table, key);
+
+	if (key != buffer)
+		g_free(key);
+	return(value);
+}
+
+static void assert_lookup(GHashTable *table,
+			  const gchar *uri,
+			  const gchar *expected)
+{
+	const gchar *found = lookup(table, uri);
+
+	if (found == expected) {
+		succeeded++;
+	} else {
+		printf("[%s]\nlookup FAILED: '%s' expected: '%s'\n",
+		       uri,
+		       found    ? found    : "(nil)",
+		       expected ? expected : "(nil)");
+		failed++;
+	}
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
+{
+	GHashTable *table;
+	gchar *contacts[TEST_CONTACTS];
+	guint i;
+
+	/* ASCII: lower case, stored in buffer if it fits */
+	assert_key("sip:User00001@Contoso.COM", KEY_BUFFER_SIZE,
+		   "sip:user00001@contoso.com", TRUE);
+	assert_key("sip:user00001@contoso.com", KEY_BUFFER_SIZE,
+		   "sip:user00001@contoso.com", TRUE);
+	assert_key("", KEY_BUFFER_SIZE, "", TRUE);
+	assert_key("sip:A@B", 8, "sip:a@b", TRUE);  /* 7 + NUL */
+	assert_key("sip:AB@C", 8, "sip:ab@c", FALSE); /* 8 + NUL */
+	assert_key("sip:User00001@Contoso.COM", 0,
+		   "sip:user00001@contoso.com", FALSE);
+
+	/* invalid UTF-8: ASCII characters are lower cased only */
+	assert_key("sip:A\xff@B", KEY_BUFFER_SIZE, "sip:a\xff@b", TRUE);
+
+	/* non-ASCII: Unicode case folding & normalization */
+	assert_same_key("sip:j\xc3\xb6rg@contoso.com",
+			"sip:J\xc3\x96RG@Contoso.com");
+	assert_same_key("sip:j\xc3\xb6rg@contoso.com",  /* U+00F6 */
+			"sip:jo\xcc\x88rg@contoso.com"); /* o + U+0308 */
+	assert_same_key("sip:stra\xc3\x9f" "e@contoso.com", /* U+00DF */
+			"sip:STRASSE@contoso.com");
+
+	/* hash table as used for buddies, every 100th URI non-ASCII */
+	table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < TEST_CONTACTS; i++) {
+		contacts[i] = (i % 100) ?
+			g_strdup_printf("sip:user%05u@contoso.com", i) :
+			g_strdup_printf("sip:j\xc3\xb6rg%05u@contoso.com", i);
+		g_hash_table_insert(table,
+				    sipe_utils_uri_key(contacts[i], NULL, 0),
+				    contacts[i]);
+	}
+	if (g_hash_table_size(table) == TEST_CONTACTS) {
+		succeeded++;
+	} else {
+		printf("table size FAILED: %u expected: %u\n",
+		       g_hash_table_size(table), TEST_CONTACTS);
+		failed++;
+	}
+
+	for (i = 0; i < TEST_CONTACTS; i++) {
+		gchar *uri = (i % 100) ?
+			g_strdup_printf("sip:User%05u@Contoso.COM", i) :
+			g_strdup_printf("sip:J\xc3\x96rg%05u@contoso.com", i);
+		assert_lookup(table, contacts[i], contacts[i]);
+		assert_lookup(table, uri,         contacts[i]);
+		g_free(uri);
+	}
+	assert_lookup(table, "sip:nobody@contoso.com", NULL);
+	assert_lookup(table, "sip:user01000@contoso.com", NULL);
+
+	g_hash_table_destroy(table);
+	for (i = 0; i < TEST_CONTACTS; i++)
+		g_free(contacts[i]);
+
+	printf("Result: %d PASSED %d FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
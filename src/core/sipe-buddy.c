@@ -68,6 +68,9 @@ struct sipe_buddies {
 	GHashTable *uri;
 	GHashTable *exchange_key;
 
+	/* Pending presence changes, key is normalized buddy URI */
+	GHashTable *deltas;
+
 	/* Pending photo download HTTP requests */
 	GSList *pending_photo_requests;
 };
@@ -87,6 +90,30 @@ static void buddy_fetch_photo(struct sipe_core_private *sipe_private,
 			      const gchar *uri);
 static void photo_response_data_free(struct photo_response_data *data);
 
+/*
+ * Buddy URIs are compared case-insensitively. The hash table key is the
+ * normalized URI, see sipe_utils_uri_key(). This allows plain byte hashing
+ * and comparison instead of Unicode case folding on every hash & compare.
+ */
+#define BUDDY_KEY_BUFFER_SIZE 256
+
+static void buddy_key_set(struct sipe_buddy *buddy)
+{
+	gchar buffer[BUDDY_KEY_BUFFER_SIZE];
+	gchar *key = sipe_utils_uri_key(buddy->name,
+					buffer,
+					sizeof(buffer));
+
+	if (sipe_strequal(key, buddy->name)) {
+		/* name is already normalized, e.g. ASCII URI */
+		buddy->key = buddy->name;
+		if (key != buffer)
+			g_free(key);
+	} else {
+		buddy->key = (key == buffer) ? g_strdup(key) : key;
+	}
+}
+
 void sipe_buddy_add_keys(struct sipe_core_private *sipe_private,
 			 struct sipe_buddy *buddy,
 			 const gchar *exchange_key,
@@ -115,8 +142,9 @@ struct sipe_buddy *sipe_buddy_add(struct sipe_core_private *sipe_private,
 	if (!buddy) {
 		buddy = g_new0(struct sipe_buddy, 1);
 		buddy->name = normalized_uri;
+		buddy_key_set(buddy);
 		g_hash_table_insert(sipe_private->buddies->uri,
-				    buddy->name,
+				    buddy->key,
 				    buddy);
 
 		sipe_buddy_add_keys(sipe_private,
@@ -163,6 +191,98 @@ static gboolean is_buddy_in_group(struct sipe_buddy *buddy,
 	return(FALSE);
 }
 
+/*
+ * Backend buddy cache
+ *
+ * sipe_backend_buddy_find() & co. have to scan the whole buddy list on
+ * some backends. Each buddy therefore caches its backend buddies, one per
+ * group. The cache is filled on first use and updated when the core adds
+ * or removes backend buddies. Changes initiated by the backend are reported
+ * through sipe_core_buddy_group() & sipe_core_buddy_remove(), which drop
+ * the cache of the buddy.
+ */
+static const GSList *buddy_backend_buddies(struct sipe_core_private *sipe_private,
+					   struct sipe_buddy *buddy)
+{
+	if (!buddy->backend_buddies_valid) {
+		/* all buddies in different groups */
+		buddy->backend_buddies = sipe_backend_buddy_find_all(SIPE_CORE_PUBLIC,
+								     buddy->name,
+								     NULL);
+		buddy->backend_buddies_valid = TRUE;
+	}
+	return(buddy->backend_buddies);
+}
+
+static void buddy_backend_invalidate(struct sipe_buddy *buddy)
+{
+	g_slist_free(buddy->backend_buddies);
+	buddy->backend_buddies       = NULL;
+	buddy->backend_buddies_valid = FALSE;
+}
+
+sipe_backend_buddy sipe_buddy_backend_find(struct sipe_core_private *sipe_private,
+					   const gchar *uri,
+					   const gchar *group_name)
+{
+	struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private, uri);
+	const GSList *entry;
+
+	if (!buddy)
+		return(sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
+					       uri,
+					       group_name));
+
+	for (entry = buddy_backend_buddies(sipe_private, buddy);
+	     entry;
+	     entry = entry->next) {
+		gchar *name;
+		gboolean found;
+
+		if (!group_name)
+			return(entry->data);
+
+		name  = sipe_backend_buddy_get_group_name(SIPE_CORE_PUBLIC,
+							  entry->data);
+		found = sipe_strequal(name, group_name);
+		g_free(name);
+		if (found)
+			return(entry->data);
+	}
+
+	return(NULL);
+}
+
+sipe_backend_buddy sipe_buddy_backend_add(struct sipe_core_private *sipe_private,
+					  const gchar *uri,
+					  const gchar *alias,
+					  const gchar *group_name)
+{
+	struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private, uri);
+	sipe_backend_buddy bb = sipe_backend_buddy_add(SIPE_CORE_PUBLIC,
+						       uri,
+						       alias,
+						       group_name);
+
+	if (bb && buddy && buddy->backend_buddies_valid)
+		buddy->backend_buddies = g_slist_prepend(buddy->backend_buddies,
+							 bb);
+
+	return(bb);
+}
+
+void sipe_buddy_backend_remove(struct sipe_core_private *sipe_private,
+			       const gchar *uri,
+			       sipe_backend_buddy bb)
+{
+	struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private, uri);
+
+	if (buddy)
+		buddy->backend_buddies = g_slist_remove(buddy->backend_buddies,
+							bb);
+	sipe_backend_buddy_remove(SIPE_CORE_PUBLIC, bb);
+}
+
 void sipe_buddy_add_to_group(struct sipe_core_private *sipe_private,
 			     struct sipe_buddy *buddy,
 			     struct sipe_group *group,
@@ -170,12 +290,12 @@ void sipe_buddy_add_to_group(struct sipe_core_private *sipe_private,
 {
 	const gchar *uri = buddy->name;
 	const gchar *group_name = group->name;
-	sipe_backend_buddy bb = sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
+	sipe_backend_buddy bb = sipe_buddy_backend_find(sipe_private,
 							uri,
 							group_name);
 
 	if (!bb) {
-		bb = sipe_backend_buddy_add(SIPE_CORE_PUBLIC,
+		bb = sipe_buddy_backend_add(sipe_private,
 					    uri,
 					    alias,
 					    group_name);
@@ -269,14 +389,15 @@ void sipe_buddy_update_groups(struct sipe_core_private *sipe_private,
 
 		/* old group NOT found in new list? */
 		if (g_slist_find(new_groups, group) == NULL) {
-			sipe_backend_buddy oldb = sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
+			sipe_backend_buddy oldb = sipe_buddy_backend_find(sipe_private,
 									  uri,
 									  group->name);
 			SIPE_DEBUG_INFO("sipe_buddy_update_groups: removing buddy %s from group '%s'",
 					uri, group->name);
 			/* this should never be NULL */
 			if (oldb)
-				sipe_backend_buddy_remove(SIPE_CORE_PUBLIC,
+				sipe_buddy_backend_remove(sipe_private,
+							  uri,
 							  oldb);
 			buddy_group_remove(buddy, bgd);
 		}
@@ -331,7 +452,7 @@ void sipe_buddy_cleanup_local_list(struct sipe_core_private *sipe_private)
 		if (!is_buddy_in_group(buddy, gname)) {
 			SIPE_DEBUG_INFO("sipe_buddy_cleanup_local_list: REMOVING '%s' from local group '%s', as buddy is not in that group on remote contact list",
 					bname, gname);
-			sipe_backend_buddy_remove(SIPE_CORE_PUBLIC, bb);
+			sipe_buddy_backend_remove(sipe_private, bname, bb);
 		}
 
 		g_free(gname);
@@ -346,8 +467,18 @@ void sipe_buddy_cleanup_local_list(struct sipe_core_private *sipe_private)
 struct sipe_buddy *sipe_buddy_find_by_uri(struct sipe_core_private *sipe_private,
 					  const gchar *uri)
 {
+	gchar buffer[BUDDY_KEY_BUFFER_SIZE];
+	gchar *key;
+	struct sipe_buddy *buddy;
+
 	if (!uri) return(NULL);
-	return(g_hash_table_lookup(sipe_private->buddies->uri, uri));
+
+	key   = sipe_utils_uri_key(uri, buffer, sizeof(buffer));
+	buddy = g_hash_table_lookup(sipe_private->buddies->uri, key);
+	if (key != buffer)
+		g_free(key);
+
+	return(buddy);
 }
 
 struct sipe_buddy *sipe_buddy_find_by_exchange_key(struct sipe_core_private *sipe_private,
@@ -357,13 +488,33 @@ struct sipe_buddy *sipe_buddy_find_by_exchange_key(struct sipe_core_private *sip
 				   exchange_key));
 }
 
+struct buddy_foreach_data {
+	GHFunc callback;
+	gpointer callback_data;
+};
+
+/* callbacks expect the buddy name, not the hash table key */
+static void buddy_foreach_cb(SIPE_UNUSED_PARAMETER gpointer key,
+			     gpointer value,
+			     gpointer user_data)
+{
+	struct buddy_foreach_data *data = user_data;
+	struct sipe_buddy *buddy = value;
+
+	(*data->callback)(buddy->name, buddy, data->callback_data);
+}
+
 void sipe_buddy_foreach(struct sipe_core_private *sipe_private,
 			GHFunc callback,
 			gpointer callback_data)
 {
+	struct buddy_foreach_data data;
+
+	data.callback      = callback;
+	data.callback_data = callback_data;
 	g_hash_table_foreach(sipe_private->buddies->uri,
-			     callback,
-			     callback_data);
+			     buddy_foreach_cb,
+			     &data);
 }
 
 static void buddy_free(struct sipe_buddy *buddy)
@@ -372,7 +523,7 @@ static void buddy_free(struct sipe_buddy *buddy)
 	 /*
 	  * We are calling g_hash_table_foreach_steal(). That means that no
 	  * key/value deallocation functions are called. Therefore the glib
-	  * hash code does not touch the key (buddy->name) or value (buddy)
+	  * hash code does not touch the key (buddy->key) or value (buddy)
 	  * of the to-be-deleted hash node at all. It follows that we
 	  *
 	  *   - MUST free the memory for the key ourselves and
@@ -382,6 +533,8 @@ static void buddy_free(struct sipe_buddy *buddy)
 	  *             crashes with SIGTRAP when closing. You'll have to live
 	  *             with the memory leak until this is fixed.
 	  */
+	if (buddy->key != buddy->name)
+		g_free(buddy->key);
 	g_free(buddy->name);
 #endif
 	g_free(buddy->exchange_key);
@@ -400,6 +553,7 @@ static void buddy_free(struct sipe_buddy *buddy)
 
 	g_free(buddy->device_name);
 	sipe_utils_slist_free_full(buddy->groups, buddy_group_free);
+	g_slist_free(buddy->backend_buddies);
 	g_free(buddy);
 }
 
@@ -429,6 +583,7 @@ void sipe_buddy_free(struct sipe_core_private *sipe_private)
 		photo_response_data_free(data);
 	}
 
+	g_hash_table_destroy(buddies->deltas);
 	g_hash_table_destroy(buddies->uri);
 	g_hash_table_destroy(buddies->exchange_key);
 	g_free(buddies);
@@ -466,13 +621,11 @@ static gboolean buddy_check_obsolete_flag(SIPE_UNUSED_PARAMETER gpointer key,
 
 	if (buddy->is_obsolete) {
 		/* all backend buddies in different groups */
-		GSList *buddies = sipe_backend_buddy_find_all(SIPE_CORE_PUBLIC,
-							      uri,
-							      NULL);
-		GSList *entry = buddies;
+		const GSList *entry = buddy_backend_buddies(sipe_private,
+							    buddy);
 
 		SIPE_DEBUG_INFO("buddy_check_obsolete_flag: REMOVING %d backend buddies for '%s'",
-				g_slist_length(buddies),
+				g_slist_length((GSList *) entry),
 				uri);
 
 		while (entry) {
@@ -480,8 +633,8 @@ static gboolean buddy_check_obsolete_flag(SIPE_UNUSED_PARAMETER gpointer key,
 						  entry->data);
 			entry = entry->next;
 		}
-		g_slist_free(buddies);
 
+		/* frees the backend buddy cache */
 		buddy_free(buddy);
 		/* return TRUE as the key/value have already been deleted */
 		return(TRUE);
@@ -497,14 +650,15 @@ static gboolean buddy_check_obsolete_flag(SIPE_UNUSED_PARAMETER gpointer key,
 
 			if (bgd->is_obsolete) {
 				const struct sipe_group *group = bgd->group;
-				sipe_backend_buddy oldb = sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
+				sipe_backend_buddy oldb = sipe_buddy_backend_find(sipe_private,
 										  uri,
 										  group->name);
 				SIPE_DEBUG_INFO("buddy_check_obsolete_flag: removing buddy '%s' from group '%s'",
 						uri, group->name);
 				/* this should never be NULL */
 				if (oldb)
-					sipe_backend_buddy_remove(SIPE_CORE_PUBLIC,
+					sipe_buddy_backend_remove(sipe_private,
+								  uri,
 								  oldb);
 				buddy_group_remove(buddy, bgd);
 			}
@@ -558,7 +712,7 @@ gchar *sipe_buddy_get_alias(struct sipe_core_private *sipe_private,
 {
 	sipe_backend_buddy pbuddy;
 	gchar *alias = NULL;
-	if ((pbuddy = sipe_backend_buddy_find(SIPE_CORE_PUBLIC, with, NULL))) {
+	if ((pbuddy = sipe_buddy_backend_find(sipe_private, with, NULL))) {
 		alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC, pbuddy);
 	}
 	return alias;
@@ -585,6 +739,9 @@ void sipe_core_buddy_group(struct sipe_core_public *sipe_public,
 		/* buddy not in roaming list */
 		return;
 
+	/* backend has added or moved a backend buddy */
+	buddy_backend_invalidate(buddy);
+
 	old_group = sipe_group_find_by_name(sipe_private, old_group_name);
 	if (old_group) {
 		sipe_buddy_remove_group(buddy, old_group);
@@ -682,17 +839,17 @@ void sipe_buddy_remove(struct sipe_core_private *sipe_private,
 	/* If the buddy still has groups, we need to delete backend buddies */
 	while (entry) {
 		const struct sipe_group *group = ((struct buddy_group_data *) entry->data)->group;
-		sipe_backend_buddy oldb = sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
+		sipe_backend_buddy oldb = sipe_buddy_backend_find(sipe_private,
 								  uri,
 								  group->name);
 		/* this should never be NULL */
 		if (oldb)
-			sipe_backend_buddy_remove(SIPE_CORE_PUBLIC, oldb);
+			sipe_buddy_backend_remove(sipe_private, uri, oldb);
 
 		entry = entry->next;
 	}
 
-	g_hash_table_remove(buddies->uri, uri);
+	g_hash_table_remove(buddies->uri, buddy->key);
 	if (buddy->exchange_key)
 		g_hash_table_remove(buddies->exchange_key,
 				    buddy->exchange_key);
@@ -751,6 +908,9 @@ void sipe_core_buddy_remove(struct sipe_core_public *sipe_public,
 		} else
 			/* updates groups on server */
 			sipe_group_update_buddy(sipe_private, buddy);
+
+		/* backend deletes the backend buddy after we return */
+		buddy_backend_invalidate(buddy);
 	}
 }
 
@@ -859,56 +1019,283 @@ void sipe_core_buddy_tooltip_info(struct sipe_core_public *sipe_public,
 	}
 }
 
+static void buddy_update_property(struct sipe_core_private *sipe_private,
+				  const gchar *uri,
+				  sipe_backend_buddy p_buddy,
+				  sipe_buddy_info_fields propkey,
+				  const gchar *property_value)
+{
+	/* for Display Name */
+	if (propkey == SIPE_BUDDY_INFO_DISPLAY_NAME) {
+		gchar *alias;
+		alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC, p_buddy);
+		if (property_value && sipe_is_bad_alias(uri, alias)) {
+			SIPE_DEBUG_INFO("Replacing alias for %s with %s", uri, property_value);
+			sipe_backend_buddy_set_alias(SIPE_CORE_PUBLIC, p_buddy, property_value);
+		}
+		g_free(alias);
+
+		alias = sipe_backend_buddy_get_server_alias(SIPE_CORE_PUBLIC, p_buddy);
+		if (!is_empty(property_value) &&
+		   (!sipe_strequal(property_value, alias) || is_empty(alias)) )
+		{
+			SIPE_DEBUG_INFO("Replacing service alias for %s with %s", uri, property_value);
+			sipe_backend_buddy_set_server_alias(SIPE_CORE_PUBLIC, p_buddy, property_value);
+		}
+		g_free(alias);
+	}
+	/* for other properties */
+	else {
+		if (!is_empty(property_value)) {
+			gchar *prop_str = sipe_backend_buddy_get_string(SIPE_CORE_PUBLIC, p_buddy, propkey);
+			if (!prop_str || !sipe_strcase_equal(prop_str, property_value)) {
+				sipe_backend_buddy_set_string(SIPE_CORE_PUBLIC, p_buddy, propkey, property_value);
+			}
+			g_free(prop_str);
+		}
+	}
+}
+
 void sipe_buddy_update_property(struct sipe_core_private *sipe_private,
 				const char *uri,
 				sipe_buddy_info_fields propkey,
 				char *property_value)
 {
-	GSList *buddies, *entry;
+	struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private, uri);
+	GSList *buddies = NULL;
+	const GSList *entry;
 
 	if (property_value)
 		property_value = g_strstrip(property_value);
 
-	entry = buddies = sipe_backend_buddy_find_all(SIPE_CORE_PUBLIC, uri, NULL); /* all buddies in different groups */
+	if (buddy)
+		entry = buddy_backend_buddies(sipe_private, buddy);
+	else
+		entry = buddies = sipe_backend_buddy_find_all(SIPE_CORE_PUBLIC, uri, NULL); /* all buddies in different groups */
 	while (entry) {
-		gchar *prop_str;
-		sipe_backend_buddy p_buddy = entry->data;
-
-		/* for Display Name */
-		if (propkey == SIPE_BUDDY_INFO_DISPLAY_NAME) {
-			gchar *alias;
-			alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC, p_buddy);
-			if (property_value && sipe_is_bad_alias(uri, alias)) {
-				SIPE_DEBUG_INFO("Replacing alias for %s with %s", uri, property_value);
-				sipe_backend_buddy_set_alias(SIPE_CORE_PUBLIC, p_buddy, property_value);
-			}
-			g_free(alias);
-
-			alias = sipe_backend_buddy_get_server_alias(SIPE_CORE_PUBLIC, p_buddy);
-			if (!is_empty(property_value) &&
-			   (!sipe_strequal(property_value, alias) || is_empty(alias)) )
-			{
-				SIPE_DEBUG_INFO("Replacing service alias for %s with %s", uri, property_value);
-				sipe_backend_buddy_set_server_alias(SIPE_CORE_PUBLIC, p_buddy, property_value);
-			}
-			g_free(alias);
-		}
-		/* for other properties */
-		else {
-			if (!is_empty(property_value)) {
-				prop_str = sipe_backend_buddy_get_string(SIPE_CORE_PUBLIC, p_buddy, propkey);
-				if (!prop_str || !sipe_strcase_equal(prop_str, property_value)) {
-					sipe_backend_buddy_set_string(SIPE_CORE_PUBLIC, p_buddy, propkey, property_value);
-				}
-				g_free(prop_str);
-			}
-		}
-
+		buddy_update_property(sipe_private,
+				      uri,
+				      entry->data,
+				      propkey,
+				      property_value);
 		entry = entry->next;
 	}
 	g_slist_free(buddies);
 }
 
+void sipe_buddy_phone_fields(const gchar *phone_type,
+			     sipe_buddy_info_fields *phone_node,
+			     sipe_buddy_info_fields *phone_display_node)
+{
+	*phone_node = SIPE_BUDDY_INFO_WORK_PHONE; /* work phone by default */
+	*phone_display_node = SIPE_BUDDY_INFO_WORK_PHONE_DISPLAY; /* work phone by default */
+
+	if ((sipe_strequal(phone_type, "mobile") ||  sipe_strequal(phone_type, "cell"))) {
+		*phone_node = SIPE_BUDDY_INFO_MOBILE_PHONE;
+		*phone_display_node = SIPE_BUDDY_INFO_MOBILE_PHONE_DISPLAY;
+	} else if (sipe_strequal(phone_type, "home")) {
+		*phone_node = SIPE_BUDDY_INFO_HOME_PHONE;
+		*phone_display_node = SIPE_BUDDY_INFO_HOME_PHONE_DISPLAY;
+	} else if (sipe_strequal(phone_type, "other")) {
+		*phone_node = SIPE_BUDDY_INFO_OTHER_PHONE;
+		*phone_display_node = SIPE_BUDDY_INFO_OTHER_PHONE_DISPLAY;
+	} else if (sipe_strequal(phone_type, "custom1")) {
+		*phone_node = SIPE_BUDDY_INFO_CUSTOM1_PHONE;
+		*phone_display_node = SIPE_BUDDY_INFO_CUSTOM1_PHONE_DISPLAY;
+	}
+}
+
+/*
+ * Presence deltas
+ *
+ * Each call of sipe_buddy_update_property() has to look up all backend
+ * buddies for the URI, which means a scan of the whole buddy list for some
+ * backends. Presence NOTIFYs therefore only record their changes in a
+ * delta per buddy. The deltas are applied by an idle action, i.e. a burst
+ * of NOTIFYs results in one lookup, one status update and one property
+ * refresh per buddy.
+ */
+#define BUDDY_DELTA_ACTION     "<+buddy-deltas>"
+/* all fields before SIPE_BUDDY_INFO_ALIAS are buddy properties */
+#define BUDDY_DELTA_PROPERTIES SIPE_BUDDY_INFO_ALIAS
+
+struct sipe_buddy_delta {
+	gchar *uri;
+	gchar *properties[BUDDY_DELTA_PROPERTIES];
+	guint activity;
+	time_t last_active;
+	gboolean has_activity;
+	gboolean update_status;
+};
+
+static void buddy_delta_free(gpointer data)
+{
+	struct sipe_buddy_delta *delta = data;
+	guint i;
+
+	for (i = 0; i < BUDDY_DELTA_PROPERTIES; i++)
+		g_free(delta->properties[i]);
+	g_free(delta->uri);
+	g_free(delta);
+}
+
+static void buddy_delta_apply(struct sipe_core_private *sipe_private,
+			      struct sipe_buddy_delta *delta)
+{
+	const gchar *uri = delta->uri;
+	struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private, uri);
+	const GSList *entry;
+
+	/* buddy was removed while the delta was pending */
+	if (!buddy)
+		return;
+
+	for (entry = buddy_backend_buddies(sipe_private, buddy);
+	     entry;
+	     entry = entry->next) {
+		guint i;
+
+		for (i = 0; i < BUDDY_DELTA_PROPERTIES; i++)
+			if (delta->properties[i])
+				buddy_update_property(sipe_private,
+						      uri,
+						      entry->data,
+						      i,
+						      delta->properties[i]);
+	}
+
+	if (delta->update_status) {
+		/* no status in the updates: re-apply contact's current status */
+		guint activity = delta->has_activity ?
+			delta->activity :
+			sipe_backend_buddy_get_status(SIPE_CORE_PUBLIC, uri);
+
+		sipe_core_buddy_got_status(SIPE_CORE_PUBLIC,
+					   uri,
+					   activity,
+					   delta->last_active);
+	}
+
+	sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
+}
+
+static void buddy_deltas_apply(SIPE_UNUSED_PARAMETER gpointer key,
+			       gpointer value,
+			       gpointer user_data)
+{
+	buddy_delta_apply(user_data, value);
+}
+
+void sipe_buddy_deltas_flush(struct sipe_core_private *sipe_private)
+{
+	struct sipe_buddies *buddies = sipe_private->buddies;
+	GHashTable *deltas = buddies->deltas;
+
+	if (g_hash_table_size(deltas) == 0)
+		return;
+
+	SIPE_DEBUG_INFO("sipe_buddy_deltas_flush: %d buddies",
+			g_hash_table_size(deltas));
+
+	/* backend callbacks may record new deltas */
+	buddies->deltas = g_hash_table_new_full(g_str_hash,
+						g_str_equal,
+						g_free,
+						buddy_delta_free);
+	g_hash_table_foreach(deltas, buddy_deltas_apply, sipe_private);
+	g_hash_table_destroy(deltas);
+}
+
+static void buddy_deltas_flush_cb(struct sipe_core_private *sipe_private,
+				  SIPE_UNUSED_PARAMETER gpointer data)
+{
+	sipe_buddy_deltas_flush(sipe_private);
+}
+
+struct sipe_buddy_delta *sipe_buddy_delta_new(void)
+{
+	return(g_new0(struct sipe_buddy_delta, 1));
+}
+
+void sipe_buddy_delta_free(struct sipe_buddy_delta *delta)
+{
+	if (delta)
+		buddy_delta_free(delta);
+}
+
+void sipe_buddy_delta_commit(struct sipe_core_private *sipe_private,
+			     struct sipe_buddy *buddy,
+			     struct sipe_buddy_delta *changes)
+{
+	GHashTable *deltas = sipe_private->buddies->deltas;
+	struct sipe_buddy_delta *delta = g_hash_table_lookup(deltas,
+							     buddy->key);
+	guint i;
+
+	if (!delta) {
+		delta = g_new0(struct sipe_buddy_delta, 1);
+		delta->uri = g_strdup(buddy->name);
+		g_hash_table_insert(deltas, g_strdup(buddy->key), delta);
+
+		/*
+		 * (Re-)schedule for every new delta, because a pending
+		 * action is cancelled when the connection is cleaned up.
+		 */
+		sipe_schedule_mseconds(sipe_private,
+				       BUDDY_DELTA_ACTION,
+				       NULL,
+				       0,
+				       buddy_deltas_flush_cb,
+				       NULL);
+	}
+
+	for (i = 0; i < BUDDY_DELTA_PROPERTIES; i++)
+		sipe_buddy_delta_property(delta, i, changes->properties[i]);
+	if (changes->has_activity)
+		sipe_buddy_delta_status(delta,
+					changes->activity,
+					changes->last_active);
+	else if (changes->update_status)
+		sipe_buddy_delta_refresh_status(delta);
+
+	buddy_delta_free(changes);
+}
+
+void sipe_buddy_delta_property(struct sipe_buddy_delta *delta,
+			       sipe_buddy_info_fields propkey,
+			       const gchar *property_value)
+{
+	gchar *value;
+
+	if (!property_value || (propkey >= BUDDY_DELTA_PROPERTIES))
+		return;
+
+	value = g_strstrip(g_strdup(property_value));
+
+	/* an empty value doesn't overwrite a pending one */
+	if (is_empty(value) && delta->properties[propkey]) {
+		g_free(value);
+		return;
+	}
+
+	g_free(delta->properties[propkey]);
+	delta->properties[propkey] = value;
+}
+
+void sipe_buddy_delta_status(struct sipe_buddy_delta *delta,
+			     guint activity,
+			     time_t last_active)
+{
+	delta->activity      = activity;
+	delta->last_active   = last_active;
+	delta->has_activity  = TRUE;
+	delta->update_status = TRUE;
+}
+
+void sipe_buddy_delta_refresh_status(struct sipe_buddy_delta *delta)
+{
+	delta->update_status = TRUE;
+}
 
 struct ms_dlx_data;
 struct ms_dlx_data {
@@ -992,6 +1379,22 @@ static gchar * prepare_buddy_search_query(GSList *query_rows, gboolean use_dlx)
 	return query;
 }
 
+static void ms_dlx_response(struct sipe_core_private *sipe_private,
+			    const gchar *uri,
+			    const gchar *raw,
+			    sipe_xml *soap_body,
+			    gpointer callback_data)
+{
+	struct ms_dlx_data *mdd = callback_data;
+
+	/* request failed, e.g. Web Ticket was rejected: don't reuse it */
+	if (uri && !soap_body)
+		sipe_webticket_invalidate(sipe_private,
+					  sipe_private->dlx_uri);
+
+	mdd->callback(sipe_private, uri, raw, soap_body, mdd);
+}
+
 static void ms_dlx_webticket(struct sipe_core_private *sipe_private,
 			     const gchar *base_uri,
 			     const gchar *auth_uri,
@@ -1033,7 +1436,7 @@ static void ms_dlx_webticket(struct sipe_core_private *sipe_private,
 					      wsse_security,
 					      search,
 					      mdd->max_returns,
-					      mdd->callback,
+					      ms_dlx_response,
 					      mdd)) {
 
 			/* keep webticket security token for potential further use */
@@ -1439,7 +1842,7 @@ static void get_info_finalize(struct sipe_core_private *sipe_private,
 	if (!info)
 		return;
 
-	bbuddy = sipe_backend_buddy_find(SIPE_CORE_PUBLIC, uri, NULL);
+	bbuddy = sipe_buddy_backend_find(sipe_private, uri, NULL);
 
 	if (is_empty(server_alias)) {
 		value = sipe_backend_buddy_get_server_alias(SIPE_CORE_PUBLIC,
@@ -1945,6 +2348,8 @@ static void photo_response_data_finalize(struct sipe_core_private *sipe_private,
 
 		sipe_private->buddies->pending_photo_requests =
 			g_slist_append(sipe_private->buddies->pending_photo_requests, data);
+		/* photos are already compressed */
+		sipe_http_request_no_compression(data->request);
 		sipe_http_request_ready(data->request);
 	} else {
 		photo_response_data_free(data);
@@ -2136,11 +2541,11 @@ static void buddy_fetch_photo(struct sipe_core_private *sipe_private,
 	}
 }
 
-static void buddy_refresh_photos_cb(gpointer uri,
-				    SIPE_UNUSED_PARAMETER gpointer value,
+static void buddy_refresh_photos_cb(SIPE_UNUSED_PARAMETER gpointer key,
+				    gpointer value,
 				    gpointer sipe_private)
 {
-	buddy_fetch_photo(sipe_private, uri);
+	buddy_fetch_photo(sipe_private, ((struct sipe_buddy *) value)->name);
 }
 
 void sipe_buddy_refresh_photos(struct sipe_core_private *sipe_private)
@@ -2184,7 +2589,7 @@ void sipe_core_buddy_new_chat(struct sipe_core_public *sipe_public,
 void sipe_core_buddy_send_email(struct sipe_core_public *sipe_public,
 				const gchar *who)
 {
-	sipe_backend_buddy buddy = sipe_backend_buddy_find(sipe_public,
+	sipe_backend_buddy buddy = sipe_buddy_backend_find(SIPE_CORE_PRIVATE,
 							   who,
 							   NULL);
 	gchar *email = sipe_backend_buddy_get_string(sipe_public,
@@ -2252,7 +2657,7 @@ struct sipe_backend_buddy_menu *sipe_core_buddy_create_menu(struct sipe_core_pub
 							    struct sipe_backend_buddy_menu *menu)
 {
 	struct sipe_core_private *sipe_private = SIPE_CORE_PRIVATE;
-	sipe_backend_buddy buddy = sipe_backend_buddy_find(sipe_public,
+	sipe_backend_buddy buddy = sipe_buddy_backend_find(sipe_private,
 							   buddy_name,
 							   NULL);
 	gchar *self = sip_uri_self(sipe_private);
@@ -2420,42 +2825,17 @@ guint sipe_buddy_count(struct sipe_core_private *sipe_private)
 	return(g_hash_table_size(sipe_private->buddies->uri));
 }
 
-static guint sipe_ht_hash_nick(const char *nick)
-{
-	char *lc = g_utf8_strdown(nick, -1);
-	guint bucket = g_str_hash(lc);
-	g_free(lc);
-
-	return bucket;
-}
-
-static gboolean sipe_ht_equals_nick(const char *nick1, const char *nick2)
-{
-	char *nick1_norm = NULL;
-	char *nick2_norm = NULL;
-	gboolean equal;
-
-	if (nick1 == NULL && nick2 == NULL) return TRUE;
-	if (nick1 == NULL || nick2 == NULL    ||
-	    !g_utf8_validate(nick1, -1, NULL) ||
-	    !g_utf8_validate(nick2, -1, NULL)) return FALSE;
-
-	nick1_norm = g_utf8_casefold(nick1, -1);
-	nick2_norm = g_utf8_casefold(nick2, -1);
-	equal = g_utf8_collate(nick1_norm, nick2_norm) == 0;
-	g_free(nick2_norm);
-	g_free(nick1_norm);
-
-	return equal;
-}
-
 void sipe_buddy_init(struct sipe_core_private *sipe_private)
 {
 	struct sipe_buddies *buddies = g_new0(struct sipe_buddies, 1);
-	buddies->uri          = g_hash_table_new((GHashFunc)  sipe_ht_hash_nick,
-						 (GEqualFunc) sipe_ht_equals_nick);
+	buddies->uri          = g_hash_table_new(g_str_hash,
+						 g_str_equal);
 	buddies->exchange_key = g_hash_table_new(g_str_hash,
 						 g_str_equal);
+	buddies->deltas       = g_hash_table_new_full(g_str_hash,
+						      g_str_equal,
+						      g_free,
+						      buddy_delta_free);
 	sipe_private->buddies = buddies;
 }
 
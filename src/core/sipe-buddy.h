@@ -22,12 +22,15 @@
 
 /* Forward declarations */
 struct sipe_backend_search_results;
+struct sipe_buddy_delta;
+struct sipe_cal_free_busy;
 struct sipe_cal_working_hours;
 struct sipe_core_private;
 struct sipe_group;
 
 struct sipe_buddy {
 	gchar *name;
+	gchar *key; /* normalized name for lookups, may be equal to name */
 	gchar *exchange_key;
 	gchar *change_key;
 	gchar *activity;
@@ -46,7 +49,8 @@ struct sipe_buddy {
 	gchar *cal_start_time;
 	int cal_granularity;
 	gchar *cal_free_busy_base64;
-	gchar *cal_free_busy;
+	/* decoded cal_free_busy_base64, single allocation for g_free() */
+	struct sipe_cal_free_busy *cal_free_busy;
 	time_t cal_free_busy_published;
 	/* for 2005 systems */
 	int user_avail;
@@ -59,6 +63,9 @@ struct sipe_buddy {
 
 	gchar *device_name;
 	GSList *groups;
+	/* cached backend buddies, see sipe_buddy_backend_find() */
+	GSList *backend_buddies;
+	gboolean backend_buddies_valid;
 	 /** flag to control sending 'context' element in 2007 subscriptions */
 	gboolean just_added;
 	gboolean is_obsolete;
@@ -94,6 +101,48 @@ struct sipe_buddy *sipe_buddy_add(struct sipe_core_private *sipe_private,
 				  const gchar *exchange_key,
 				  const gchar *change_key);
 
+/**
+ * Find a backend buddy
+ *
+ * Replacement for @c sipe_backend_buddy_find() that uses the backend buddy
+ * cache when the URI is in our buddy list.
+ *
+ * @param sipe_private SIPE core data
+ * @param uri          SIP URI of a buddy
+ * @param group_name   group to look in, or @c NULL for any group
+ *
+ * @return backend buddy or @c NULL
+ */
+sipe_backend_buddy sipe_buddy_backend_find(struct sipe_core_private *sipe_private,
+					   const gchar *uri,
+					   const gchar *group_name);
+
+/**
+ * Add a backend buddy and update the backend buddy cache
+ *
+ * @param sipe_private SIPE core data
+ * @param uri          SIP URI of a buddy
+ * @param alias        alias of the buddy (may be @c NULL)
+ * @param group_name   group to add the buddy to
+ *
+ * @return backend buddy or @c NULL
+ */
+sipe_backend_buddy sipe_buddy_backend_add(struct sipe_core_private *sipe_private,
+					  const gchar *uri,
+					  const gchar *alias,
+					  const gchar *group_name);
+
+/**
+ * Remove a backend buddy and update the backend buddy cache
+ *
+ * @param sipe_private SIPE core data
+ * @param uri          SIP URI of a buddy
+ * @param bb           backend buddy
+ */
+void sipe_buddy_backend_remove(struct sipe_core_private *sipe_private,
+			       const gchar *uri,
+			       sipe_backend_buddy bb);
+
 /**
  * Add buddy to a group.
  *
@@ -226,6 +275,86 @@ void sipe_buddy_update_property(struct sipe_core_private *sipe_private,
 				sipe_buddy_info_fields propkey,
 				gchar *property_value);
 
+/**
+ * Map phone type to buddy properties
+ * Suitable for both 2005 and 2007 systems.
+ *
+ * @param phone_type         type attribute of the phone element (may be @c NULL)
+ * @param phone_node         [out] property for the phone number
+ * @param phone_display_node [out] property for the display string
+ */
+void sipe_buddy_phone_fields(const gchar *phone_type,
+			     sipe_buddy_info_fields *phone_node,
+			     sipe_buddy_info_fields *phone_display_node);
+
+/**
+ * Create an empty set of presence changes, e.g. for one NOTIFY document
+ *
+ * @return delta. Must be committed with @c sipe_buddy_delta_commit() or
+ *         freed with @c sipe_buddy_delta_free().
+ */
+struct sipe_buddy_delta *sipe_buddy_delta_new(void);
+
+/**
+ * Drop presence changes without applying them, e.g. after a parse error
+ *
+ * @param delta changes (may be @c NULL)
+ */
+void sipe_buddy_delta_free(struct sipe_buddy_delta *delta);
+
+/**
+ * Add presence changes to the pending changes for a buddy
+ *
+ * Pending changes are applied to the backend by an idle action, i.e. all
+ * changes from a burst of presence updates are applied with one backend
+ * buddy lookup and one property refresh.
+ *
+ * @param sipe_private SIPE core data
+ * @param buddy        sipe_buddy data structure
+ * @param changes      changes from @c sipe_buddy_delta_new(). Will be freed.
+ */
+void sipe_buddy_delta_commit(struct sipe_core_private *sipe_private,
+			     struct sipe_buddy *buddy,
+			     struct sipe_buddy_delta *changes);
+
+/**
+ * Record a buddy property change
+ *
+ * An empty value does not overwrite a previously recorded value.
+ *
+ * @param delta          pending changes
+ * @param propkey        property id (see sipe-backend.h)
+ * @param property_value new value for the property (may be @c NULL)
+ */
+void sipe_buddy_delta_property(struct sipe_buddy_delta *delta,
+			       sipe_buddy_info_fields propkey,
+			       const gchar *property_value);
+
+/**
+ * Record a buddy status change
+ *
+ * @param delta       pending changes
+ * @param activity    new activity
+ * @param last_active time of last activity (may be 0)
+ */
+void sipe_buddy_delta_status(struct sipe_buddy_delta *delta,
+			     guint activity,
+			     time_t last_active);
+
+/**
+ * Record that the buddy status must be re-applied, e.g. after a note change
+ *
+ * @param delta pending changes
+ */
+void sipe_buddy_delta_refresh_status(struct sipe_buddy_delta *delta);
+
+/**
+ * Apply all pending presence changes immediately
+ *
+ * @param sipe_private SIPE core data
+ */
+void sipe_buddy_deltas_flush(struct sipe_core_private *sipe_private);
+
 /**
  * Update the buddy photo with given SIP URI. If hash is the same
  * as the cached one then the fetching of the photo is skipped.
@@ -0,0 +1,370 @@
+/**
+ * @file sipe-cache-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "sipe-cache.c"
+
+#include "sip-transport.h"
+#include "uuid.h"
+
+/*
+ * Stubs
+ */
+gboolean sipe_backend_debug_enabled(void)
+{
+	return(TRUE);
+}
+
+void sipe_backend_debug_literal(sipe_debug_level level,
+				const gchar *msg)
+{
+	printf("DEBUG(%d): %s\n", level, msg);
+}
+
+void sipe_backend_debug(sipe_debug_level level,
+			const gchar *format,
+			...)
+{
+	va_list ap;
+	gchar *newformat = g_strdup_printf("DEBUG(%d): %s\n", level, format);
+
+	va_start(ap, format);
+	vprintf(newformat, ap);
+	va_end(ap);
+
+	g_free(newformat);
+}
+
+void sipe_schedule_seconds(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			   SIPE_UNUSED_PARAMETER const gchar *name,
+			   SIPE_UNUSED_PARAMETER gpointer payload,
+			   SIPE_UNUSED_PARAMETER guint seconds,
+			   SIPE_UNUSED_PARAMETER sipe_schedule_action action,
+			   SIPE_UNUSED_PARAMETER GDestroyNotify destroy)
+{
+}
+
+const gchar *sip_transport_epid(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private)
+{
+	return(NULL);
+}
+
+const gchar *sip_transport_ip_address(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private)
+{
+	return(NULL);
+}
+
+char *generateUUIDfromEPID(SIPE_UNUSED_PARAMETER const gchar *epid)
+{
+	return(NULL);
+}
+
+char *sipe_get_epid(SIPE_UNUSED_PARAMETER const char *self_sip_uri,
+		    SIPE_UNUSED_PARAMETER const char *hostname,
+		    SIPE_UNUSED_PARAMETER const char *ip_address)
+{
+	return(NULL);
+}
+
+/* needed when linking against NSS */
+void md4sum(const guchar *data, gsize length, guchar *digest);
+void md4sum(SIPE_UNUSED_PARAMETER const guchar *data,
+	    SIPE_UNUSED_PARAMETER gsize length,
+	    SIPE_UNUSED_PARAMETER guchar *digest)
+{
+}
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+static void check(gboolean ok,
+		  const gchar *name)
+{
+	if (ok) {
+		succeeded++;
+	} else {
+		SIPE_DEBUG_ERROR("FAILED: %s", name);
+		failed++;
+	}
+}
+
+/* RFC 6070: PKCS #5 PBKDF2 HMAC-SHA1 test vectors */
+static void pbkdf2(const gchar *password,
+		   gsize password_length,
+		   const gchar *salt,
+		   gsize salt_length,
+		   guint iterations,
+		   const gchar *expected)
+{
+	gsize length = strlen(expected) / 2;
+	guchar *out  = g_malloc(length);
+	gchar *hex;
+
+	cache_pbkdf2((const guchar *) password, password_length,
+		     (const guchar *) salt, salt_length,
+		     iterations,
+		     out, length);
+	hex = buff_to_hex_str(out, length);
+	if (g_ascii_strcasecmp(hex, expected) == 0) {
+		succeeded++;
+	} else {
+		SIPE_DEBUG_ERROR("FAILED: PBKDF2 c=%u expected '%s' got '%s'",
+				 iterations, expected, hex);
+		failed++;
+	}
+
+	g_free(hex);
+	g_free(out);
+}
+
+static struct sipe_cache *cache_new(struct sipe_core_private *sipe_private,
+				    const gchar *filename)
+{
+	struct sipe_cache *cache = g_new0(struct sipe_cache, 1);
+
+	cache->entries  = g_hash_table_new_full(g_str_hash,
+						g_str_equal,
+						g_free,
+						cache_entry_free);
+	cache->filename = g_strdup(filename);
+	sipe_private->cache = cache;
+
+	return(cache);
+}
+
+static void cache_add(struct sipe_cache *cache,
+		      const gchar *key,
+		      const gchar *value,
+		      time_t expires,
+		      gboolean secret)
+{
+	struct cache_entry *entry = g_new0(struct cache_entry, 1);
+
+	entry->value   = g_strdup(value);
+	entry->expires = expires;
+	entry->secret  = secret;
+	g_hash_table_insert(cache->entries, g_strdup(key), entry);
+	cache->dirty = TRUE;
+}
+
+static void check_entry(struct sipe_cache *cache,
+			const gchar *key,
+			const gchar *value,
+			gboolean secret)
+{
+	struct cache_entry *entry = g_hash_table_lookup(cache->entries, key);
+
+	if (entry &&
+	    sipe_strequal(entry->value, value) &&
+	    (entry->secret == secret)) {
+		succeeded++;
+	} else {
+		SIPE_DEBUG_ERROR("FAILED: entry '%s' expected '%s' got '%s'",
+				 key, value, entry ? entry->value : "<NULL>");
+		failed++;
+	}
+}
+
+/* AES-128-OFB: encrypting twice must restore the data */
+static void crypt_round_trip(struct sipe_cache *cache)
+{
+	static const gchar plaintext[] = "not a multiple of the AES block size";
+	guchar iv[SIPE_CACHE_IV_LENGTH];
+	guchar buffer[sizeof(plaintext)];
+
+	memset(iv, 0xa5, sizeof(iv));
+	memcpy(buffer, plaintext, sizeof(buffer));
+	cache_crypt(cache, iv, buffer, sizeof(buffer));
+	check(memcmp(buffer, plaintext, sizeof(buffer)) != 0,
+	      "encryption changes data");
+	cache_crypt(cache, iv, buffer, sizeof(buffer));
+	check(memcmp(buffer, plaintext, sizeof(buffer)) == 0,
+	      "decryption restores data");
+
+	/* zero length is a no-op */
+	cache_crypt(cache, iv, buffer, 0);
+	check(memcmp(buffer, plaintext, sizeof(buffer)) == 0,
+	      "zero length");
+}
+
+/* load cache file into a fresh cache, returns result of cache_load() */
+static gboolean reload(struct sipe_core_private *sipe_private,
+		       const gchar *filename)
+{
+	sipe_cache_free(sipe_private);
+	return(cache_load(sipe_private, cache_new(sipe_private, filename)));
+}
+
+/* overwrite cache file with a modified copy */
+static void modify(const gchar *filename,
+		   gsize offset,
+		   gsize length)
+{
+	gchar *data;
+	gsize size;
+
+	if (g_file_get_contents(filename, &data, &size, NULL)) {
+		if (offset < size)
+			data[offset] ^= 0x01;
+		g_file_set_contents(filename, data, MIN(length, size), NULL);
+		g_free(data);
+	}
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	struct sipe_core_private *sipe_private = g_new0(struct sipe_core_private, 1);
+	struct sipe_cache *cache;
+	gchar *filename = g_build_filename(g_get_tmp_dir(),
+					   "sipe-cache-tests.cache",
+					   NULL);
+	time_t expires  = time(NULL) + 3600;
+	gchar *data;
+	gsize size;
+
+	/* Initialization for crypto backend (test mode) */
+	sipe_crypto_init(FALSE);
+
+	/*
+	 * RFC 6070 PBKDF2 HMAC-SHA1 test vectors
+	 *
+	 * The vector with 16777216 iterations is left out as it takes too
+	 * long for a unit test.
+	 */
+	pbkdf2("password", 8, "salt", 4,    1,
+	       "0c60c80f961f0e71f3a9b524af6012062fe037a6");
+	pbkdf2("password", 8, "salt", 4,    2,
+	       "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957");
+	pbkdf2("password", 8, "salt", 4, 4096,
+	       "4b007901b765489abead49d926f721d065a429c1");
+	pbkdf2("passwordPASSWORDpassword", 24,
+	       "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36,
+	       4096,
+	       "3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038");
+	pbkdf2("pass\0word", 9, "sa\0lt", 5, 4096,
+	       "56fa6aa75548099dcc37d7f03425e0c3");
+
+	/* encryption/decryption round trip */
+	sipe_private->username = g_strdup("alice@example.com");
+	sipe_private->password = g_strdup("secret");
+	cache = cache_new(sipe_private, filename);
+	memset(cache->salt, 0x5a, SIPE_CACHE_SALT_LENGTH);
+	cache_derive_keys(sipe_private, cache);
+	crypt_round_trip(cache);
+
+	/* escape/parse round trip for entries */
+	cache_add(cache, "plain",           "value",                         expires, FALSE);
+	cache_add(cache, "key\twith\ttabs", "line 1\nline 2\r\n",            expires, FALSE);
+	cache_add(cache, "back\\slash",     "\"quoted\" \\ \x01 \xc3\xa4",   expires, FALSE);
+	cache_add(cache, "empty",           "",                              expires, FALSE);
+	cache_add(cache, "token",           "<Token>secret</Token>",         expires, TRUE);
+	cache_add(cache, "expired",         "old",               time(NULL) - 1, FALSE);
+	cache_save(sipe_private, cache);
+	check(g_file_test(filename, G_FILE_TEST_EXISTS), "cache file written");
+
+	check(reload(sipe_private, filename), "cache file loaded");
+	cache = sipe_private->cache;
+	check(g_hash_table_size(cache->entries) == 5, "number of entries");
+	check_entry(cache, "plain",           "value",                       FALSE);
+	check_entry(cache, "key\twith\ttabs", "line 1\nline 2\r\n",          FALSE);
+	check_entry(cache, "back\\slash",     "\"quoted\" \\ \x01 \xc3\xa4", FALSE);
+	check_entry(cache, "empty",           "",                            FALSE);
+	check_entry(cache, "token",           "<Token>secret</Token>",       TRUE);
+	check(g_hash_table_lookup(cache->entries, "expired") == NULL,
+	      "expired entry dropped");
+
+	/* cache file of another password */
+	g_free(sipe_private->password);
+	sipe_private->password = g_strdup("changed");
+	check(!reload(sipe_private, filename), "wrong password rejected");
+	check(g_hash_table_size(sipe_private->cache->entries) == 0,
+	      "no entries after wrong password");
+	g_free(sipe_private->password);
+	sipe_private->password = g_strdup("secret");
+
+	/* Single Sign-On: secret entries are not loaded */
+	g_free(sipe_private->password);
+	sipe_private->password = NULL;
+	cache = sipe_private->cache;
+	memcpy(cache->salt, "0123456789abcdef", SIPE_CACHE_SALT_LENGTH);
+	cache_derive_keys(sipe_private, cache);
+	cache_add(cache, "plain", "value",                 expires, FALSE);
+	cache_add(cache, "token", "<Token>secret</Token>", expires, TRUE);
+	cache_save(sipe_private, cache);
+	check(reload(sipe_private, filename), "SSO cache file loaded");
+	check_entry(sipe_private->cache, "plain", "value", FALSE);
+	check(g_hash_table_lookup(sipe_private->cache->entries, "token") == NULL,
+	      "secret entry not stored without password");
+
+	/* rewrite a valid file for the tampering tests */
+	cache_add(sipe_private->cache, "plain", "value", expires, FALSE);
+	cache_save(sipe_private, sipe_private->cache);
+	if (g_file_get_contents(filename, &data, &size, NULL))
+		g_free(data);
+
+	/* tampered ciphertext */
+	modify(filename, SIPE_CACHE_HEADER_LENGTH, size);
+	check(!reload(sipe_private, filename), "tampered ciphertext rejected");
+	modify(filename, SIPE_CACHE_HEADER_LENGTH, size);
+	check(reload(sipe_private, filename), "restored file loaded");
+
+	/* tampered HMAC */
+	modify(filename, size - 1, size);
+	check(!reload(sipe_private, filename), "tampered HMAC rejected");
+	modify(filename, size - 1, size);
+	check(reload(sipe_private, filename), "restored file loaded");
+
+	/* truncated file */
+	modify(filename, size, size - 1);
+	check(!reload(sipe_private, filename), "truncated file rejected");
+	modify(filename, size, SIPE_CACHE_HEADER_LENGTH + SIPE_DIGEST_HMAC_SHA1_LENGTH - 1);
+	check(!reload(sipe_private, filename), "short file rejected");
+	modify(filename, size, 0);
+	check(!reload(sipe_private, filename), "empty file rejected");
+	check(g_hash_table_size(sipe_private->cache->entries) == 0,
+	      "no entries after rejection");
+
+	sipe_private->cache->dirty = FALSE;
+	sipe_cache_free(sipe_private);
+	g_unlink(filename);
+	g_free(filename);
+	g_free(sipe_private->username);
+	g_free(sipe_private);
+
+	printf("Result: %d PASSED %d FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -0,0 +1,511 @@
+/**
+ * @file sipe-cache.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *
+ * Cache file format:
+ *
+ *   magic | salt (16) | IV (16) | encrypted entries | HMAC-SHA1 (20)
+ *
+ * Encryption is AES-128 in OFB mode, i.e. the key stream is the AES-CBC
+ * encryption of a zero buffer. The HMAC covers everything before it.
+ * Encryption & HMAC keys are derived with PBKDF2-HMAC-SHA1 from the
+ * account credentials and the salt. Salt & IV come from the crypto backend
+ * RNG. Without a password (SSO) the keys only depend on the user name, i.e.
+ * the file is merely obfuscated. Secret entries are therefore neither
+ * written nor accepted in that case.
+ *
+ * Decrypted entries are stored one per line:
+ *
+ *   escaped key <TAB> expires <TAB> secret <TAB> escaped value <LF>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-cache.h"
+#include "sipe-core.h"
+#include "sipe-core-private.h"
+#include "sipe-crypt.h"
+#include "sipe-digest.h"
+#include "sipe-schedule.h"
+#include "sipe-utils.h"
+
+#define SIPE_CACHE_MAGIC             "SIPE-CACHE-1"
+#define SIPE_CACHE_MAGIC_LENGTH      (sizeof(SIPE_CACHE_MAGIC) - 1)
+#define SIPE_CACHE_SALT_LENGTH       16
+#define SIPE_CACHE_IV_LENGTH         16 /* AES block size */
+#define SIPE_CACHE_AES_KEY_LENGTH    16
+#define SIPE_CACHE_HMAC_KEY_LENGTH   SIPE_DIGEST_HMAC_SHA1_LENGTH
+#define SIPE_CACHE_HEADER_LENGTH     (SIPE_CACHE_MAGIC_LENGTH + \
+				      SIPE_CACHE_SALT_LENGTH  + \
+				      SIPE_CACHE_IV_LENGTH)
+#define SIPE_CACHE_PBKDF2_ITERATIONS 4096
+#define SIPE_CACHE_SAVE_DELAY        5 /* seconds */
+
+struct cache_entry {
+	gchar *value;
+	time_t expires;
+	gboolean secret;
+};
+
+struct sipe_cache {
+	GHashTable *entries;
+	gchar *filename;
+	guchar salt[SIPE_CACHE_SALT_LENGTH];
+	guchar aes_key[SIPE_CACHE_AES_KEY_LENGTH];
+	guchar hmac_key[SIPE_CACHE_HMAC_KEY_LENGTH];
+	gboolean dirty;
+};
+
+static void cache_entry_free(gpointer data)
+{
+	struct cache_entry *entry = data;
+	g_free(entry->value);
+	g_free(entry);
+}
+
+/* PBKDF2 (RFC 2898) with HMAC-SHA1 as pseudo random function */
+static void cache_pbkdf2(const guchar *password,
+			 gsize password_length,
+			 const guchar *salt,
+			 gsize salt_length,
+			 guint iterations,
+			 guchar *out,
+			 gsize length)
+{
+	guchar *block = g_malloc(salt_length + 4);
+	guint32 index = 1;
+
+	memcpy(block, salt, salt_length);
+
+	while (length) {
+		guchar u[SIPE_DIGEST_HMAC_SHA1_LENGTH];
+		guchar t[SIPE_DIGEST_HMAC_SHA1_LENGTH];
+		gsize copy = MIN(length, SIPE_DIGEST_HMAC_SHA1_LENGTH);
+		guint i;
+
+		/* U_1 = PRF(P, S || INT(i)) */
+		block[salt_length]     = index >> 24;
+		block[salt_length + 1] = index >> 16;
+		block[salt_length + 2] = index >> 8;
+		block[salt_length + 3] = index;
+		sipe_digest_hmac_sha1(password, password_length,
+				      block, salt_length + 4,
+				      u);
+		memcpy(t, u, sizeof(t));
+
+		/* T_i = U_1 ^ U_2 ^ ... ^ U_c */
+		for (i = 1; i < iterations; i++) {
+			guint j;
+
+			sipe_digest_hmac_sha1(password, password_length,
+					      u, sizeof(u),
+					      u);
+			for (j = 0; j < sizeof(t); j++)
+				t[j] ^= u[j];
+		}
+
+		memcpy(out, t, copy);
+		out    += copy;
+		length -= copy;
+		index++;
+	}
+
+	g_free(block);
+}
+
+static void cache_derive_keys(struct sipe_core_private *sipe_private,
+			      struct sipe_cache *cache)
+{
+	guchar keys[SIPE_CACHE_AES_KEY_LENGTH + SIPE_CACHE_HMAC_KEY_LENGTH];
+	gchar *password = g_strdup_printf("%s\n%s",
+					  sipe_private->username,
+					  sipe_private->password ? sipe_private->password : "");
+
+	cache_pbkdf2((guchar *) password, strlen(password),
+		     cache->salt, SIPE_CACHE_SALT_LENGTH,
+		     SIPE_CACHE_PBKDF2_ITERATIONS,
+		     keys, sizeof(keys));
+	memcpy(cache->aes_key,  keys, SIPE_CACHE_AES_KEY_LENGTH);
+	memcpy(cache->hmac_key, keys + SIPE_CACHE_AES_KEY_LENGTH, SIPE_CACHE_HMAC_KEY_LENGTH);
+
+	memset(keys, 0, sizeof(keys));
+	memset(password, 0, strlen(password));
+	g_free(password);
+}
+
+static void cache_new_salt(struct sipe_core_private *sipe_private,
+			   struct sipe_cache *cache)
+{
+	if (!sipe_crypt_random(cache->salt, SIPE_CACHE_SALT_LENGTH)) {
+		/* never write a file with a predictable salt */
+		SIPE_DEBUG_ERROR("cache_new_salt: disabling cache file %s",
+				 cache->filename);
+		g_free(cache->filename);
+		cache->filename = NULL;
+		return;
+	}
+
+	cache_derive_keys(sipe_private, cache);
+}
+
+/* AES-128-OFB: encryption & decryption are the same operation */
+static void cache_crypt(struct sipe_cache *cache,
+			const guchar *iv,
+			guchar *data,
+			gsize length)
+{
+	gsize padded = (length + SIPE_CACHE_IV_LENGTH - 1) & ~((gsize) SIPE_CACHE_IV_LENGTH - 1);
+
+	if (padded) {
+		guchar *zero   = g_malloc0(padded);
+		guchar *stream = g_malloc(padded);
+		gsize i;
+
+		sipe_crypt_tls_block(cache->aes_key, SIPE_CACHE_AES_KEY_LENGTH,
+				     iv, SIPE_CACHE_IV_LENGTH,
+				     zero, padded,
+				     stream);
+		for (i = 0; i < length; i++)
+			data[i] ^= stream[i];
+
+		g_free(stream);
+		g_free(zero);
+	}
+}
+
+static gchar *cache_filename(struct sipe_core_private *sipe_private)
+{
+	guchar digest[SIPE_DIGEST_SHA1_LENGTH];
+	gchar *account = g_strdup_printf("%s\n%s",
+					 sipe_private->username,
+					 sipe_private->authuser ? sipe_private->authuser : "");
+	gchar *hex;
+	gchar *name;
+	gchar *filename;
+
+	sipe_digest_sha1((guchar *) account, strlen(account), digest);
+	g_free(account);
+	hex  = buff_to_hex_str(digest, sizeof(digest));
+	name = g_strdup_printf("%s.cache", hex);
+	g_free(hex);
+
+	filename = g_build_filename(g_get_user_cache_dir(),
+				    "sipe",
+				    name,
+				    NULL);
+	g_free(name);
+
+	return(filename);
+}
+
+static void cache_parse(struct sipe_cache *cache,
+			const gchar *plaintext,
+			gboolean accept_secrets)
+{
+	gchar **lines = g_strsplit(plaintext, "\n", 0);
+	time_t now    = time(NULL);
+	gchar **line;
+
+	for (line = lines; *line; line++) {
+		gchar **fields = g_strsplit(*line, "\t", 4);
+
+		if (g_strv_length(fields) == 4) {
+			time_t expires  = strtoll(fields[1], NULL, 10);
+			gboolean secret = sipe_strequal(fields[2], "1");
+
+			if ((expires > now) && (accept_secrets || !secret)) {
+				struct cache_entry *entry = g_new0(struct cache_entry, 1);
+				entry->value   = g_strcompress(fields[3]);
+				entry->expires = expires;
+				entry->secret  = secret;
+				g_hash_table_insert(cache->entries,
+						    g_strcompress(fields[0]),
+						    entry);
+			}
+		}
+
+		g_strfreev(fields);
+	}
+
+	g_strfreev(lines);
+}
+
+static gboolean cache_load(struct sipe_core_private *sipe_private,
+			   struct sipe_cache *cache)
+{
+	gchar *data;
+	gsize length;
+	gboolean loaded = FALSE;
+
+	if (g_file_get_contents(cache->filename, &data, &length, NULL)) {
+		if ((length >= SIPE_CACHE_HEADER_LENGTH + SIPE_DIGEST_HMAC_SHA1_LENGTH) &&
+		    (memcmp(data, SIPE_CACHE_MAGIC, SIPE_CACHE_MAGIC_LENGTH) == 0)) {
+			guchar *raw  = (guchar *) data;
+			gsize signed_length = length - SIPE_DIGEST_HMAC_SHA1_LENGTH;
+			guchar digest[SIPE_DIGEST_HMAC_SHA1_LENGTH];
+			guchar diff = 0;
+			guint i;
+
+			memcpy(cache->salt,
+			       raw + SIPE_CACHE_MAGIC_LENGTH,
+			       SIPE_CACHE_SALT_LENGTH);
+			cache_derive_keys(sipe_private, cache);
+
+			sipe_digest_hmac_sha1(cache->hmac_key, SIPE_CACHE_HMAC_KEY_LENGTH,
+					      raw, signed_length,
+					      digest);
+			for (i = 0; i < SIPE_DIGEST_HMAC_SHA1_LENGTH; i++)
+				diff |= digest[i] ^ raw[signed_length + i];
+
+			if (diff == 0) {
+				guchar *ciphertext = raw + SIPE_CACHE_HEADER_LENGTH;
+				gsize text_length  = signed_length - SIPE_CACHE_HEADER_LENGTH;
+				gchar *plaintext;
+
+				cache_crypt(cache,
+					    raw + SIPE_CACHE_MAGIC_LENGTH + SIPE_CACHE_SALT_LENGTH,
+					    ciphertext,
+					    text_length);
+				plaintext = g_strndup((gchar *) ciphertext, text_length);
+				cache_parse(cache,
+					    plaintext,
+					    sipe_private->password != NULL);
+				memset(plaintext, 0, text_length);
+				g_free(plaintext);
+
+				SIPE_DEBUG_INFO("cache_load: %u entries loaded from %s",
+						g_hash_table_size(cache->entries),
+						cache->filename);
+				loaded = TRUE;
+			} else {
+				SIPE_DEBUG_INFO("cache_load: discarding %s (authentication failed)",
+						cache->filename);
+			}
+		}
+
+		memset(data, 0, length);
+		g_free(data);
+	}
+
+	return(loaded);
+}
+
+static void cache_save(struct sipe_core_private *sipe_private,
+		       struct sipe_cache *cache)
+{
+	GString *text = g_string_new("");
+	gboolean store_secrets = sipe_private->password != NULL;
+	time_t now = time(NULL);
+	GHashTableIter iter;
+	gpointer key, value;
+
+	/* cache file disabled */
+	if (!cache->filename)
+		return;
+
+	cache->dirty = FALSE;
+
+	g_hash_table_iter_init(&iter, cache->entries);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct cache_entry *entry = value;
+
+		if ((entry->expires > now) &&
+		    (store_secrets || !entry->secret)) {
+			gchar *escaped_key   = g_strescape(key, NULL);
+			gchar *escaped_value = g_strescape(entry->value, NULL);
+
+			g_string_append_printf(text,
+					       "%s\t%" G_GINT64_FORMAT "\t%d\t%s\n",
+					       escaped_key,
+					       (gint64) entry->expires,
+					       entry->secret ? 1 : 0,
+					       escaped_value);
+			g_free(escaped_value);
+			g_free(escaped_key);
+		}
+	}
+
+	if (text->len) {
+		gsize signed_length = SIPE_CACHE_HEADER_LENGTH + text->len;
+		guchar *data = g_malloc(signed_length + SIPE_DIGEST_HMAC_SHA1_LENGTH);
+		guchar *iv   = data + SIPE_CACHE_MAGIC_LENGTH + SIPE_CACHE_SALT_LENGTH;
+
+		if (sipe_crypt_random(iv, SIPE_CACHE_IV_LENGTH)) {
+			gchar *dir = g_path_get_dirname(cache->filename);
+
+			memcpy(data, SIPE_CACHE_MAGIC, SIPE_CACHE_MAGIC_LENGTH);
+			memcpy(data + SIPE_CACHE_MAGIC_LENGTH, cache->salt, SIPE_CACHE_SALT_LENGTH);
+
+			memcpy(data + SIPE_CACHE_HEADER_LENGTH, text->str, text->len);
+			cache_crypt(cache,
+				    iv,
+				    data + SIPE_CACHE_HEADER_LENGTH,
+				    text->len);
+			sipe_digest_hmac_sha1(cache->hmac_key, SIPE_CACHE_HMAC_KEY_LENGTH,
+					      data, signed_length,
+					      data + signed_length);
+
+			if ((g_mkdir_with_parents(dir, 0700) == 0) &&
+			    g_file_set_contents(cache->filename,
+						(gchar *) data,
+						signed_length + SIPE_DIGEST_HMAC_SHA1_LENGTH,
+						NULL)) {
+				g_chmod(cache->filename, 0600);
+				SIPE_DEBUG_INFO("cache_save: %s updated", cache->filename);
+			} else {
+				SIPE_DEBUG_ERROR("cache_save: can't write %s", cache->filename);
+			}
+
+			g_free(dir);
+		} else {
+			/* keep the previous file */
+			SIPE_DEBUG_ERROR("cache_save: not updating %s", cache->filename);
+		}
+
+		g_free(data);
+	} else {
+		g_unlink(cache->filename);
+	}
+
+	memset(text->str, 0, text->len);
+	g_string_free(text, TRUE);
+}
+
+static void cache_save_cb(struct sipe_core_private *sipe_private,
+			  SIPE_UNUSED_PARAMETER gpointer unused)
+{
+	if (sipe_private->cache && sipe_private->cache->dirty)
+		cache_save(sipe_private, sipe_private->cache);
+}
+
+static void cache_changed(struct sipe_core_private *sipe_private,
+			  struct sipe_cache *cache)
+{
+	/* coalesce updates: rescheduling replaces the pending action */
+	cache->dirty = TRUE;
+	sipe_schedule_seconds(sipe_private,
+			      "<+cache-save>",
+			      NULL,
+			      SIPE_CACHE_SAVE_DELAY,
+			      cache_save_cb,
+			      NULL);
+}
+
+static struct sipe_cache *cache_get(struct sipe_core_private *sipe_private)
+{
+	struct sipe_cache *cache = sipe_private->cache;
+
+	if (!cache) {
+		sipe_private->cache = cache = g_new0(struct sipe_cache, 1);
+		cache->entries  = g_hash_table_new_full(g_str_hash,
+							g_str_equal,
+							g_free,
+							cache_entry_free);
+		cache->filename = cache_filename(sipe_private);
+
+		if (!cache_load(sipe_private, cache))
+			cache_new_salt(sipe_private, cache);
+	}
+
+	return(cache);
+}
+
+const gchar *sipe_cache_lookup(struct sipe_core_private *sipe_private,
+			       const gchar *key,
+			       time_t *expires)
+{
+	struct sipe_cache *cache = cache_get(sipe_private);
+	struct cache_entry *entry = g_hash_table_lookup(cache->entries, key);
+
+	if (entry && (entry->expires <= time(NULL))) {
+		SIPE_DEBUG_INFO("sipe_cache_lookup: entry '%s' has expired", key);
+		g_hash_table_remove(cache->entries, key);
+		cache_changed(sipe_private, cache);
+		entry = NULL;
+	}
+
+	if (!entry)
+		return(NULL);
+
+	if (expires)
+		*expires = entry->expires;
+	return(entry->value);
+}
+
+void sipe_cache_store(struct sipe_core_private *sipe_private,
+		      const gchar *key,
+		      const gchar *value,
+		      time_t expires,
+		      gboolean secret)
+{
+	struct sipe_cache *cache  = cache_get(sipe_private);
+	struct cache_entry *entry = g_new0(struct cache_entry, 1);
+
+	entry->value   = g_strdup(value);
+	entry->expires = expires;
+	entry->secret  = secret;
+	g_hash_table_insert(cache->entries, g_strdup(key), entry);
+	cache_changed(sipe_private, cache);
+}
+
+void sipe_cache_invalidate(struct sipe_core_private *sipe_private,
+			   const gchar *key)
+{
+	struct sipe_cache *cache = cache_get(sipe_private);
+
+	if (g_hash_table_remove(cache->entries, key)) {
+		SIPE_DEBUG_INFO("sipe_cache_invalidate: entry '%s' removed", key);
+		cache_changed(sipe_private, cache);
+	}
+}
+
+void sipe_cache_free(struct sipe_core_private *sipe_private)
+{
+	struct sipe_cache *cache = sipe_private->cache;
+
+	if (cache) {
+		if (cache->dirty)
+			cache_save(sipe_private, cache);
+
+		memset(cache->aes_key,  0, sizeof(cache->aes_key));
+		memset(cache->hmac_key, 0, sizeof(cache->hmac_key));
+		g_hash_table_destroy(cache->entries);
+		g_free(cache->filename);
+		g_free(cache);
+		sipe_private->cache = NULL;
+	}
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
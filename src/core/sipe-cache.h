@@ -0,0 +1,106 @@
+/**
+ * @file sipe-cache.h
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Persistent per-account cache
+ *
+ * Stores results of network discovery (autodiscover, realm info) and
+ * unexpired Web Tickets between sessions, so that a login doesn't need to
+ * walk through all HTTP round trips again. Users of the cache must consult
+ * it before any network activity and invalidate their entries on failure.
+ *
+ * The cache file is stored in the user cache directory. It is encrypted
+ * with AES-128 and authenticated with HMAC-SHA1, both keys are derived
+ * from the account credentials. A file that can't be authenticated, e.g.
+ * after a password change, is silently discarded.
+ *
+ * Without a password, i.e. when Single Sign-On is enabled, the keys are
+ * derived from the user name only and don't protect the file contents.
+ * Entries marked as secret are therefore neither written to nor loaded
+ * from disk in that case.
+ *
+ * Interface dependencies:
+ *
+ * <time.h>
+ * <glib.h>
+ */
+
+/* Forward declarations */
+struct sipe_core_private;
+
+/**
+ * Look up cache entry
+ *
+ * Loads the cache file on first use. Expired entries are removed.
+ *
+ * @param sipe_private SIPE core private data
+ * @param key          entry key
+ * @param expires      (out) expiration time of the entry (may be @c NULL)
+ *
+ * @return value or @c NULL if not found. Only valid until the next
+ *         modification of the cache.
+ */
+const gchar *sipe_cache_lookup(struct sipe_core_private *sipe_private,
+			       const gchar *key,
+			       time_t *expires);
+
+/**
+ * Add or replace cache entry
+ *
+ * The cache file is updated a few seconds later.
+ *
+ * @param sipe_private SIPE core private data
+ * @param key          entry key
+ * @param value        entry value
+ * @param expires      expiration time of the entry
+ * @param secret       @c TRUE if value is a credential, e.g. a security token
+ */
+void sipe_cache_store(struct sipe_core_private *sipe_private,
+		      const gchar *key,
+		      const gchar *value,
+		      time_t expires,
+		      gboolean secret);
+
+/**
+ * Remove cache entry
+ *
+ * @param sipe_private SIPE core private data
+ * @param key          entry key
+ */
+void sipe_cache_invalidate(struct sipe_core_private *sipe_private,
+			   const gchar *key);
+
+/**
+ * Free cache data, writes pending changes to the cache file
+ *
+ * @param sipe_private SIPE core private data
+ */
+void sipe_cache_free(struct sipe_core_private *sipe_private);
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
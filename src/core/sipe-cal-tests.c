@@ -0,0 +1,349 @@
+/**
+ * @file sipe-cal-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Tests for the packed free/busy data
+ *
+ *  - the SSE2 byte scans must return the same results as the scalar code
+ *  - status, "since" and "switch" times must match a simple slot by slot
+ *    search over the unpacked free/busy digits
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "sipe-cal.c"
+
+#include "sip-transport.h"
+#include "uuid.h"
+
+#define GRANULARITY 15 /* minutes */
+
+/*
+ * Stubs
+ */
+gboolean sipe_backend_debug_enabled(void)
+{
+	return(FALSE);
+}
+
+void sipe_backend_debug_literal(SIPE_UNUSED_PARAMETER sipe_debug_level level,
+				SIPE_UNUSED_PARAMETER const gchar *msg)
+{
+}
+
+void sipe_backend_debug(SIPE_UNUSED_PARAMETER sipe_debug_level level,
+			SIPE_UNUSED_PARAMETER const gchar *format,
+			...)
+{
+}
+
+const gchar *sipe_backend_setting(SIPE_UNUSED_PARAMETER struct sipe_core_public *sipe_public,
+				  SIPE_UNUSED_PARAMETER sipe_setting type)
+{
+	return(NULL);
+}
+
+void sipe_schedule_seconds(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			   SIPE_UNUSED_PARAMETER const gchar *name,
+			   SIPE_UNUSED_PARAMETER gpointer payload,
+			   SIPE_UNUSED_PARAMETER guint seconds,
+			   SIPE_UNUSED_PARAMETER sipe_schedule_action action,
+			   SIPE_UNUSED_PARAMETER GDestroyNotify destroy)
+{
+}
+
+void sipe_ews_update_calendar(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) {}
+void sipe_http_request_cancel(SIPE_UNUSED_PARAMETER struct sipe_http_request *request) {}
+void sipe_http_session_close(SIPE_UNUSED_PARAMETER struct sipe_http_session *session) {}
+void sipe_ocs2005_presence_publish(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+				   SIPE_UNUSED_PARAMETER gboolean do_publish_calendar) {}
+void sipe_ocs2007_presence_publish(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+				   SIPE_UNUSED_PARAMETER gpointer unused) {}
+void sipe_ocs2007_category_publish(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+				   SIPE_UNUSED_PARAMETER gboolean force_publish) {}
+
+const gchar *sip_transport_epid(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) { return(NULL); }
+char *generateUUIDfromEPID(SIPE_UNUSED_PARAMETER const gchar *epid) { return(NULL); }
+char *sipe_get_epid(SIPE_UNUSED_PARAMETER const char *self_sip_uri,
+		    SIPE_UNUSED_PARAMETER const char *hostname,
+		    SIPE_UNUSED_PARAMETER const char *ip_address) { return(NULL); }
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+/* deterministic pseudo random numbers (LCG from ISO C) */
+static guint32 seed = 1;
+static guint random_number(guint range)
+{
+	seed = seed * 1103515245 + 12345;
+	return((seed >> 16) % range);
+}
+
+#ifdef __SSE2__
+/* SSE2 and scalar byte scans must agree for ranges starting or ending at i */
+static void compare_byte_scans(const guchar *bytes,
+			       gsize length,
+			       guchar pattern)
+{
+	gsize i;
+
+	for (i = 0; i <= length; i++) {
+		if ((free_busy_rfind_byte_sse2(bytes, i, pattern) ==
+		     free_busy_rfind_byte_scalar(bytes, i, pattern)) &&
+		    (free_busy_find_byte_sse2(bytes, i, length, pattern) ==
+		     free_busy_find_byte_scalar(bytes, i, length, pattern)) &&
+		    (free_busy_find_byte_sse2(bytes, 0, i, pattern) ==
+		     free_busy_find_byte_scalar(bytes, 0, i, pattern))) {
+			succeeded++;
+		} else {
+			printf("byte scan FAILED: length %" G_GSIZE_FORMAT " index %" G_GSIZE_FORMAT "\n",
+			       length, i);
+			failed++;
+		}
+	}
+}
+
+static void test_byte_scans(void)
+{
+	guchar bytes[80];
+	gsize length;
+	guint i;
+
+	for (length = 0; length <= sizeof(bytes); length++) {
+		gsize mismatch;
+
+		/* no mismatch */
+		memset(bytes, STATE_BYTE(SIPE_CAL_BUSY), length);
+		compare_byte_scans(bytes, length, STATE_BYTE(SIPE_CAL_BUSY));
+
+		/* one mismatch at every position, also in a single slot */
+		for (mismatch = 0; mismatch < length; mismatch++) {
+			memset(bytes, STATE_BYTE(SIPE_CAL_BUSY), length);
+			bytes[mismatch] ^= (mismatch & 1) ? 0x01 : 0xC0;
+			compare_byte_scans(bytes, length, STATE_BYTE(SIPE_CAL_BUSY));
+		}
+	}
+
+	/* random mismatches */
+	for (i = 0; i < 100; i++) {
+		gsize j;
+
+		length = random_number(sizeof(bytes) + 1);
+		for (j = 0; j < length; j++)
+			bytes[j] = (random_number(8) == 0) ?
+				random_number(256) :
+				STATE_BYTE(SIPE_CAL_FREE);
+		compare_byte_scans(bytes, length, STATE_BYTE(SIPE_CAL_FREE));
+	}
+}
+#endif
+
+/* pre-packing algorithm on the free/busy digits */
+static time_t reference_since(const gchar *digits,
+			      time_t cal_start,
+			      gsize index)
+{
+	int state = digits[index] - '0';
+	gssize i;
+
+	for (i = index; i >= 0; i--)
+		if (digits[i] - '0' != state)
+			return(cal_start + (i + 1)*GRANULARITY*60);
+	return(cal_start);
+}
+
+static time_t reference_switch(const gchar *digits,
+			       time_t cal_start,
+			       gsize index,
+			       int *to_state)
+{
+	int state = digits[index] - '0';
+	gsize i;
+
+	for (i = index + 1; i < strlen(digits); i++)
+		if (digits[i] - '0' != state) {
+			*to_state = digits[i] - '0';
+			return(cal_start + i*GRANULARITY*60);
+		}
+	return(TIME_NULL);
+}
+
+/* pack digits, decode them again and compare with reference */
+static void test_free_busy(const gchar *digits)
+{
+	struct sipe_buddy buddy;
+	const struct sipe_cal_free_busy *fb;
+	time_t cal_start = 1514800800;
+	/* packing fills up the last byte with free slots */
+	gchar *padded = g_strdup_printf("%s%.*s",
+					digits,
+					(int) ((4 - strlen(digits) % 4) % 4),
+					"000");
+	gsize count = strlen(padded);
+	gsize index;
+
+	memset(&buddy, 0, sizeof(buddy));
+	buddy.cal_free_busy_base64 = sipe_cal_get_freebusy_base64(digits);
+	fb = sipe_cal_get_free_busy(&buddy);
+
+	if (fb && (fb->count == count)) {
+		succeeded++;
+	} else {
+		printf("count FAILED: '%s' expected %" G_GSIZE_FORMAT " got %" G_GSIZE_FORMAT "\n",
+		       digits, count, fb ? fb->count : 0);
+		failed++;
+		count = 0;
+	}
+
+	for (index = 0; index < count; index++) {
+		int state = padded[index] - '0';
+		int found_index = -1;
+		int to_state = SIPE_CAL_NO_DATA;
+		int expected_to_state = SIPE_CAL_NO_DATA;
+		time_t since;
+		time_t expected_since;
+		time_t switch_time;
+		time_t expected_switch_time;
+
+		if ((sipe_cal_get_status0(fb,
+					  cal_start,
+					  GRANULARITY,
+					  cal_start + index*GRANULARITY*60,
+					  &found_index) == state) &&
+		    (found_index == (int) index)) {
+			succeeded++;
+		} else {
+			printf("status FAILED: '%s' index %" G_GSIZE_FORMAT "\n",
+			       digits, index);
+			failed++;
+		}
+
+		since          = sipe_cal_get_since_time(fb,
+							 cal_start,
+							 GRANULARITY,
+							 index,
+							 state);
+		expected_since = reference_since(padded, cal_start, index);
+		if (since == expected_since) {
+			succeeded++;
+		} else {
+			printf("since FAILED: '%s' index %" G_GSIZE_FORMAT " expected %ld got %ld\n",
+			       digits, index, (long) expected_since, (long) since);
+			failed++;
+		}
+
+		switch_time          = sipe_cal_get_switch_time(fb,
+								cal_start,
+								GRANULARITY,
+								index,
+								state,
+								&to_state);
+		expected_switch_time = reference_switch(padded,
+							cal_start,
+							index,
+							&expected_to_state);
+		if ((switch_time == expected_switch_time) &&
+		    (to_state == expected_to_state)) {
+			succeeded++;
+		} else {
+			printf("switch FAILED: '%s' index %" G_GSIZE_FORMAT " expected %ld/%d got %ld/%d\n",
+			       digits, index,
+			       (long) expected_switch_time, expected_to_state,
+			       (long) switch_time, to_state);
+			failed++;
+		}
+	}
+
+	g_free(buddy.cal_free_busy);
+	g_free(buddy.cal_free_busy_base64);
+	g_free(padded);
+}
+
+/* free/busy digits with runs of random state and length */
+static gchar *random_digits(guint max_run)
+{
+	GString *digits = g_string_new("");
+	guint length = random_number(400) + 1;
+
+	while (digits->len < length) {
+		gchar digit = '0' + random_number(4);
+		guint run   = random_number(max_run) + 1;
+
+		while (run-- && (digits->len < length))
+			g_string_append_c(digits, digit);
+	}
+
+	return(g_string_free(digits, FALSE));
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
+{
+	guint i;
+
+#ifdef __SSE2__
+	test_byte_scans();
+#else
+	printf("SSE2 not available: skipping byte scan comparison\n");
+#endif
+
+	/* uniform data */
+	test_free_busy("0");
+	test_free_busy("2222");
+	test_free_busy("33333");
+	for (i = 0; i < 4; i++) {
+		gchar *digits = g_strnfill(257, '0' + i);
+		test_free_busy(digits);
+		g_free(digits);
+	}
+
+	/* a single different slot at every position of a long run */
+	for (i = 0; i < 300; i++) {
+		gchar *digits = g_strnfill(300, '2');
+		digits[i] = '0' + (i % 2);
+		test_free_busy(digits);
+		g_free(digits);
+	}
+
+	/* random runs: short runs stay inside bytes, long ones span blocks */
+	for (i = 0; i < 100; i++) {
+		gchar *digits = random_digits((i % 2) ? 5 : 150);
+		test_free_busy(digits);
+		g_free(digits);
+	}
+
+	printf("Result: %d PASSED %d FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
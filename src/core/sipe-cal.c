@@ -32,6 +32,10 @@
 
 #include <glib.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "sipe-backend.h"
 #include "sipe-buddy.h"
 #include "sipe-common.h"
@@ -99,11 +103,11 @@ Desc:
 
 struct sipe_cal_std_dst {
 	int bias;           /* Ex.: -60 */
-	gchar *time;        /* hh:mm:ss, 02:00:00 */
+	int time;           /* seconds since midnight, from hh:mm:ss, 02:00:00 */
 	int day_order;      /* 1..5 */
 	int month;          /* 1..12 */
-	gchar *day_of_week; /* Sunday or Monday or Tuesday or Wednesday or Thursday or Friday or Saturday */
-	gchar *year;        /* YYYY */
+	int day_of_week;    /* 0..6, Sunday or Monday or Tuesday or Wednesday or Thursday or Friday or Saturday */
+	int year;           /* YYYY, 0 if switch is on the same day every year */
 
 	time_t switch_time;
 };
@@ -116,13 +120,7 @@ struct sipe_cal_working_hours {
 	int start_time;               /* 0...1440 */
 	int end_time;                 /* 0...1440 */
 
-	gchar *tz;                    /* aggregated timezone string as in TZ environment variable.
-	                                 Ex.: TST+8TDT+7,M3.2.0/02:00:00,M11.1.0/02:00:00 */
-	/** separate simple strings for Windows platform as the proper TZ does not work there.
-	 *  anyway, dynamic timezones would't work with just TZ
-	 */
-	gchar *tz_std;                /* Ex.: TST8 */
-	gchar *tz_dst;                /* Ex.: TDT7 */
+	int switch_year;              /* year of the std/dst switch times */
 };
 
 /* not for translation, a part of XML Schema definitions */
@@ -134,7 +132,7 @@ static const char *wday_names[] = {"Sunday",
 				   "Friday",
 				   "Saturday"};
 static int
-sipe_cal_get_wday(char *wday_name)
+sipe_cal_get_wday(const char *wday_name)
 {
 	int i;
 
@@ -257,71 +255,116 @@ sipe_cal_event_hash(struct sipe_cal_event* event)
 				event->is_meeting);
 }
 
-#define ENVIRONMENT_TIMEZONE "TZ"
+/*
+ * Timezone conversions
+ *
+ * All conversions are done with plain arithmetic on the proleptic
+ * Gregorian calendar. The process timezone (TZ environment variable) is
+ * never touched, i.e. they are thread-safe and need no tzset().
+ *
+ * A contact's local time is described by a bias in minutes:
+ *
+ *    UTC = local time + bias
+ */
 
-static gchar *
-sipe_switch_tz(const char *tz)
+/* days since 1970-01-01, month 1..12 */
+static gint64
+sipe_cal_days_from_civil(gint64 year,
+			 int month,
+			 int day)
 {
-	gchar *tz_orig;
-
-	tz_orig = g_strdup(g_getenv(ENVIRONMENT_TIMEZONE));
-	g_setenv(ENVIRONMENT_TIMEZONE, tz, TRUE);
-	tzset();
-	return(tz_orig);
+	gint64 era;
+	gint64 year_of_era;
+	gint64 day_of_year;
+	gint64 day_of_era;
+
+	/* year starts on March 1st */
+	year -= month <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	year_of_era = year - era * 400;
+	day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	day_of_era  = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	return era * 146097 + day_of_era - 719468;
 }
 
-static void
-sipe_reset_tz(gchar *tz_orig)
+static struct tm *
+sipe_cal_gmtime(time_t time,
+		struct tm *tm)
 {
-	if (tz_orig) {
-		g_setenv(ENVIRONMENT_TIMEZONE, tz_orig, TRUE);
-		g_free(tz_orig);
-	} else {
-		g_unsetenv(ENVIRONMENT_TIMEZONE);
+	gint64 days = time / (24*60*60);
+	gint64 secs = time % (24*60*60);
+	gint64 era;
+	gint64 day_of_era;
+	gint64 year_of_era;
+	gint64 day_of_year;
+	gint64 mp;
+	gint64 year;
+	int month;
+
+	if (secs < 0) {
+		secs += 24*60*60;
+		days--;
 	}
-	tzset();
+
+	tm->tm_hour  = secs / (60*60);
+	tm->tm_min   = (secs / 60) % 60;
+	tm->tm_sec   = secs % 60;
+	/* 1970-01-01 was a Thursday */
+	tm->tm_wday  = ((days % 7) + 11) % 7;
+	tm->tm_isdst = 0;
+
+	days += 719468;
+	era = (days >= 0 ? days : days - 146096) / 146097;
+	day_of_era  = days - era * 146097;
+	year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	mp = (5 * day_of_year + 2) / 153;
+	month = mp < 10 ? mp + 3 : mp - 9;
+	year = year_of_era + era * 400 + (month <= 2);
+
+	tm->tm_year = year - 1900;
+	tm->tm_mon  = month - 1;
+	tm->tm_mday = day_of_year - (153 * mp + 2) / 5 + 1;
+	tm->tm_yday = days - 719468 - sipe_cal_days_from_civil(year, 1, 1);
+
+	return tm;
 }
 
-/**
- * Converts struct tm to Epoch time_t considering timezone.
- *
- * @param tz as defined for TZ environment variable.
- *
- * Reference: see timegm(3) - Linux man page
- */
 time_t
-sipe_mktime_tz(struct tm *tm,
-	       const char* tz)
+sipe_mktime_utc(struct tm *tm)
 {
+	gint64 year  = tm->tm_year + 1900;
+	gint64 month = tm->tm_mon;
 	time_t ret;
-	gchar *tz_orig;
 
-	tz_orig = sipe_switch_tz(tz);
-	ret = mktime(tm);
-	sipe_reset_tz(tz_orig);
+	/* normalize month, other fields are linear */
+	year  += month / 12;
+	month %= 12;
+	if (month < 0) {
+		month += 12;
+		year--;
+	}
+
+	ret = sipe_cal_days_from_civil(year, month + 1, 1) * (24*60*60) +
+		(gint64) (tm->tm_mday - 1) * (24*60*60) +
+		tm->tm_hour * (60*60) +
+		tm->tm_min * 60 +
+		tm->tm_sec;
 
+	/* update fields like mktime(3) */
+	sipe_cal_gmtime(ret, tm);
 	return ret;
 }
 
 /**
- * Converts Epoch time_t to struct tm considering timezone.
- *
- * @param tz as defined for TZ environment variable.
- *
- * Reference: see timegm(3) - Linux man page
+ * Converts Epoch time_t to struct tm in the timezone described by bias.
  */
 static struct tm *
-sipe_localtime_tz(const time_t *time,
-		  const char* tz)
+sipe_cal_localtime_bias(time_t time,
+			int bias,
+			struct tm *tm)
 {
-	struct tm *ret;
-	gchar *tz_orig;
-
-	tz_orig = sipe_switch_tz(tz);
-	ret = localtime(time);
-	sipe_reset_tz(tz_orig);
-
-	return ret;
+	return sipe_cal_gmtime(time - bias * 60, tm);
 }
 
 void
@@ -329,74 +372,64 @@ sipe_cal_free_working_hours(struct sipe_cal_working_hours *wh)
 {
 	if (!wh) return;
 
-	g_free(wh->std.time);
-	g_free(wh->std.day_of_week);
-	g_free(wh->std.year);
-
-	g_free(wh->dst.time);
-	g_free(wh->dst.day_of_week);
-	g_free(wh->dst.year);
-
 	g_free(wh->days_of_week);
-	g_free(wh->tz);
-	g_free(wh->tz_std);
-	g_free(wh->tz_dst);
 	g_free(wh);
 }
 
 /**
  * Returns time_t of daylight savings time start/end
- * in the provided timezone or otherwise
+ * in the provided year or otherwise
  * (time_t)-1 if no daylight savings time.
  */
 static time_t
-sipe_cal_get_std_dst_time(time_t now,
+sipe_cal_get_std_dst_time(int year,
 			  int bias,
-			  struct sipe_cal_std_dst* std_dst,
-			  struct sipe_cal_std_dst* dst_std)
+			  const struct sipe_cal_std_dst* std_dst,
+			  const struct sipe_cal_std_dst* dst_std)
 {
 	struct tm switch_tm;
-	time_t res = TIME_NULL;
-	struct tm *gm_now_tm;
-	gchar **time_arr;
+	time_t res;
 
 	if (std_dst->month == 0) return TIME_NULL;
 
-	gm_now_tm = gmtime(&now);
-	time_arr = g_strsplit(std_dst->time, ":", 0);
-
-	switch_tm.tm_sec  = atoi(time_arr[2]);
-	switch_tm.tm_min  = atoi(time_arr[1]);
-	switch_tm.tm_hour = atoi(time_arr[0]);
-	g_strfreev(time_arr);
+	memset(&switch_tm, 0, sizeof(switch_tm));
 	switch_tm.tm_mday  = std_dst->year ? std_dst->day_order : 1 /* to adjust later */ ;
 	switch_tm.tm_mon   = std_dst->month - 1;
-	switch_tm.tm_year  = std_dst->year ? atoi(std_dst->year) - 1900 : gm_now_tm->tm_year;
-	switch_tm.tm_isdst = 0;
+	switch_tm.tm_year  = (std_dst->year ? std_dst->year : year) - 1900;
 	/* to set tm_wday */
-	res = sipe_mktime_tz(&switch_tm, "UTC");
+	res = sipe_mktime_utc(&switch_tm);
 
 	/* if not dynamic, calculate right tm_mday */
 	if (!std_dst->year) {
-		int switch_wday = sipe_cal_get_wday(std_dst->day_of_week);
-		int needed_month;
 		/* get first desired wday in the month */
-		int delta = switch_wday >= switch_tm.tm_wday ? (switch_wday - switch_tm.tm_wday) : (switch_wday + 7 - switch_tm.tm_wday);
-		switch_tm.tm_mday = 1 + delta;
+		int delta = ((std_dst->day_of_week - switch_tm.tm_wday) % 7 + 7) % 7;
 		/* try nth order */
-		switch_tm.tm_mday += (std_dst->day_order - 1) * 7;
-		needed_month = switch_tm.tm_mon;
-		/* to set settle date if ahead of allowed month dates */
-		res = sipe_mktime_tz(&switch_tm, "UTC");
-		if (needed_month != switch_tm.tm_mon) {
-			/* moving 1 week back to stay within required month */
-			switch_tm.tm_mday -= 7;
-			/* to fix date again */
-			res = sipe_mktime_tz(&switch_tm, "UTC");
-		}
+		int mday  = 1 + delta + (std_dst->day_order - 1) * 7;
+		int days  = sipe_cal_days_from_civil(switch_tm.tm_year + 1900, std_dst->month + 1, 1) -
+			    sipe_cal_days_from_civil(switch_tm.tm_year + 1900, std_dst->month, 1);
+
+		/* moving 1 week back to stay within required month */
+		if (mday > days)
+			mday -= 7;
+		res += (mday - 1) * (24*60*60);
 	}
 	/* note: bias is taken from "switch to" structure */
-	return res + (bias + dst_std->bias)*60;
+	return res + std_dst->time + (bias + dst_std->bias)*60;
+}
+
+/* precompute switch times for the year of time */
+static void
+sipe_cal_update_switch_times(struct sipe_cal_working_hours *wh,
+			     time_t time)
+{
+	struct tm gm_tm;
+	int year = sipe_cal_gmtime(time, &gm_tm)->tm_year + 1900;
+
+	if (wh->switch_year == year) return;
+
+	wh->switch_year     = year;
+	wh->std.switch_time = sipe_cal_get_std_dst_time(year, wh->bias, &wh->std, &wh->dst);
+	wh->dst.switch_time = sipe_cal_get_std_dst_time(year, wh->bias, &wh->dst, &wh->std);
 }
 
 static void
@@ -425,7 +458,16 @@ sipe_cal_parse_std_dst(const sipe_xml *xn_std_dst_time,
 	}
 
 	if ((node = sipe_xml_child(xn_std_dst_time, "Time"))) {
-		std_dst->time = sipe_xml_data(node);
+		gchar **time_arr = g_strsplit(tmp = sipe_xml_data(node), ":", 3);
+		guint i;
+
+		/* hh:mm:ss */
+		for (i = 0; time_arr[i]; i++)
+			std_dst->time = std_dst->time * 60 + atoi(time_arr[i]);
+		for (; i < 3; i++)
+			std_dst->time *= 60;
+		g_strfreev(time_arr);
+		g_free(tmp);
 	}
 
 	if ((node = sipe_xml_child(xn_std_dst_time, "DayOrder"))) {
@@ -439,17 +481,18 @@ sipe_cal_parse_std_dst(const sipe_xml *xn_std_dst_time,
 	}
 
 	if ((node = sipe_xml_child(xn_std_dst_time, "DayOfWeek"))) {
-		std_dst->day_of_week = sipe_xml_data(node);
+		std_dst->day_of_week = sipe_cal_get_wday(tmp = sipe_xml_data(node));
+		g_free(tmp);
 	}
 
 	if ((node = sipe_xml_child(xn_std_dst_time, "Year"))) {
-		std_dst->year = sipe_xml_data(node);
+		std_dst->year = atoi(tmp = sipe_xml_data(node));
+		g_free(tmp);
 	}
 }
 
-void
-sipe_cal_parse_working_hours(const sipe_xml *xn_working_hours,
-			     struct sipe_buddy *buddy)
+struct sipe_cal_working_hours *
+sipe_cal_parse_working_hours(const sipe_xml *xn_working_hours)
 {
 	const sipe_xml *xn_bias;
 	const sipe_xml *xn_timezone;
@@ -460,8 +503,9 @@ sipe_cal_parse_working_hours(const sipe_xml *xn_working_hours,
 	time_t now = time(NULL);
 	struct sipe_cal_std_dst* std;
 	struct sipe_cal_std_dst* dst;
+	struct sipe_cal_working_hours *wh;
 
-	if (!xn_working_hours) return;
+	if (!xn_working_hours) return(NULL);
 /*
 <WorkingHours xmlns="http://schemas.microsoft.com/exchange/services/2006/types">
   <TimeZone>
@@ -477,66 +521,41 @@ sipe_cal_parse_working_hours(const sipe_xml *xn_working_hours,
   </WorkingPeriodArray>
 </WorkingHours>
 */
-	sipe_cal_free_working_hours(buddy->cal_working_hours);
-	buddy->cal_working_hours = g_new0(struct sipe_cal_working_hours, 1);
+	wh = g_new0(struct sipe_cal_working_hours, 1);
 
 	xn_timezone = sipe_xml_child(xn_working_hours, "TimeZone");
 	xn_bias = sipe_xml_child(xn_timezone, "Bias");
 	if (xn_bias) {
-		buddy->cal_working_hours->bias = atoi(tmp = sipe_xml_data(xn_bias));
+		wh->bias = atoi(tmp = sipe_xml_data(xn_bias));
 		g_free(tmp);
 	}
 
 	xn_standard_time = sipe_xml_child(xn_timezone, "StandardTime");
 	xn_daylight_time = sipe_xml_child(xn_timezone, "DaylightTime");
 
-	std = &((*buddy->cal_working_hours).std);
-	dst = &((*buddy->cal_working_hours).dst);
+	std = &wh->std;
+	dst = &wh->dst;
 	sipe_cal_parse_std_dst(xn_standard_time, std);
 	sipe_cal_parse_std_dst(xn_daylight_time, dst);
 
 	xn_working_period = sipe_xml_child(xn_working_hours, "WorkingPeriodArray/WorkingPeriod");
 	if (xn_working_period) {
 		/* NOTE: this can be NULL! */
-		buddy->cal_working_hours->days_of_week =
+		wh->days_of_week =
 			sipe_xml_data(sipe_xml_child(xn_working_period, "DayOfWeek"));
 
-		buddy->cal_working_hours->start_time =
+		wh->start_time =
 			atoi(tmp = sipe_xml_data(sipe_xml_child(xn_working_period, "StartTimeInMinutes")));
 		g_free(tmp);
 
-		buddy->cal_working_hours->end_time =
+		wh->end_time =
 			atoi(tmp = sipe_xml_data(sipe_xml_child(xn_working_period, "EndTimeInMinutes")));
 		g_free(tmp);
 	}
 
-	std->switch_time = sipe_cal_get_std_dst_time(now, buddy->cal_working_hours->bias, std, dst);
-	dst->switch_time = sipe_cal_get_std_dst_time(now, buddy->cal_working_hours->bias, dst, std);
-
-	/* TST8TDT7,M3.2.0/02:00:00,M11.1.0/02:00:00 */
-	buddy->cal_working_hours->tz =
-		g_strdup_printf("TST%dTDT%d,M%d.%d.%d/%s,M%d.%d.%d/%s",
-				(buddy->cal_working_hours->bias + buddy->cal_working_hours->std.bias) / 60,
-				(buddy->cal_working_hours->bias + buddy->cal_working_hours->dst.bias) / 60,
-
-				buddy->cal_working_hours->dst.month,
-				buddy->cal_working_hours->dst.day_order,
-				sipe_cal_get_wday(buddy->cal_working_hours->dst.day_of_week),
-				buddy->cal_working_hours->dst.time,
-
-				buddy->cal_working_hours->std.month,
-				buddy->cal_working_hours->std.day_order,
-				sipe_cal_get_wday(buddy->cal_working_hours->std.day_of_week),
-				buddy->cal_working_hours->std.time
-				);
-	/* TST8 */
-	buddy->cal_working_hours->tz_std =
-		g_strdup_printf("TST%d",
-				(buddy->cal_working_hours->bias + buddy->cal_working_hours->std.bias) / 60);
-	/* TDT7 */
-	buddy->cal_working_hours->tz_dst =
-		g_strdup_printf("TDT%d",
-				(buddy->cal_working_hours->bias + buddy->cal_working_hours->dst.bias) / 60);
+	sipe_cal_update_switch_times(wh, now);
+
+	return(wh);
 }
 
 struct sipe_cal_event*
@@ -573,8 +592,159 @@ sipe_cal_get_event(GSList *cal_events,
 	return res;
 }
 
+/*
+   http://msdn.microsoft.com/en-us/library/dd941537%28office.13%29.aspx
+		00, Free (Fr)
+		01, Tentative (Te)
+		10, Busy (Bu)
+		11, Out of facility (Oo)
+
+   http://msdn.microsoft.com/en-us/library/aa566048.aspx
+		0  Free
+		1  Tentative
+		2  Busy
+		3  Out of Office (OOF)
+		4  No data
+
+   The decoded free/busy data is kept packed: 4 slots per byte, first slot
+   in the lowest 2 bits.
+*/
+struct sipe_cal_free_busy {
+	const guchar *bytes;
+	gsize length; /* in bytes */
+	gsize count;  /* in slots */
+};
+
+#define TWO_BIT_MASK	0x03
+#define SLOT_STATE(fb, i) (((fb)->bytes[(i) >> 2] >> (((i) & 3) * 2)) & TWO_BIT_MASK)
+/* byte with all 4 slots set to state */
+#define STATE_BYTE(state) ((guchar) ((state) * 0x55))
+
+/* index of the last byte in bytes[0..end[ not equal to pattern, or -1 */
+static gssize free_busy_rfind_byte_scalar(const guchar *bytes,
+					  gsize end,
+					  guchar pattern)
+{
+	while (end > 0) {
+		if (bytes[--end] != pattern)
+			return(end);
+	}
+	return(-1);
+}
+
+/* index of the first byte in bytes[start..end[ not equal to pattern, or end */
+static gsize free_busy_find_byte_scalar(const guchar *bytes,
+					gsize start,
+					gsize end,
+					guchar pattern)
+{
+	while ((start < end) && (bytes[start] == pattern))
+		start++;
+	return(start);
+}
+
+#ifdef __SSE2__
+/* skip 16 matching bytes at a time, the scalar code handles the rest */
+static gssize free_busy_rfind_byte_sse2(const guchar *bytes,
+					gsize end,
+					guchar pattern)
+{
+	__m128i match = _mm_set1_epi8((char) pattern);
+
+	while (end >= 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *) (bytes + end - 16));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, match)) != 0xFFFF)
+			break;
+		end -= 16;
+	}
+
+	return(free_busy_rfind_byte_scalar(bytes, end, pattern));
+}
+
+static gsize free_busy_find_byte_sse2(const guchar *bytes,
+				      gsize start,
+				      gsize end,
+				      guchar pattern)
+{
+	__m128i match = _mm_set1_epi8((char) pattern);
+
+	while (start + 16 <= end) {
+		__m128i block = _mm_loadu_si128((const __m128i *) (bytes + start));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, match)) != 0xFFFF)
+			break;
+		start += 16;
+	}
+
+	return(free_busy_find_byte_scalar(bytes, start, end, pattern));
+}
+
+#define free_busy_rfind_byte free_busy_rfind_byte_sse2
+#define free_busy_find_byte  free_busy_find_byte_sse2
+#else
+#define free_busy_rfind_byte free_busy_rfind_byte_scalar
+#define free_busy_find_byte  free_busy_find_byte_scalar
+#endif
+
+/* index of the last slot <= index with a different state, or -1 */
+static gssize free_busy_rfind_change(const struct sipe_cal_free_busy *fb,
+				     gsize index,
+				     int state)
+{
+	gsize first = index & ~((gsize) 3);
+	gssize byte;
+	int i;
+
+	/* slots of the byte containing index */
+	for (;;) {
+		if ((int) SLOT_STATE(fb, index) != state)
+			return(index);
+		if (index == first)
+			break;
+		index--;
+	}
+
+	/* whole bytes */
+	byte = free_busy_rfind_byte(fb->bytes, first >> 2, STATE_BYTE(state));
+	if (byte < 0)
+		return(-1);
+
+	/* change is in this byte */
+	for (i = 3; i >= 0; i--) {
+		gsize slot = (byte << 2) + i;
+		if ((int) SLOT_STATE(fb, slot) != state)
+			return(slot);
+	}
+	return(-1); /* not reached */
+}
+
+/* index of the first slot > index with a different state, or count */
+static gsize free_busy_find_change(const struct sipe_cal_free_busy *fb,
+				   gsize index,
+				   int state)
+{
+	gsize byte;
+	gsize slot;
+
+	/* slots of the byte containing index */
+	for (slot = index + 1; (slot < fb->count) && (slot & 3); slot++)
+		if ((int) SLOT_STATE(fb, slot) != state)
+			return(slot);
+
+	/* whole bytes */
+	byte = free_busy_find_byte(fb->bytes,
+				   slot >> 2,
+				   fb->length,
+				   STATE_BYTE(state));
+
+	/* change is in this byte */
+	for (slot = byte << 2; slot < fb->count; slot++)
+		if ((int) SLOT_STATE(fb, slot) != state)
+			return(slot);
+	return(fb->count);
+}
+
 static int
-sipe_cal_get_status0(const gchar *free_busy,
+sipe_cal_get_status0(const struct sipe_cal_free_busy *fb,
 		     time_t cal_start,
 		     int granularity,
 		     time_t time_in_question,
@@ -582,7 +752,7 @@ sipe_cal_get_status0(const gchar *free_busy,
 {
 	int res = SIPE_CAL_NO_DATA;
 	int shift;
-	time_t cal_end = cal_start + strlen(free_busy)*granularity*60 - 1;
+	time_t cal_end = cal_start + fb->count*granularity*60 - 1;
 
 	if (!(time_in_question >= cal_start && time_in_question <= cal_end)) return res;
 
@@ -591,7 +761,7 @@ sipe_cal_get_status0(const gchar *free_busy,
 		*index = shift;
 	}
 
-	res = free_busy[shift] - '0';
+	res = SLOT_STATE(fb, shift);
 
 	return res;
 }
@@ -600,37 +770,33 @@ sipe_cal_get_status0(const gchar *free_busy,
  * Returns time when current calendar state started
  */
 static time_t
-sipe_cal_get_since_time(const gchar *free_busy,
+sipe_cal_get_since_time(const struct sipe_cal_free_busy *fb,
 			time_t calStart,
 			int granularity,
 			int index,
 			int current_state)
 {
-	int i;
-
-	if ((index < 0) || ((size_t)(index + 1) > strlen(free_busy))) return 0;
+	gssize i;
 
-	for (i = index; i >= 0; i--) {
-		int temp_status = free_busy[i] - '0';
+	if ((index < 0) || ((gsize)(index + 1) > fb->count)) return 0;
 
-		if (current_state != temp_status) {
-			return calStart + (i + 1)*granularity*60;
-		}
+	i = free_busy_rfind_change(fb, index, current_state);
+	if (i >= 0) {
+		return calStart + (i + 1)*granularity*60;
 	}
 
 	return calStart;
 }
 
-static char*
+static const struct sipe_cal_free_busy *
 sipe_cal_get_free_busy(struct sipe_buddy *buddy);
-
 int
 sipe_cal_get_status(struct sipe_buddy *buddy,
 		    time_t time_in_question,
 		    time_t *since)
 {
 	time_t cal_start;
-	const char* free_busy;
+	const struct sipe_cal_free_busy *free_busy;
 	int ret = SIPE_CAL_NO_DATA;
 	time_t state_since;
 	int index = -1;
@@ -645,7 +811,8 @@ sipe_cal_get_status(struct sipe_buddy *buddy,
 		SIPE_DEBUG_INFO("sipe_cal_get_status: no calendar data2 for %s, exiting", buddy->name);
 		return SIPE_CAL_NO_DATA;
 	}
-	SIPE_DEBUG_INFO("sipe_cal_get_description: buddy->cal_free_busy=\n%s", free_busy);
+	SIPE_DEBUG_INFO("sipe_cal_get_status: %" G_GSIZE_FORMAT " free/busy slots for %s",
+			free_busy->count, buddy->name);
 
 	cal_start = sipe_utils_str_to_time(buddy->cal_start_time);
 
@@ -665,36 +832,34 @@ sipe_cal_get_status(struct sipe_buddy *buddy,
 }
 
 static time_t
-sipe_cal_get_switch_time(const gchar *free_busy,
+sipe_cal_get_switch_time(const struct sipe_cal_free_busy *fb,
 			 time_t calStart,
 			 int granularity,
 			 int index,
 			 int current_state,
 			 int *to_state)
 {
-	size_t i;
+	gsize i;
 	time_t ret = TIME_NULL;
 
-	if ((index < 0) || ((size_t) (index + 1) > strlen(free_busy))) {
+	if ((index < 0) || ((gsize) (index + 1) > fb->count)) {
 		*to_state = SIPE_CAL_NO_DATA;
 		return ret;
 	}
 
-	for (i = index + 1; i < strlen(free_busy); i++) {
-		int temp_status = free_busy[i] - '0';
-
-		if (current_state != temp_status) {
-			*to_state = temp_status;
-			return calStart + i*granularity*60;
-		}
+	i = free_busy_find_change(fb, index, current_state);
+	if (i < fb->count) {
+		*to_state = SLOT_STATE(fb, i);
+		return calStart + i*granularity*60;
 	}
 
 	return ret;
 }
 
-static const char*
-sipe_cal_get_tz(struct sipe_cal_working_hours *wh,
-                time_t time_in_question)
+/* returns bias in minutes for the contact's local time at time_in_question */
+static int
+sipe_cal_get_bias(const struct sipe_cal_working_hours *wh,
+		  time_t time_in_question)
 {
 	time_t dst_switch_time = (*wh).dst.switch_time;
 	time_t std_switch_time = (*wh).std.switch_time;
@@ -702,7 +867,7 @@ sipe_cal_get_tz(struct sipe_cal_working_hours *wh,
 
 	/* No daylight savings */
 	if (dst_switch_time == TIME_NULL) {
-		return wh->tz_std;
+		return wh->bias + wh->std.bias;
 	}
 
 	if (dst_switch_time < std_switch_time) { /* North hemosphere - Europe, US */
@@ -716,22 +881,25 @@ sipe_cal_get_tz(struct sipe_cal_working_hours *wh,
 	}
 
 	if (is_dst) {
-		return wh->tz_dst;
+		return wh->bias + wh->dst.bias;
 	} else {
-		return wh->tz_std;
+		return wh->bias + wh->std.bias;
 	}
 }
 
+#define SIPE_CAL_REMOTE_TM(wh, t, buf) \
+	sipe_cal_localtime_bias((t), sipe_cal_get_bias((wh), (t)), (buf))
+
 static time_t
 sipe_cal_mktime_of_day(struct tm *sample_today_tm,
 		       const int shift_minutes,
-		       const char *tz)
+		       int bias)
 {
 	sample_today_tm->tm_sec  = 0;
 	sample_today_tm->tm_min  = shift_minutes % 60;
 	sample_today_tm->tm_hour = shift_minutes / 60;
 
-	return sipe_mktime_tz(sample_today_tm, tz);
+	return sipe_mktime_utc(sample_today_tm) + bias * 60;
 }
 
 /**
@@ -746,8 +914,13 @@ sipe_cal_get_today_work_hours(struct sipe_cal_working_hours *wh,
 			      time_t *next_start)
 {
 	time_t now = time(NULL);
-	const char *tz = sipe_cal_get_tz(wh, now);
-	struct tm *remote_now_tm = sipe_localtime_tz(&now, tz);
+	int bias;
+	struct tm remote_now_buf;
+	struct tm *remote_now_tm;
+
+	sipe_cal_update_switch_times(wh, now);
+	bias = sipe_cal_get_bias(wh, now);
+	remote_now_tm = sipe_cal_localtime_bias(now, bias, &remote_now_buf);
 
 	if (!(wh->days_of_week && strstr(wh->days_of_week, wday_names[remote_now_tm->tm_wday]))) {
 		/* not a work day */
@@ -757,21 +930,23 @@ sipe_cal_get_today_work_hours(struct sipe_cal_working_hours *wh,
 		return;
 	}
 
-	*end = sipe_cal_mktime_of_day(remote_now_tm, wh->end_time, tz);
+	*end = sipe_cal_mktime_of_day(remote_now_tm, wh->end_time, bias);
 
 	if (now < *end) {
-		*start = sipe_cal_mktime_of_day(remote_now_tm, wh->start_time, tz);
+		*start = sipe_cal_mktime_of_day(remote_now_tm, wh->start_time, bias);
 		*next_start = TIME_NULL;
 	} else { /* calculate start of tomorrow's work day if any */
 		time_t tom = now + 24*60*60;
-		struct tm *remote_tom_tm = sipe_localtime_tz(&tom, sipe_cal_get_tz(wh, tom));
+		int tom_bias = sipe_cal_get_bias(wh, tom);
+		struct tm remote_tom_buf;
+		struct tm *remote_tom_tm = sipe_cal_localtime_bias(tom, tom_bias, &remote_tom_buf);
 
 		if (!(wh->days_of_week && strstr(wh->days_of_week, wday_names[remote_tom_tm->tm_wday]))) {
 			/* not a work day */
 			*next_start = TIME_NULL;
 		}
 
-		*next_start = sipe_cal_mktime_of_day(remote_tom_tm, wh->start_time, sipe_cal_get_tz(wh, tom));
+		*next_start = sipe_cal_mktime_of_day(remote_tom_tm, wh->start_time, tom_bias);
 		*start = TIME_NULL;
 	}
 }
@@ -817,42 +992,24 @@ sipe_cal_get_until(const time_t now,
 	return ret;
 }
 
-static char*
+static const struct sipe_cal_free_busy *
 sipe_cal_get_free_busy(struct sipe_buddy *buddy)
 {
 /* do lazy decode if necessary */
 	if (!buddy->cal_free_busy && buddy->cal_free_busy_base64) {
 		gsize cal_dec64_len;
-		guchar *cal_dec64;
-		gsize i;
-		int j = 0;
-
-		cal_dec64 = g_base64_decode(buddy->cal_free_busy_base64, &cal_dec64_len);
-
-		buddy->cal_free_busy = g_malloc0(cal_dec64_len * 4 + 1);
-/*
-   http://msdn.microsoft.com/en-us/library/dd941537%28office.13%29.aspx
-		00, Free (Fr)
-		01, Tentative (Te)
-		10, Busy (Bu)
-		11, Out of facility (Oo)
-
-   http://msdn.microsoft.com/en-us/library/aa566048.aspx
-		0  Free
-		1  Tentative
-		2  Busy
-		3  Out of Office (OOF)
-		4  No data
-*/
-		for (i = 0; i < cal_dec64_len; i++) {
-#define TWO_BIT_MASK	0x03
-			char tmp = cal_dec64[i];
-			buddy->cal_free_busy[j++] = (tmp & TWO_BIT_MASK) + '0';
-			buddy->cal_free_busy[j++] = ((tmp >> 2) & TWO_BIT_MASK) + '0';
-			buddy->cal_free_busy[j++] = ((tmp >> 4) & TWO_BIT_MASK) + '0';
-			buddy->cal_free_busy[j++] = ((tmp >> 6) & TWO_BIT_MASK) + '0';
-		}
-		buddy->cal_free_busy[j++] = '\0';
+		guchar *cal_dec64 = g_base64_decode(buddy->cal_free_busy_base64,
+						    &cal_dec64_len);
+		struct sipe_cal_free_busy *fb = g_malloc(sizeof(struct sipe_cal_free_busy) +
+							 cal_dec64_len);
+		guchar *bytes = (guchar *) (fb + 1);
+
+		/* single allocation, i.e. it can be released with g_free() */
+		memcpy(bytes, cal_dec64, cal_dec64_len);
+		fb->bytes  = bytes;
+		fb->length = cal_dec64_len;
+		fb->count  = cal_dec64_len * 4;
+		buddy->cal_free_busy = fb;
 		g_free(cal_dec64);
 	}
 
@@ -864,7 +1021,6 @@ sipe_cal_get_freebusy_base64(const char* freebusy_hex)
 {
 	guint i = 0;
 	guint j = 0;
-	guint shift_factor = 0;
 	guint len, res_len;
 	guchar *res;
 	gchar *res_base64;
@@ -872,18 +1028,21 @@ sipe_cal_get_freebusy_base64(const char* freebusy_hex)
 	if (!freebusy_hex) return NULL;
 
 	len = strlen(freebusy_hex);
-	res_len = len / 4 + 1;
-	res = g_malloc0(res_len);
-	while (i < len) {
-		res[j] |= (freebusy_hex[i++] - '0') << shift_factor;
-		shift_factor += 2;
-		if (shift_factor == 8) {
-			shift_factor = 0;
-			j++;
-		}
-	}
+	res_len = (len + 3) / 4;
+	res = g_malloc0(res_len + 1);
 
-	res_base64 = g_base64_encode(res, shift_factor ? res_len : res_len - 1);
+	/* 4 slots per byte */
+	for (; i + 4 <= len; i += 4)
+		res[j++] =  (freebusy_hex[i]     - '0')       |
+			   ((freebusy_hex[i + 1] - '0') << 2) |
+			   ((freebusy_hex[i + 2] - '0') << 4) |
+			   ((freebusy_hex[i + 3] - '0') << 6);
+
+	/* remaining slots */
+	for (; i < len; i++)
+		res[j] |= (freebusy_hex[i] - '0') << ((i & 3) * 2);
+
+	res_base64 = g_base64_encode(res, res_len);
 	g_free(res);
 	return res_base64;
 }
@@ -903,7 +1062,7 @@ sipe_cal_get_description(struct sipe_buddy *buddy)
 	time_t until = TIME_NULL;
 	int index = 0;
 	gboolean has_working_hours = (buddy->cal_working_hours != NULL);
-	const char *free_busy;
+	const struct sipe_cal_free_busy *free_busy;
 	const char *cal_states[] = {_("Free"),
 				    _("Tentative"),
 				    _("Busy"),
@@ -917,15 +1076,16 @@ sipe_cal_get_description(struct sipe_buddy *buddy)
 
 	/* to lazy load if needed */
 	free_busy = sipe_cal_get_free_busy(buddy);
-	SIPE_DEBUG_INFO("sipe_cal_get_description: buddy->cal_free_busy=\n%s", free_busy ? free_busy : "");
+	SIPE_DEBUG_INFO("sipe_cal_get_description: %" G_GSIZE_FORMAT " free/busy slots",
+			free_busy ? free_busy->count : 0);
 
-	if (!buddy->cal_free_busy || !buddy->cal_granularity || !buddy->cal_start_time) {
+	if (!free_busy || !buddy->cal_granularity || !buddy->cal_start_time) {
 		SIPE_DEBUG_INFO_NOFORMAT("sipe_cal_get_description: no calendar data, exiting");
 		return NULL;
 	}
 
 	cal_start = sipe_utils_str_to_time(buddy->cal_start_time);
-	cal_end = cal_start + 60 * (buddy->cal_granularity) * strlen(buddy->cal_free_busy);
+	cal_end = cal_start + 60 * (buddy->cal_granularity) * free_busy->count;
 
 	current_cal_state = sipe_cal_get_status0(free_busy, cal_start, buddy->cal_granularity, time(NULL), &index);
 	if (current_cal_state == SIPE_CAL_NO_DATA) {
@@ -937,23 +1097,26 @@ sipe_cal_get_description(struct sipe_buddy *buddy)
 
 	SIPE_DEBUG_INFO_NOFORMAT("\n* Calendar *");
 	if (buddy->cal_working_hours) {
-		sipe_cal_get_today_work_hours(buddy->cal_working_hours, &start, &end, &next_start);
+		struct sipe_cal_working_hours *wh = buddy->cal_working_hours;
+		struct tm tm_buf;
+
+		sipe_cal_get_today_work_hours(wh, &start, &end, &next_start);
 
-		SIPE_DEBUG_INFO("Remote now timezone : %s", sipe_cal_get_tz(buddy->cal_working_hours, now));
+		SIPE_DEBUG_INFO("Remote now bias     : %d", sipe_cal_get_bias(wh, now));
 		SIPE_DEBUG_INFO("std.switch_time(GMT): %s",
-				IS((*buddy->cal_working_hours).std.switch_time) ? sipe_utils_time_to_debug_str(gmtime(&((*buddy->cal_working_hours).std.switch_time))) : "");
+				IS(wh->std.switch_time) ? sipe_utils_time_to_debug_str(sipe_cal_gmtime(wh->std.switch_time, &tm_buf)) : "");
 		SIPE_DEBUG_INFO("dst.switch_time(GMT): %s",
-				IS((*buddy->cal_working_hours).dst.switch_time) ? sipe_utils_time_to_debug_str(gmtime(&((*buddy->cal_working_hours).dst.switch_time))) : "");
+				IS(wh->dst.switch_time) ? sipe_utils_time_to_debug_str(sipe_cal_gmtime(wh->dst.switch_time, &tm_buf)) : "");
 		SIPE_DEBUG_INFO("Remote now time     : %s",
-			sipe_utils_time_to_debug_str(sipe_localtime_tz(&now, sipe_cal_get_tz(buddy->cal_working_hours, now))));
+			sipe_utils_time_to_debug_str(SIPE_CAL_REMOTE_TM(wh, now, &tm_buf)));
 		SIPE_DEBUG_INFO("Remote start time   : %s",
-			IS(start) ? sipe_utils_time_to_debug_str(sipe_localtime_tz(&start, sipe_cal_get_tz(buddy->cal_working_hours, start))) : "");
+			IS(start) ? sipe_utils_time_to_debug_str(SIPE_CAL_REMOTE_TM(wh, start, &tm_buf)) : "");
 		SIPE_DEBUG_INFO("Remote end time     : %s",
-			IS(end) ? sipe_utils_time_to_debug_str(sipe_localtime_tz(&end, sipe_cal_get_tz(buddy->cal_working_hours, end))) : "");
+			IS(end) ? sipe_utils_time_to_debug_str(SIPE_CAL_REMOTE_TM(wh, end, &tm_buf)) : "");
 		SIPE_DEBUG_INFO("Rem. next_start time: %s",
-			IS(next_start) ? sipe_utils_time_to_debug_str(sipe_localtime_tz(&next_start, sipe_cal_get_tz(buddy->cal_working_hours, next_start))) : "");
+			IS(next_start) ? sipe_utils_time_to_debug_str(SIPE_CAL_REMOTE_TM(wh, next_start, &tm_buf)) : "");
 		SIPE_DEBUG_INFO("Remote switch time  : %s",
-			IS(switch_time) ? sipe_utils_time_to_debug_str(sipe_localtime_tz(&switch_time, sipe_cal_get_tz(buddy->cal_working_hours, switch_time))) : "");
+			IS(switch_time) ? sipe_utils_time_to_debug_str(SIPE_CAL_REMOTE_TM(wh, switch_time, &tm_buf)) : "");
 	} else {
 		SIPE_DEBUG_INFO("Local now time      : %s",
 			sipe_utils_time_to_debug_str(localtime(&now)));
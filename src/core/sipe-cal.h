@@ -114,15 +114,15 @@ sipe_cal_event_debug(const struct sipe_cal_event *cal_event,
 		     const gchar *label);
 
 /**
- * Converts struct tm to Epoch time_t considering timezone.
+ * Converts struct tm in UTC to Epoch time_t. Like mktime(3) the fields
+ * of @c tm are normalized, e.g. tm_wday and tm_yday are updated.
  *
- * @param tz as defined for TZ environment variable.
+ * Doesn't touch the process timezone, i.e. it is thread-safe.
  *
  * Reference: see timegm(3) - Linux man page
  */
 time_t
-sipe_mktime_tz(struct tm *tm,
-	       const char* tz);
+sipe_mktime_utc(struct tm *tm);
 
 /**
  * Converts hex representation of freebusy string as
@@ -139,11 +139,12 @@ struct sipe_cal_working_hours;
 
 /**
  * Parses Working Hours from passed XML piece
- * and creates/fills struct sipe_cal_working_hours in struct sipe_buddy
+ *
+ * @return new struct sipe_cal_working_hours (may be @c NULL).
+ *         Must be freed with sipe_cal_free_working_hours().
  */
-void
-sipe_cal_parse_working_hours(const struct _sipe_xml *xn_working_hours,
-			     struct sipe_buddy *buddy);
+struct sipe_cal_working_hours *
+sipe_cal_parse_working_hours(const struct _sipe_xml *xn_working_hours);
 
 /**
  * Frees struct sipe_cal_working_hours
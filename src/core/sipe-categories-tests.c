@@ -0,0 +1,357 @@
+/**
+ * @file sipe-categories-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Tests for the presence categories processing
+ *
+ * sipe_categories_process() must only change the buddy when the whole
+ * document could be parsed. A truncated document must neither change the
+ * buddy nor drop the changes of an earlier valid document.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "sip-transport.h"
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-buddy.h"
+#include "sipe-cal.h"
+#include "sipe-categories.h"
+#include "sipe-core.h"
+#include "sipe-core-private.h"
+#include "sipe-ocs2007.h"
+#include "sipe-status.h"
+#include "sipe-utils.h"
+#include "uuid.h"
+
+#define TEST_URI      "sip:alice@contoso.com"
+#define TEST_ACTIVITY 42
+
+/* stub functions for backend API */
+void sipe_backend_debug_literal(sipe_debug_level level,
+				const gchar *msg)
+{
+	printf("DEBUG %d: %s\n", level, msg);
+}
+void sipe_backend_debug(sipe_debug_level level,
+			const gchar *format,
+			...)
+{
+	va_list args;
+	gchar *msg;
+	va_start(args, format);
+	msg = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	sipe_backend_debug_literal(level, msg);
+	g_free(msg);
+}
+gboolean sipe_backend_debug_enabled(void)
+{
+	return TRUE;
+}
+
+/* stubs for sipe-utils.c */
+const gchar *sip_transport_epid(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) { return(NULL); }
+char *generateUUIDfromEPID(SIPE_UNUSED_PARAMETER const gchar *epid) { return(NULL); }
+char *sipe_get_epid(SIPE_UNUSED_PARAMETER const char *self_sip_uri,
+		    SIPE_UNUSED_PARAMETER const char *hostname,
+		    SIPE_UNUSED_PARAMETER const char *ip_address) { return(NULL); }
+
+/* status stubs */
+const gchar *sipe_core_activity_description(SIPE_UNUSED_PARAMETER guint type) { return("In a meeting"); }
+guint sipe_status_token_to_activity(SIPE_UNUSED_PARAMETER const gchar *token) { return(TEST_ACTIVITY); }
+const gchar *sipe_ocs2007_status_from_legacy_availability(SIPE_UNUSED_PARAMETER guint availability,
+							  SIPE_UNUSED_PARAMETER const gchar *activity) { return("busy"); }
+const gchar *sipe_ocs2007_legacy_activity_description(SIPE_UNUSED_PARAMETER guint availability) { return(NULL); }
+
+/* calendar stubs: count working hours */
+struct sipe_cal_working_hours {
+	guint dummy;
+};
+static guint working_hours = 0;
+
+struct sipe_cal_working_hours *sipe_cal_parse_working_hours(SIPE_UNUSED_PARAMETER const struct _sipe_xml *xn_working_hours)
+{
+	working_hours++;
+	return(g_new0(struct sipe_cal_working_hours, 1));
+}
+void sipe_cal_free_working_hours(struct sipe_cal_working_hours *wh)
+{
+	if (wh) {
+		working_hours--;
+		g_free(wh);
+	}
+}
+
+/* buddy stubs: record the committed changes */
+struct sipe_buddy_delta {
+	gchar *display_name;
+	guint activity;
+	gboolean has_activity;
+	gboolean update_status;
+};
+static struct sipe_buddy buddy;
+static struct sipe_buddy_delta pending;
+static guint deltas  = 0;
+static guint commits = 0;
+static guint photos  = 0;
+static gchar *photo_hash = NULL;
+
+struct sipe_buddy *sipe_buddy_find_by_uri(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+					  const gchar *uri)
+{
+	return(sipe_strequal(uri, buddy.name) ? &buddy : NULL);
+}
+void sipe_buddy_phone_fields(SIPE_UNUSED_PARAMETER const gchar *phone_type,
+			     sipe_buddy_info_fields *phone_node,
+			     sipe_buddy_info_fields *phone_display_node)
+{
+	*phone_node         = SIPE_BUDDY_INFO_WORK_PHONE;
+	*phone_display_node = SIPE_BUDDY_INFO_WORK_PHONE_DISPLAY;
+}
+void sipe_buddy_update_photo(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			     SIPE_UNUSED_PARAMETER const gchar *uri,
+			     const gchar *hash,
+			     SIPE_UNUSED_PARAMETER const gchar *url,
+			     SIPE_UNUSED_PARAMETER const gchar *headers)
+{
+	photos++;
+	g_free(photo_hash);
+	photo_hash = g_strdup(hash);
+}
+struct sipe_buddy_delta *sipe_buddy_delta_new(void)
+{
+	deltas++;
+	return(g_new0(struct sipe_buddy_delta, 1));
+}
+void sipe_buddy_delta_free(struct sipe_buddy_delta *delta)
+{
+	if (delta) {
+		deltas--;
+		g_free(delta->display_name);
+		g_free(delta);
+	}
+}
+void sipe_buddy_delta_property(struct sipe_buddy_delta *delta,
+			       sipe_buddy_info_fields propkey,
+			       const gchar *property_value)
+{
+	if (property_value && (propkey == SIPE_BUDDY_INFO_DISPLAY_NAME)) {
+		g_free(delta->display_name);
+		delta->display_name = g_strdup(property_value);
+	}
+}
+void sipe_buddy_delta_status(struct sipe_buddy_delta *delta,
+			     guint activity,
+			     SIPE_UNUSED_PARAMETER time_t last_active)
+{
+	delta->activity      = activity;
+	delta->has_activity  = TRUE;
+	delta->update_status = TRUE;
+}
+void sipe_buddy_delta_refresh_status(struct sipe_buddy_delta *delta)
+{
+	delta->update_status = TRUE;
+}
+void sipe_buddy_delta_commit(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+			     struct sipe_buddy *sbuddy,
+			     struct sipe_buddy_delta *changes)
+{
+	if (sbuddy == &buddy)
+		commits++;
+	if (changes->display_name) {
+		g_free(pending.display_name);
+		pending.display_name = changes->display_name;
+		changes->display_name = NULL;
+	}
+	if (changes->has_activity) {
+		pending.activity     = changes->activity;
+		pending.has_activity = TRUE;
+	}
+	pending.update_status |= changes->update_status;
+	sipe_buddy_delta_free(changes);
+}
+
+/* test helpers */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+static void assert_string(const gchar *what,
+			  const gchar *value,
+			  const gchar *expected)
+{
+	if (sipe_strequal(value, expected)) {
+		succeeded++;
+	} else {
+		printf("%s FAILED: '%s' expected: '%s'\n",
+		       what,
+		       value    ? value    : "(nil)",
+		       expected ? expected : "(nil)");
+		failed++;
+	}
+}
+
+static void assert_uint(const gchar *what,
+			guint value,
+			guint expected)
+{
+	if (value == expected) {
+		succeeded++;
+	} else {
+		printf("%s FAILED: %u expected: %u\n", what, value, expected);
+		failed++;
+	}
+}
+
+#define CATEGORIES_START(uri) \
+	"<categories xmlns=\"http://schemas.microsoft.com/2006/09/sip/categories\" uri=\"" uri "\">"
+#define CATEGORY_CONTACT_CARD(name, hash) \
+	"<category name=\"contactCard\" instance=\"0\" publishTime=\"2018-01-01T10:00:00Z\">" \
+	"<contactCard xmlns=\"http://schemas.microsoft.com/2006/09/sip/contactcard\">" \
+	"<identity><name><displayName>" name "</displayName></name></identity>" \
+	"<photo><uri>https://photos.contoso.com/alice</uri><hash>" hash "</hash></photo>" \
+	"</contactCard></category>"
+#define CATEGORY_NOTE(body) \
+	"<category name=\"note\" instance=\"0\" publishTime=\"2018-01-01T10:00:00Z\">" \
+	"<note xmlns=\"http://schemas.microsoft.com/2006/09/sip/note\">" \
+	"<body type=\"personal\">" body "</body></note></category>"
+#define CATEGORY_STATE(subject) \
+	"<category name=\"state\" instance=\"0\" publishTime=\"2018-01-01T10:00:00Z\">" \
+	"<state xmlns=\"http://schemas.microsoft.com/2006/09/sip/state\">" \
+	"<availability>6500</availability><activity token=\"in-a-meeting\"/>" \
+	"<meetingSubject>" subject "</meetingSubject></state></category>"
+#define CATEGORY_CALENDAR_DATA(start) \
+	"<category name=\"calendarData\" instance=\"0\" publishTime=\"2018-01-01T10:00:00Z\">" \
+	"<calendarData xmlns=\"http://schemas.microsoft.com/2006/09/sip/calendarData\">" \
+	"<WorkingHours/>" \
+	"<freeBusy startTime=\"" start "\" granularity=\"PT15M\">AAAA</freeBusy>" \
+	"</calendarData></category>"
+#define CATEGORIES_END "</categories>"
+
+static const gchar valid[] =
+	CATEGORIES_START(TEST_URI)
+	CATEGORY_CONTACT_CARD("Alice", "hash1")
+	CATEGORY_NOTE("Hello")
+	CATEGORY_STATE("Sync")
+	CATEGORY_CALENDAR_DATA("2018-01-01T00:00:00Z")
+	CATEGORIES_END;
+
+/* all categories but the last are complete */
+static const gchar truncated[] =
+	CATEGORIES_START(TEST_URI)
+	CATEGORY_CONTACT_CARD("Mallory", "hash2")
+	CATEGORY_NOTE("Bye")
+	CATEGORY_STATE("Review")
+	CATEGORY_CALENDAR_DATA("2018-02-01T00:00:00Z");
+
+static const gchar unknown[] =
+	CATEGORIES_START("sip:bob@contoso.com")
+	CATEGORY_CONTACT_CARD("Bob", "hash3")
+	CATEGORY_NOTE("Hi")
+	CATEGORIES_END;
+
+static void assert_buddy(const gchar *note,
+			 const gchar *subject,
+			 const gchar *start)
+{
+	assert_string("note",            buddy.note,                 note);
+	assert_string("activity",        buddy.activity,             "In a meeting");
+	assert_string("meeting subject", buddy.meeting_subject,      subject);
+	assert_string("free/busy start", buddy.cal_start_time,       start);
+	assert_string("free/busy",       buddy.cal_free_busy_base64, "AAAA");
+	assert_uint("granularity",       buddy.cal_granularity,      15);
+	assert_uint("working hours",     buddy.cal_working_hours != NULL, TRUE);
+}
+
+static void assert_pending(guint expected_commits,
+			   const gchar *display_name,
+			   guint expected_photos,
+			   const gchar *hash)
+{
+	assert_uint("commits",        commits,              expected_commits);
+	assert_string("display name", pending.display_name, display_name);
+	assert_uint("status",         pending.has_activity, TRUE);
+	assert_uint("activity",       pending.activity,     TEST_ACTIVITY);
+	assert_uint("photo requests", photos,               expected_photos);
+	assert_string("photo hash",   photo_hash,           hash);
+	/* nothing left over from processing */
+	assert_uint("open deltas",    deltas,               0);
+	assert_uint("working hours",  working_hours,        1);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
+{
+	struct sipe_core_private *sipe_private = g_new0(struct sipe_core_private, 1);
+
+	buddy.name = g_strdup(TEST_URI);
+
+	/* valid document: applied */
+	sipe_categories_process(sipe_private, valid, strlen(valid));
+	assert_buddy("Hello", "Sync", "2018-01-01T00:00:00Z");
+	assert_pending(1, "Alice", 1, "hash1");
+
+	/* truncated document: neither applied nor discarding earlier changes */
+	sipe_categories_process(sipe_private, truncated, strlen(truncated));
+	assert_buddy("Hello", "Sync", "2018-01-01T00:00:00Z");
+	assert_pending(1, "Alice", 1, "hash1");
+
+	/* document for a buddy not in the contact list: ignored */
+	sipe_categories_process(sipe_private, unknown, strlen(unknown));
+	assert_buddy("Hello", "Sync", "2018-01-01T00:00:00Z");
+	assert_pending(1, "Alice", 1, "hash1");
+
+	/* processing continues after the truncated document */
+	sipe_categories_process(sipe_private, valid, strlen(valid));
+	assert_buddy("Hello", "Sync", "2018-01-01T00:00:00Z");
+	assert_pending(2, "Alice", 2, "hash1");
+
+	sipe_cal_free_working_hours(buddy.cal_working_hours);
+	g_free(buddy.cal_free_busy_base64);
+	g_free(buddy.cal_start_time);
+	g_free(buddy.meeting_location);
+	g_free(buddy.meeting_subject);
+	g_free(buddy.activity);
+	g_free(buddy.note);
+	g_free(buddy.name);
+	g_free(pending.display_name);
+	g_free(photo_hash);
+	g_free(sipe_private);
+
+	printf("Result: %d PASSED %d FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
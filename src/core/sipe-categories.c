@@ -0,0 +1,565 @@
+/**
+ * @file sipe-categories.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2011-2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *
+ * Process OCS2007+ presence categories from incoming NOTIFY/BENOTIFY
+ *
+ * The document is parsed with the streaming XML parser, i.e. categories are
+ * processed while the document is still being parsed. All changes are
+ * collected in struct sipe_categories_data and only applied to the buddy
+ * when the complete document has been parsed successfully.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "sipe-backend.h"
+#include "sipe-buddy.h"
+#include "sipe-cal.h"
+#include "sipe-categories.h"
+#include "sipe-core.h"
+#include "sipe-core-private.h"
+#include "sipe-ocs2007.h"
+#include "sipe-status.h"
+#include "sipe-utils.h"
+#include "sipe-xml.h"
+
+struct sipe_categories_data {
+	struct sipe_core_private *sipe_private;
+	gchar *uri;
+	struct sipe_buddy *sbuddy;
+	/* changes from this document */
+	struct sipe_buddy_delta *delta;
+	const char *status;
+	gboolean do_update_status;
+	time_t last_active;
+	/* contactCard */
+	gchar *photo_url;
+	gchar *photo_hash;
+	/* note */
+	gboolean has_note_cleaned;
+	gchar *note;
+	gboolean is_oof_note;
+	time_t note_since;
+	/* state */
+	gboolean has_state;
+	gboolean is_mobile;
+	gchar *activity;
+	gchar *meeting_subject;
+	gchar *meeting_location;
+	/* calendarData */
+	gboolean has_free_busy_cleaned;
+	gchar *cal_start_time;
+	int cal_granularity;
+	gchar *cal_free_busy_base64;
+	time_t cal_free_busy_published;
+	struct sipe_cal_working_hours *cal_working_hours;
+};
+
+static void categories_data_free(struct sipe_categories_data *data)
+{
+	sipe_cal_free_working_hours(data->cal_working_hours);
+	g_free(data->cal_free_busy_base64);
+	g_free(data->cal_start_time);
+	g_free(data->meeting_location);
+	g_free(data->meeting_subject);
+	g_free(data->activity);
+	g_free(data->note);
+	g_free(data->photo_hash);
+	g_free(data->photo_url);
+	sipe_buddy_delta_free(data->delta);
+	g_free(data->uri);
+}
+
+static void categories_start(const sipe_xml *xn_categories,
+			     gpointer user_data)
+{
+	struct sipe_categories_data *data = user_data;
+
+	data->uri = g_strdup(sipe_xml_attribute(xn_categories, "uri")); /* with 'sip:' prefix */
+	if (data->uri) {
+		data->sbuddy = sipe_buddy_find_by_uri(data->sipe_private, data->uri);
+		if (data->sbuddy)
+			data->delta = sipe_buddy_delta_new();
+	}
+}
+
+/* compiled paths for category processing */
+static struct sipe_xml_path path_activity = SIPE_XML_PATH_INIT("activity");
+static struct sipe_xml_path path_address = SIPE_XML_PATH_INIT("address");
+static struct sipe_xml_path path_availability = SIPE_XML_PATH_INIT("availability");
+static struct sipe_xml_path path_calendar_data_free_busy = SIPE_XML_PATH_INIT("calendarData/freeBusy");
+static struct sipe_xml_path path_calendar_data_working_hours = SIPE_XML_PATH_INIT("calendarData/WorkingHours");
+static struct sipe_xml_path path_city = SIPE_XML_PATH_INIT("city");
+static struct sipe_xml_path path_company = SIPE_XML_PATH_INIT("company");
+static struct sipe_xml_path path_contact_card = SIPE_XML_PATH_INIT("contactCard");
+static struct sipe_xml_path path_country_code = SIPE_XML_PATH_INIT("countryCode");
+static struct sipe_xml_path path_custom = SIPE_XML_PATH_INIT("custom");
+static struct sipe_xml_path path_department = SIPE_XML_PATH_INIT("department");
+static struct sipe_xml_path path_device = SIPE_XML_PATH_INIT("device");
+static struct sipe_xml_path path_display_string = SIPE_XML_PATH_INIT("displayString");
+static struct sipe_xml_path path_email = SIPE_XML_PATH_INIT("email");
+static struct sipe_xml_path path_hash = SIPE_XML_PATH_INIT("hash");
+static struct sipe_xml_path path_identity = SIPE_XML_PATH_INIT("identity");
+static struct sipe_xml_path path_meeting_location = SIPE_XML_PATH_INIT("meetingLocation");
+static struct sipe_xml_path path_meeting_subject = SIPE_XML_PATH_INIT("meetingSubject");
+static struct sipe_xml_path path_name_display_name = SIPE_XML_PATH_INIT("name/displayName");
+static struct sipe_xml_path path_note_body = SIPE_XML_PATH_INIT("note/body");
+static struct sipe_xml_path path_office = SIPE_XML_PATH_INIT("office");
+static struct sipe_xml_path path_phone = SIPE_XML_PATH_INIT("phone");
+static struct sipe_xml_path path_photo = SIPE_XML_PATH_INIT("photo");
+static struct sipe_xml_path path_state = SIPE_XML_PATH_INIT("state");
+static struct sipe_xml_path path_street = SIPE_XML_PATH_INIT("street");
+static struct sipe_xml_path path_title = SIPE_XML_PATH_INIT("title");
+static struct sipe_xml_path path_uri = SIPE_XML_PATH_INIT("uri");
+static struct sipe_xml_path path_url = SIPE_XML_PATH_INIT("url");
+static struct sipe_xml_path path_zipcode = SIPE_XML_PATH_INIT("zipcode");
+
+static void categories_category(const sipe_xml *xn_category,
+				gpointer user_data)
+{
+	struct sipe_categories_data *data = user_data;
+	struct sipe_core_private *sipe_private = data->sipe_private;
+	struct sipe_buddy_delta *delta = data->delta;
+	const char *uri = data->uri;
+	const sipe_xml *xn_node;
+	const char *tmp;
+	const char *attrVar = sipe_xml_attribute(xn_category, "name");
+	time_t publish_time = (tmp = sipe_xml_attribute(xn_category, "publishTime")) ?
+		sipe_utils_str_to_time(tmp) : 0;
+
+	/* Got presence of a buddy not in our contact list, ignore. */
+	if (!data->sbuddy)
+		return;
+
+	/* contactCard */
+	if (sipe_strequal(attrVar, "contactCard"))
+	{
+		const sipe_xml *card = sipe_xml_path_child(xn_category, &path_contact_card);
+
+		if (card) {
+			const sipe_xml *node;
+			/* identity - Display Name and email */
+			node = sipe_xml_path_child(card, &path_identity);
+			if (node) {
+				char* display_name = sipe_xml_data(
+					sipe_xml_path_child(node, &path_name_display_name));
+				char* email = sipe_xml_data(
+					sipe_xml_path_child(node, &path_email));
+
+				sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
+				sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_EMAIL, email);
+
+				g_free(display_name);
+				g_free(email);
+			}
+			/* company */
+			node = sipe_xml_path_child(card, &path_company);
+			if (node) {
+				char* company = sipe_xml_data(node);
+				sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_COMPANY, company);
+				g_free(company);
+			}
+			/* department */
+			node = sipe_xml_path_child(card, &path_department);
+			if (node) {
+				char* department = sipe_xml_data(node);
+				sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_DEPARTMENT, department);
+				g_free(department);
+			}
+			/* title */
+			node = sipe_xml_path_child(card, &path_title);
+			if (node) {
+				char* title = sipe_xml_data(node);
+				sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_JOB_TITLE, title);
+				g_free(title);
+			}
+			/* office */
+			node = sipe_xml_path_child(card, &path_office);
+			if (node) {
+				char* office = sipe_xml_data(node);
+				sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_OFFICE, office);
+				g_free(office);
+			}
+			/* site (url) */
+			node = sipe_xml_path_child(card, &path_url);
+			if (node) {
+				char* site = sipe_xml_data(node);
+				sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_SITE, site);
+				g_free(site);
+			}
+			/* phone */
+			for (node = sipe_xml_path_child(card, &path_phone);
+			     node;
+			     node = sipe_xml_twin(node))
+			{
+				const char *phone_type = sipe_xml_attribute(node, "type");
+				char* phone = sipe_xml_data(sipe_xml_path_child(node, &path_uri));
+				char* phone_display_string = sipe_xml_data(sipe_xml_path_child(node, &path_display_string));
+
+				if (!is_empty(phone)) {
+					sipe_buddy_info_fields phone_node;
+					sipe_buddy_info_fields phone_display_node;
+
+					sipe_buddy_phone_fields(phone_type,
+								&phone_node,
+								&phone_display_node);
+					sipe_buddy_delta_property(delta, phone_node, phone);
+					sipe_buddy_delta_property(delta, phone_display_node, phone_display_string);
+				}
+
+				g_free(phone);
+				g_free(phone_display_string);
+			}
+			/* address */
+			for (node = sipe_xml_path_child(card, &path_address);
+			     node;
+			     node = sipe_xml_twin(node))
+			{
+				if (sipe_strequal(sipe_xml_attribute(node, "type"), "work")) {
+					char* street = sipe_xml_data(sipe_xml_path_child(node, &path_street));
+					char* city = sipe_xml_data(sipe_xml_path_child(node, &path_city));
+					char* state = sipe_xml_data(sipe_xml_path_child(node, &path_state));
+					char* zipcode = sipe_xml_data(sipe_xml_path_child(node, &path_zipcode));
+					char* country_code = sipe_xml_data(sipe_xml_path_child(node, &path_country_code));
+
+					sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_STREET, street);
+					sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_CITY, city);
+					sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_STATE, state);
+					sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_ZIPCODE, zipcode);
+					sipe_buddy_delta_property(delta, SIPE_BUDDY_INFO_COUNTRY, country_code);
+
+					g_free(street);
+					g_free(city);
+					g_free(state);
+					g_free(zipcode);
+					g_free(country_code);
+
+					break;
+				}
+			}
+			/* photo: fetched after the document has been parsed */
+			for (node = sipe_xml_path_child(card, &path_photo);
+			     node;
+			     node = sipe_xml_twin(node)) {
+				const gchar *type = sipe_xml_attribute(node, "type");
+				gchar *photo_url;
+				gchar *hash;
+
+				if (sipe_strequal(type, "default") &&
+				    !SIPE_CORE_PUBLIC_FLAG_IS(ALLOW_WEB_PHOTO)) {
+					SIPE_DEBUG_INFO("sipe_categories_process: skipping download of web profile picture for %s", uri);
+					continue;
+				}
+
+				photo_url = sipe_xml_data(sipe_xml_path_child(node, &path_uri));
+				hash = sipe_xml_data(sipe_xml_path_child(node, &path_hash));
+
+				if (!is_empty(photo_url) && !is_empty(hash)) {
+					g_free(data->photo_url);
+					g_free(data->photo_hash);
+					data->photo_url  = photo_url;
+					data->photo_hash = hash;
+					break;
+				}
+
+				g_free(hash);
+				g_free(photo_url);
+			}
+		}
+	}
+	/* note */
+	else if (sipe_strequal(attrVar, "note"))
+	{
+		if (!data->has_note_cleaned) {
+			data->has_note_cleaned = TRUE;
+			data->note_since = publish_time;
+		}
+		if (publish_time >= data->note_since) {
+			/* clean up in case no 'note' element is supplied
+			 * which indicate note removal in client
+			 */
+			g_free(data->note);
+			data->note = NULL;
+			data->is_oof_note = FALSE;
+			data->note_since = publish_time;
+
+			xn_node = sipe_xml_path_child(xn_category, &path_note_body);
+			if (xn_node) {
+				char *tmp;
+				data->note = g_markup_escape_text((tmp = sipe_xml_data(xn_node)), -1);
+				g_free(tmp);
+				data->is_oof_note = sipe_strequal(sipe_xml_attribute(xn_node, "type"), "OOF");
+
+				SIPE_DEBUG_INFO("sipe_categories_process: uri(%s), note(%s)",
+						uri, data->note ? data->note : "");
+			}
+		}
+		/* to trigger UI refresh in case no status info is supplied in this update */
+		data->do_update_status = TRUE;
+	}
+	/* state */
+	else if(sipe_strequal(attrVar, "state"))
+	{
+		char *tmp;
+		int availability;
+		const sipe_xml *xn_availability;
+		const sipe_xml *xn_activity;
+		const sipe_xml *xn_device;
+		const sipe_xml *xn_meeting_subject;
+		const sipe_xml *xn_meeting_location;
+		const gchar *legacy_activity;
+		const gchar *last_active_attr;
+
+		xn_node = sipe_xml_path_child(xn_category, &path_state);
+		if (!xn_node) return;
+		xn_availability = sipe_xml_path_child(xn_node, &path_availability);
+		if (!xn_availability) return;
+		xn_activity = sipe_xml_path_child(xn_node, &path_activity);
+		xn_meeting_subject = sipe_xml_path_child(xn_node, &path_meeting_subject);
+		xn_meeting_location = sipe_xml_path_child(xn_node, &path_meeting_location);
+
+		tmp = sipe_xml_data(xn_availability);
+		availability = atoi(tmp);
+		g_free(tmp);
+
+		data->has_state = TRUE;
+
+		data->is_mobile = FALSE;
+		xn_device = sipe_xml_path_child(xn_node, &path_device);
+		if (xn_device) {
+			tmp = sipe_xml_data(xn_device);
+			data->is_mobile = !g_ascii_strcasecmp(tmp, "Mobile");
+			g_free(tmp);
+		}
+
+		/* activity */
+		g_free(data->activity);
+		data->activity = NULL;
+		if (xn_activity) {
+			const char *token = sipe_xml_attribute(xn_activity, "token");
+			const sipe_xml *xn_custom = sipe_xml_path_child(xn_activity, &path_custom);
+
+			/* from token */
+			if (!is_empty(token)) {
+				data->activity = g_strdup(sipe_core_activity_description(sipe_status_token_to_activity(token)));
+			}
+			/* from custom element */
+			if (xn_custom) {
+				char *custom = sipe_xml_data(xn_custom);
+
+				if (!is_empty(custom)) {
+					g_free(data->activity);
+					data->activity = custom;
+					custom = NULL;
+				}
+				g_free(custom);
+			}
+		}
+		/* meeting_subject */
+		g_free(data->meeting_subject);
+		data->meeting_subject = NULL;
+		if (xn_meeting_subject) {
+			char *meeting_subject = sipe_xml_data(xn_meeting_subject);
+
+			if (!is_empty(meeting_subject)) {
+				data->meeting_subject = meeting_subject;
+				meeting_subject = NULL;
+			}
+			g_free(meeting_subject);
+		}
+		/* meeting_location */
+		g_free(data->meeting_location);
+		data->meeting_location = NULL;
+		if (xn_meeting_location) {
+			char *meeting_location = sipe_xml_data(xn_meeting_location);
+
+			if (!is_empty(meeting_location)) {
+				data->meeting_location = meeting_location;
+				meeting_location = NULL;
+			}
+			g_free(meeting_location);
+		}
+
+		data->status = sipe_ocs2007_status_from_legacy_availability(availability, NULL);
+		legacy_activity = sipe_ocs2007_legacy_activity_description(availability);
+		if (data->activity && legacy_activity) {
+			gchar *tmp2 = data->activity;
+
+			data->activity = g_strdup_printf("%s, %s", data->activity, legacy_activity);
+			g_free(tmp2);
+		} else if (legacy_activity) {
+			data->activity = g_strdup(legacy_activity);
+		}
+
+		/* lastActive */
+		last_active_attr = sipe_xml_attribute(xn_node, "lastActive");
+		if (last_active_attr) {
+			data->last_active = sipe_utils_str_to_time(last_active_attr);
+		}
+
+		data->do_update_status = TRUE;
+	}
+	/* calendarData */
+	else if(sipe_strequal(attrVar, "calendarData"))
+	{
+		const sipe_xml *xn_free_busy = sipe_xml_path_child(xn_category, &path_calendar_data_free_busy);
+		const sipe_xml *xn_working_hours = sipe_xml_path_child(xn_category, &path_calendar_data_working_hours);
+
+		if (xn_free_busy) {
+			if (!data->has_free_busy_cleaned) {
+				data->has_free_busy_cleaned = TRUE;
+				data->cal_free_busy_published = publish_time;
+			}
+
+			if (publish_time >= data->cal_free_busy_published) {
+				g_free(data->cal_start_time);
+				data->cal_start_time = g_strdup(sipe_xml_attribute(xn_free_busy, "startTime"));
+
+				data->cal_granularity = sipe_strcase_equal(sipe_xml_attribute(xn_free_busy, "granularity"), "PT15M") ?
+					15 : 0;
+
+				g_free(data->cal_free_busy_base64);
+				data->cal_free_busy_base64 = sipe_xml_data(xn_free_busy);
+
+				data->cal_free_busy_published = publish_time;
+
+				SIPE_DEBUG_INFO("sipe_categories_process: startTime=%s granularity=%d cal_free_busy_base64=\n%s", data->cal_start_time, data->cal_granularity, data->cal_free_busy_base64);
+			}
+		}
+
+		if (xn_working_hours) {
+			sipe_cal_free_working_hours(data->cal_working_hours);
+			data->cal_working_hours = sipe_cal_parse_working_hours(xn_working_hours);
+		}
+	}
+}
+
+/* move all collected changes to the buddy */
+static void categories_apply(struct sipe_categories_data *data)
+{
+	struct sipe_core_private *sipe_private = data->sipe_private;
+	struct sipe_buddy *sbuddy = data->sbuddy;
+
+	if (data->has_note_cleaned) {
+		g_free(sbuddy->note);
+		sbuddy->note        = data->note;
+		sbuddy->is_oof_note = data->is_oof_note;
+		sbuddy->note_since  = data->note_since;
+		data->note = NULL;
+	}
+
+	if (data->has_state) {
+		sbuddy->is_mobile = data->is_mobile;
+		g_free(sbuddy->activity);
+		sbuddy->activity = data->activity;
+		g_free(sbuddy->meeting_subject);
+		sbuddy->meeting_subject = data->meeting_subject;
+		g_free(sbuddy->meeting_location);
+		sbuddy->meeting_location = data->meeting_location;
+		data->activity         = NULL;
+		data->meeting_subject  = NULL;
+		data->meeting_location = NULL;
+	}
+
+	if (data->has_free_busy_cleaned) {
+		g_free(sbuddy->cal_start_time);
+		sbuddy->cal_start_time = data->cal_start_time;
+		sbuddy->cal_granularity = data->cal_granularity;
+		g_free(sbuddy->cal_free_busy_base64);
+		sbuddy->cal_free_busy_base64 = data->cal_free_busy_base64;
+		g_free(sbuddy->cal_free_busy);
+		sbuddy->cal_free_busy = NULL;
+		sbuddy->cal_free_busy_published = data->cal_free_busy_published;
+		data->cal_start_time       = NULL;
+		data->cal_free_busy_base64 = NULL;
+	}
+
+	if (data->cal_working_hours) {
+		sipe_cal_free_working_hours(sbuddy->cal_working_hours);
+		sbuddy->cal_working_hours = data->cal_working_hours;
+		data->cal_working_hours = NULL;
+	}
+
+	if (data->photo_url)
+		sipe_buddy_update_photo(sipe_private,
+					data->uri,
+					data->photo_hash,
+					data->photo_url,
+					NULL);
+
+	if (data->status) {
+		SIPE_DEBUG_INFO("sipe_categories_process: %s", data->status);
+		sipe_buddy_delta_status(data->delta,
+					sipe_status_token_to_activity(data->status),
+					data->last_active);
+	} else if (data->do_update_status) {
+		/* no status category in this update,
+		   using contact's current status */
+		sipe_buddy_delta_refresh_status(data->delta);
+	}
+
+	/* applied to the backend by the buddy delta action */
+	sipe_buddy_delta_commit(sipe_private, sbuddy, data->delta);
+	data->delta = NULL;
+}
+
+void sipe_categories_process(struct sipe_core_private *sipe_private,
+			     const gchar *data,
+			     gsize len)
+{
+	static const struct sipe_xml_stream_handler handlers[] = {
+		{ "categories",          categories_start, NULL },
+		{ "categories/category", NULL, categories_category },
+		{ NULL, NULL, NULL }
+	};
+	struct sipe_categories_data categories;
+
+	memset(&categories, 0, sizeof(categories));
+	categories.sipe_private = sipe_private;
+
+	/* categories are processed one at a time while parsing */
+	if (!sipe_xml_stream(data, len, handlers, &categories)) {
+		SIPE_DEBUG_ERROR("sipe_categories_process: discarding incomplete update for %s",
+				 categories.uri ? categories.uri : "");
+	} else if (categories.sbuddy) {
+		categories_apply(&categories);
+	}
+
+	categories_data_free(&categories);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2011-2016 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2011-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  *
  * This program is free software; you can redistribute it and/or modify
@@ -56,6 +56,7 @@ struct sipe_certificate {
 
 struct certificate_callback_data {
 	gchar *target;
+	gchar *webticket_uri;
 	struct sipe_svc_session *session;
 };
 
@@ -63,6 +64,7 @@ static void callback_data_free(struct certificate_callback_data *ccd)
 {
 	if (ccd) {
 		sipe_svc_session_close(ccd->session);
+		g_free(ccd->webticket_uri);
 		g_free(ccd->target);
 		g_free(ccd);
 	}
@@ -229,6 +231,9 @@ static void get_and_publish_cert(struct sipe_core_private *sipe_private,
 	}
 
 	if (!success) {
+		/* Web Ticket might have been rejected: don't reuse it */
+		sipe_webticket_invalidate(sipe_private, ccd->webticket_uri);
+
 		certificate_failure(sipe_private,
 				    _("Certificate request to %s failed"),
 				    uri,
@@ -259,6 +264,8 @@ static void certprov_webticket(struct sipe_core_private *sipe_private,
 
 			SIPE_DEBUG_INFO_NOFORMAT("certprov_webticket: created certificate request");
 
+			ccd->webticket_uri = g_strdup(base_uri);
+
 			if (sipe_svc_get_and_publish_cert(sipe_private,
 							  ccd->session,
 							  auth_uri,
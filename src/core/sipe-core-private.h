@@ -21,11 +21,11 @@
  */
 
 /* Forward declarations */
-struct sip_address_data;
 struct sip_csta;
-struct sip_service_data;
+struct sip_resolve;
 struct sip_transport;
 struct sipe_buddies;
+struct sipe_cache;
 struct sipe_calendar;
 struct sipe_certificate;
 struct sipe_ews_autodiscover;
@@ -35,6 +35,8 @@ struct sipe_http;
 struct sipe_http_request;
 struct sipe_lync_autodiscover;
 struct sipe_media_call_private;
+struct sipe_presence_batch;
+struct sipe_scheduler;
 struct sipe_svc;
 struct sipe_ucs;
 struct sipe_webticket;
@@ -54,8 +56,7 @@ struct sipe_core_private {
 	/* sip-transport.c private data */
 	struct sip_transport *transport;
 	GSList *lync_autodiscover_servers;           /* Lync autodiscover */
-	const struct sip_service_data *service_data; /* autodiscovery SRV records */
-	const struct sip_address_data *address_data; /* autodiscovery A records */
+	struct sip_resolve *resolve;                 /* autodiscovery DNS SRV & A records */
 	gchar *user_agent;
 	guint transport_type;
 	guint authentication_type;
@@ -122,10 +123,12 @@ struct sipe_core_private {
 	gchar *ocs2005_user_states;
 
 	/* Scheduling system */
-	GSList *timeouts;
+	struct sipe_scheduler *scheduler;
 
 	/* Active subscriptions */
 	GHashTable *subscriptions;
+	struct sipe_presence_batch *presence_batch;
+	guint presence_batch_size;
 
 	/* Voice call */
 	GHashTable *media_calls;
@@ -151,14 +154,13 @@ struct sipe_core_private {
 	/* For RCC - Remote Call Control */
 	struct sip_csta *csta;
 
-	struct sipe_dns_query *dns_query;
-
 	/* HTTP service */
 	struct sipe_http *http;
 
 	/* TLS-DSK: Certificates & Web services */
 	struct sipe_certificate *certificate;
 	struct sipe_webticket *webticket;
+	struct sipe_cache *cache;
 	struct sipe_svc *svc;
 
 	/* Unified Contact Store */
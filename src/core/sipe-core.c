@@ -75,6 +75,7 @@
 #include "sip-transport.h"
 #include "sipe-backend.h"
 #include "sipe-buddy.h"
+#include "sipe-cache.h"
 #include "sipe-cal.h"
 #include "sipe-certificate.h"
 #include "sipe-chat.h"
@@ -461,6 +462,7 @@ void sipe_core_deallocate(struct sipe_core_public *sipe_public)
 	sipe_ews_autodiscover_free(sipe_private);
 	sipe_cal_calendar_free(sipe_private->calendar);
 	sipe_certificate_free(sipe_private);
+	sipe_cache_free(sipe_private);
 
 	g_free(sipe_private->public.sip_name);
 	g_free(sipe_private->public.sip_domain);
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2011-2015 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2011-2018 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2010 pier11 <pier11@operamail.com>
  *
  * This program is free software; you can redistribute it and/or modify
@@ -285,6 +285,16 @@ void sipe_crypt_tls_block(const guchar *key, gsize key_length,
 	}
 }
 
+gboolean sipe_crypt_random(guchar *buffer, gsize length)
+{
+	if (PK11_GenerateRandom(buffer, length) != SECSuccess) {
+		SIPE_DEBUG_ERROR("sipe_crypt_random: can't generate %" G_GSIZE_FORMAT " random bytes",
+				 length);
+		return(FALSE);
+	}
+	return(TRUE);
+}
+
 /*
   Local Variables:
   mode: c
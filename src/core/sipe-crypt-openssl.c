@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2013-2017 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2013-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -24,6 +24,7 @@
  * Cipher routines implementation based on OpenSSL.
  */
 #include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/rsa.h>
 
 #include "glib.h"
@@ -246,6 +247,16 @@ void sipe_crypt_tls_block(const guchar *key, gsize key_length,
 	}
 }
 
+gboolean sipe_crypt_random(guchar *buffer, gsize length)
+{
+	if (RAND_bytes(buffer, length) != 1) {
+		SIPE_DEBUG_ERROR("sipe_crypt_random: can't generate %" G_GSIZE_FORMAT " random bytes",
+				 length);
+		return(FALSE);
+	}
+	return(TRUE);
+}
+
 /*
   Local Variables:
   mode: c
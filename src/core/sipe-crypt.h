@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010-2015 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -52,7 +52,7 @@ gboolean sipe_crypt_verify_rsa(gpointer public,
 			       const guchar *digest, gsize digest_length,
 			       const guchar *signature, gsize signature_length);
 
-/* Stream RC4 cipher for file transfer */
+/* Stream RC4 cipher for file transfer (in & out may be the same buffer) */
 gpointer sipe_crypt_ft_start(const guchar *key);
 void sipe_crypt_ft_stream(gpointer context,
 			  const guchar *in, gsize length,
@@ -71,3 +71,6 @@ void sipe_crypt_tls_block(const guchar *key, gsize key_length,
 			  const guchar *iv, gsize iv_length,
 			  const guchar *in, gsize length,
 			  guchar *out);
+
+/* Cryptographically secure random bytes, returns FALSE on failure */
+gboolean sipe_crypt_random(guchar *buffer, gsize length);
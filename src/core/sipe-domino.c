@@ -332,7 +332,7 @@ static void sipe_domino_do_calendar_request(struct sipe_calendar *cal)
 		now_tm->tm_sec = 0;
 		now_tm->tm_min = 0;
 		now_tm->tm_hour = 0;
-		cal->fb_start = sipe_mktime_tz(now_tm, "UTC");
+		cal->fb_start = sipe_mktime_utc(now_tm);
 		cal->fb_start -= 24*60*60;
 		/* end = start + 4 days - 1 sec */
 		end = cal->fb_start + SIPE_FREE_BUSY_PERIOD_SEC - 1;
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2013-2015 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2013-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  *
  * This program is free software; you can redistribute it and/or modify
@@ -31,10 +31,12 @@
  */
 
 #include <string.h>
+#include <time.h>
 
 #include <glib.h>
 
 #include "sipe-backend.h"
+#include "sipe-cache.h"
 #include "sipe-common.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
@@ -43,6 +45,9 @@
 #include "sipe-utils.h"
 #include "sipe-xml.h"
 
+#define EWS_AUTODISCOVER_CACHE_PREFIX  "ews-autodiscover:"
+#define EWS_AUTODISCOVER_CACHE_TIMEOUT (7 * 24 * 60 * 60) /* 7 days */
+
 struct sipe_ews_autodiscover_cb {
 	sipe_ews_autodiscover_callback *cb;
 	gpointer cb_data;
@@ -61,8 +66,79 @@ struct sipe_ews_autodiscover {
 	const struct autodiscover_method *method;
 	gboolean retry;
 	gboolean completed;
+	gboolean from_cache;
 };
 
+static gchar *sipe_ews_autodiscover_cache_key(struct sipe_core_private *sipe_private)
+{
+	return(g_strconcat(EWS_AUTODISCOVER_CACHE_PREFIX,
+			   sipe_private->email,
+			   NULL));
+}
+
+/* one line per field, empty line for missing field */
+static void sipe_ews_autodiscover_cache_store(struct sipe_core_private *sipe_private,
+					      const struct sipe_ews_autodiscover_data *ews_data)
+{
+	gchar *key   = sipe_ews_autodiscover_cache_key(sipe_private);
+	gchar *value = g_strdup_printf("%s\n%s\n%s\n%s\n%s",
+				       ews_data->as_url    ? ews_data->as_url    : "",
+				       ews_data->ews_url   ? ews_data->ews_url   : "",
+				       ews_data->legacy_dn ? ews_data->legacy_dn : "",
+				       ews_data->oab_url   ? ews_data->oab_url   : "",
+				       ews_data->oof_url   ? ews_data->oof_url   : "");
+
+	sipe_cache_store(sipe_private,
+			 key,
+			 value,
+			 time(NULL) + EWS_AUTODISCOVER_CACHE_TIMEOUT,
+			 FALSE);
+	g_free(value);
+	g_free(key);
+}
+
+static struct sipe_ews_autodiscover_data *sipe_ews_autodiscover_cache_lookup(struct sipe_core_private *sipe_private)
+{
+	gchar *key = sipe_ews_autodiscover_cache_key(sipe_private);
+	const gchar *value = sipe_cache_lookup(sipe_private, key, NULL);
+	struct sipe_ews_autodiscover_data *ews_data = NULL;
+
+	if (value) {
+		gchar **fields = g_strsplit(value, "\n", 5);
+
+		if (g_strv_length(fields) == 5) {
+			ews_data = g_new0(struct sipe_ews_autodiscover_data, 1);
+
+#define _FIELD(index, field) \
+			if (*fields[index]) ews_data->field = g_strdup(fields[index])
+
+			_FIELD(0, as_url);
+			_FIELD(1, ews_url);
+			_FIELD(2, legacy_dn);
+			_FIELD(3, oab_url);
+			_FIELD(4, oof_url);
+#undef _FIELD
+
+		}
+		g_strfreev(fields);
+	}
+	g_free(key);
+
+	return(ews_data);
+}
+
+static void sipe_ews_autodiscover_data_free(struct sipe_ews_autodiscover_data *ews_data)
+{
+	if (ews_data) {
+		g_free((gchar *)ews_data->as_url);
+		g_free((gchar *)ews_data->ews_url);
+		g_free((gchar *)ews_data->legacy_dn);
+		g_free((gchar *)ews_data->oab_url);
+		g_free((gchar *)ews_data->oof_url);
+		g_free(ews_data);
+	}
+}
+
 static void sipe_ews_autodiscover_complete(struct sipe_core_private *sipe_private,
 					   struct sipe_ews_autodiscover_data *ews_data)
 {
@@ -134,6 +210,10 @@ static void sipe_ews_autodiscover_parse(struct sipe_core_private *sipe_private,
 				g_free(type);
 			}
 
+			if (ews_data->as_url || ews_data->ews_url)
+				sipe_ews_autodiscover_cache_store(sipe_private,
+								  ews_data);
+
 		/* POX autodiscover redirect to new email address? */
 		} else if ((node = sipe_xml_child(account, "RedirectAddr")) != NULL) {
 			gchar *addr = sipe_xml_data(node);
@@ -348,6 +428,18 @@ void sipe_ews_autodiscover_start(struct sipe_core_private *sipe_private,
 {
 	struct sipe_ews_autodiscover *sea = sipe_private->ews_autodiscover;
 
+	/* result from previous session? */
+	if (!sea->completed && !sea->method) {
+		struct sipe_ews_autodiscover_data *ews_data = sipe_ews_autodiscover_cache_lookup(sipe_private);
+
+		if (ews_data) {
+			SIPE_DEBUG_INFO_NOFORMAT("sipe_ews_autodiscover_start: using cached data");
+			sea->data       = ews_data;
+			sea->completed  = TRUE;
+			sea->from_cache = TRUE;
+		}
+	}
+
 	if (sea->completed) {
 		(*callback)(sipe_private, sea->data, callback_data);
 	} else {
@@ -361,6 +453,26 @@ void sipe_ews_autodiscover_start(struct sipe_core_private *sipe_private,
 	}
 }
 
+gboolean sipe_ews_autodiscover_invalidate(struct sipe_core_private *sipe_private)
+{
+	struct sipe_ews_autodiscover *sea = sipe_private->ews_autodiscover;
+	gboolean from_cache = sea->from_cache;
+	gchar *key = sipe_ews_autodiscover_cache_key(sipe_private);
+
+	sipe_cache_invalidate(sipe_private, key);
+	g_free(key);
+
+	/* next start will trigger a new autodiscover */
+	if (from_cache && !sea->callbacks) {
+		sipe_ews_autodiscover_data_free(sea->data);
+		sea->data       = NULL;
+		sea->completed  = FALSE;
+		sea->from_cache = FALSE;
+	}
+
+	return(from_cache);
+}
+
 void sipe_ews_autodiscover_init(struct sipe_core_private *sipe_private)
 {
 	struct sipe_ews_autodiscover *sea = g_new0(struct sipe_ews_autodiscover, 1);
@@ -373,16 +485,8 @@ void sipe_ews_autodiscover_init(struct sipe_core_private *sipe_private)
 void sipe_ews_autodiscover_free(struct sipe_core_private *sipe_private)
 {
 	struct sipe_ews_autodiscover *sea = sipe_private->ews_autodiscover;
-	struct sipe_ews_autodiscover_data *ews_data = sea->data;
 	sipe_ews_autodiscover_complete(sipe_private, NULL);
-	if (ews_data) {
-		g_free((gchar *)ews_data->as_url);
-		g_free((gchar *)ews_data->ews_url);
-		g_free((gchar *)ews_data->legacy_dn);
-		g_free((gchar *)ews_data->oab_url);
-		g_free((gchar *)ews_data->oof_url);
-		g_free(ews_data);
-	}
+	sipe_ews_autodiscover_data_free(sea->data);
 	g_free(sea->email);
 	g_free(sea);
 }
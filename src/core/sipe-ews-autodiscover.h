@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2013 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2013-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  *
  * This program is free software; you can redistribute it and/or modify
@@ -48,6 +48,9 @@ typedef void (sipe_ews_autodiscover_callback)(struct sipe_core_private *sipe_pri
 /**
  * Trigger EWS autodiscover
  *
+ * NOTE: the callback is called immediately if the result is available,
+ *       e.g. from the cache.
+ *
  * @param sipe_private  SIPE core private data
  * @param callback      callback function
  * @param callback_data callback data
@@ -56,6 +59,18 @@ void sipe_ews_autodiscover_start(struct sipe_core_private *sipe_private,
 				 sipe_ews_autodiscover_callback *callback,
 				 gpointer callback_data);
 
+/**
+ * Invalidate cached EWS autodiscover result
+ *
+ * Must be called when the EWS URLs don't work.
+ *
+ * @param sipe_private SIPE core private data
+ *
+ * @return @c TRUE if the result was taken from the cache, i.e. the next
+ *         @c sipe_ews_autodiscover_start() will trigger a new autodiscover
+ */
+gboolean sipe_ews_autodiscover_invalidate(struct sipe_core_private *sipe_private);
+
 /**
  * Initialize EWS autodiscover data
  *
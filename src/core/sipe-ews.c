@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010-2015 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2018 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2010, 2009 pier11 <pier11@operamail.com>
  *
  *
@@ -377,7 +377,7 @@ static void sipe_ews_do_avail_request(struct sipe_calendar *cal)
 		now_tm->tm_sec = 0;
 		now_tm->tm_min = 0;
 		now_tm->tm_hour = 0;
-		cal->fb_start = sipe_mktime_tz(now_tm, "UTC");
+		cal->fb_start = sipe_mktime_utc(now_tm);
 		cal->fb_start -= 24*60*60;
 		/* end = start + 4 days - 1 sec */
 		end = cal->fb_start + SIPE_FREE_BUSY_PERIOD_SEC - 1;
@@ -428,7 +428,19 @@ sipe_ews_run_state_machine(struct sipe_calendar *cal)
 	switch (cal->state) {
 	case SIPE_EWS_STATE_AVAILABILITY_FAILURE:
 	case SIPE_EWS_STATE_OOF_FAILURE:
-		cal->is_ews_disabled = TRUE;
+		if (sipe_ews_autodiscover_invalidate(cal->sipe_private)) {
+			/* cached URLs are outdated: repeat autodiscover on next update */
+			g_free(cal->as_url);
+			g_free(cal->legacy_dn);
+			g_free(cal->oab_url);
+			g_free(cal->oof_url);
+			cal->as_url    = NULL;
+			cal->legacy_dn = NULL;
+			cal->oab_url   = NULL;
+			cal->oof_url   = NULL;
+			cal->state     = SIPE_EWS_STATE_IDLE;
+		} else
+			cal->is_ews_disabled = TRUE;
 		break;
 	case SIPE_EWS_STATE_IDLE:
 		sipe_ews_do_avail_request(cal);
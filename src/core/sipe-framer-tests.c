@@ -0,0 +1,435 @@
+/**
+ * @file sipe-framer-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests for sipe-framer.c incremental message framing */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <glib.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "sip-transport.h"
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-core.h"
+#include "sipe-framer.h"
+#include "sipe-mime.h"
+#include "sipe-utils.h"
+#include "sipmsg.h"
+#include "uuid.h"
+
+/* stub functions for backend API */
+void sipe_backend_debug_literal(sipe_debug_level level,
+				const gchar *msg)
+{
+	printf("DEBUG %d: %s\n", level, msg);
+}
+void sipe_backend_debug(sipe_debug_level level,
+			const gchar *format,
+			...)
+{
+	va_list args;
+	gchar *msg;
+	va_start(args, format);
+	msg = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	sipe_backend_debug_literal(level, msg);
+	g_free(msg);
+}
+/* don't dump every framed message */
+gboolean sipe_backend_debug_enabled(void)
+{
+	return FALSE;
+}
+gchar *sipe_backend_markup_css_property(SIPE_UNUSED_PARAMETER const gchar *style,
+					SIPE_UNUSED_PARAMETER const gchar *option) { return(NULL); }
+void sipe_mime_parts_foreach(SIPE_UNUSED_PARAMETER const gchar *type,
+			     SIPE_UNUSED_PARAMETER const gchar *body,
+			     SIPE_UNUSED_PARAMETER sipe_mime_parts_cb callback,
+			     SIPE_UNUSED_PARAMETER gpointer user_data) {}
+
+const gchar *sip_transport_epid(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) { return(NULL); }
+char *generateUUIDfromEPID(SIPE_UNUSED_PARAMETER const gchar *epid) { return(NULL); }
+char *sipe_get_epid(SIPE_UNUSED_PARAMETER const char *self_sip_uri,
+		    SIPE_UNUSED_PARAMETER const char *hostname,
+		    SIPE_UNUSED_PARAMETER const char *ip_address) { return(NULL); }
+
+/* test helpers */
+static guint succeeded = 0;
+static guint failed    = 0;
+static const gchar *testname;
+
+static void assert_string(const gchar *what,
+			  const gchar *value,
+			  const gchar *expected)
+{
+	if (sipe_strequal(value, expected)) {
+		succeeded++;
+	} else {
+		printf("[%s]\n%s FAILED: '%s' expected: '%s'\n",
+		       testname, what,
+		       value ? value : "(nil)",
+		       expected ? expected : "(nil)");
+		failed++;
+	}
+}
+
+static void assert_int(const gchar *what,
+		       int value,
+		       int expected)
+{
+	if (value == expected) {
+		succeeded++;
+	} else {
+		printf("[%s]\n%s FAILED: %d expected: %d\n",
+		       testname, what, value, expected);
+		failed++;
+	}
+}
+
+/* simulates a backend input callback: append data to connection buffer */
+static void feed_len(struct sipe_transport_connection *conn,
+		     const gchar *data,
+		     gsize length)
+{
+	if (conn->buffer_used + length + 1 > conn->buffer_length) {
+		conn->buffer_length = conn->buffer_used + length + 1;
+		conn->buffer = g_realloc(conn->buffer, conn->buffer_length);
+	}
+	memcpy(conn->buffer + conn->buffer_used, data, length);
+	conn->buffer_used += length;
+	conn->buffer[conn->buffer_used] = '\0';
+}
+
+static void feed(struct sipe_transport_connection *conn,
+		 const gchar *data)
+{
+	feed_len(conn, data, strlen(data));
+}
+
+static void assert_pending(struct sipe_framer *framer,
+			   struct sipe_transport_connection *conn,
+			   const gchar *what)
+{
+	struct sipmsg *msg = sipe_framer_next(framer, conn);
+	if (msg) {
+		printf("[%s]\n%s FAILED: unexpected message\n", testname, what);
+		sipmsg_free(msg);
+		failed++;
+	} else {
+		succeeded++;
+	}
+}
+
+/* checks response & body, returns the message */
+static struct sipmsg *assert_message(struct sipe_framer *framer,
+				     struct sipe_transport_connection *conn,
+				     int response,
+				     const gchar *body)
+{
+	struct sipmsg *msg = sipe_framer_next(framer, conn);
+	if (!msg) {
+		printf("[%s]\nmessage FAILED: no message\n", testname);
+		failed++;
+		return(NULL);
+	}
+	assert_int("response", msg->response, response);
+	if (body) {
+		assert_string("body",    msg->body,    body);
+		assert_int(   "bodylen", msg->bodylen, strlen(body));
+	}
+	return(msg);
+}
+
+static void check_message(struct sipe_framer *framer,
+			  struct sipe_transport_connection *conn,
+			  int response,
+			  const gchar *body)
+{
+	sipmsg_free(assert_message(framer, conn, response, body));
+}
+
+static void reset(struct sipe_framer *framer,
+		  struct sipe_transport_connection *conn)
+{
+	sipe_framer_reset(framer);
+	conn->buffer_used = 0;
+	if (conn->buffer)
+		conn->buffer[0] = '\0';
+}
+
+#ifdef HAVE_ZLIB
+/* zlib format, i.e. Content-Encoding: deflate */
+static GString *compress_body(const gchar *data,
+			      gsize length,
+			      guint repeat)
+{
+	GString *compressed = g_string_new("");
+	z_stream zstream;
+	guchar out[16384];
+	int flush;
+
+	memset(&zstream, 0, sizeof(zstream));
+	deflateInit(&zstream, Z_BEST_COMPRESSION);
+	do {
+		zstream.next_in  = (Bytef *) data;
+		zstream.avail_in = length;
+		flush = (--repeat == 0) ? Z_FINISH : Z_NO_FLUSH;
+		do {
+			zstream.next_out  = out;
+			zstream.avail_out = sizeof(out);
+			deflate(&zstream, flush);
+			g_string_append_len(compressed,
+					    (const gchar *) out,
+					    sizeof(out) - zstream.avail_out);
+		} while (zstream.avail_out == 0);
+	} while (flush != Z_FINISH);
+	deflateEnd(&zstream);
+
+	return(compressed);
+}
+
+static void compressed_tests(struct sipe_transport_connection *conn)
+{
+	struct sipe_framer *framer = sipe_framer_new("TEST");
+	GString *expected = g_string_new("");
+	GString *compressed;
+	gchar *header;
+	struct sipmsg *msg;
+	gsize half;
+	guint i;
+
+	sipe_framer_enable_decompression(framer);
+
+	/* highly compressible: decoded data exceeds one inflate step */
+	for (i = 0; i < 10000; i++)
+		g_string_append_printf(expected, "<contact id=\"%u\"/>\r\n", i % 10);
+	compressed = compress_body(expected->str, expected->len, 1);
+
+	/* compressed body split across reads */
+	testname = "deflate";
+	header = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+				 "Content-Encoding: deflate\r\n"
+				 "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+				 "\r\n",
+				 compressed->len);
+	feed(conn, header);
+	g_free(header);
+	half = compressed->len / 2;
+	feed_len(conn, compressed->str, half);
+	assert_pending(framer, conn, "partial body");
+	feed_len(conn, compressed->str + half, compressed->len - half);
+	msg = assert_message(framer, conn, 200, expected->str);
+	if (msg) {
+		assert_string("Content-Encoding",
+			      sipmsg_find_header(msg, "Content-Encoding"),
+			      NULL);
+		sipmsg_free(msg);
+	}
+	reset(framer, conn);
+
+	/* compressed body in chunks */
+	testname = "chunked deflate";
+	feed(conn,
+	     "HTTP/1.1 200 OK\r\n"
+	     "Content-Encoding: deflate\r\n"
+	     "Transfer-Encoding: chunked\r\n"
+	     "\r\n");
+	header = g_strdup_printf("%x\r\n", (guint) half);
+	feed(conn, header);
+	g_free(header);
+	feed_len(conn, compressed->str, half);
+	header = g_strdup_printf("\r\n%x\r\n", (guint) (compressed->len - half));
+	feed(conn, header);
+	g_free(header);
+	feed_len(conn, compressed->str + half, compressed->len - half);
+	assert_pending(framer, conn, "last chunk missing");
+	feed(conn, "\r\n0\r\n\r\n");
+	check_message(framer, conn, 200, expected->str);
+	reset(framer, conn);
+	g_string_free(compressed, TRUE);
+
+	/* decompression bomb: 65 MB of zeros */
+	testname = "decompression bomb";
+	g_string_set_size(expected, 1024 * 1024);
+	memset(expected->str, 0, expected->len);
+	compressed = compress_body(expected->str, expected->len, 65);
+	header = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+				 "Content-Encoding: deflate\r\n"
+				 "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+				 "\r\n",
+				 compressed->len);
+	feed(conn, header);
+	g_free(header);
+	feed_len(conn, compressed->str, compressed->len);
+	msg = assert_message(framer, conn, SIPMSG_RESPONSE_FATAL_ERROR, NULL);
+	if (msg) {
+		assert_int("bodylen", msg->bodylen, 0);
+		sipmsg_free(msg);
+	}
+	reset(framer, conn);
+	g_string_free(compressed, TRUE);
+
+	g_string_free(expected, TRUE);
+	sipe_framer_free(framer);
+}
+#endif
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	struct sipe_transport_connection conn;
+	struct sipe_framer *framer = sipe_framer_new("TEST");
+	struct sipmsg *msg;
+	const gchar *p;
+
+	memset(&conn, 0, sizeof(conn));
+
+	/* header split across reads, incl. the terminator */
+	testname = "split header";
+	feed(&conn, "SIP/2.0 200 OK\r\nCSeq: 1 OPTIONS\r\nContent-Len");
+	assert_pending(framer, &conn, "partial header");
+	feed(&conn, "gth: 5\r\n\r");
+	assert_pending(framer, &conn, "partial terminator");
+	feed(&conn, "\nhello");
+	msg = assert_message(framer, &conn, 200, "hello");
+	if (msg) {
+		assert_string("CSeq",
+			      sipmsg_find_header(msg, "CSeq"),
+			      "1 OPTIONS");
+		sipmsg_free(msg);
+	}
+	assert_pending(framer, &conn, "after message");
+	reset(framer, &conn);
+
+	/* body split across reads */
+	testname = "split body";
+	feed(&conn, "SIP/2.0 200 OK\r\nCSeq: 2 OPTIONS\r\nContent-Length: 11\r\n\r\n");
+	assert_pending(framer, &conn, "header only");
+	feed(&conn, "hello");
+	assert_pending(framer, &conn, "partial body");
+	feed(&conn, " world");
+	check_message(framer, &conn, 200, "hello world");
+	reset(framer, &conn);
+
+	/* multiple messages in one read, leading CRLF keep-alives */
+	testname = "pipelined";
+	feed(&conn,
+	     "\r\n\r\n"
+	     "SIP/2.0 200 OK\r\nCSeq: 3 OPTIONS\r\nContent-Length: 3\r\n\r\none"
+	     "SIP/2.0 486 Busy Here\r\nCSeq: 4 INVITE\r\nContent-Length: 0\r\n\r\n"
+	     "SIP/2.0 200 OK\r\nCSeq: 5 OPTIONS\r\nContent-Length: 5\r\n\r\nth");
+	check_message(framer, &conn, 200, "one");
+	check_message(framer, &conn, 486, "");
+	assert_pending(framer, &conn, "partial third");
+	/* consumed messages are larger than the unread data */
+	assert_int("compacted", conn.buffer_used,
+		   strlen("SIP/2.0 200 OK\r\nCSeq: 5 OPTIONS\r\nContent-Length: 5\r\n\r\nth"));
+	feed(&conn, "ree");
+	check_message(framer, &conn, 200, "three");
+	reset(framer, &conn);
+
+	/* chunked encoding, fed byte by byte */
+	testname = "chunked";
+	for (p = "HTTP/1.1 200 OK\r\n"
+		 "Transfer-Encoding: chunked\r\n"
+		 "\r\n"
+		 "5\r\nhello\r\n"
+		 "6;ext=1\r\n world\r\n"
+		 "0\r\n\r\n";
+	     *p;
+	     p++) {
+		gchar byte[2] = { *p, '\0' };
+		msg = sipe_framer_next(framer, &conn);
+		if (msg) {
+			printf("[%s]\nFAILED: premature message\n", testname);
+			sipmsg_free(msg);
+			failed++;
+		}
+		feed(&conn, byte);
+	}
+	check_message(framer, &conn, 200, "hello world");
+	assert_pending(framer, &conn, "after message");
+	reset(framer, &conn);
+
+	/* negative Content-Length must not stall the connection */
+	testname = "negative Content-Length";
+	feed(&conn, "SIP/2.0 200 OK\r\nCSeq: 6 OPTIONS\r\nContent-Length: -5\r\n\r\nhello");
+	msg = assert_message(framer, &conn, SIPMSG_RESPONSE_FATAL_ERROR, NULL);
+	if (msg) {
+		assert_int("bodylen", msg->bodylen, 0);
+		sipmsg_free(msg);
+	}
+	reset(framer, &conn);
+
+	/* -1 is the value of SIPMSG_BODYLEN_CHUNKED */
+	testname = "Content-Length -1";
+	feed(&conn, "HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\n5\r\nhello\r\n0\r\n\r\n");
+	msg = assert_message(framer, &conn, SIPMSG_RESPONSE_FATAL_ERROR, NULL);
+	if (msg) {
+		assert_int("bodylen", msg->bodylen, 0);
+		sipmsg_free(msg);
+	}
+	reset(framer, &conn);
+
+	/* illegal chunk size */
+	testname = "illegal chunk size";
+	feed(&conn, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\nhello\r\n0\r\n\r\n");
+	msg = assert_message(framer, &conn, SIPMSG_RESPONSE_FATAL_ERROR, NULL);
+	sipmsg_free(msg);
+	reset(framer, &conn);
+
+	/* framer recovers after reset */
+	testname = "reset";
+	feed(&conn, "SIP/2.0 200 OK\r\nCSeq: 7 OPTIONS\r\nContent-Length: 2\r\n\r\nok");
+	check_message(framer, &conn, 200, "ok");
+	reset(framer, &conn);
+
+#ifdef HAVE_ZLIB
+	compressed_tests(&conn);
+#endif
+
+	sipe_framer_free(framer);
+	g_free(conn.buffer);
+
+	printf("Result: %d PASSED %d FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -0,0 +1,502 @@
+/**
+ * @file sipe-framer.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "sipe-backend.h"
+#include "sipe-core.h"
+#include "sipe-framer.h"
+#include "sipe-utils.h"
+#include "sipmsg.h"
+
+enum sipe_framer_state {
+	SIPE_FRAMER_HEADER,     /* looking for end of header       */
+	SIPE_FRAMER_BODY,       /* waiting for Content-Length body */
+	SIPE_FRAMER_CHUNK_SIZE, /* waiting for chunk size line     */
+	SIPE_FRAMER_CHUNK_DATA  /* waiting for chunk data + CRLF   */
+};
+
+enum sipe_framer_encoding {
+	SIPE_FRAMER_IDENTITY,
+	SIPE_FRAMER_GZIP,
+	SIPE_FRAMER_DEFLATE
+};
+
+/* output is inflated directly into the body string in steps of this size */
+#define SIPE_FRAMER_INFLATE_STEP 16384
+
+/*
+ * Upper limit for decoded bodies, i.e. protection against decompression
+ * bombs. Bodies from the servers are a few MB at most (address book search,
+ * photos), so this is a multiple of anything we need to accept.
+ */
+#define SIPE_FRAMER_INFLATE_MAX  (64 * 1024 * 1024)
+
+struct sipe_framer {
+	const gchar *type;
+	enum sipe_framer_state state;
+
+	/* all offsets are relative to the start of the connection buffer */
+	gsize cursor;       /* start of the current message                */
+	gsize scan;         /* where to resume scanning for a terminator   */
+	gsize body;         /* start of pending body or chunk data         */
+	gsize chunk_length; /* length of the pending chunk                 */
+
+	struct sipmsg *msg; /* parsed header of the current message        */
+	GString *chunked;   /* collected body of a chunked message         */
+
+	gboolean decompress;                 /* decode Content-Encoding    */
+	enum sipe_framer_encoding encoding;  /* of the current message     */
+#ifdef HAVE_ZLIB
+	z_stream *zstream;  /* NULL until first compressed body data       */
+	gboolean zstream_end;
+#endif
+};
+
+struct sipe_framer *sipe_framer_new(const gchar *type)
+{
+	struct sipe_framer *framer = g_new0(struct sipe_framer, 1);
+	framer->type = type;
+	return(framer);
+}
+
+void sipe_framer_enable_decompression(struct sipe_framer *framer)
+{
+#ifdef HAVE_ZLIB
+	framer->decompress = TRUE;
+#else
+	(void) framer; /* keep compiler happy */
+#endif
+}
+
+static void framer_inflate_end(struct sipe_framer *framer)
+{
+#ifdef HAVE_ZLIB
+	if (framer->zstream) {
+		inflateEnd(framer->zstream);
+		g_free(framer->zstream);
+		framer->zstream = NULL;
+	}
+	framer->zstream_end = FALSE;
+#endif
+	framer->encoding = SIPE_FRAMER_IDENTITY;
+}
+
+void sipe_framer_reset(struct sipe_framer *framer)
+{
+	sipmsg_free(framer->msg);
+	if (framer->chunked)
+		g_string_free(framer->chunked, TRUE);
+	framer_inflate_end(framer);
+	framer->msg          = NULL;
+	framer->chunked      = NULL;
+	framer->state        = SIPE_FRAMER_HEADER;
+	framer->cursor       = 0;
+	framer->scan         = 0;
+	framer->body         = 0;
+	framer->chunk_length = 0;
+}
+
+void sipe_framer_free(struct sipe_framer *framer)
+{
+	if (framer) {
+		sipe_framer_reset(framer);
+		g_free(framer);
+	}
+}
+
+/* search for pattern in buffer[start..end[ */
+static gboolean framer_find(const gchar *buffer,
+			    gsize start,
+			    gsize end,
+			    const gchar *pattern,
+			    gsize length,
+			    gsize *found)
+{
+	while (start + length <= end) {
+		const gchar *p = memchr(buffer + start,
+					pattern[0],
+					end - start - length + 1);
+		if (!p)
+			break;
+		if (memcmp(p, pattern, length) == 0) {
+			*found = p - buffer;
+			return(TRUE);
+		}
+		start = p - buffer + 1;
+	}
+	return(FALSE);
+}
+
+/*
+ * Remove consumed data from the connection buffer.
+ *
+ * Only move the unread data when it is not larger than the consumed data,
+ * i.e. the cost of the memmove() is amortized by the consumed messages.
+ */
+static void framer_compact(struct sipe_framer *framer,
+			   struct sipe_transport_connection *conn)
+{
+	gsize consumed = framer->cursor;
+	gsize unread   = conn->buffer_used - consumed;
+
+	if ((consumed == 0) || (unread > consumed))
+		return;
+
+	/* string terminator is not included in buffer_used */
+	memmove(conn->buffer, conn->buffer + consumed, unread + 1);
+	conn->buffer_used = unread;
+
+	framer->cursor = 0;
+	framer->scan  -= consumed;
+	if (framer->state != SIPE_FRAMER_HEADER)
+		framer->body -= consumed;
+}
+
+static void framer_encoding(struct sipe_framer *framer,
+			    struct sipmsg *msg)
+{
+	const gchar *encoding;
+
+	if (!framer->decompress)
+		return;
+
+	encoding = sipmsg_find_header(msg, "Content-Encoding");
+	if (sipe_strcase_equal(encoding, "gzip") ||
+	    sipe_strcase_equal(encoding, "x-gzip"))
+		framer->encoding = SIPE_FRAMER_GZIP;
+	else if (sipe_strcase_equal(encoding, "deflate"))
+		framer->encoding = SIPE_FRAMER_DEFLATE;
+}
+
+#ifdef HAVE_ZLIB
+/* FALSE indicates corrupted data */
+static gboolean framer_inflate(struct sipe_framer *framer,
+			       GString *body,
+			       const gchar *data,
+			       gsize length)
+{
+	z_stream *zstream = framer->zstream;
+
+	if (!zstream) {
+		/* 32: automatic gzip or zlib header detection */
+		int window_bits = MAX_WBITS + 32;
+
+		/*
+		 * Some servers send "deflate" as raw deflate data
+		 * without the zlib header (RFC 1950) it requires.
+		 */
+		if ((framer->encoding == SIPE_FRAMER_DEFLATE) &&
+		    (length >= 2) &&
+		    (((data[0] & 0x0F) != Z_DEFLATED) ||
+		     ((((guchar) data[0] << 8) | (guchar) data[1]) % 31)))
+			window_bits = -MAX_WBITS;
+
+		framer->zstream = zstream = g_new0(z_stream, 1);
+		if (inflateInit2(zstream, window_bits) != Z_OK) {
+			SIPE_DEBUG_ERROR("framer_inflate: initialization failed: %s",
+					 zstream->msg ? zstream->msg : "");
+			return(FALSE);
+		}
+	}
+
+	zstream->next_in  = (Bytef *) data;
+	zstream->avail_in = length;
+
+	/*
+	 * ignore data after the end of the compressed stream
+	 *
+	 * A full output step may leave decoded data pending in zlib even
+	 * when all input has been consumed, i.e. continue until it is empty.
+	 */
+	while (!framer->zstream_end &&
+	       (zstream->avail_in || (zstream->avail_out == 0))) {
+		gsize used = body->len;
+		int ret;
+
+		if (used >= SIPE_FRAMER_INFLATE_MAX) {
+			SIPE_DEBUG_ERROR("framer_inflate: decoded body exceeds %d bytes",
+					 SIPE_FRAMER_INFLATE_MAX);
+			return(FALSE);
+		}
+
+		g_string_set_size(body, used + SIPE_FRAMER_INFLATE_STEP);
+		zstream->next_out  = (Bytef *) body->str + used;
+		zstream->avail_out = SIPE_FRAMER_INFLATE_STEP;
+
+		ret = inflate(zstream, Z_NO_FLUSH);
+		g_string_set_size(body,
+				  used + SIPE_FRAMER_INFLATE_STEP - zstream->avail_out);
+
+		if (ret == Z_STREAM_END) {
+			framer->zstream_end = TRUE;
+		} else if (ret == Z_BUF_ERROR) {
+			/* no progress possible: waiting for more input */
+			break;
+		} else if (ret != Z_OK) {
+			SIPE_DEBUG_ERROR("framer_inflate: corrupted data (%d): %s",
+					 ret, zstream->msg ? zstream->msg : "");
+			return(FALSE);
+		}
+	}
+
+	return(TRUE);
+}
+#endif
+
+/* append body data, FALSE indicates corrupted compressed data */
+static gboolean framer_append(struct sipe_framer *framer,
+			      GString *body,
+			      const gchar *data,
+			      gsize length)
+{
+#ifdef HAVE_ZLIB
+	if (framer->encoding != SIPE_FRAMER_IDENTITY)
+		return(framer_inflate(framer, body, data, length));
+#endif
+	g_string_append_len(body, data, length);
+	return(TRUE);
+}
+
+static struct sipmsg *framer_complete(struct sipe_framer *framer,
+				      struct sipe_transport_connection *conn,
+				      gsize end)
+{
+	struct sipmsg *msg = framer->msg;
+
+	if (framer->encoding != SIPE_FRAMER_IDENTITY) {
+		/* body has been decoded */
+		sipmsg_remove_header_now(msg, "Content-Encoding");
+		framer_inflate_end(framer);
+	}
+
+	/* header was zero terminated by the parser step */
+	sipe_utils_message_debug(conn,
+				 framer->type,
+				 conn->buffer + framer->cursor,
+				 msg->body,
+				 FALSE);
+
+	framer->msg    = NULL;
+	framer->state  = SIPE_FRAMER_HEADER;
+	framer->cursor = end;
+	framer->scan   = end;
+	return(msg);
+}
+
+struct sipmsg *sipe_framer_next(struct sipe_framer *framer,
+				struct sipe_transport_connection *conn)
+{
+	gchar *buffer = conn->buffer;
+	gsize used    = conn->buffer_used;
+
+	while (TRUE) {
+		struct sipmsg *msg;
+		gsize found;
+
+		switch (framer->state) {
+		case SIPE_FRAMER_HEADER:
+			/* according to the RFC remove CRLF at the beginning */
+			while ((framer->cursor < used) &&
+			       ((buffer[framer->cursor] == '\r') ||
+				(buffer[framer->cursor] == '\n')))
+				framer->cursor++;
+			if (framer->scan < framer->cursor)
+				framer->scan = framer->cursor;
+
+			/* Received a full header? */
+			if (!framer_find(buffer, framer->scan, used,
+					 "\r\n\r\n", 4, &found)) {
+				/* terminator may be split across reads */
+				framer->scan = (used > framer->cursor + 3) ?
+					used - 3 : framer->cursor;
+				framer_compact(framer, conn);
+				return(NULL);
+			}
+
+			buffer[found + 2] = '\0';
+			msg = sipmsg_parse_header_block(buffer + framer->cursor,
+							found + 2 - framer->cursor);
+			if (!msg) {
+				/* restore header for next try */
+				buffer[found + 2] = '\r';
+				framer->scan = found;
+				framer_compact(framer, conn);
+				return(NULL);
+			}
+
+			framer->msg  = msg;
+			framer->body = found + 4;
+			framer_encoding(framer, msg);
+
+			/*
+			 * SIPMSG_BODYLEN_CHUNKED is also the value of
+			 * "Content-Length: -1", i.e. check for the header
+			 */
+			if ((msg->bodylen < 0) &&
+			    sipmsg_find_header_id(msg, SIPMSG_HEADER_CONTENT_LENGTH)) {
+				SIPE_DEBUG_ERROR("sipe_framer_next: illegal Content-Length in %s message",
+						 framer->type);
+				msg->response = SIPMSG_RESPONSE_FATAL_ERROR;
+				msg->bodylen  = 0;
+				return(framer_complete(framer,
+						       conn,
+						       used));
+			}
+
+			if (msg->bodylen == SIPMSG_BODYLEN_CHUNKED) {
+				framer->chunked = g_string_new("");
+				framer->scan    = framer->body;
+				framer->state   = SIPE_FRAMER_CHUNK_SIZE;
+			} else {
+				framer->state   = SIPE_FRAMER_BODY;
+			}
+			break;
+
+		case SIPE_FRAMER_BODY:
+			msg = framer->msg;
+			if (used - framer->body < (gsize) msg->bodylen) {
+				framer_compact(framer, conn);
+				return(NULL);
+			}
+
+			if (framer->encoding == SIPE_FRAMER_IDENTITY) {
+				msg->body = g_malloc(msg->bodylen + 1);
+				memcpy(msg->body, buffer + framer->body, msg->bodylen);
+				msg->body[msg->bodylen] = '\0';
+			} else {
+				/* decode directly from the connection buffer */
+				GString *body = g_string_sized_new(msg->bodylen * 4);
+				gsize end = framer->body + msg->bodylen;
+
+				if (framer_append(framer, body,
+						  buffer + framer->body,
+						  msg->bodylen)) {
+					msg->bodylen = body->len;
+					msg->body    = g_string_free(body, FALSE);
+				} else {
+					/* don't pass on partially decoded data */
+					msg->response = SIPMSG_RESPONSE_FATAL_ERROR;
+					msg->bodylen  = 0;
+					g_string_free(body, TRUE);
+				}
+				return(framer_complete(framer, conn, end));
+			}
+			return(framer_complete(framer,
+					       conn,
+					       framer->body + msg->bodylen));
+
+		case SIPE_FRAMER_CHUNK_SIZE:
+			/* HTTP/1.1 Transfer-Encoding: chunked */
+			if (!framer_find(buffer, framer->scan, used,
+					 "\r\n", 2, &found)) {
+				/* CRLF may be split across reads */
+				framer->scan = (used > framer->body + 1) ?
+					used - 1 : framer->body;
+				framer_compact(framer, conn);
+				return(NULL);
+			} else {
+				gchar *end;
+
+				framer->chunk_length = g_ascii_strtoull(buffer + framer->body,
+									&end,
+									16);
+
+				/* Illegal number */
+				if ((end == buffer + framer->body) ||
+				    (framer->chunk_length > G_MAXINT)) {
+					SIPE_DEBUG_ERROR("sipe_framer_next: illegal chunk size in %s message",
+							 framer->type);
+					msg = framer->msg;
+					msg->response = SIPMSG_RESPONSE_FATAL_ERROR;
+					g_string_free(framer->chunked, TRUE);
+					framer->chunked = NULL;
+					return(framer_complete(framer,
+							       conn,
+							       used));
+				}
+
+				framer->body  = found + 2;
+				framer->state = SIPE_FRAMER_CHUNK_DATA;
+			}
+			break;
+
+		case SIPE_FRAMER_CHUNK_DATA:
+			/* chunk data is followed by CRLF */
+			if (used - framer->body < framer->chunk_length + 2) {
+				framer_compact(framer, conn);
+				return(NULL);
+			}
+
+			/* compressed data is decoded chunk by chunk */
+			if (!framer_append(framer,
+					   framer->chunked,
+					   buffer + framer->body,
+					   framer->chunk_length)) {
+				SIPE_DEBUG_ERROR("sipe_framer_next: corrupted compressed %s message",
+						 framer->type);
+				msg = framer->msg;
+				msg->response = SIPMSG_RESPONSE_FATAL_ERROR;
+				g_string_free(framer->chunked, TRUE);
+				framer->chunked = NULL;
+				return(framer_complete(framer,
+						       conn,
+						       used));
+			}
+			framer->body += framer->chunk_length + 2;
+
+			/* Body completed */
+			if (framer->chunk_length == 0) {
+				msg = framer->msg;
+				msg->bodylen = framer->chunked->len;
+				msg->body    = g_string_free(framer->chunked, FALSE);
+				framer->chunked = NULL;
+				return(framer_complete(framer,
+						       conn,
+						       framer->body));
+			}
+
+			framer->scan  = framer->body;
+			framer->state = SIPE_FRAMER_CHUNK_SIZE;
+			break;
+		}
+	}
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
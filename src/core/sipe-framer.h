@@ -0,0 +1,109 @@
+/**
+ * @file sipe-framer.h
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Incremental message framer for SIP & HTTP transport connections
+ *
+ * The framer splits the stream received in the transport connection buffer
+ * into messages. It keeps its state between input callbacks, i.e. a header
+ * is scanned and parsed only once and the body is collected when the
+ * remaining data has arrived. Consumed messages only advance a read cursor.
+ * The buffer is compacted when the framer runs out of complete messages and
+ * the consumed part outweighs the unread part.
+ *
+ * The framer stores offsets only, because the backend may reallocate the
+ * buffer between input callbacks.
+ *
+ * When enabled, gzip/deflate compressed bodies (Content-Encoding) are
+ * decoded while they are collected, i.e. the compressed body is never
+ * copied out of the connection buffer.
+ */
+
+/* Forward declarations */
+struct sipe_framer;
+struct sipe_transport_connection;
+struct sipmsg;
+
+/**
+ * Create a new framer
+ *
+ * @param type message type for debugging, e.g. "SIP" (must be static)
+ *
+ * @return framer. Must be freed with @c sipe_framer_free()
+ */
+struct sipe_framer *sipe_framer_new(const gchar *type);
+
+/**
+ * Free framer
+ *
+ * @param framer framer (may be @c NULL)
+ */
+void sipe_framer_free(struct sipe_framer *framer);
+
+/**
+ * Enable decoding of compressed message bodies
+ *
+ * The Content-Encoding header is removed from decoded messages. Corrupted
+ * compressed data or a decoded body larger than 64 MB is reported as a
+ * message with response @c SIPMSG_RESPONSE_FATAL_ERROR.
+ *
+ * Does nothing if SIPE was built without zlib.
+ *
+ * @param framer framer
+ */
+void sipe_framer_enable_decompression(struct sipe_framer *framer);
+
+/**
+ * Reset framer state, e.g. when a new backend connection is established
+ *
+ * @param framer framer
+ */
+void sipe_framer_reset(struct sipe_framer *framer);
+
+/**
+ * Extract the next complete message from the connection buffer
+ *
+ * Supports Content-Length and HTTP/1.1 "Transfer-Encoding: chunked" bodies.
+ * An illegal Content-Length or corrupted chunked encoding is reported as a
+ * message with response @c SIPMSG_RESPONSE_FATAL_ERROR. The rest of the
+ * connection buffer is discarded, i.e. the caller must drop the connection.
+ *
+ * When no complete message is available the connection buffer may be
+ * compacted, i.e. @c buffer_used may be updated.
+ *
+ * @param framer framer
+ * @param conn   transport connection
+ *
+ * @return message or @c NULL if more data is required. Must be freed with
+ *         @c sipmsg_free()
+ */
+struct sipmsg *sipe_framer_next(struct sipe_framer *framer,
+				struct sipe_transport_connection *conn);
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
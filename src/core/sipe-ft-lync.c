@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2014-2017 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2014-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -26,13 +26,8 @@
 
 #include <glib.h>
 
-#include <errno.h>
-#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
-#ifdef HAVE_UNISTD_H
-#include <unistd.h>
-#endif
 
 #include "sip-transport.h"
 #include "sipe-backend.h"
@@ -57,13 +52,17 @@ struct sipe_file_transfer_lync {
 	guint request_id;
 
 	guint bytes_left_in_chunk;
+	gsize bytes_sent;
 
 	guint8 buffer[2048];
-	guint buffer_len;
-	guint buffer_read_pos;
 
-	int backend_pipe[2];
-	int backend_pipe_write_source_id;
+	/* outgoing XDATA frames, reused for every write */
+	guint8 *frames;
+	gsize frames_size;
+	guint send_source_id;
+
+	/* backend transfer has been completed or cancelled */
+	gboolean finished;
 
 	struct sipe_core_private *sipe_private;
 	struct sipe_media_call *call;
@@ -80,31 +79,53 @@ typedef enum {
 	SIPE_XDATA_END_OF_STREAM = 0x02
 } SipeXDataMessages;
 
-#define XDATA_HEADER_SIZE sizeof (guint8) + sizeof (guint16)
+#define XDATA_HEADER_SIZE (sizeof (guint8) + sizeof (guint16))
+#define XDATA_CHUNK_SIZE  2048
 
 static void
 sipe_file_transfer_lync_free(struct sipe_file_transfer_lync *ft_private)
 {
-	int our_pipe_end;
-
-	our_pipe_end = sipe_backend_ft_is_incoming(SIPE_FILE_TRANSFER) ? 1 : 0;
-
-	if (ft_private->backend_pipe[our_pipe_end] != 0) {
-		// Backend is responsible for closing the pipe's other end.
-		close(ft_private->backend_pipe[our_pipe_end]);
+	/* call was torn down before the transfer finished */
+	if (!ft_private->finished && SIPE_FILE_TRANSFER->backend_private) {
+		sipe_backend_ft_deallocate(SIPE_FILE_TRANSFER);
 	}
 
 	g_free(ft_private->file_name);
 	g_free(ft_private->sdp);
 	g_free(ft_private->id);
+	g_free(ft_private->frames);
 
-	if (ft_private->backend_pipe_write_source_id) {
-		g_source_remove(ft_private->backend_pipe_write_source_id);
+	if (ft_private->send_source_id) {
+		g_source_remove(ft_private->send_source_id);
 	}
 
 	g_free(ft_private);
 }
 
+/* Stop calling into the backend transfer, it has ended. */
+static void
+ft_lync_finished(struct sipe_file_transfer_lync *ft_private)
+{
+	struct sipe_media_stream *stream;
+
+	ft_private->finished = TRUE;
+
+	if (ft_private->send_source_id) {
+		g_source_remove(ft_private->send_source_id);
+		ft_private->send_source_id = 0;
+	}
+
+	if (!ft_private->call) {
+		return;
+	}
+
+	stream = sipe_core_media_get_stream_by_id(ft_private->call, "data");
+	if (stream) {
+		stream->read_cb = NULL;
+		stream->writable_cb = NULL;
+	}
+}
+
 static void
 send_ms_filetransfer_msg(char *body, struct sipe_file_transfer_lync *ft_private,
 			 TransCallback callback)
@@ -208,46 +229,22 @@ candidate_pairs_established_cb(struct sipe_media_stream *stream)
 				 ft_private, NULL);
 }
 
-static gboolean
-create_pipe(int pipefd[2])
-{
-#ifdef _WIN32
-#error "Pipes not implemented for Windows"
-/* Those interested in porting the code may use Pidgin's wpurple_input_pipe() in
- * win32dep.c as an inspiration. */
-#else
-	if (pipe(pipefd) != 0) {
-		return FALSE;
-	}
-
-	/* @TODO: ignoring potential error return - how to handle? */
-	(void) fcntl(pipefd[0], F_SETFL, fcntl(pipefd[0], F_GETFL) | O_NONBLOCK);
-	(void) fcntl(pipefd[1], F_SETFL, fcntl(pipefd[1], F_GETFL) | O_NONBLOCK);
-
-	return TRUE;
-#endif
-}
-
 static void
 xdata_start_of_stream_cb(struct sipe_media_stream *stream,
 			 guint8 *buffer, gsize len)
 {
 	struct sipe_file_transfer_lync *ft_private =
 			sipe_media_stream_get_data(stream);
-	struct sipe_backend_fd *fd;
 
 	buffer[len] = 0;
 	SIPE_DEBUG_INFO("Received new stream for requestId : %s", buffer);
 
-	if (!create_pipe(ft_private->backend_pipe)) {
-		SIPE_DEBUG_ERROR_NOFORMAT("Couldn't create backend pipe");
-		sipe_backend_ft_cancel_local(SIPE_FILE_TRANSFER);
+	if (ft_private->finished) {
 		return;
 	}
 
-	fd = sipe_backend_fd_from_int(ft_private->backend_pipe[0]);
-	sipe_backend_ft_start(SIPE_FILE_TRANSFER, fd, NULL, 0);
-	sipe_backend_fd_free(fd);
+	/* data is pulled from the stream by ft_lync_read() */
+	sipe_backend_ft_start(SIPE_FILE_TRANSFER, NULL, NULL, 0);
 }
 
 static void
@@ -295,41 +292,9 @@ read_cb(struct sipe_media_stream *stream)
 	struct sipe_file_transfer_lync *ft_private =
 			sipe_media_stream_get_data(stream);
 
-	if (ft_private->buffer_read_pos < ft_private->buffer_len) {
-		/* Have data in buffer, write them to the backend. */
-
-		gpointer buffer;
-		size_t len;
-		ssize_t written;
-
-		buffer = ft_private->buffer + ft_private->buffer_read_pos;
-		len = ft_private->buffer_len - ft_private->buffer_read_pos;
-		written = write(ft_private->backend_pipe[1], buffer, len);
-
-		if (written > 0) {
-			ft_private->buffer_read_pos += written;
-		} else if (written < 0 && errno != EAGAIN) {
-			SIPE_DEBUG_ERROR_NOFORMAT("Error while writing into "
-						  "backend pipe");
-			sipe_backend_ft_cancel_local(SIPE_FILE_TRANSFER);
-			return;
-		}
-	} else if (ft_private->bytes_left_in_chunk != 0) {
-		/* Have data from the sender, replenish our buffer with it. */
-
-		ft_private->buffer_len = MIN(ft_private->bytes_left_in_chunk,
-					     sizeof (ft_private->buffer));
-
-		ft_private->buffer_len =
-				sipe_backend_media_stream_read(stream,
-							       ft_private->buffer,
-							       ft_private->buffer_len);
-
-		ft_private->bytes_left_in_chunk -= ft_private->buffer_len;
-		ft_private->buffer_read_pos = 0;
-
-		SIPE_DEBUG_INFO("Read %d bytes. %d left in this chunk.",
-				ft_private->buffer_len, ft_private->bytes_left_in_chunk);
+	if (ft_private->bytes_left_in_chunk != 0) {
+		/* Have data from the sender, let the backend pull it. */
+		sipe_backend_ft_ready(SIPE_FILE_TRANSFER);
 	} else {
 		/* No data available. This is either stream start, beginning of
 		 * chunk, or stream end. */
@@ -340,6 +305,50 @@ read_cb(struct sipe_media_stream *stream)
 	}
 }
 
+static gssize
+ft_lync_read(struct sipe_file_transfer *ft, guchar **buffer,
+	     SIPE_UNUSED_PARAMETER gsize bytes_remaining,
+	     gsize bytes_available)
+{
+	struct sipe_file_transfer_lync *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
+	struct sipe_media_stream *stream;
+	gsize len;
+	gssize bytes_read;
+
+	*buffer = NULL;
+
+	stream = sipe_core_media_get_stream_by_id(ft_private->call, "data");
+	if (!stream) {
+		/* backend cancels the transfer */
+		ft_lync_finished(ft_private);
+		return -1;
+	}
+
+	len = MIN(ft_private->bytes_left_in_chunk, bytes_available);
+	if (len == 0) {
+		return 0;
+	}
+
+	/* Read directly into the buffer handed over to the backend. */
+	*buffer = g_malloc(len);
+	bytes_read = sipe_backend_media_stream_read(stream, *buffer, len);
+	if (bytes_read <= 0) {
+		g_free(*buffer);
+		*buffer = NULL;
+		if (bytes_read < 0) {
+			ft_lync_finished(ft_private);
+		}
+		return bytes_read;
+	}
+
+	ft_private->bytes_left_in_chunk -= bytes_read;
+
+	SIPE_DEBUG_INFO("Read %" G_GSSIZE_FORMAT " bytes. %d left in this chunk.",
+			bytes_read, ft_private->bytes_left_in_chunk);
+
+	return bytes_read;
+}
+
 static void
 ft_lync_incoming_init(struct sipe_file_transfer *ft,
 		      SIPE_UNUSED_PARAMETER const gchar *filename,
@@ -402,6 +411,7 @@ send_transfer_progress(struct sipe_file_transfer_lync *ft_private)
 static gboolean
 ft_lync_end(struct sipe_file_transfer *ft)
 {
+	ft_lync_finished(SIPE_FILE_TRANSFER_PRIVATE);
 	send_transfer_progress(SIPE_FILE_TRANSFER_PRIVATE);
 
 	return TRUE;
@@ -417,7 +427,8 @@ call_reject_cb(struct sipe_media_call *call, gboolean local)
 		ft_private->call_reject_parent_cb(call, local);
 	}
 
-	if (!local) {
+	if (!local && !ft_private->finished) {
+		ft_lync_finished(ft_private);
 		sipe_backend_ft_cancel_remote(&ft_private->public);
 	}
 }
@@ -437,7 +448,8 @@ ft_lync_incoming_cancelled(struct sipe_file_transfer *ft)
 			"</request>";
 
 	struct sipe_file_transfer_lync *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
-	struct sipe_media_stream *stream;
+
+	ft_lync_finished(ft_private);
 
 	send_ms_filetransfer_msg(g_strdup_printf(FILETRANSFER_CANCEL_REQUEST,
 						 ft_private->request_id + 1,
@@ -447,11 +459,6 @@ ft_lync_incoming_cancelled(struct sipe_file_transfer *ft)
 				 ft_private,
 				 NULL);
 
-	stream = sipe_core_media_get_stream_by_id(ft_private->call, "data");
-	if (stream) {
-		stream->read_cb = NULL;
-	}
-
 	sipe_backend_media_hangup(ft_private->call->backend_private, FALSE);
 }
 
@@ -489,6 +496,7 @@ process_incoming_invite_ft_lync(struct sipe_core_private *sipe_private,
 	ft_private->public.ft_init = ft_lync_incoming_init;
 	ft_private->public.ft_request_denied = ft_lync_request_denied;
 	ft_private->public.ft_cancelled = ft_lync_incoming_cancelled;
+	ft_private->public.ft_read = ft_lync_read;
 	ft_private->public.ft_end = ft_lync_end;
 
 	ft_private->call_reject_parent_cb = ft_private->call->call_reject_cb;
@@ -527,99 +535,165 @@ process_response_incoming(struct sipe_file_transfer_lync *ft_private,
 	attr = sipe_xml_attribute(xml, "code");
 	if (sipe_strequal(attr, "failure")) {
 		const gchar *reason = sipe_xml_attribute(xml, "reason");
-		if (sipe_strequal(reason, "requestCancelled")) {
+		if (sipe_strequal(reason, "requestCancelled") &&
+		    !ft_private->finished) {
+			ft_lync_finished(ft_private);
 			sipe_backend_ft_cancel_remote(SIPE_FILE_TRANSFER);
 		}
 	}
 }
 
+/* @return position after the frame */
+static guint8 *
+append_frame(guint8 *pos, guint8 type, guint16 len, const guint8 *payload)
+{
+	/* frame header: type, length (big-endian) */
+	*pos++ = type;
+	*pos++ = len >> 8;
+	*pos++ = len & 0xFF;
+	memcpy(pos, payload, len);
+
+	return pos + len;
+}
+
+static guint8 *
+frames_reserve(struct sipe_file_transfer_lync *ft_private, gsize size)
+{
+	if (ft_private->frames_size < size) {
+		g_free(ft_private->frames);
+		ft_private->frames = g_malloc(size);
+		ft_private->frames_size = size;
+	}
+
+	return ft_private->frames;
+}
+
 static void
-write_chunk(struct sipe_media_stream *stream,
-	    guint8 type, guint16 len, const gchar *buffer)
+write_control_frame(struct sipe_file_transfer_lync *ft_private,
+		    struct sipe_media_stream *stream,
+		    guint8 type)
 {
-	guint16 len_be = GUINT16_TO_BE(len);
+	gchar *request_id_str = g_strdup_printf("%u", ft_private->request_id);
+	gsize len = strlen(request_id_str);
+	guint8 *frames = frames_reserve(ft_private, XDATA_HEADER_SIZE + len);
+	guint8 *end = append_frame(frames, type, len,
+				   (const guint8 *) request_id_str);
 
-	sipe_media_stream_write(stream, &type, sizeof (guint8));
-	sipe_media_stream_write(stream, (guint8 *)&len_be, sizeof (guint16));
-	sipe_media_stream_write(stream, (guint8 *)buffer, len);
+	sipe_media_stream_write(stream, frames, end - frames);
+	g_free(request_id_str);
 }
 
 static gboolean
-send_file_chunk(SIPE_UNUSED_PARAMETER GIOChannel *source,
-		SIPE_UNUSED_PARAMETER GIOCondition condition,
-		gpointer data)
+send_ready_cb(gpointer data)
 {
 	struct sipe_file_transfer_lync *ft_private = data;
-	struct sipe_media_call *call = ft_private->call;
+
+	ft_private->send_source_id = 0;
+	sipe_backend_ft_ready(SIPE_FILE_TRANSFER);
+
+	return FALSE; /* G_SOURCE_REMOVE */
+}
+
+/* Ask backend for more data after we're back in the main loop. */
+static void
+schedule_send(struct sipe_file_transfer_lync *ft_private)
+{
+	if (!ft_private->send_source_id) {
+		ft_private->send_source_id = g_idle_add(send_ready_cb,
+							ft_private);
+	}
+}
+
+static void
+writable_cb(struct sipe_media_stream *stream)
+{
+	struct sipe_file_transfer_lync *ft_private =
+			sipe_media_stream_get_data(stream);
+
+	if (ft_private->bytes_sent < ft_private->file_size) {
+		schedule_send(ft_private);
+	}
+}
+
+static gssize
+ft_lync_write(struct sipe_file_transfer *ft, const guchar *buffer,
+	      gsize size)
+{
+	struct sipe_file_transfer_lync *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
 	struct sipe_media_stream *stream;
-	gssize bytes_read;
+	gsize chunks;
+	gsize offset;
+	guint8 *frames;
+	guint8 *pos;
 
-	stream = sipe_core_media_get_stream_by_id(call, "data");
+	stream = sipe_core_media_get_stream_by_id(ft_private->call, "data");
 	if (!stream) {
 		SIPE_DEBUG_ERROR_NOFORMAT("Couldn't find data stream");
-		sipe_backend_ft_cancel_local(SIPE_FILE_TRANSFER);
-		ft_private->backend_pipe_write_source_id = 0;
-		return FALSE; /* G_SOURCE_REMOVE */
+		/* backend cancels the transfer */
+		ft_lync_finished(ft_private);
+		return -1;
 	}
 
+	/* writable_cb() will resume the transfer */
 	if (!sipe_media_stream_is_writable(stream)) {
-		return TRUE; /* G_SOURCE_CONTINUE */
+		return 0;
 	}
 
-	bytes_read = read(ft_private->backend_pipe[0],
-			  ft_private->buffer, sizeof (ft_private->buffer));
-	if (bytes_read > 0) {
-		write_chunk(stream, SIPE_XDATA_DATA_CHUNK,
-			    bytes_read, (const gchar *)ft_private->buffer);
-	} else if (bytes_read == 0) {
-		/* EOF, write end of stream */
-		gchar *request_id_str;
+	/*
+	 * Assemble all data chunks and, after the last chunk, the end of
+	 * stream message into one buffer, so that the whole batch is sent
+	 * with a single stream write.
+	 */
+	chunks = (size + XDATA_CHUNK_SIZE - 1) / XDATA_CHUNK_SIZE;
+	frames = pos = frames_reserve(ft_private,
+				      size + chunks * XDATA_HEADER_SIZE);
+	for (offset = 0; offset < size; offset += XDATA_CHUNK_SIZE) {
+		pos = append_frame(pos, SIPE_XDATA_DATA_CHUNK,
+				   MIN(size - offset, XDATA_CHUNK_SIZE),
+				   buffer + offset);
+	}
 
-		request_id_str = g_strdup_printf("%u", ft_private->request_id);
-		write_chunk(stream, SIPE_XDATA_END_OF_STREAM,
-			    strlen(request_id_str), request_id_str);
-		g_free(request_id_str);
+	sipe_media_stream_write(stream, frames, pos - frames);
+	ft_private->bytes_sent += size;
 
-		return FALSE; /* G_SOURCE_REMOVE */
+	if (ft_private->bytes_sent >= ft_private->file_size) {
+		write_control_frame(ft_private, stream,
+				    SIPE_XDATA_END_OF_STREAM);
+		/* backend completes the transfer */
+		ft_lync_finished(ft_private);
+	} else if (sipe_media_stream_is_writable(stream)) {
+		schedule_send(ft_private);
 	}
 
-	return TRUE; /* G_SOURCE_CONTINUE */
+	return size;
+}
+
+static void
+ft_lync_outgoing_cancelled(struct sipe_file_transfer *ft)
+{
+	ft_lync_finished(SIPE_FILE_TRANSFER_PRIVATE);
 }
 
 static void
 start_writing(struct sipe_file_transfer_lync *ft_private)
 {
 	struct sipe_media_stream *stream;
-	gchar *request_id_str;
-	struct sipe_backend_fd *fd;
-	GIOChannel *channel;
 
-	stream = sipe_core_media_get_stream_by_id(ft_private->call, "data");
-	if (!stream) {
+	if (ft_private->finished) {
 		return;
 	}
 
-	if (!create_pipe(ft_private->backend_pipe)) {
-		SIPE_DEBUG_ERROR_NOFORMAT("Couldn't create backend pipe");
-		sipe_backend_ft_cancel_local(SIPE_FILE_TRANSFER);
+	stream = sipe_core_media_get_stream_by_id(ft_private->call, "data");
+	if (!stream) {
 		return;
 	}
 
-	request_id_str = g_strdup_printf("%u", ft_private->request_id);
-	write_chunk(stream, SIPE_XDATA_START_OF_STREAM,
-		    strlen(request_id_str), request_id_str);
-	g_free(request_id_str);
-
-	channel = g_io_channel_unix_new(ft_private->backend_pipe[0]);
-	ft_private->backend_pipe_write_source_id = g_io_add_watch(channel,
-								  G_IO_IN | G_IO_HUP,
-								  send_file_chunk,
-								  ft_private);
-	g_io_channel_unref(channel);
+	write_control_frame(ft_private, stream, SIPE_XDATA_START_OF_STREAM);
 
-	fd = sipe_backend_fd_from_int(ft_private->backend_pipe[1]);
-	sipe_backend_ft_start(SIPE_FILE_TRANSFER, fd, NULL, 0);
-	sipe_backend_fd_free(fd);
+	/* data is pushed into the stream by ft_lync_write() */
+	stream->writable_cb = writable_cb;
+	sipe_backend_ft_start(SIPE_FILE_TRANSFER, NULL, NULL, 0);
+	schedule_send(ft_private);
 }
 
 static void
@@ -783,6 +857,8 @@ sipe_file_transfer_lync_new_outgoing(struct sipe_core_private *sipe_private)
 
 	ft_private->sipe_private = sipe_private;
 	ft_private->public.ft_init = ft_lync_outgoing_init;
+	ft_private->public.ft_write = ft_lync_write;
+	ft_private->public.ft_cancelled = ft_lync_outgoing_cancelled;
 
 	return SIPE_FILE_TRANSFER;
 }
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010-2016 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2018 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2010 Jakub Adam <jakub.adam@ktknet.cz>
  * Copyright (C) 2010 Tomáš Hrabčík <tomas.hrabcik@tieto.com>
  *
@@ -31,6 +31,7 @@
 #include <glib.h>
 #include <glib/gprintf.h>
 
+#include "sipe-common.h"
 #include "sipe-backend.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
@@ -40,11 +41,69 @@
 #include "sipe-ft.h"
 #include "sipe-ft-tftp.h"
 #include "sipe-nls.h"
+#include "sipe-schedule.h"
 #include "sipe-utils.h"
 
 #define BUFFER_SIZE 50
 #define SIPE_FT_CHUNK_HEADER_LENGTH  3
 
+/*
+ * When sending data via server with ForeFront installed, block bigger than
+ * this default causes ending of transmission. The maximum is limited by the
+ * 16-bit chunk size in the chunk header.
+ */
+#define SIPE_FT_BLOCK_SIZE_DEFAULT   2045
+#define SIPE_FT_BLOCK_SIZE_MAXIMUM   0xFFFF
+
+/* max. number of chunks encrypted in one sipe_ft_tftp_write() call */
+#define SIPE_FT_BATCH_CHUNKS         32
+
+/* cipher & MAC are interleaved in blocks of this size to stay in cache */
+#define SIPE_FT_CRYPT_BLOCK          4096
+
+/* seconds to wait for a protocol message from the peer */
+#define SIPE_FT_TFTP_TIMEOUT 10
+
+/*
+ * TFTP protocol state machine
+ *
+ * The backend calls sipe_ft_tftp_read() when the connection is readable
+ * (receiving) or sipe_ft_tftp_write() when it is writable (sending). The
+ * handshake is advanced from these callbacks using non-blocking reads.
+ * Incomplete lines stay in the input buffer until the next callback. While
+ * the sender waits for a message from the peer, the backend is asked to
+ * call sipe_ft_tftp_write() when the connection is readable instead.
+ * A timer cancels the transfer when the peer doesn't answer in time.
+ *
+ *   Receiver                                 Sender
+ *   VER MSN_SECURE_FTP             ->
+ *                                  <-        VER MSN_SECURE_FTP
+ *   USR <user> <cookie>            ->
+ *                                  <-        FIL <size>
+ *   TFR                            ->
+ *                                  <-        <data chunks>
+ *   BYE 16777989                   ->
+ *                                  <-        MAC <digest>
+ *
+ * The last data block (receiver) or byte (sender) is not reported to the
+ * backend before the BYE/MAC exchange has completed, because the backend
+ * closes the connection after the transfer has been completed.
+ */
+enum {
+	SIPE_FT_TFTP_RECEIVE_VER = 0,
+	SIPE_FT_TFTP_RECEIVE_FIL,
+	SIPE_FT_TFTP_RECEIVE_DATA,
+	SIPE_FT_TFTP_RECEIVE_MAC,
+	SIPE_FT_TFTP_SEND_VER,
+	SIPE_FT_TFTP_SEND_USR,
+	SIPE_FT_TFTP_SEND_TFR,
+	SIPE_FT_TFTP_SEND_DATA,
+	SIPE_FT_TFTP_SEND_BYE,
+	SIPE_FT_TFTP_DONE
+};
+
+static const guchar VER[] = "VER MSN_SECURE_FTP\r\n";
+
 static gboolean
 write_exact(struct sipe_file_transfer_private *ft_private, const guchar *data,
 	    gsize size)
@@ -56,59 +115,150 @@ write_exact(struct sipe_file_transfer_private *ft_private, const guchar *data,
 	return TRUE;
 }
 
+/* read all available data into the input buffer without blocking */
 static gboolean
-read_exact(struct sipe_file_transfer_private *ft_private, guchar *data,
-	   gsize size)
+input_fill(struct sipe_file_transfer_private *ft_private)
 {
-	const gulong READ_TIMEOUT = 10000000;
-	gulong time_spent = 0;
+	gsize space = sizeof(ft_private->tftp_input) - ft_private->tftp_input_length;
 
-	while (size) {
+	if (space) {
 		gssize bytes_read = sipe_backend_ft_read(SIPE_FILE_TRANSFER_PUBLIC,
-							 data, size);
-		if (bytes_read == 0) {
-			g_usleep(100000);
-			time_spent += 100000;
-		} else if (bytes_read < 0 || time_spent > READ_TIMEOUT) {
+							 ft_private->tftp_input + ft_private->tftp_input_length,
+							 space);
+		if (bytes_read < 0)
 			return FALSE;
-		} else {
-			size -= bytes_read;
-			data += bytes_read;
-			time_spent = 0;
-		}
+		ft_private->tftp_input_length += bytes_read;
 	}
 	return TRUE;
 }
 
+static void
+input_consume(struct sipe_file_transfer_private *ft_private, gsize length)
+{
+	ft_private->tftp_input_length -= length;
+	memmove(ft_private->tftp_input,
+		ft_private->tftp_input + length,
+		ft_private->tftp_input_length);
+}
+
 static gboolean
-read_line(struct sipe_file_transfer_private *ft_private, guchar *data,
-	  gsize size)
+input_has_prefix(struct sipe_file_transfer_private *ft_private,
+		 const gchar *prefix)
 {
-	gsize pos = 0;
+	gsize length = strlen(prefix);
+	return((ft_private->tftp_input_length >= length) &&
+	       (memcmp(ft_private->tftp_input, prefix, length) == 0));
+}
 
-	if (size < 2) return FALSE;
+/* copy data from input buffer first, then from connection */
+static gssize
+input_read(struct sipe_file_transfer_private *ft_private, guchar *data,
+	   gsize size)
+{
+	gsize buffered = MIN(size, ft_private->tftp_input_length);
+	gssize bytes_read = 0;
 
-	memset(data, 0, size--);
-	do {
-		if (!read_exact(ft_private, data + pos, 1))
-			return FALSE;
-	} while ((data[pos] != '\n') && (++pos < size));
+	if (buffered) {
+		memcpy(data, ft_private->tftp_input, buffered);
+		input_consume(ft_private, buffered);
+	}
+	if (buffered < size)
+		bytes_read = sipe_backend_ft_read(SIPE_FILE_TRANSFER_PUBLIC,
+						  data + buffered,
+						  size - buffered);
 
-	/* Buffer too short? */
-	if ((pos == size) && (data[pos - 1] != '\n')) {
-		return FALSE;
+	/* report error only if no data is available */
+	if (bytes_read < 0)
+		return(buffered ? (gssize) buffered : bytes_read);
+	return(buffered + bytes_read);
+}
+
+/*
+ * Extract the next line (including "\r\n") from the input buffer
+ *
+ * @return line length, 0 if line is not complete yet or -1 on error
+ */
+static gssize
+read_line(struct sipe_file_transfer_private *ft_private, gchar *line,
+	  gsize size)
+{
+	guchar *end;
+	gsize length;
+
+	if (!input_fill(ft_private))
+		return(-1);
+
+	end = memchr(ft_private->tftp_input, '\n', ft_private->tftp_input_length);
+	if (!end) {
+		/* Buffer too short? */
+		if (ft_private->tftp_input_length >= size - 1)
+			return(-1);
+		return(0);
 	}
 
-	return TRUE;
+	length = end - ft_private->tftp_input + 1;
+	if (length >= size)
+		return(-1);
+	memcpy(line, ft_private->tftp_input, length);
+	line[length] = '\0';
+	input_consume(ft_private, length);
+
+	return(length);
 }
 
+static gchar *
+peer_timeout_name(struct sipe_file_transfer_private *ft_private)
+{
+	return(g_strdup_printf("<+ft-tftp-timeout><%p>", ft_private));
+}
 
 static void
-raise_ft_socket_read_error_and_cancel(struct sipe_file_transfer_private *ft_private)
+peer_timeout_cb(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+		gpointer data)
 {
+	struct sipe_file_transfer_private *ft_private = data;
+
+	SIPE_DEBUG_INFO("peer_timeout_cb: no answer from peer in state %u",
+			ft_private->tftp_state);
 	sipe_ft_raise_error_and_cancel(ft_private, _("Socket read failed"));
 }
 
+static void
+wait_for_peer(struct sipe_file_transfer_private *ft_private, guint state)
+{
+	gchar *name = peer_timeout_name(ft_private);
+
+	ft_private->tftp_state = state;
+	sipe_schedule_seconds(ft_private->sipe_private,
+			      name,
+			      ft_private,
+			      SIPE_FT_TFTP_TIMEOUT,
+			      peer_timeout_cb,
+			      NULL);
+	g_free(name);
+}
+
+static void
+stop_timeout(struct sipe_file_transfer_private *ft_private)
+{
+	gchar *name = peer_timeout_name(ft_private);
+	sipe_schedule_cancel(ft_private->sipe_private, name);
+	g_free(name);
+}
+
+void
+sipe_ft_tftp_stop_timeout(struct sipe_file_transfer *ft)
+{
+	stop_timeout(SIPE_FILE_TRANSFER_PRIVATE);
+}
+
+static void
+peer_answered(struct sipe_file_transfer_private *ft_private, guint state)
+{
+	ft_private->tftp_state = state;
+	stop_timeout(ft_private);
+}
+
 static void
 raise_ft_socket_write_error_and_cancel(struct sipe_file_transfer_private *ft_private)
 {
@@ -155,6 +305,37 @@ sipe_hmac_context_init(const guchar *hash_key)
 	return sipe_digest_ft_start(k2);
 }
 
+/* MAC is calculated over the decrypted data */
+static void
+encrypt_and_digest(struct sipe_file_transfer_private *ft_private,
+		   const guchar *in, gsize length, guchar *out)
+{
+	while (length) {
+		gsize block = MIN(length, SIPE_FT_CRYPT_BLOCK);
+
+		sipe_digest_ft_update(ft_private->hmac_context, in, block);
+		sipe_crypt_ft_stream(ft_private->cipher_context, in, block, out);
+		in     += block;
+		out    += block;
+		length -= block;
+	}
+}
+
+/* decrypts in place */
+static void
+decrypt_and_digest(struct sipe_file_transfer_private *ft_private,
+		   guchar *data, gsize length)
+{
+	while (length) {
+		gsize block = MIN(length, SIPE_FT_CRYPT_BLOCK);
+
+		sipe_crypt_ft_stream(ft_private->cipher_context, data, block, data);
+		sipe_digest_ft_update(ft_private->hmac_context, data, block);
+		data   += block;
+		length -= block;
+	}
+}
+
 static gchar *
 sipe_hmac_finalize(gpointer hmac_context)
 {
@@ -166,206 +347,274 @@ sipe_hmac_finalize(gpointer hmac_context)
 	return g_base64_encode(hmac_digest, sizeof (hmac_digest));
 }
 
-void
-sipe_ft_tftp_start_receiving(struct sipe_file_transfer *ft, gsize total_size)
+/* @return error message or NULL */
+static const gchar *
+receive_handshake(struct sipe_file_transfer_private *ft_private)
 {
-	static const guchar VER[]    = "VER MSN_SECURE_FTP\r\n";
 	static const guchar TFR[]    = "TFR\r\n";
 	const gsize FILE_SIZE_OFFSET = 4;
 
-	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
-	guchar buf[BUFFER_SIZE];
-	gchar *request;
-	gsize file_size;
+	gchar buf[BUFFER_SIZE];
+	gssize length;
 
-	if (!write_exact(ft_private, VER, sizeof(VER) - 1)) {
-		raise_ft_socket_read_error_and_cancel(ft_private);
-		return;
-	}
-	if (!read_line(ft_private, buf, BUFFER_SIZE)) {
-		raise_ft_socket_read_error_and_cancel(ft_private);
-		return;
-	}
+	while ((ft_private->tftp_state == SIPE_FT_TFTP_RECEIVE_VER) ||
+	       (ft_private->tftp_state == SIPE_FT_TFTP_RECEIVE_FIL)) {
 
-	request = g_strdup_printf("USR %s %u\r\n",
-				  ft_private->sipe_private->username,
-				  ft_private->auth_cookie);
-	if (!write_exact(ft_private, (guchar *)request, strlen(request))) {
-		raise_ft_socket_write_error_and_cancel(ft_private);
-		g_free(request);
-		return;
-	}
-	g_free(request);
+		length = read_line(ft_private, buf, sizeof(buf));
+		if (length < 0)
+			return(_("Socket read failed"));
+		if (length == 0)
+			break;
 
-	if (!read_line(ft_private, buf, BUFFER_SIZE)) {
-		raise_ft_socket_read_error_and_cancel(ft_private);
-		return;
-	}
+		if (ft_private->tftp_state == SIPE_FT_TFTP_RECEIVE_VER) {
+			gchar *request = g_strdup_printf("USR %s %u\r\n",
+							 ft_private->sipe_private->username,
+							 ft_private->auth_cookie);
+			gboolean ok = write_exact(ft_private,
+						  (guchar *) request,
+						  strlen(request));
+			g_free(request);
+			if (!ok)
+				return(_("Socket write failed"));
 
-	file_size = g_ascii_strtoull((gchar *) buf + FILE_SIZE_OFFSET, NULL, 10);
-	if (file_size != total_size) {
-		sipe_ft_raise_error_and_cancel(ft_private,
-					       _("File size is different from the advertised value."));
-		return;
-	}
+			wait_for_peer(ft_private, SIPE_FT_TFTP_RECEIVE_FIL);
 
-	if (sipe_backend_ft_write(SIPE_FILE_TRANSFER_PUBLIC, TFR, sizeof(TFR) - 1) != (sizeof(TFR) - 1)) {
-		raise_ft_socket_write_error_and_cancel(ft_private);
-		return;
+		} else {
+			gsize file_size = g_ascii_strtoull(buf + FILE_SIZE_OFFSET, NULL, 10);
+
+			if (file_size != ft_private->tftp_file_size)
+				return(_("File size is different from the advertised value."));
+
+			if (!write_exact(ft_private, TFR, sizeof(TFR) - 1))
+				return(_("Socket write failed"));
+
+			ft_private->bytes_remaining_chunk = 0;
+			ft_private->cipher_context = sipe_cipher_context_init(ft_private->encryption_key);
+			ft_private->hmac_context   = sipe_hmac_context_init(ft_private->hash_key);
+			peer_answered(ft_private, SIPE_FT_TFTP_RECEIVE_DATA);
+		}
 	}
 
-	ft_private->bytes_remaining_chunk = 0;
-	ft_private->cipher_context = sipe_cipher_context_init(ft_private->encryption_key);
-	ft_private->hmac_context   = sipe_hmac_context_init(ft_private->hash_key);
+	return(NULL);
 }
 
-gboolean
-sipe_ft_tftp_stop_receiving(struct sipe_file_transfer *ft)
+/* @return error message or NULL */
+static const gchar *
+receive_mac(struct sipe_file_transfer_private *ft_private)
 {
-	static const guchar BYE[] = "BYE 16777989\r\n";
-	const gsize MAC_OFFSET    = 4;
+	const gsize MAC_OFFSET = 4;
 
-	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
 	gchar buffer[BUFFER_SIZE];
-	gsize mac_len;
+	gssize mac_len;
 	gchar *mac;
 	gchar *mac1;
+	gboolean match;
 
-	if (sipe_backend_ft_write(SIPE_FILE_TRANSFER_PUBLIC, BYE, sizeof(BYE) - 1) != (sizeof(BYE) - 1)) {
-		raise_ft_socket_write_error_and_cancel(ft_private);
-		return FALSE;
-	}
-
-	if (!read_line(ft_private, (guchar *) buffer, BUFFER_SIZE)) {
-		raise_ft_socket_read_error_and_cancel(ft_private);
-		return FALSE;
-	}
+	mac_len = read_line(ft_private, buffer, sizeof(buffer));
+	if (mac_len < 0)
+		return(_("Socket read failed"));
+	if (mac_len == 0)
+		return(NULL);
 
+	/* MAC is terminated by a zero byte before "\r\n" */
 	mac_len = strlen(buffer);
-	if (mac_len < (MAC_OFFSET)) {
-		sipe_ft_raise_error_and_cancel(ft_private,
-					       _("Received MAC is corrupted"));
-		return FALSE;
-	}
+	if (mac_len < (gssize) MAC_OFFSET)
+		return(_("Received MAC is corrupted"));
 
 	/* Check MAC */
-	mac  = g_strndup(buffer + MAC_OFFSET, mac_len - MAC_OFFSET);
-	mac1 = sipe_hmac_finalize(ft_private->hmac_context);
-	if (!sipe_strequal(mac, mac1)) {
-		g_free(mac1);
-		g_free(mac);
-		sipe_ft_raise_error_and_cancel(ft_private,
-					       _("Received file is corrupted"));
-		return(FALSE);
-	}
+	mac   = g_strndup(buffer + MAC_OFFSET, mac_len - MAC_OFFSET);
+	mac1  = sipe_hmac_finalize(ft_private->hmac_context);
+	match = sipe_strequal(mac, mac1);
 	g_free(mac1);
 	g_free(mac);
+	if (!match)
+		return(_("Received file is corrupted"));
 
-	sipe_ft_free(ft);
-
-	return(TRUE);
+	peer_answered(ft_private, SIPE_FT_TFTP_DONE);
+	return(NULL);
 }
 
 void
-sipe_ft_tftp_start_sending(struct sipe_file_transfer *ft, gsize total_size)
+sipe_ft_tftp_start_receiving(struct sipe_file_transfer *ft, gsize total_size)
 {
-	static const guchar VER[] = "VER MSN_SECURE_FTP\r\n";
-
 	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
-	guchar buf[BUFFER_SIZE];
-	gchar **parts;
-	unsigned auth_cookie_received;
-	gboolean users_match;
 
-	if (!read_line(ft_private, buf, BUFFER_SIZE)) {
-		raise_ft_socket_read_error_and_cancel(ft_private);
-		return;
-	}
-
-	if (!sipe_strequal((gchar *)buf, (gchar *)VER)) {
-		sipe_ft_raise_error_and_cancel(ft_private,
-					       _("File transfer initialization failed."));
-		SIPE_DEBUG_INFO("File transfer VER string incorrect, received: %s expected: %s",
-				buf, VER);
-		return;
-	}
+	ft_private->tftp_file_size    = total_size;
+	ft_private->tftp_input_length = 0;
 
 	if (!write_exact(ft_private, VER, sizeof(VER) - 1)) {
 		raise_ft_socket_write_error_and_cancel(ft_private);
 		return;
 	}
 
-	if (!read_line(ft_private, buf, BUFFER_SIZE)) {
-		raise_ft_socket_read_error_and_cancel(ft_private);
-		return;
-	}
-
-	parts = g_strsplit((gchar *)buf, " ", 3);
-	auth_cookie_received = g_ascii_strtoull(parts[2], NULL, 10);
-	/* dialog->with has 'sip:' prefix, skip these four characters */
-	users_match = sipe_strcase_equal(parts[1],
-					 (ft_private->dialog->with + 4));
-	g_strfreev(parts);
+	/* handshake continues in sipe_ft_tftp_read() */
+	wait_for_peer(ft_private, SIPE_FT_TFTP_RECEIVE_VER);
+}
 
-	SIPE_DEBUG_INFO("File transfer authentication: %s Expected: USR %s %u",
-			buf,
-			ft_private->dialog->with + 4,
-			ft_private->auth_cookie);
+gboolean
+sipe_ft_tftp_stop_receiving(struct sipe_file_transfer *ft)
+{
+	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
 
-	if (!users_match ||
-	    (ft_private->auth_cookie != auth_cookie_received)) {
+	/* MAC has already been verified by sipe_ft_tftp_read() */
+	if (ft_private->tftp_state != SIPE_FT_TFTP_DONE) {
 		sipe_ft_raise_error_and_cancel(ft_private,
-					       _("File transfer authentication failed."));
-		return;
+					       _("Received file is corrupted"));
+		return(FALSE);
 	}
 
-	g_sprintf((gchar *)buf, "FIL %" G_GSIZE_FORMAT "\r\n", total_size);
-	if (!write_exact(ft_private, buf, strlen((gchar *)buf))) {
-		raise_ft_socket_write_error_and_cancel(ft_private);
-		return;
-	}
+	sipe_ft_free(ft);
 
-	/* TFR */
-	if (!read_line(ft_private ,buf, BUFFER_SIZE)) {
-		raise_ft_socket_read_error_and_cancel(ft_private);
-		return;
+	return(TRUE);
+}
+
+/* @return error message or NULL */
+static const gchar *
+send_handshake(struct sipe_file_transfer_private *ft_private)
+{
+	gchar buf[BUFFER_SIZE];
+	gssize length;
+
+	while ((ft_private->tftp_state == SIPE_FT_TFTP_SEND_VER) ||
+	       (ft_private->tftp_state == SIPE_FT_TFTP_SEND_USR) ||
+	       (ft_private->tftp_state == SIPE_FT_TFTP_SEND_TFR)) {
+
+		length = read_line(ft_private, buf, sizeof(buf));
+		if (length < 0)
+			return(_("Socket read failed"));
+		if (length == 0)
+			break;
+
+		switch (ft_private->tftp_state) {
+		case SIPE_FT_TFTP_SEND_VER:
+			if (!sipe_strequal(buf, (gchar *)VER)) {
+				SIPE_DEBUG_INFO("File transfer VER string incorrect, received: %s expected: %s",
+						buf, VER);
+				return(_("File transfer initialization failed."));
+			}
+
+			if (!write_exact(ft_private, VER, sizeof(VER) - 1))
+				return(_("Socket write failed"));
+
+			wait_for_peer(ft_private, SIPE_FT_TFTP_SEND_USR);
+			break;
+
+		case SIPE_FT_TFTP_SEND_USR: {
+			gchar **parts = g_strsplit(buf, " ", 3);
+			unsigned auth_cookie_received = 0;
+			gboolean users_match = FALSE;
+
+			if (parts[0] && parts[1] && parts[2]) {
+				auth_cookie_received = g_ascii_strtoull(parts[2], NULL, 10);
+				/* dialog->with has 'sip:' prefix, skip these four characters */
+				users_match = sipe_strcase_equal(parts[1],
+								 (ft_private->dialog->with + 4));
+			}
+			g_strfreev(parts);
+
+			SIPE_DEBUG_INFO("File transfer authentication: %s Expected: USR %s %u",
+					buf,
+					ft_private->dialog->with + 4,
+					ft_private->auth_cookie);
+
+			if (!users_match ||
+			    (ft_private->auth_cookie != auth_cookie_received))
+				return(_("File transfer authentication failed."));
+
+			g_sprintf(buf, "FIL %" G_GSIZE_FORMAT "\r\n",
+				  ft_private->tftp_file_size);
+			if (!write_exact(ft_private, (guchar *) buf, strlen(buf)))
+				return(_("Socket write failed"));
+
+			wait_for_peer(ft_private, SIPE_FT_TFTP_SEND_TFR);
+			break;
+		}
+
+		default:
+			/* TFR */
+			ft_private->tftp_output_pending = 0;
+			ft_private->cipher_context = sipe_cipher_context_init(ft_private->encryption_key);
+			ft_private->hmac_context   = sipe_hmac_context_init(ft_private->hash_key);
+			peer_answered(ft_private, SIPE_FT_TFTP_SEND_DATA);
+			break;
+		}
 	}
 
-	ft_private->bytes_remaining_chunk = 0;
-	ft_private->cipher_context = sipe_cipher_context_init(ft_private->encryption_key);
-	ft_private->hmac_context   = sipe_hmac_context_init(ft_private->hash_key);
+	return(NULL);
 }
 
-gboolean
-sipe_ft_tftp_stop_sending(struct sipe_file_transfer *ft)
+/* @return error message or NULL */
+static const gchar *
+send_mac(struct sipe_file_transfer_private *ft_private)
 {
-	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
-	guchar buffer[BUFFER_SIZE];
+	gchar buffer[BUFFER_SIZE];
+	gssize length;
 	gchar *mac;
 	gsize mac_len;
 
 	/* BYE */
-	if (!read_line(ft_private, buffer, BUFFER_SIZE)) {
-		raise_ft_socket_read_error_and_cancel(ft_private);
-		return FALSE;
-	}
+	length = read_line(ft_private, buffer, sizeof(buffer));
+	if (length < 0)
+		return(_("Socket read failed"));
+	if (length == 0)
+		return(NULL);
 
 	mac = sipe_hmac_finalize(ft_private->hmac_context);
-	g_sprintf((gchar *)buffer, "MAC %s \r\n", mac);
+	g_sprintf(buffer, "MAC %s \r\n", mac);
 	g_free(mac);
 
-	mac_len = strlen((gchar *)buffer);
+	mac_len = strlen(buffer);
 	/* There must be this zero byte between mac and \r\n */
 	buffer[mac_len - 3] = 0;
 
-	if (!write_exact(ft_private, buffer, mac_len)) {
-		raise_ft_socket_write_error_and_cancel(ft_private);
-		return FALSE;
+	if (!write_exact(ft_private, (guchar *) buffer, mac_len))
+		return(_("Socket write failed"));
+
+	peer_answered(ft_private, SIPE_FT_TFTP_DONE);
+	return(NULL);
+}
+
+void
+sipe_ft_tftp_start_sending(struct sipe_file_transfer *ft, gsize total_size)
+{
+	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
+	struct sipe_core_private *sipe_private = ft_private->sipe_private;
+	const gchar *block_size = sipe_backend_setting(SIPE_CORE_PUBLIC,
+						       SIPE_SETTING_FT_BLOCK_SIZE);
+	const gchar *error;
+
+	ft_private->tftp_file_size     = total_size;
+	ft_private->tftp_bytes_pending = total_size;
+	ft_private->tftp_input_length  = 0;
+	ft_private->tftp_block_size    = sipe_strequal(block_size, "maximum") ?
+		SIPE_FT_BLOCK_SIZE_MAXIMUM : SIPE_FT_BLOCK_SIZE_DEFAULT;
+	SIPE_DEBUG_INFO("sipe_ft_tftp_start_sending: block size %" G_GSIZE_FORMAT,
+			ft_private->tftp_block_size);
+	wait_for_peer(ft_private, SIPE_FT_TFTP_SEND_VER);
+
+	/* handshake continues in sipe_ft_tftp_write() */
+	error = send_handshake(ft_private);
+	if (error)
+		sipe_ft_raise_error_and_cancel(ft_private, error);
+	else if (ft_private->tftp_state != SIPE_FT_TFTP_SEND_DATA)
+		sipe_backend_ft_watch_readable(SIPE_FILE_TRANSFER_PUBLIC, TRUE);
+}
+
+gboolean
+sipe_ft_tftp_stop_sending(struct sipe_file_transfer *ft)
+{
+	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
+
+	/* MAC has already been sent by sipe_ft_tftp_write() */
+	if (ft_private->tftp_state != SIPE_FT_TFTP_DONE) {
+		sipe_ft_raise_error_and_cancel(ft_private,
+					       _("File transfer initialization failed."));
+		return(FALSE);
 	}
 
 	sipe_ft_free(ft);
 
-	return TRUE;
+	return(TRUE);
 }
 
 static void raise_ft_error(struct sipe_file_transfer_private *ft_private,
@@ -377,38 +626,50 @@ static void raise_ft_error(struct sipe_file_transfer_private *ft_private,
 	g_free(tmp);
 }
 
-gssize
-sipe_ft_tftp_read(struct sipe_file_transfer *ft, guchar **buffer,
-		  gsize bytes_remaining, gsize bytes_available)
+static gssize
+tftp_read(struct sipe_file_transfer *ft, guchar **buffer,
+	  gsize bytes_remaining, gsize bytes_available)
 {
 	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
+	const gchar *error = NULL;
 	gsize  bytes_to_read;
-	gssize bytes_read;
-
-	if (ft_private->bytes_remaining_chunk == 0) {
-		guchar hdr_buf[SIPE_FT_CHUNK_HEADER_LENGTH];
-
-		/* read chunk header */
-		if (!read_exact(ft_private, hdr_buf, sizeof(hdr_buf))) {
-			raise_ft_error(ft_private, _("Socket read failed"));
-			return -1;
+	gsize  bytes_total = 0;
+	gssize bytes_read  = 0;
+
+	*buffer = NULL;
+
+	switch (ft_private->tftp_state) {
+	case SIPE_FT_TFTP_RECEIVE_VER:
+	case SIPE_FT_TFTP_RECEIVE_FIL:
+		error = receive_handshake(ft_private);
+		break;
+
+	case SIPE_FT_TFTP_RECEIVE_MAC:
+		error = receive_mac(ft_private);
+		if (!error && (ft_private->tftp_state == SIPE_FT_TFTP_DONE)) {
+			/* file is OK: release last block */
+			*buffer = ft_private->tftp_last_block;
+			ft_private->tftp_last_block = NULL;
+			return(ft_private->tftp_last_block_length);
 		}
+		break;
 
-		/* chunk header format:
-		 *
-		 *  0:  00   unknown             (always zero?)
-		 *  1:  LL   chunk size in bytes (low byte)
-		 *  2:  HH   chunk size in bytes (high byte)
-		 *
-		 * Convert size from little endian to host order
-		 */
-		ft_private->bytes_remaining_chunk =
-			hdr_buf[1] + (hdr_buf[2] << 8);
+	default:
+		break;
+	}
+	if (error) {
+		sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC, error);
+		return -1;
 	}
+	if (ft_private->tftp_state != SIPE_FT_TFTP_RECEIVE_DATA)
+		return 0;
 
+	/*
+	 * Collect as many chunks as are available into one buffer. Only the
+	 * data of the current chunk is read from the connection, because the
+	 * MAC follows directly after the last chunk.
+	 */
 	bytes_to_read = MIN(bytes_remaining, bytes_available);
-	bytes_to_read = MIN(bytes_to_read, ft_private->bytes_remaining_chunk);
-
 	*buffer = g_malloc(bytes_to_read);
 	if (!*buffer) {
 		sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC, _("Out of memory"));
@@ -417,78 +678,167 @@ sipe_ft_tftp_read(struct sipe_file_transfer *ft, guchar **buffer,
 		return -1;
 	}
 
-	bytes_read = sipe_backend_ft_read(SIPE_FILE_TRANSFER_PUBLIC, *buffer, bytes_to_read);
-	if (bytes_read < 0) {
+	while (bytes_total < bytes_to_read) {
+		gsize bytes_chunk;
+
+		if (ft_private->bytes_remaining_chunk == 0) {
+			const guchar *hdr_buf = ft_private->tftp_input;
+
+			/* read chunk header */
+			if (ft_private->tftp_input_length < SIPE_FT_CHUNK_HEADER_LENGTH) {
+				if (!input_fill(ft_private)) {
+					bytes_read = -1;
+					break;
+				}
+				if (ft_private->tftp_input_length < SIPE_FT_CHUNK_HEADER_LENGTH)
+					break;
+			}
+
+			/* chunk header format:
+			 *
+			 *  0:  00   unknown             (always zero?)
+			 *  1:  LL   chunk size in bytes (low byte)
+			 *  2:  HH   chunk size in bytes (high byte)
+			 *
+			 * Convert size from little endian to host order
+			 */
+			ft_private->bytes_remaining_chunk =
+				hdr_buf[1] + (hdr_buf[2] << 8);
+			input_consume(ft_private, SIPE_FT_CHUNK_HEADER_LENGTH);
+		}
+
+		bytes_chunk = MIN(bytes_to_read - bytes_total,
+				  ft_private->bytes_remaining_chunk);
+		bytes_read  = input_read(ft_private,
+					 *buffer + bytes_total,
+					 bytes_chunk);
+		if (bytes_read <= 0)
+			break;
+
+		decrypt_and_digest(ft_private, *buffer + bytes_total, bytes_read);
+		bytes_total                       += bytes_read;
+		ft_private->bytes_remaining_chunk -= bytes_read;
+
+		/* no more data available */
+		if ((gsize) bytes_read < bytes_chunk)
+			break;
+	}
+
+	/* report error only if no data is available */
+	if ((bytes_read < 0) && (bytes_total == 0)) {
 		raise_ft_error(ft_private, _("Socket read failed"));
 		g_free(*buffer);
 		*buffer = NULL;
 		return -1;
 	}
 
-	if (bytes_read > 0) {
-		guchar *decrypted = g_malloc(bytes_read);
+	if (bytes_total == 0) {
+		g_free(*buffer);
+		*buffer = NULL;
+
+	/* last block: hold it back until the MAC has been verified */
+	} else if (bytes_total == bytes_remaining) {
+		static const guchar BYE[] = "BYE 16777989\r\n";
+
+		ft_private->tftp_last_block        = *buffer;
+		ft_private->tftp_last_block_length = bytes_total;
+		*buffer = NULL;
 
-		if (!decrypted) {
-			sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC, _("Out of memory"));
-			SIPE_DEBUG_ERROR("sipe_core_ft_read: can't allocate %" G_GSIZE_FORMAT " bytes for decryption buffer",
-					 (gsize)bytes_read);
-			g_free(*buffer);
-			*buffer = NULL;
+		if (!write_exact(ft_private, BYE, sizeof(BYE) - 1)) {
+			raise_ft_error(ft_private, _("Socket write failed"));
 			return -1;
 		}
-		sipe_crypt_ft_stream(ft_private->cipher_context,
-				     *buffer, bytes_read, decrypted);
-		g_free(*buffer);
-		*buffer = decrypted;
+		wait_for_peer(ft_private, SIPE_FT_TFTP_RECEIVE_MAC);
 
-		sipe_digest_ft_update(ft_private->hmac_context,
-				      decrypted, bytes_read);
-
-		ft_private->bytes_remaining_chunk -= bytes_read;
+		/* MAC might have already been received */
+		return(tftp_read(ft, buffer,
+				 bytes_remaining,
+				 bytes_available));
 	}
 
-	return(bytes_read);
+	return(bytes_total);
 }
 
 gssize
-sipe_ft_tftp_write(struct sipe_file_transfer *ft, const guchar *buffer,
-		   gsize size)
+sipe_ft_tftp_read(struct sipe_file_transfer *ft, guchar **buffer,
+		  gsize bytes_remaining, gsize bytes_available)
+{
+	gssize bytes_read = tftp_read(ft, buffer,
+				      bytes_remaining,
+				      bytes_available);
+
+	/* backend cancels the transfer */
+	if (bytes_read < 0)
+		stop_timeout(SIPE_FILE_TRANSFER_PRIVATE);
+
+	return(bytes_read);
+}
+
+static gssize
+tftp_write(struct sipe_file_transfer *ft, const guchar *buffer,
+	   gsize size)
 {
 	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
+	const gchar *error = NULL;
 	gssize bytes_written;
 
-	/* When sending data via server with ForeFront installed, block bigger than
-	 * this default causes ending of transmission. Hard limit block to this value
-	 * when libpurple sends us more data. */
-	const gsize DEFAULT_BLOCK_SIZE = 2045;
-	if (size > DEFAULT_BLOCK_SIZE)
-		size = DEFAULT_BLOCK_SIZE;
+	switch (ft_private->tftp_state) {
+	case SIPE_FT_TFTP_SEND_VER:
+	case SIPE_FT_TFTP_SEND_USR:
+	case SIPE_FT_TFTP_SEND_TFR:
+		error = send_handshake(ft_private);
+		/* handshake completed: send data when writable again */
+		if (!error &&
+		    (ft_private->tftp_state == SIPE_FT_TFTP_SEND_DATA))
+			sipe_backend_ft_watch_readable(ft, FALSE);
+		break;
+
+	case SIPE_FT_TFTP_SEND_BYE:
+		error = send_mac(ft_private);
+		if (!error && (ft_private->tftp_state == SIPE_FT_TFTP_DONE))
+			/* MAC sent: report last byte */
+			return(1);
+		break;
+
+	default:
+		break;
+	}
+	if (error) {
+		sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC, error);
+		return -1;
+	}
+	if (ft_private->tftp_state != SIPE_FT_TFTP_SEND_DATA)
+		return 0;
 
-	if (ft_private->bytes_remaining_chunk == 0) {
-		gssize bytes_read;
-		guchar local_buf[16 + 1]; /* space for string terminator */
-		guchar hdr_buf[SIPE_FT_CHUNK_HEADER_LENGTH];
+	/*
+	 * Encrypt a batch of chunks into the send buffer. The backend offers
+	 * the same data again until the whole batch has been sent.
+	 */
+	if (ft_private->tftp_output_pending == 0) {
+		gsize block_size = ft_private->tftp_block_size;
+		gsize chunks;
+		gsize needed;
+		gsize offset;
+		guchar *out;
 
 		/* Check if receiver did not cancel the transfer
 		   before it is finished */
-		bytes_read = sipe_backend_ft_read(SIPE_FILE_TRANSFER_PUBLIC,
-						  local_buf,
-						  sizeof(local_buf) - 1);
-		local_buf[sizeof(local_buf) - 1] = '\0';
-
-		if (bytes_read < 0) {
+		if (!input_fill(ft_private)) {
 			sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC,
 					      _("Socket read failed"));
 			return -1;
-		} else if ((bytes_read > 0) &&
-			   (g_str_has_prefix((gchar *)local_buf, "CCL\r\n") ||
-			    g_str_has_prefix((gchar *)local_buf, "BYE 2164261682\r\n"))) {
+		} else if (input_has_prefix(ft_private, "CCL\r\n") ||
+			   input_has_prefix(ft_private, "BYE 2164261682\r\n")) {
 			return -1;
 		}
 
-		if (ft_private->outbuf_size < size) {
+		size   = MIN(size, block_size * SIPE_FT_BATCH_CHUNKS);
+		chunks = (size + block_size - 1) / block_size;
+		needed = size + chunks * SIPE_FT_CHUNK_HEADER_LENGTH;
+
+		if (ft_private->outbuf_size < needed) {
 			g_free(ft_private->encrypted_outbuf);
-			ft_private->outbuf_size = size;
+			ft_private->outbuf_size = needed;
 			ft_private->encrypted_outbuf = g_malloc(ft_private->outbuf_size);
 			if (!ft_private->encrypted_outbuf) {
 				sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC,
@@ -499,47 +849,72 @@ sipe_ft_tftp_write(struct sipe_file_transfer *ft, const guchar *buffer,
 			}
 		}
 
-		ft_private->bytes_remaining_chunk = size;
-		ft_private->outbuf_ptr = ft_private->encrypted_outbuf;
-		sipe_crypt_ft_stream(ft_private->cipher_context,
-				     buffer, size,
-				     ft_private->encrypted_outbuf);
-		sipe_digest_ft_update(ft_private->hmac_context,
-				      buffer, size);
-
-		/* chunk header format:
-		 *
-		 *  0:  00   unknown             (always zero?)
-		 *  1:  LL   chunk size in bytes (low byte)
-		 *  2:  HH   chunk size in bytes (high byte)
-		 *
-		 * Convert size from host order to little endian
-		 */
-		hdr_buf[0] = 0;
-		hdr_buf[1] = (ft_private->bytes_remaining_chunk & 0x00FF);
-		hdr_buf[2] = (ft_private->bytes_remaining_chunk & 0xFF00) >> 8;
-
-		/* write chunk header */
-		if (sipe_backend_ft_write(SIPE_FILE_TRANSFER_PUBLIC, hdr_buf, sizeof(hdr_buf)) != sizeof(hdr_buf)) {
-			sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC,
-					      _("Socket write failed"));
-			return -1;
+		out = ft_private->encrypted_outbuf;
+		for (offset = 0; offset < size; offset += block_size) {
+			gsize chunk_size = MIN(size - offset, block_size);
+
+			/* chunk header format:
+			 *
+			 *  0:  00   unknown             (always zero?)
+			 *  1:  LL   chunk size in bytes (low byte)
+			 *  2:  HH   chunk size in bytes (high byte)
+			 *
+			 * Convert size from host order to little endian
+			 */
+			out[0] = 0;
+			out[1] = (chunk_size & 0x00FF);
+			out[2] = (chunk_size & 0xFF00) >> 8;
+			out   += SIPE_FT_CHUNK_HEADER_LENGTH;
+
+			encrypt_and_digest(ft_private, buffer + offset, chunk_size, out);
+			out   += chunk_size;
 		}
+
+		ft_private->outbuf_ptr          = ft_private->encrypted_outbuf;
+		ft_private->tftp_batch_size     = size;
+		ft_private->tftp_output_pending = needed;
 	}
 
 	bytes_written = sipe_backend_ft_write(SIPE_FILE_TRANSFER_PUBLIC,
 					      ft_private->outbuf_ptr,
-					      ft_private->bytes_remaining_chunk);
+					      ft_private->tftp_output_pending);
 	if (bytes_written < 0) {
 		raise_ft_error(ft_private, _("Socket write failed"));
-	} else if (bytes_written > 0) {
-		ft_private->bytes_remaining_chunk -= bytes_written;
-		ft_private->outbuf_ptr += bytes_written;
+		return bytes_written;
+	}
+
+	ft_private->outbuf_ptr          += bytes_written;
+	ft_private->tftp_output_pending -= bytes_written;
+	if (ft_private->tftp_output_pending)
+		return 0;
+
+	/* batch sent: report file data */
+	bytes_written = ft_private->tftp_batch_size;
+	ft_private->tftp_bytes_pending -= bytes_written;
+
+	/* whole file sent: hold back last byte until MAC has been sent */
+	if (ft_private->tftp_bytes_pending == 0) {
+		wait_for_peer(ft_private, SIPE_FT_TFTP_SEND_BYE);
+		sipe_backend_ft_watch_readable(ft, TRUE);
+		bytes_written--;
 	}
 
 	return bytes_written;
 }
 
+gssize
+sipe_ft_tftp_write(struct sipe_file_transfer *ft, const guchar *buffer,
+		   gsize size)
+{
+	gssize bytes_written = tftp_write(ft, buffer, size);
+
+	/* backend cancels the transfer */
+	if (bytes_written < 0)
+		stop_timeout(SIPE_FILE_TRANSFER_PRIVATE);
+
+	return(bytes_written);
+}
+
 /*
   Local Variables:
   mode: c
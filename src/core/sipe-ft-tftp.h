@@ -39,3 +39,7 @@ sipe_ft_tftp_stop_sending(struct sipe_file_transfer *ft);
 gssize
 sipe_ft_tftp_write(struct sipe_file_transfer *ft, const guchar *buffer,
 		   gsize size);
+
+/* cancel the timer waiting for a message from the peer */
+void
+sipe_ft_tftp_stop_timeout(struct sipe_file_transfer *ft);
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010-2016 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2018 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2010 Jakub Adam <jakub.adam@ktknet.cz>
  * Copyright (C) 2010 Tomáš Hrabčík <tomas.hrabcik@tieto.com>
  *
@@ -143,6 +143,8 @@ sipe_ft_free(struct sipe_file_transfer *ft)
 	if (ft_private->listendata)
 		sipe_backend_network_listen_cancel(ft_private->listendata);
 
+	sipe_ft_tftp_stop_timeout(ft);
+
 	if (ft_private->cipher_context)
 		sipe_crypt_ft_destroy(ft_private->cipher_context);
 
@@ -151,6 +153,7 @@ sipe_ft_free(struct sipe_file_transfer *ft)
 
 	g_free(ft_private->invitation_cookie);
 	g_free(ft_private->encrypted_outbuf);
+	g_free(ft_private->tftp_last_block);
 	g_free(ft_private);
 }
 
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2018 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2010 Jakub Adam <jakub.adam@ktknet.cz>
  * Copyright (C) 2010 Tomáš Hrabčík <tomas.hrabcik@tieto.com>
  *
@@ -26,6 +26,7 @@
 struct sipe_core_private;
 
 #define SIPE_FT_KEY_LENGTH 24
+#define SIPE_FT_TFTP_BUFFER_SIZE 256
 
 /**
  * File transport (private part)
@@ -54,6 +55,18 @@ struct sipe_file_transfer_private {
 	guchar *outbuf_ptr;
 	gsize outbuf_size;
 
+	/* TFTP protocol state machine, see sipe-ft-tftp.c */
+	guint tftp_state;
+	gsize tftp_file_size;
+	gsize tftp_bytes_pending;         /* file data not yet sent */
+	gsize tftp_block_size;            /* max. file data per chunk */
+	gsize tftp_batch_size;            /* file data in encrypted_outbuf */
+	gsize tftp_output_pending;        /* encrypted_outbuf not yet sent */
+	guchar tftp_input[SIPE_FT_TFTP_BUFFER_SIZE];
+	gsize tftp_input_length;
+	guchar *tftp_last_block;          /* held until MAC has been verified */
+	gsize tftp_last_block_length;
+
 	struct sipe_backend_listendata *listendata;
 };
 #define SIPE_FILE_TRANSFER_PUBLIC  ((struct sipe_file_transfer *) ft_private)
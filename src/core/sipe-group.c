@@ -369,7 +369,7 @@ void sipe_group_update_buddy(struct sipe_core_private *sipe_private,
 			     struct sipe_buddy *buddy)
 {
 	if (buddy) {
-		sipe_backend_buddy backend_buddy = sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
+		sipe_backend_buddy backend_buddy = sipe_buddy_backend_find(sipe_private,
 									   buddy->name,
 									   NULL);
 		if (backend_buddy) {
@@ -26,7 +26,7 @@
  *  - request handling: creation, parameters, deletion, cancelling
  *  - session handling: creation, closing
  *  - client authorization handling
- *  - connection request queue handling
+ *  - connection request queue handling & pipelining
  *  - compile HTTP header contents and hand-off to transport layer
  *  - process HTTP response and hand-off to user callback
  */
@@ -80,6 +80,17 @@ struct sipe_http_request {
 #define SIPE_HTTP_REQUEST_FLAG_REDIRECT  0x00000002
 #define SIPE_HTTP_REQUEST_FLAG_AUTHDATA  0x00000004
 #define SIPE_HTTP_REQUEST_FLAG_HANDSHAKE 0x00000008
+#define SIPE_HTTP_REQUEST_FLAG_SENT      0x00000010
+#define SIPE_HTTP_REQUEST_FLAG_READY     0x00000020
+#define SIPE_HTTP_REQUEST_FLAG_CANCELLED 0x00000040
+#define SIPE_HTTP_REQUEST_FLAG_IDENTITY  0x00000080
+
+/* compressed responses are decoded by the transport layer */
+#ifdef HAVE_ZLIB
+#define SIPE_HTTP_ACCEPT_ENCODING "Accept-Encoding: gzip, deflate\r\n"
+#else
+#define SIPE_HTTP_ACCEPT_ENCODING ""
+#endif
 
 static void sipe_http_request_free(struct sipe_core_private *sipe_private,
 				   struct sipe_http_request *req,
@@ -107,9 +118,9 @@ static void add_cookie_cb(SIPE_UNUSED_PARAMETER const gchar *key,
 	g_string_append_printf(string, "Cookie: %s\r\n", cookie);
 }
 
-static void sipe_http_request_send(struct sipe_http_connection_public *conn_public)
+static void sipe_http_request_send(struct sipe_http_connection_public *conn_public,
+				   struct sipe_http_request *req)
 {
-	struct sipe_http_request *req = conn_public->pending_requests->data;
 	gchar *header;
 	gchar *content = NULL;
 	gchar *cookie  = NULL;
@@ -131,11 +142,12 @@ static void sipe_http_request_send(struct sipe_http_connection_public *conn_publ
 	header = g_strdup_printf("%s /%s HTTP/1.1\r\n"
 				 "Host: %s\r\n"
 				 "User-Agent: %s\r\n"
-				 "%s%s%s%s",
+				 "%s%s%s%s%s",
 				 content ? "POST" : "GET",
 				 req->path,
 				 conn_public->host,
 				 sipe_core_user_agent(conn_public->sipe_private),
+				 (req->flags & SIPE_HTTP_REQUEST_FLAG_IDENTITY) ? "" : SIPE_HTTP_ACCEPT_ENCODING,
 				 conn_public->cached_authorization ? conn_public->cached_authorization :
 				 req->authorization ? req->authorization : "",
 				 req->headers ? req->headers : "",
@@ -147,6 +159,7 @@ static void sipe_http_request_send(struct sipe_http_connection_public *conn_publ
 	/* only use authorization once */
 	g_free(req->authorization);
 	req->authorization = NULL;
+	req->flags |= SIPE_HTTP_REQUEST_FLAG_SENT;
 
 	sipe_http_transport_send(conn_public,
 				 header,
@@ -159,9 +172,124 @@ gboolean sipe_http_request_pending(struct sipe_http_connection_public *conn_publ
 	return(conn_public->pending_requests != NULL);
 }
 
+/*
+ * Requests are sent in queue order, i.e. the requests in flight are always
+ * at the head of the queue and responses are matched to the queue head.
+ *
+ * Further requests are only pipelined behind requests in flight if
+ *
+ *  - the connection has already been authenticated,
+ *  - all of them are idempotent GETs,
+ *  - they don't carry an authentication handshake token and
+ *  - the requester has declared them ready.
+ */
 void sipe_http_request_next(struct sipe_http_connection_public *conn_public)
 {
-	sipe_http_request_send(conn_public);
+	GSList *entry = conn_public->pending_requests;
+	guint in_flight = 0;
+	gboolean idempotent = TRUE;
+
+	while (entry) {
+		struct sipe_http_request *req = entry->data;
+		entry = entry->next;
+
+		if (!(req->flags & SIPE_HTTP_REQUEST_FLAG_SENT)) {
+			if (in_flight &&
+			    (!conn_public->pipelining                   ||
+			     (in_flight >= conn_public->pipeline_depth) ||
+			     !idempotent                                ||
+			     req->body                                  ||
+			     req->authorization                         ||
+			     !(req->flags & SIPE_HTTP_REQUEST_FLAG_READY)))
+				break;
+
+			sipe_http_request_send(conn_public, req);
+		}
+
+		in_flight++;
+		if (req->body)
+			idempotent = FALSE;
+	}
+}
+
+void sipe_http_request_disconnected(struct sipe_http_connection_public *conn_public)
+{
+	GSList *entry = conn_public->pending_requests;
+
+	/* requests in flight have to be sent again on the new connection */
+	while (entry) {
+		struct sipe_http_request *req = entry->data;
+		entry = entry->next;
+
+		if (req->flags & SIPE_HTTP_REQUEST_FLAG_CANCELLED) {
+			conn_public->pending_requests = g_slist_remove(conn_public->pending_requests,
+								       req);
+			sipe_http_request_free(conn_public->sipe_private,
+					       req,
+					       SIPE_HTTP_STATUS_CANCELLED);
+		} else {
+			req->flags &= ~SIPE_HTTP_REQUEST_FLAG_SENT;
+		}
+	}
+
+	conn_public->pipelining = FALSE;
+}
+
+/* remove completed, failed or cancelled request from its connection */
+static void sipe_http_request_remove(struct sipe_http_request *req)
+{
+	struct sipe_http_connection_public *conn_public = req->connection;
+	conn_public->pending_requests = g_slist_remove(conn_public->pending_requests,
+						       req);
+
+	/* don't use callback */
+	req->cb = NULL;
+
+	sipe_http_request_free(conn_public->sipe_private,
+			       req,
+			       SIPE_HTTP_STATUS_CANCELLED);
+}
+
+/* TRUE if another request on the connection drives the authentication */
+static gboolean sipe_http_request_handshake_active(struct sipe_http_request *req)
+{
+	const struct sipe_http_connection_public *conn_public = req->connection;
+	GSList *entry;
+
+	for (entry = conn_public->pending_requests; entry; entry = entry->next) {
+		const struct sipe_http_request *other = entry->data;
+		if ((other != req) &&
+		    (other->flags & SIPE_HTTP_REQUEST_FLAG_HANDSHAKE))
+			return(TRUE);
+	}
+
+	return(FALSE);
+}
+
+/*
+ * Request stays in the queue for another round of authentication handshake.
+ * Move it behind the requests that are still in flight and behind the
+ * request that drives the authentication handshake.
+ */
+static void sipe_http_request_requeue(struct sipe_http_request *req)
+{
+	struct sipe_http_connection_public *conn_public = req->connection;
+	GSList *entry;
+	guint position = 0;
+
+	req->flags &= ~SIPE_HTTP_REQUEST_FLAG_SENT;
+	conn_public->pending_requests = g_slist_remove(conn_public->pending_requests,
+						       req);
+	for (entry = conn_public->pending_requests; entry; entry = entry->next) {
+		const struct sipe_http_request *other = entry->data;
+		if (!(other->flags & (SIPE_HTTP_REQUEST_FLAG_SENT |
+				      SIPE_HTTP_REQUEST_FLAG_HANDSHAKE)))
+			break;
+		position++;
+	}
+	conn_public->pending_requests = g_slist_insert(conn_public->pending_requests,
+						       req,
+						       position);
 }
 
 static void sipe_http_request_enqueue(struct sipe_core_private *sipe_private,
@@ -255,8 +383,9 @@ static gboolean sipe_http_request_response_redirection(struct sipe_core_private
 
 			/* free old request data */
 			g_free(req->path);
-			req->flags &= ~( SIPE_HTTP_REQUEST_FLAG_FIRST |
-					 SIPE_HTTP_REQUEST_FLAG_HANDSHAKE );
+			req->flags &= ~( SIPE_HTTP_REQUEST_FLAG_FIRST     |
+					 SIPE_HTTP_REQUEST_FLAG_HANDSHAKE |
+					 SIPE_HTTP_REQUEST_FLAG_SENT );
 
 			/* resubmit request on other connection */
 			sipe_http_request_enqueue(sipe_private, req, parsed_uri);
@@ -392,10 +521,11 @@ static gboolean sipe_http_request_response_unauthorized(struct sipe_core_private
 				}
 
 				/*
-				 * Keep the request in the queue. As it is at
-				 * the head it will be pulled automatically
-				 * by the transport layer after returning.
+				 * Keep the request in the queue. It will be
+				 * pulled automatically by the transport layer
+				 * after the requests still in flight.
 				 */
+				sipe_http_request_requeue(req);
 				failed = FALSE;
 
 			} else {
@@ -465,16 +595,29 @@ static void sipe_http_request_response_callback(struct sipe_core_private *sipe_p
 		   req->cb_data);
 
 	/* remove completed request */
-	sipe_http_request_cancel(req);
+	sipe_http_request_remove(req);
 }
 
 void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 				struct sipmsg *msg)
 {
 	struct sipe_core_private *sipe_private = conn_public->sipe_private;
-	struct sipe_http_request *req = conn_public->pending_requests->data;
+	struct sipe_http_request *req;
 	gboolean failed;
 
+	if (!conn_public->pending_requests) {
+		SIPE_DEBUG_ERROR("sipe_http_request_response: unexpected response %d from host '%s'",
+				 msg->response, conn_public->host);
+		return;
+	}
+	req = conn_public->pending_requests->data;
+
+	/* requester is no longer interested in this response */
+	if (req->flags & SIPE_HTTP_REQUEST_FLAG_CANCELLED) {
+		sipe_http_request_remove(req);
+		return;
+	}
+
 	if ((req->flags & SIPE_HTTP_REQUEST_FLAG_REDIRECT)   &&
 	    (msg->response >= SIPE_HTTP_STATUS_REDIRECTION)  &&
 	    (msg->response <  SIPE_HTTP_STATUS_CLIENT_ERROR)) {
@@ -483,9 +626,25 @@ void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 								msg);
 
 	} else if (msg->response == SIPE_HTTP_STATUS_CLIENT_UNAUTHORIZED) {
-		failed = sipe_http_request_response_unauthorized(sipe_private,
-								 req,
-								 msg);
+		/* no pipelining until authentication has completed */
+		conn_public->pipelining = FALSE;
+
+		/*
+		 * Requests that were pipelined before the server started
+		 * the authentication will also be rejected. Only the request
+		 * that drives the handshake may touch the security context.
+		 * All others are sent again after the handshake has completed.
+		 */
+		if (!(req->flags & SIPE_HTTP_REQUEST_FLAG_HANDSHAKE) &&
+		    sipe_http_request_handshake_active(req)) {
+			SIPE_DEBUG_INFO("sipe_http_request_response: retrying '%s' after authentication handshake",
+					req->path);
+			sipe_http_request_requeue(req);
+			failed = FALSE;
+		} else
+			failed = sipe_http_request_response_unauthorized(sipe_private,
+									 req,
+									 msg);
 
 	} else {
 		/* On some errors throw away the security context */
@@ -498,6 +657,13 @@ void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 			sipe_http_request_drop_context(conn_public);
 		}
 
+		/*
+		 * connection is ready for pipelining after a successful
+		 * response, unless an authentication handshake is ongoing
+		 */
+		conn_public->pipelining = (msg->response < SIPE_HTTP_STATUS_CLIENT_ERROR) &&
+			!sipe_http_request_handshake_active(req);
+
 		/* All other cases are passed on to the user */
 		sipe_http_request_response_callback(sipe_private, req, msg);
 
@@ -514,7 +680,7 @@ void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 			   req->cb_data);
 
 		/* remove failed request */
-		sipe_http_request_cancel(req);
+		sipe_http_request_remove(req);
 	}
 }
 
@@ -530,7 +696,7 @@ void sipe_http_request_shutdown(struct sipe_http_connection_public *conn_public,
 		while (entry) {
 			struct sipe_http_request *req = entry->data;
 
-			if (warn) {
+			if (warn && !(req->flags & SIPE_HTTP_REQUEST_FLAG_CANCELLED)) {
 				SIPE_DEBUG_ERROR("sipe_http_request_shutdown: pending request at shutdown: could indicate missing _ready() call on request. Debugging information:\n"
 						 "Host:   %s\n"
 						 "Port:   %d\n"
@@ -611,10 +777,16 @@ void sipe_http_request_ready(struct sipe_http_request *request)
 {
 	struct sipe_http_connection_public *conn_public = request->connection;
 
-	/* pass first request on already opened connection through directly */
-	if ((request->flags & SIPE_HTTP_REQUEST_FLAG_FIRST) &&
-	    conn_public->connected)
-		sipe_http_request_send(conn_public);
+	request->flags |= SIPE_HTTP_REQUEST_FLAG_READY;
+
+	/*
+	 * pass first request on already opened connection through directly,
+	 * otherwise try to pipeline it behind the requests in flight
+	 */
+	if (conn_public->connected &&
+	    ((request->flags & SIPE_HTTP_REQUEST_FLAG_FIRST) ||
+	     (((struct sipe_http_request *) conn_public->pending_requests->data)->flags & SIPE_HTTP_REQUEST_FLAG_SENT)))
+		sipe_http_request_next(conn_public);
 }
 
 struct sipe_http_session *sipe_http_session_start(void)
@@ -637,16 +809,19 @@ void sipe_http_session_close(struct sipe_http_session *session)
 
 void sipe_http_request_cancel(struct sipe_http_request *request)
 {
-	struct sipe_http_connection_public *conn_public = request->connection;
-	conn_public->pending_requests = g_slist_remove(conn_public->pending_requests,
-						       request);
-
-	/* cancelled by requester, don't use callback */
-	request->cb = NULL;
-
-	sipe_http_request_free(conn_public->sipe_private,
-			       request,
-			       SIPE_HTTP_STATUS_CANCELLED);
+	if (request->flags & SIPE_HTTP_REQUEST_FLAG_SENT) {
+		/*
+		 * Request is in flight: keep it in the queue so that its
+		 * response isn't matched to the next request. It will be
+		 * removed when the response arrives.
+		 */
+		request->flags |= SIPE_HTTP_REQUEST_FLAG_CANCELLED;
+
+		/* cancelled by requester, don't use callback */
+		request->cb = NULL;
+	} else {
+		sipe_http_request_remove(request);
+	}
 }
 
 void sipe_http_request_session(struct sipe_http_request *request,
@@ -660,6 +835,11 @@ void sipe_http_request_allow_redirect(struct sipe_http_request *request)
 	request->flags |= SIPE_HTTP_REQUEST_FLAG_REDIRECT;
 }
 
+void sipe_http_request_no_compression(struct sipe_http_request *request)
+{
+	request->flags |= SIPE_HTTP_REQUEST_FLAG_IDENTITY;
+}
+
 void sipe_http_request_authentication(struct sipe_http_request *request,
 				      const gchar *user,
 				      const gchar *password)
@@ -76,6 +76,13 @@ gboolean sipe_http_request_pending(struct sipe_http_connection_public *conn_publ
  */
 void sipe_http_request_next(struct sipe_http_connection_public *conn_public);
 
+/**
+ * HTTP connection was closed, requests in flight need to be sent again
+ *
+ * @param conn_public HTTP connection public data
+ */
+void sipe_http_request_disconnected(struct sipe_http_connection_public *conn_public);
+
 /**
  * HTTP response received
  *
@@ -23,7 +23,7 @@
  *
  * SIPE HTTP transport layer implementation
  *
- *  - connection handling: opening, closing, timeout
+ *  - connection handling: opening, closing, timeout, pooling per host
  *  - interface to backend: sending & receiving of raw messages
  *  - request queue pulling
  */
@@ -38,6 +38,7 @@
 #include "sipe-common.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
+#include "sipe-framer.h"
 #include "sipe-http.h"
 #include "sipe-schedule.h"
 #include "sipe-utils.h"
@@ -54,20 +55,29 @@
 #define SIPE_HTTP_TIMEOUT_ACTION  "<+http-timeout>"
 #define SIPE_HTTP_DEFAULT_TIMEOUT 60 /* in seconds */
 
+/* defaults for the account settings */
+#define SIPE_HTTP_MAX_CONNECTIONS 4 /* connections per host/port   */
+#define SIPE_HTTP_PIPELINE_DEPTH  4 /* requests in flight, 1 = off */
+#define SIPE_HTTP_LIMIT_MAXIMUM   16 /* upper bound for both        */
+
 struct sipe_http_connection {
 	struct sipe_http_connection_public public;
 
 	struct sipe_transport_connection *connection;
 
+	struct sipe_framer *framer;
+
 	gchar *host_port;
 	time_t timeout;  /* in seconds from epoch */
 	gboolean use_tls;
 };
 
 struct sipe_http {
-	GHashTable *connections;
+	GHashTable *connections; /* key: host/port, value: GQueue of connections */
 	GQueue *timeouts;
 	time_t next_timeout; /* in seconds from epoch, 0 if timer isn't running */
+	guint max_connections;
+	guint pipeline_depth;
 	gboolean shutting_down;
 };
 
@@ -99,28 +109,42 @@ static void sipe_http_transport_free(gpointer data)
 
 	g_free(conn->public.host);
 
+	sipe_framer_free(conn->framer);
 	g_free(conn->host_port);
 	g_free(conn);
 }
 
+static void sipe_http_transport_pool_free(gpointer data)
+{
+	GQueue *pool = data;
+	struct sipe_http_connection *conn;
+
+	while ((conn = g_queue_pop_head(pool)) != NULL)
+		sipe_http_transport_free(conn);
+	g_queue_free(pool);
+}
+
 static void sipe_http_transport_drop(struct sipe_http *http,
 				     struct sipe_http_connection *conn,
 				     const gchar *message)
 {
+	GQueue *pool = g_hash_table_lookup(http->connections, conn->host_port);
+
 	SIPE_LOG_INFO("sipe_http_transport_drop: dropping connection '%s'(%p): %s",
 		      conn->host_port,
 		      conn->connection,
 		      message ? message : "REASON UNKNOWN");
 
-#if GLIB_CHECK_VERSION(2,30,0)
-	/* this triggers sipe_http_transport_free() */
-	g_hash_table_remove(http->connections, conn->host_port);
-#else
-	/* GLIB < 2.30 calls destroy notifiers *before* removing the entry */
-	/* which can cause a race condition with sipe_http_transport_new() */
-	g_hash_table_steal(http->connections, conn->host_port);
+	/*
+	 * Remove connection from pool *before* freeing it, because request
+	 * callbacks may trigger sipe_http_transport_new() for the same host.
+	 */
+	if (pool) {
+		g_queue_remove(pool, conn);
+		if (g_queue_is_empty(pool))
+			g_hash_table_remove(http->connections, conn->host_port);
+	}
 	sipe_http_transport_free(conn);
-#endif
 	/* conn is no longer valid */
 }
 
@@ -227,6 +251,25 @@ void sipe_http_free(struct sipe_core_private *sipe_private)
 	sipe_private->http = NULL;
 }
 
+static guint sipe_http_limit(struct sipe_core_private *sipe_private,
+			     sipe_setting type,
+			     guint value)
+{
+	const gchar *setting = sipe_backend_setting(SIPE_CORE_PUBLIC, type);
+
+	if (!is_empty(setting)) {
+		guint64 limit = g_ascii_strtoull(setting, NULL, 10);
+
+		if ((limit > 0) && (limit <= SIPE_HTTP_LIMIT_MAXIMUM))
+			value = limit;
+		else
+			SIPE_DEBUG_ERROR("sipe_http_limit: ignoring invalid setting '%s'",
+					 setting);
+	}
+
+	return(value);
+}
+
 static void sipe_http_init(struct sipe_core_private *sipe_private)
 {
 	struct sipe_http *http;
@@ -235,9 +278,17 @@ static void sipe_http_init(struct sipe_core_private *sipe_private)
 
 	sipe_private->http = http = g_new0(struct sipe_http, 1);
 	http->connections = g_hash_table_new_full(g_str_hash, g_str_equal,
-						  NULL,
-						  sipe_http_transport_free);
+						  g_free,
+						  sipe_http_transport_pool_free);
 	http->timeouts = g_queue_new();
+	http->max_connections = sipe_http_limit(sipe_private,
+						SIPE_SETTING_HTTP_CONNECTIONS,
+						SIPE_HTTP_MAX_CONNECTIONS);
+	http->pipeline_depth  = sipe_http_limit(sipe_private,
+						SIPE_SETTING_HTTP_PIPELINE_DEPTH,
+						SIPE_HTTP_PIPELINE_DEPTH);
+	SIPE_DEBUG_INFO("sipe_http_init: %u connections per host, %u requests in flight per connection",
+			http->max_connections, http->pipeline_depth);
 }
 
 static void sipe_http_transport_connected(struct sipe_transport_connection *connection)
@@ -265,141 +316,19 @@ static void sipe_http_transport_connected(struct sipe_transport_connection *conn
 	sipe_http_request_next(SIPE_HTTP_CONNECTION_PUBLIC);
 }
 
+static void sipe_http_transport_connect(struct sipe_http_connection *conn);
 static void sipe_http_transport_input(struct sipe_transport_connection *connection)
 {
 	struct sipe_http_connection *conn = SIPE_HTTP_CONNECTION;
-	char *current = connection->buffer;
-
-	/* according to the RFC remove CRLF at the beginning */
-	while (*current == '\r' || *current == '\n') {
-		current++;
-	}
-	if (current != connection->buffer)
-		sipe_utils_shrink_buffer(connection, current);
+	struct sipmsg *msg;
+	gboolean drop = FALSE;
 
-	if (conn->connection &&
-	    (current = strstr(connection->buffer, "\r\n\r\n")) != NULL) {
-		struct sipmsg *msg;
-		gboolean drop = FALSE;
+	/* "connection" is no longer valid after drop */
+	while (!drop &&
+	       conn->connection &&
+	       ((msg = sipe_framer_next(conn->framer, connection)) != NULL)) {
 		gboolean next;
 
-		current += 2;
-		current[0] = '\0';
-		msg = sipmsg_parse_header(connection->buffer);
-		if (!msg) {
-			/* restore header for next try */
-			current[0] = '\r';
-			return;
-		}
-
-		/* HTTP/1.1 Transfer-Encoding: chunked */
-		if (msg->bodylen == SIPMSG_BODYLEN_CHUNKED) {
-			gchar *start        = current + 2;
-			GSList *chunks      = NULL;
-			gboolean incomplete = TRUE;
-
-			msg->bodylen = 0;
-			while (strlen(start) > 0) {
-				gchar *tmp;
-				guint length = g_ascii_strtoll(start, &tmp, 16);
-				guint remainder;
-				struct _chunk {
-					guint length;
-					const gchar *start;
-				} *chunk;
-
-				/* Illegal number */
-				if ((length == 0) && (start == tmp))
-					break;
-				msg->bodylen += length;
-
-				/* Chunk header not finished yet */
-				tmp = strstr(tmp, "\r\n");
-				if (tmp == NULL)
-					break;
-
-				/* Chunk not finished yet */
-				tmp += 2;
-				remainder = connection->buffer_used - (tmp - connection->buffer);
-				if (remainder < length + 2)
-					break;
-
-				/* Next chunk */
-				start = tmp + length + 2;
-
-				/* Body completed */
-				if (length == 0) {
-					gchar *dummy  = g_malloc(msg->bodylen + 1);
-					gchar *p      = dummy;
-					GSList *entry = chunks;
-
-					while (entry) {
-						chunk = entry->data;
-						memcpy(p, chunk->start, chunk->length);
-						p += chunk->length;
-						entry = entry->next;
-					}
-					p[0] = '\0';
-
-					msg->body = dummy;
-					sipe_utils_message_debug(connection,
-								 "HTTP",
-								 connection->buffer,
-								 msg->body,
-								 FALSE);
-
-					current = start;
-					sipe_utils_shrink_buffer(connection,
-								 current);
-
-					incomplete = FALSE;
-					break;
-				}
-
-				/* Append completed chunk */
-				chunk = g_new0(struct _chunk, 1);
-				chunk->length = length;
-				chunk->start  = tmp;
-				chunks = g_slist_append(chunks, chunk);
-			}
-
-			if (chunks)
-				sipe_utils_slist_free_full(chunks, g_free);
-
-			if (incomplete) {
-				/* restore header for next try */
-				sipmsg_free(msg);
-				current[0] = '\r';
-				return;
-			}
-
-		} else {
-			guint remainder = connection->buffer_used - (current + 2 - connection->buffer);
-
-			if (remainder >= (guint) msg->bodylen) {
-				char *dummy = g_malloc(msg->bodylen + 1);
-				current += 2;
-				memcpy(dummy, current, msg->bodylen);
-				dummy[msg->bodylen] = '\0';
-				msg->body = dummy;
-				current += msg->bodylen;
-				sipe_utils_message_debug(connection,
-							 "HTTP",
-							 connection->buffer,
-							 msg->body,
-							 FALSE);
-				sipe_utils_shrink_buffer(connection, current);
-			} else {
-				SIPE_DEBUG_INFO("sipe_http_transport_input: body too short (%d < %d, strlen %" G_GSIZE_FORMAT ") - ignoring message",
-						remainder, msg->bodylen, strlen(connection->buffer));
-
-				/* restore header for next try */
-				sipmsg_free(msg);
-				current[0] = '\r';
-				return;
-			}
-		}
-
 		if (msg->response == SIPMSG_RESPONSE_FATAL_ERROR) {
 			/* fatal header parse error */
 			msg->response = SIPE_HTTP_STATUS_SERVER_ERROR;
@@ -419,12 +348,19 @@ static void sipe_http_transport_input(struct sipe_transport_connection *connecti
 			conn->connection       = NULL;
 			conn->public.connected = FALSE;
 
+			/* responses for pipelined requests will never arrive */
+			sipe_http_request_disconnected(SIPE_HTTP_CONNECTION_PUBLIC);
+			next = sipe_http_request_pending(SIPE_HTTP_CONNECTION_PUBLIC);
+
 			/* if we have pending requests we need to trigger re-connect */
-			if (next)
-				sipe_http_transport_new(conn->public.sipe_private,
-							conn->public.host,
-							conn->public.port,
-							conn->use_tls);
+			if (next) {
+				SIPE_DEBUG_INFO("sipe_http_transport_input: re-establishing %s",
+						conn->host_port);
+
+				/* will be re-inserted after connect */
+				sipe_http_transport_update_timeout_queue(conn, TRUE);
+				sipe_http_transport_connect(conn);
+			}
 
 		} else if (next) {
 			/* trigger sending of next pending request */
@@ -445,6 +381,54 @@ static void sipe_http_transport_error(struct sipe_transport_connection *connecti
 	/* conn is no longer valid */
 }
 
+static void sipe_http_transport_connect(struct sipe_http_connection *conn)
+{
+	struct sipe_core_private *sipe_private = conn->public.sipe_private;
+	sipe_connect_setup setup = {
+		conn->use_tls ? SIPE_TRANSPORT_TLS : SIPE_TRANSPORT_TCP,
+		conn->public.host,
+		conn->public.port,
+		conn,
+		sipe_http_transport_connected,
+		sipe_http_transport_input,
+		sipe_http_transport_error
+	};
+
+	conn->public.connected = FALSE;
+	sipe_framer_reset(conn->framer);
+	conn->connection = sipe_backend_transport_connect(SIPE_CORE_PUBLIC,
+							  &setup);
+}
+
+/* select connection from pool, NULL if a new one should be opened */
+static struct sipe_http_connection *sipe_http_transport_select(struct sipe_http *http,
+								GQueue *pool)
+{
+	struct sipe_http_connection *selected = NULL;
+	guint selected_pending = G_MAXUINT;
+	GList *entry;
+
+	for (entry = pool->head; entry; entry = entry->next) {
+		struct sipe_http_connection *conn = entry->data;
+		guint pending = g_slist_length(conn->public.pending_requests);
+
+		/* idle connection */
+		if (pending == 0)
+			return(conn);
+
+		if (pending < selected_pending) {
+			selected         = conn;
+			selected_pending = pending;
+		}
+	}
+
+	/* all connections are busy: open a new one if allowed */
+	if (g_queue_get_length(pool) < http->max_connections)
+		return(NULL);
+
+	return(selected);
+}
+
 struct sipe_http_connection_public *sipe_http_transport_new(struct sipe_core_private *sipe_private,
 							    const gchar *host_in,
 							    const guint32 port,
@@ -463,12 +447,22 @@ struct sipe_http_connection_public *sipe_http_transport_new(struct sipe_core_pri
 		SIPE_DEBUG_ERROR("sipe_http_transport_new: new connection requested during shutdown: THIS SHOULD NOT HAPPEN! Debugging information:\n"
 				 "Host/Port: %s", host_port);
 	} else {
-		conn = g_hash_table_lookup(http->connections, host_port);
+		GQueue *pool = g_hash_table_lookup(http->connections, host_port);
+
+		if (!pool) {
+			pool = g_queue_new();
+			g_hash_table_insert(http->connections,
+					    g_strdup(host_port),
+					    pool);
+		}
+
+		conn = sipe_http_transport_select(http, pool);
 
 		if (conn) {
 			/* re-establishing connection */
 			if (!conn->connection) {
-				SIPE_DEBUG_INFO("sipe_http_transport_new: re-establishing %s", host_port);
+				SIPE_DEBUG_INFO("sipe_http_transport_new: re-establishing %s(%p)",
+						host_port, conn);
 
 				/* will be re-inserted after connect */
 				sipe_http_transport_update_timeout_queue(conn, TRUE);
@@ -476,38 +470,27 @@ struct sipe_http_connection_public *sipe_http_transport_new(struct sipe_core_pri
 
 		} else {
 			/* new connection */
-			SIPE_DEBUG_INFO("sipe_http_transport_new: new %s", host_port);
+			SIPE_DEBUG_INFO("sipe_http_transport_new: new %s (%u in pool)",
+					host_port, g_queue_get_length(pool) + 1);
 
 			conn = g_new0(struct sipe_http_connection, 1);
 
 			conn->public.sipe_private = sipe_private;
 			conn->public.host         = g_strdup(host);
 			conn->public.port         = port;
+			conn->public.pipeline_depth = http->pipeline_depth;
 
 			conn->host_port           = host_port;
 			conn->use_tls             = use_tls;
+			conn->framer              = sipe_framer_new("HTTP");
+			sipe_framer_enable_decompression(conn->framer);
 
-			g_hash_table_insert(http->connections,
-					    host_port,
-					    conn);
-			host_port = NULL; /* conn_private takes ownership of the key */
+			g_queue_push_tail(pool, conn);
+			host_port = NULL; /* conn_private takes ownership of the string */
 		}
 
-		if (!conn->connection) {
-			sipe_connect_setup setup = {
-				use_tls ? SIPE_TRANSPORT_TLS : SIPE_TRANSPORT_TCP,
-				host,
-				port,
-				conn,
-				sipe_http_transport_connected,
-				sipe_http_transport_input,
-				sipe_http_transport_error
-			};
-
-			conn->public.connected = FALSE;
-			conn->connection = sipe_backend_transport_connect(SIPE_CORE_PUBLIC,
-									  &setup);
-		}
+		if (!conn->connection)
+			sipe_http_transport_connect(conn);
 	}
 
 	g_free(host_port);
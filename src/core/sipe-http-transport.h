@@ -42,9 +42,11 @@ struct sipe_http_connection_public {
 	GSList *pending_requests;        /* handled by sipe-http-request.c */
 	struct sip_sec_context *context; /* handled by sipe-http-request.c */
 	gchar *cached_authorization;     /* handled by sipe-http-request.c */
+	gboolean pipelining;             /* handled by sipe-http-request.c */
 
 	gchar *host;
 	guint32 port;
+	guint pipeline_depth;            /* max. requests in flight */
 	gboolean connected;
 };
 
@@ -60,7 +62,9 @@ gboolean sipe_http_shutting_down(struct sipe_core_private *sipe_private);
 /**
  * Initiate HTTP connection
  *
- * If a connection to this host/port already exists it will be reused.
+ * Connections are pooled per host/port. An idle connection is reused,
+ * otherwise a new one is opened until the per host limit is reached.
+ * After that the connection with the shortest request queue is returned.
  *
  * @param sipe_private SIPE core private data
  * @param host         name of the host to connect to
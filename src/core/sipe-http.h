@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2013-2015 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2013-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  *
  * This program is free software; you can redistribute it and/or modify
@@ -151,6 +151,17 @@ void sipe_http_request_session(struct sipe_http_request *request,
  */
 void sipe_http_request_allow_redirect(struct sipe_http_request *request);
 
+/**
+ * Don't request a compressed response for HTTP request
+ *
+ * By default responses are requested with gzip/deflate Content-Encoding
+ * and decoded transparently. Use this for already compressed content,
+ * e.g. images.
+ *
+ * @param request pointer to opaque HTTP request data structure
+ */
+void sipe_http_request_no_compression(struct sipe_http_request *request);
+
 /**
  * Provide authentication information for HTTP request
  *
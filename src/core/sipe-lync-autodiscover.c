@@ -27,12 +27,15 @@
  *                    https://technet.microsoft.com/en-us/library/jj945654.aspx
  */
 
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <glib.h>
 
 #include "sipe-common.h"
 #include "sipe-backend.h"
+#include "sipe-cache.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
 #include "sipe-http.h"
@@ -45,6 +48,9 @@
 #define LYNC_AUTODISCOVER_ACCEPT_HEADER \
 	"Accept: application/vnd.microsoft.rtc.autodiscover+xml;v=1\r\n"
 
+#define LYNC_AUTODISCOVER_CACHE_KEY     "lync-autodiscover"
+#define LYNC_AUTODISCOVER_CACHE_TIMEOUT (7 * 24 * 60 * 60) /* 7 days */
+
 struct lync_autodiscover_request {
 	sipe_lync_autodiscover_callback *cb;
 	gpointer cb_data;
@@ -54,11 +60,13 @@ struct lync_autodiscover_request {
 	const gchar *protocol;
 	const gchar **method;
 	gchar *uri;
+	gchar *webticket_uri;
 	gboolean is_pending;
 };
 
 struct sipe_lync_autodiscover {
 	GSList *pending_requests;
+	gboolean from_cache;
 };
 
 /* Use "lar" inside the code fragment */
@@ -87,6 +95,7 @@ static void sipe_lync_autodiscover_request_free(struct sipe_core_private *sipe_p
 		/* Callback: aborted */
 		(*request->cb)(sipe_private, NULL, request->cb_data);
 	sipe_svc_session_close(request->session);
+	g_free(request->webticket_uri);
 	g_free(request->uri);
 	g_free(request);
 }
@@ -145,6 +154,60 @@ GSList *sipe_lync_autodiscover_pop(GSList *servers)
 	return(servers);
 }
 
+/* "fqdn:port" per line, in the order of the list */
+static void sipe_lync_autodiscover_cache_store(struct sipe_core_private *sipe_private,
+					       GSList *servers)
+{
+	GString *value = g_string_new("");
+
+	for (; servers; servers = servers->next) {
+		struct sipe_lync_autodiscover_data *lync_data = servers->data;
+		if (lync_data)
+			g_string_append_printf(value, "%s:%u\n",
+					       lync_data->server,
+					       lync_data->port);
+	}
+
+	if (value->len)
+		sipe_cache_store(sipe_private,
+				 LYNC_AUTODISCOVER_CACHE_KEY,
+				 value->str,
+				 time(NULL) + LYNC_AUTODISCOVER_CACHE_TIMEOUT,
+				 FALSE);
+	g_string_free(value, TRUE);
+}
+
+static GSList *sipe_lync_autodiscover_cache_lookup(struct sipe_core_private *sipe_private)
+{
+	const gchar *value = sipe_cache_lookup(sipe_private,
+					       LYNC_AUTODISCOVER_CACHE_KEY,
+					       NULL);
+	GSList *servers = NULL;
+
+	if (value) {
+		gchar **lines = g_strsplit(value, "\n", 0);
+		gchar **line;
+
+		for (line = lines; *line; line++) {
+			gchar *colon = strrchr(*line, ':');
+			guint port = colon ? strtoul(colon + 1, NULL, 10) : 0;
+
+			if (port) {
+				struct sipe_lync_autodiscover_data *lync_data = g_new0(struct sipe_lync_autodiscover_data, 1);
+				lync_data->server = g_strndup(*line, colon - *line);
+				lync_data->port   = port;
+				servers = g_slist_prepend(servers, lync_data);
+			}
+		}
+		g_strfreev(lines);
+
+		/* restore original order, terminating NULL entry last */
+		servers = g_slist_append(g_slist_reverse(servers), NULL);
+	}
+
+	return(servers);
+}
+
 static void sipe_lync_autodiscover_queue_request(struct sipe_core_private *sipe_private,
 						 struct lync_autodiscover_request *request);
 static void sipe_lync_autodiscover_parse(struct sipe_core_private *sipe_private,
@@ -239,6 +302,10 @@ static void sipe_lync_autodiscover_parse(struct sipe_core_private *sipe_private,
 									     "SipClientInternalAccess");
 				}
 
+				sipe_lync_autodiscover_cache_store(sipe_private,
+								   servers);
+				sipe_private->lync_autodiscover->from_cache = FALSE;
+
 				/* Callback takes ownership of servers list */
 				(*request->cb)(sipe_private, servers, request->cb_data);
 
@@ -264,7 +331,7 @@ static void sipe_lync_autodiscover_parse(struct sipe_core_private *sipe_private,
 }
 
 static void sipe_lync_autodiscover_webticket(struct sipe_core_private *sipe_private,
-					     SIPE_UNUSED_PARAMETER const gchar *base_uri,
+					     const gchar *base_uri,
 					     const gchar *auth_uri,
 					     const gchar *wsse_security,
 					     SIPE_UNUSED_PARAMETER const gchar *failure_msg,
@@ -289,6 +356,10 @@ static void sipe_lync_autodiscover_webticket(struct sipe_core_private *sipe_priv
 				auth_uri);
 		g_free(saml);
 
+		/* remember Web Ticket for authentication failure */
+		g_free(request->webticket_uri);
+		request->webticket_uri = g_strdup(base_uri);
+
 		lync_request(sipe_private, request, auth_uri, headers);
 		g_free(headers);
 
@@ -320,6 +391,14 @@ static void sipe_lync_autodiscover_cb(struct sipe_core_private *sipe_private,
 
 	case SIPE_HTTP_STATUS_FAILED:
 		{
+			/* Web Ticket was rejected: don't reuse it */
+			if (request->webticket_uri) {
+				sipe_webticket_invalidate(sipe_private,
+							  request->webticket_uri);
+				g_free(request->webticket_uri);
+				request->webticket_uri = NULL;
+			}
+
 			if (uri) {
 				/* check for authentication failure */
 				const gchar *webticket_uri = sipe_utils_nameval_find(headers,
@@ -474,6 +553,16 @@ void sipe_lync_autodiscover_start(struct sipe_core_private *sipe_private,
 				  gpointer callback_data)
 {
 	gpointer id = NULL;
+	GSList *servers = sipe_lync_autodiscover_cache_lookup(sipe_private);
+
+	if (servers) {
+		SIPE_DEBUG_INFO_NOFORMAT("sipe_lync_autodiscover_start: using cached server list");
+		sipe_private->lync_autodiscover->from_cache = TRUE;
+
+		/* Callback takes ownership of servers list */
+		(*callback)(sipe_private, servers, callback_data);
+		return;
+	}
 
 #define CREATE(protocol) \
 	id = sipe_lync_autodiscover_create(sipe_private,  \
@@ -485,6 +574,17 @@ void sipe_lync_autodiscover_start(struct sipe_core_private *sipe_private,
 	CREATE(https);
 }
 
+gboolean sipe_lync_autodiscover_invalidate(struct sipe_core_private *sipe_private)
+{
+	struct sipe_lync_autodiscover *sla = sipe_private->lync_autodiscover;
+	gboolean from_cache = sla->from_cache;
+
+	sipe_cache_invalidate(sipe_private, LYNC_AUTODISCOVER_CACHE_KEY);
+	sla->from_cache = FALSE;
+
+	return(from_cache);
+}
+
 void sipe_lync_autodiscover_init(struct sipe_core_private *sipe_private)
 {
 	struct sipe_lync_autodiscover *sla = g_new0(struct sipe_lync_autodiscover, 1);
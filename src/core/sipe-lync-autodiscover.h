@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2016 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2016-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  *
  * This program is free software; you can redistribute it and/or modify
@@ -56,6 +56,8 @@ GSList *sipe_lync_autodiscover_pop(GSList *servers);
 /**
  * Trigger Lync autodiscover
  *
+ * NOTE: the callback is called immediately if the result is cached.
+ *
  * @param sipe_private  SIPE core private data
  * @param callback      callback function
  * @param callback_data callback data
@@ -64,6 +66,18 @@ void sipe_lync_autodiscover_start(struct sipe_core_private *sipe_private,
 				  sipe_lync_autodiscover_callback *callback,
 				  gpointer callback_data);
 
+/**
+ * Invalidate cached Lync autodiscover result
+ *
+ * Must be called when none of the servers on the list was reachable.
+ *
+ * @param sipe_private SIPE core private data
+ *
+ * @return @c TRUE if the server list was taken from the cache, i.e. a new
+ *         autodiscover should be started with @c sipe_lync_autodiscover_start()
+ */
+gboolean sipe_lync_autodiscover_invalidate(struct sipe_core_private *sipe_private);
+
 /**
  * Initialize Lync autodiscover data
  *
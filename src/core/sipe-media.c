@@ -95,7 +95,9 @@ struct sipe_media_stream_private {
 
 	GSList *extra_sdp;
 
-	GQueue *write_queue;
+	/* unsent data: [write_queue_pos, write_queue->len) */
+	GByteArray *write_queue;
+	guint write_queue_pos;
 	GQueue *async_reads;
 	gssize read_pos;
 
@@ -107,6 +109,8 @@ struct sipe_media_stream_private {
 #define SIPE_MEDIA_STREAM_PRIVATE ((struct sipe_media_stream_private *) stream)
 
 #define SIPE_MEDIA_STREAM_CONNECTION_TIMEOUT_SECONDS 120
+/* queued data above which the stream is reported as not writable */
+#define SIPE_MEDIA_STREAM_WRITE_HIGH_WATER (64 * 1024)
 #define SIPE_MEDIA_CALL_RINGING_TIMEOUT_SECONDS 60
 #define SIPE_MEDIA_CALL_TIMEOUT_SECONDS 120
 
@@ -161,8 +165,7 @@ sipe_media_stream_free(struct sipe_media_stream_private *stream_private)
 	}
 	g_free(SIPE_MEDIA_STREAM->id);
 	g_free(stream_private->encryption_key);
-	g_queue_free_full(stream_private->write_queue,
-			  (GDestroyNotify)g_byte_array_unref);
+	g_byte_array_free(stream_private->write_queue, TRUE);
 	g_queue_free_full(stream_private->async_reads, g_free);
 	sipe_utils_nameval_free(stream_private->extra_sdp);
 	g_free(stream_private);
@@ -1419,7 +1422,7 @@ sipe_media_stream_add(struct sipe_media_call *call, const gchar *id,
 	stream_private = g_new0(struct sipe_media_stream_private, 1);
 	SIPE_MEDIA_STREAM->call = call;
 	SIPE_MEDIA_STREAM->id = g_strdup(id);
-	stream_private->write_queue = g_queue_new();
+	stream_private->write_queue = g_byte_array_new();
 	stream_private->async_reads = g_queue_new();
 
 	if (ssrc_count > 0) {
@@ -2514,34 +2517,78 @@ sipe_media_stream_read_async(struct sipe_media_stream *stream,
 	g_queue_push_tail(SIPE_MEDIA_STREAM_PRIVATE->async_reads, data);
 }
 
+static guint
+stream_write_queue_length(struct sipe_media_stream *stream)
+{
+	return SIPE_MEDIA_STREAM_PRIVATE->write_queue->len -
+	       SIPE_MEDIA_STREAM_PRIVATE->write_queue_pos;
+}
+
+/* Send as much of the queued data as possible with one backend write. */
 static void
-stream_append_buffer(struct sipe_media_stream *stream,
-		     guint8 *buffer, guint len)
+stream_flush_write_queue(struct sipe_media_stream *stream)
 {
-	GByteArray *b = g_byte_array_sized_new(len);
-	g_byte_array_append(b, buffer, len);
-	g_queue_push_tail(SIPE_MEDIA_STREAM_PRIVATE->write_queue, b);
+	struct sipe_media_stream_private *stream_private =
+			SIPE_MEDIA_STREAM_PRIVATE;
+	GByteArray *queue = stream_private->write_queue;
+	guint len = stream_write_queue_length(stream);
+	gssize written;
+
+	if (!len ||
+	    !stream_private->writable ||
+	    !stream_private->sdp_negotiation_concluded) {
+		return;
+	}
+
+	written = sipe_backend_media_stream_write(stream,
+						  queue->data + stream_private->write_queue_pos,
+						  len);
+	if (written <= 0) {
+		return;
+	}
+
+	stream_private->write_queue_pos += written;
+	if (stream_private->write_queue_pos == queue->len) {
+		/* keep the allocation for the next time */
+		g_byte_array_set_size(queue, 0);
+		stream_private->write_queue_pos = 0;
+	} else if (stream_private->write_queue_pos > queue->len / 2) {
+		g_byte_array_remove_range(queue, 0,
+					  stream_private->write_queue_pos);
+		stream_private->write_queue_pos = 0;
+	}
 }
 
 gboolean
 sipe_media_stream_write(struct sipe_media_stream *stream,
 			gpointer buffer, gsize len)
 {
-	if (!sipe_media_stream_is_writable(stream)) {
-		stream_append_buffer(stream, buffer, len);
-		return FALSE;
-	} else {
-		guint written;
+	struct sipe_media_stream_private *stream_private =
+			SIPE_MEDIA_STREAM_PRIVATE;
 
-		written = sipe_backend_media_stream_write(stream, buffer, len);
-		if (written == len) {
+	if (stream_write_queue_length(stream) == 0 &&
+	    stream_private->writable &&
+	    stream_private->sdp_negotiation_concluded) {
+		gssize written = sipe_backend_media_stream_write(stream,
+								 buffer,
+								 len);
+		if (written > 0) {
+			buffer = (guint8 *)buffer + written;
+			len -= written;
+		}
+		if (len == 0) {
 			return TRUE;
 		}
-
-		stream_append_buffer(stream,
-				     (guint8 *)buffer + written, len - written);
-		return FALSE;
 	}
+
+	/*
+	 * Adjacent writes are coalesced in the queue, so that many small
+	 * writes (e.g. frame headers) are flushed with one backend write.
+	 */
+	g_byte_array_append(stream_private->write_queue, buffer, len);
+	stream_flush_write_queue(stream);
+
+	return sipe_media_stream_is_writable(stream);
 }
 
 void
@@ -2554,21 +2601,7 @@ sipe_core_media_stream_writable(struct sipe_media_stream *stream,
 		return;
 	}
 
-	while (!g_queue_is_empty(SIPE_MEDIA_STREAM_PRIVATE->write_queue)) {
-		GByteArray *b;
-		guint written;
-
-		b = g_queue_peek_head(SIPE_MEDIA_STREAM_PRIVATE->write_queue);
-
-		written = sipe_backend_media_stream_write(stream, b->data, b->len);
-		if (written != b->len) {
-			g_byte_array_remove_range(b, 0, written);
-			return;
-		}
-
-		g_byte_array_unref(b);
-		g_queue_pop_head(SIPE_MEDIA_STREAM_PRIVATE->write_queue);
-	}
+	stream_flush_write_queue(stream);
 
 	if (sipe_media_stream_is_writable(stream) && stream->writable_cb) {
 		stream->writable_cb(stream);
@@ -2580,7 +2613,7 @@ sipe_media_stream_is_writable(struct sipe_media_stream *stream)
 {
 	return SIPE_MEDIA_STREAM_PRIVATE->writable &&
 	       SIPE_MEDIA_STREAM_PRIVATE->sdp_negotiation_concluded &&
-	       g_queue_is_empty(SIPE_MEDIA_STREAM_PRIVATE->write_queue);
+	       (stream_write_queue_length(stream) < SIPE_MEDIA_STREAM_WRITE_HIGH_WATER);
 }
 #endif
 
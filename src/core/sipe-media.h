@@ -240,18 +240,20 @@ sipe_media_stream_read_async(struct sipe_media_stream *stream,
 /**
  * Writes @c len bytes from @c buffer into @c stream.
  *
- * If @c stream is not in writable state, Sipe will store the data in
- * an internal queue which gets emptied once the stream becomes writable again.
- * Users should check the stream state using sipe_media_stream_is_writable()
- * before sending excessive data into the stream.
+ * Data that can't be written immediately is appended to an internal queue
+ * which gets emptied once the stream becomes writable again. Adjacent writes
+ * are coalesced in the queue. When the queue exceeds its high-water mark
+ * the stream is reported as unwritable until enough data has been sent;
+ * the @c writable_cb of @c stream is then called. Users should check the
+ * stream state using sipe_media_stream_is_writable() before sending
+ * excessive data into the stream.
  *
  * @param stream (in) media stream data
  * @param buffer (in) data to send
  * @param len (in) length of @c buffer
  *
- * @return @c TRUE when @c buffer was written into the stream as a whole,
- *         @c FALSE when some data had to be queued for later (and thus
- *         the stream is now in unwritable state).
+ * @return @c TRUE when more data may be written into the stream,
+ *         @c FALSE when the stream is now in unwritable state.
  */
 gboolean
 sipe_media_stream_write(struct sipe_media_stream *stream,
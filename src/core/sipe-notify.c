@@ -40,6 +40,7 @@
 #include "sipe-backend.h"
 #include "sipe-buddy.h"
 #include "sipe-cal.h"
+#include "sipe-categories.h"
 #include "sipe-conf.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
@@ -282,38 +283,20 @@ static void process_incoming_notify_rlmi_resub(struct sipe_core_private *sipe_pr
  * @param uri                   buddy SIP URI with 'sip:' prefix whose info we want to change.
  * @param phone_type
  * @param phone                 may be modified to strip white space
- * @param phone_display_string  may be modified to strip white space
  */
 static void
 sipe_update_user_phone(struct sipe_core_private *sipe_private,
 		       const gchar *uri,
 		       const gchar *phone_type,
-		       gchar *phone,
-		       gchar *phone_display_string)
+		       gchar *phone)
 {
-	sipe_buddy_info_fields phone_node = SIPE_BUDDY_INFO_WORK_PHONE; /* work phone by default */
-	sipe_buddy_info_fields phone_display_node = SIPE_BUDDY_INFO_WORK_PHONE_DISPLAY; /* work phone by default */
+	sipe_buddy_info_fields phone_node;
+	sipe_buddy_info_fields phone_display_node;
 
 	if(!phone || strlen(phone) == 0) return;
 
-	if ((sipe_strequal(phone_type, "mobile") ||  sipe_strequal(phone_type, "cell"))) {
-		phone_node = SIPE_BUDDY_INFO_MOBILE_PHONE;
-		phone_display_node = SIPE_BUDDY_INFO_MOBILE_PHONE_DISPLAY;
-	} else if (sipe_strequal(phone_type, "home")) {
-		phone_node = SIPE_BUDDY_INFO_HOME_PHONE;
-		phone_display_node = SIPE_BUDDY_INFO_HOME_PHONE_DISPLAY;
-	} else if (sipe_strequal(phone_type, "other")) {
-		phone_node = SIPE_BUDDY_INFO_OTHER_PHONE;
-		phone_display_node = SIPE_BUDDY_INFO_OTHER_PHONE_DISPLAY;
-	} else if (sipe_strequal(phone_type, "custom1")) {
-		phone_node = SIPE_BUDDY_INFO_CUSTOM1_PHONE;
-		phone_display_node = SIPE_BUDDY_INFO_CUSTOM1_PHONE_DISPLAY;
-	}
-
+	sipe_buddy_phone_fields(phone_type, &phone_node, &phone_display_node);
 	sipe_buddy_update_property(sipe_private, uri, phone_node, phone);
-	if (phone_display_string) {
-		sipe_buddy_update_property(sipe_private, uri, phone_display_node, phone_display_string);
-	}
 }
 
 static void process_incoming_notify_msrtc(struct sipe_core_private *sipe_private,
@@ -423,7 +406,7 @@ static void process_incoming_notify_msrtc(struct sipe_core_private *sipe_private
 			const char *phone_type = sipe_xml_attribute(node, "type");
 			char* phone = sipe_xml_data(node);
 
-			sipe_update_user_phone(sipe_private, uri, phone_type, phone, NULL);
+			sipe_update_user_phone(sipe_private, uri, phone_type, phone);
 
 			g_free(phone);
 		}
@@ -592,382 +575,6 @@ static void process_incoming_notify_msrtc(struct sipe_core_private *sipe_private
 	g_free(self_uri);
 }
 
-static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
-					 const gchar *data,
-					 unsigned len)
-{
-	const char *uri;
-	struct sipe_buddy *sbuddy = NULL;
-	sipe_xml *xn_categories;
-	const sipe_xml *xn_category;
-	const char *status = NULL;
-	gboolean do_update_status = FALSE;
-	gboolean has_note_cleaned = FALSE;
-	gboolean has_free_busy_cleaned = FALSE;
-	time_t last_active = 0;
-
-	xn_categories = sipe_xml_parse(data, len);
-	uri = sipe_xml_attribute(xn_categories, "uri"); /* with 'sip:' prefix */
-	if (uri) {
-		sbuddy = sipe_buddy_find_by_uri(sipe_private, uri);
-	}
-
-	if (!sbuddy) {
-		/* Got presence of a buddy not in our contact list, ignore. */
-		sipe_xml_free(xn_categories);
-		return;
-	}
-
-	for (xn_category = sipe_xml_child(xn_categories, "category");
-		 xn_category ;
-		 xn_category = sipe_xml_twin(xn_category) )
-	{
-		const sipe_xml *xn_node;
-		const char *tmp;
-		const char *attrVar = sipe_xml_attribute(xn_category, "name");
-		time_t publish_time = (tmp = sipe_xml_attribute(xn_category, "publishTime")) ?
-			sipe_utils_str_to_time(tmp) : 0;
-
-		/* contactCard */
-		if (sipe_strequal(attrVar, "contactCard"))
-		{
-			const sipe_xml *card = sipe_xml_child(xn_category, "contactCard");
-
-			if (card) {
-				const sipe_xml *node;
-				/* identity - Display Name and email */
-				node = sipe_xml_child(card, "identity");
-				if (node) {
-					char* display_name = sipe_xml_data(
-						sipe_xml_child(node, "name/displayName"));
-					char* email = sipe_xml_data(
-						sipe_xml_child(node, "email"));
-
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_EMAIL, email);
-
-					g_free(display_name);
-					g_free(email);
-				}
-				/* company */
-				node = sipe_xml_child(card, "company");
-				if (node) {
-					char* company = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_COMPANY, company);
-					g_free(company);
-				}
-				/* department */
-				node = sipe_xml_child(card, "department");
-				if (node) {
-					char* department = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_DEPARTMENT, department);
-					g_free(department);
-				}
-				/* title */
-				node = sipe_xml_child(card, "title");
-				if (node) {
-					char* title = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_JOB_TITLE, title);
-					g_free(title);
-				}
-				/* office */
-				node = sipe_xml_child(card, "office");
-				if (node) {
-					char* office = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_OFFICE, office);
-					g_free(office);
-				}
-				/* site (url) */
-				node = sipe_xml_child(card, "url");
-				if (node) {
-					char* site = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_SITE, site);
-					g_free(site);
-				}
-				/* phone */
-				for (node = sipe_xml_child(card, "phone");
-				     node;
-				     node = sipe_xml_twin(node))
-				{
-					const char *phone_type = sipe_xml_attribute(node, "type");
-					char* phone = sipe_xml_data(sipe_xml_child(node, "uri"));
-					char* phone_display_string = sipe_xml_data(sipe_xml_child(node, "displayString"));
-
-					sipe_update_user_phone(sipe_private, uri, phone_type, phone, phone_display_string);
-
-					g_free(phone);
-					g_free(phone_display_string);
-				}
-				/* address */
-				for (node = sipe_xml_child(card, "address");
-				     node;
-				     node = sipe_xml_twin(node))
-				{
-					if (sipe_strequal(sipe_xml_attribute(node, "type"), "work")) {
-						char* street = sipe_xml_data(sipe_xml_child(node, "street"));
-						char* city = sipe_xml_data(sipe_xml_child(node, "city"));
-						char* state = sipe_xml_data(sipe_xml_child(node, "state"));
-						char* zipcode = sipe_xml_data(sipe_xml_child(node, "zipcode"));
-						char* country_code = sipe_xml_data(sipe_xml_child(node, "countryCode"));
-
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_STREET, street);
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_CITY, city);
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_STATE, state);
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_ZIPCODE, zipcode);
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_COUNTRY, country_code);
-
-						g_free(street);
-						g_free(city);
-						g_free(state);
-						g_free(zipcode);
-						g_free(country_code);
-
-						break;
-					}
-				}
-				/* photo */
-				for (node = sipe_xml_child(card, "photo");
-				     node;
-				     node = sipe_xml_twin(node)) {
-					const gchar *type = sipe_xml_attribute(node, "type");
-					gchar *photo_url;
-					gchar *hash;
-					gboolean found = FALSE;
-
-					if (sipe_strequal(type, "default") &&
-					    !SIPE_CORE_PUBLIC_FLAG_IS(ALLOW_WEB_PHOTO)) {
-						SIPE_DEBUG_INFO("process_incoming_notify_rlmi: skipping download of web profile picture for %s", uri);
-						continue;
-					}
-
-					photo_url = sipe_xml_data(sipe_xml_child(node, "uri"));
-					hash = sipe_xml_data(sipe_xml_child(node, "hash"));
-
-					if (!is_empty(photo_url) && !is_empty(hash)) {
-						sipe_buddy_update_photo(sipe_private,
-									uri,
-									hash,
-									photo_url,
-									NULL);
-						found = TRUE;
-					}
-
-					g_free(hash);
-					g_free(photo_url);
-
-					if (found)
-						break;
-				}
-			}
-		}
-		/* note */
-		else if (sipe_strequal(attrVar, "note"))
-		{
-			if (!has_note_cleaned) {
-				has_note_cleaned = TRUE;
-
-				g_free(sbuddy->note);
-				sbuddy->note = NULL;
-				sbuddy->is_oof_note = FALSE;
-				sbuddy->note_since = publish_time;
-
-				do_update_status = TRUE;
-			}
-			if (publish_time >= sbuddy->note_since) {
-				/* clean up in case no 'note' element is supplied
-				 * which indicate note removal in client
-				 */
-				g_free(sbuddy->note);
-				sbuddy->note = NULL;
-				sbuddy->is_oof_note = FALSE;
-				sbuddy->note_since = publish_time;
-
-				xn_node = sipe_xml_child(xn_category, "note/body");
-				if (xn_node) {
-					char *tmp;
-					sbuddy->note = g_markup_escape_text((tmp = sipe_xml_data(xn_node)), -1);
-					g_free(tmp);
-					sbuddy->is_oof_note = sipe_strequal(sipe_xml_attribute(xn_node, "type"), "OOF");
-					sbuddy->note_since = publish_time;
-
-					SIPE_DEBUG_INFO("process_incoming_notify_rlmi: uri(%s), note(%s)",
-							uri, sbuddy->note ? sbuddy->note : "");
-				}
-				/* to trigger UI refresh in case no status info is supplied in this update */
-				do_update_status = TRUE;
-			}
-		}
-		/* state */
-		else if(sipe_strequal(attrVar, "state"))
-		{
-			char *tmp;
-			int availability;
-			const sipe_xml *xn_availability;
-			const sipe_xml *xn_activity;
-			const sipe_xml *xn_device;
-			const sipe_xml *xn_meeting_subject;
-			const sipe_xml *xn_meeting_location;
-			const gchar *legacy_activity;
-			const gchar *last_active_attr;
-
-			xn_node = sipe_xml_child(xn_category, "state");
-			if (!xn_node) continue;
-			xn_availability = sipe_xml_child(xn_node, "availability");
-			if (!xn_availability) continue;
-			xn_activity = sipe_xml_child(xn_node, "activity");
-			xn_meeting_subject = sipe_xml_child(xn_node, "meetingSubject");
-			xn_meeting_location = sipe_xml_child(xn_node, "meetingLocation");
-
-			tmp = sipe_xml_data(xn_availability);
-			availability = atoi(tmp);
-			g_free(tmp);
-
-			sbuddy->is_mobile = FALSE;
-			xn_device = sipe_xml_child(xn_node, "device");
-			if (xn_device) {
-				tmp = sipe_xml_data(xn_device);
-				sbuddy->is_mobile = !g_ascii_strcasecmp(tmp, "Mobile");
-				g_free(tmp);
-			}
-
-			/* activity */
-			g_free(sbuddy->activity);
-			sbuddy->activity = NULL;
-			if (xn_activity) {
-				const char *token = sipe_xml_attribute(xn_activity, "token");
-				const sipe_xml *xn_custom = sipe_xml_child(xn_activity, "custom");
-
-				/* from token */
-				if (!is_empty(token)) {
-					sbuddy->activity = g_strdup(sipe_core_activity_description(sipe_status_token_to_activity(token)));
-				}
-				/* from custom element */
-				if (xn_custom) {
-					char *custom = sipe_xml_data(xn_custom);
-
-					if (!is_empty(custom)) {
-						g_free(sbuddy->activity);
-						sbuddy->activity = custom;
-						custom = NULL;
-					}
-					g_free(custom);
-				}
-			}
-			/* meeting_subject */
-			g_free(sbuddy->meeting_subject);
-			sbuddy->meeting_subject = NULL;
-			if (xn_meeting_subject) {
-				char *meeting_subject = sipe_xml_data(xn_meeting_subject);
-
-				if (!is_empty(meeting_subject)) {
-					sbuddy->meeting_subject = meeting_subject;
-					meeting_subject = NULL;
-				}
-				g_free(meeting_subject);
-			}
-			/* meeting_location */
-			g_free(sbuddy->meeting_location);
-			sbuddy->meeting_location = NULL;
-			if (xn_meeting_location) {
-				char *meeting_location = sipe_xml_data(xn_meeting_location);
-
-				if (!is_empty(meeting_location)) {
-					sbuddy->meeting_location = meeting_location;
-					meeting_location = NULL;
-				}
-				g_free(meeting_location);
-			}
-
-			status = sipe_ocs2007_status_from_legacy_availability(availability, NULL);
-			legacy_activity = sipe_ocs2007_legacy_activity_description(availability);
-			if (sbuddy->activity && legacy_activity) {
-				gchar *tmp2 = sbuddy->activity;
-
-				sbuddy->activity = g_strdup_printf("%s, %s", sbuddy->activity, legacy_activity);
-				g_free(tmp2);
-			} else if (legacy_activity) {
-				sbuddy->activity = g_strdup(legacy_activity);
-			}
-
-			/* lastActive */
-			last_active_attr = sipe_xml_attribute(xn_node, "lastActive");
-			if (last_active_attr) {
-				last_active = sipe_utils_str_to_time(last_active_attr);
-			}
-
-			do_update_status = TRUE;
-		}
-		/* calendarData */
-		else if(sipe_strequal(attrVar, "calendarData"))
-		{
-			const sipe_xml *xn_free_busy = sipe_xml_child(xn_category, "calendarData/freeBusy");
-			const sipe_xml *xn_working_hours = sipe_xml_child(xn_category, "calendarData/WorkingHours");
-
-			if (xn_free_busy) {
-				if (!has_free_busy_cleaned) {
-					has_free_busy_cleaned = TRUE;
-
-					g_free(sbuddy->cal_start_time);
-					sbuddy->cal_start_time = NULL;
-
-					g_free(sbuddy->cal_free_busy_base64);
-					sbuddy->cal_free_busy_base64 = NULL;
-
-					g_free(sbuddy->cal_free_busy);
-					sbuddy->cal_free_busy = NULL;
-
-					sbuddy->cal_free_busy_published = publish_time;
-				}
-
-				if (publish_time >= sbuddy->cal_free_busy_published) {
-					g_free(sbuddy->cal_start_time);
-					sbuddy->cal_start_time = g_strdup(sipe_xml_attribute(xn_free_busy, "startTime"));
-
-					sbuddy->cal_granularity = sipe_strcase_equal(sipe_xml_attribute(xn_free_busy, "granularity"), "PT15M") ?
-						15 : 0;
-
-					g_free(sbuddy->cal_free_busy_base64);
-					sbuddy->cal_free_busy_base64 = sipe_xml_data(xn_free_busy);
-
-					g_free(sbuddy->cal_free_busy);
-					sbuddy->cal_free_busy = NULL;
-
-					sbuddy->cal_free_busy_published = publish_time;
-
-					SIPE_DEBUG_INFO("process_incoming_notify_rlmi: startTime=%s granularity=%d cal_free_busy_base64=\n%s", sbuddy->cal_start_time, sbuddy->cal_granularity, sbuddy->cal_free_busy_base64);
-				}
-			}
-
-			if (xn_working_hours) {
-				sipe_cal_parse_working_hours(xn_working_hours, sbuddy);
-			}
-		}
-	}
-
-	if (do_update_status) {
-		guint activity;
-
-		if (status) {
-			SIPE_DEBUG_INFO("process_incoming_notify_rlmi: %s", status);
-			activity = sipe_status_token_to_activity(status);
-		} else {
-			/* no status category in this update,
-			   using contact's current status */
-			activity = sipe_backend_buddy_get_status(SIPE_CORE_PUBLIC,
-								 uri);
-		}
-
-		sipe_core_buddy_got_status(SIPE_CORE_PUBLIC,
-					   uri,
-					   activity,
-					   last_active);
-	}
-
-	sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
-
-	sipe_xml_free(xn_categories);
-}
-
 static void sipe_buddy_status_from_activity(struct sipe_core_private *sipe_private,
 					    const gchar *uri,
 					    const gchar *activity,
@@ -1091,7 +698,7 @@ static void sipe_presence_mime_cb(gpointer user_data, /* sipe_core_private */
 	} else if (strstr(type, "text/xml+msrtc.pidf")) {
 		process_incoming_notify_msrtc(user_data, body, length);
 	} else {
-		process_incoming_notify_rlmi(user_data, body, length);
+		sipe_categories_process(user_data, body, length);
 	}
 }
 
@@ -1112,7 +719,7 @@ static void sipe_process_presence(struct sipe_core_private *sipe_private,
 		}
 		else if(strstr(ctype, "application/msrtc-event-categories+xml") )
 		{
-			process_incoming_notify_rlmi(sipe_private, msg->body, msg->bodylen);
+			sipe_categories_process(sipe_private, msg->body, msg->bodylen);
 		}
 		else if(strstr(ctype, "application/rlmi+xml"))
 		{
@@ -1183,28 +790,101 @@ static void sipe_process_registration_notify(struct sipe_core_private *sipe_priv
 
 }
 
+/*
+ * Attributes of a group or contact element
+ *
+ * Roaming contacts documents are collected while parsing and processed
+ * after the parser has accepted the whole document. This makes sure that
+ * nothing is applied from a truncated document and that contacts don't
+ * depend on the order of the group and contact elements.
+ */
+struct sipe_roaming_item {
+	gchar *id;
+	gchar *uri;
+	gchar *name;
+	gchar *groups;
+};
+
+enum sipe_roaming_item_type {
+	SIPE_ROAMING_GROUP,
+	SIPE_ROAMING_CONTACT,
+	SIPE_ROAMING_ADDED_GROUP,
+	SIPE_ROAMING_MODIFIED_GROUP,
+	SIPE_ROAMING_ADDED_CONTACT,
+	SIPE_ROAMING_MODIFIED_CONTACT,
+	SIPE_ROAMING_DELETED_CONTACT,
+	SIPE_ROAMING_DELETED_GROUP,
+	SIPE_ROAMING_ITEM_TYPES
+};
+
+/* element names, indexed by enum sipe_roaming_item_type */
+static const gchar * const roaming_item_names[SIPE_ROAMING_ITEM_TYPES] = {
+	"group",
+	"contact",
+	"addedGroup",
+	"modifiedGroup",
+	"addedContact",
+	"modifiedContact",
+	"deletedContact",
+	"deletedGroup"
+};
+
+struct sipe_process_roaming_contacts_data {
+	gboolean contact_list;
+	gboolean contact_delta;
+	guint delta;
+	gchar *ucsmode;
+	GSList *items[SIPE_ROAMING_ITEM_TYPES];
+};
+
+static void roaming_item_free(gpointer data)
+{
+	struct sipe_roaming_item *item = data;
+
+	g_free(item->groups);
+	g_free(item->name);
+	g_free(item->uri);
+	g_free(item->id);
+	g_free(item);
+}
+
+static void roaming_contacts_data_free(struct sipe_process_roaming_contacts_data *data)
+{
+	guint type;
+
+	for (type = 0; type < SIPE_ROAMING_ITEM_TYPES; type++)
+		sipe_utils_slist_free_full(data->items[type],
+					   roaming_item_free);
+	g_free(data->ucsmode);
+}
+
+static int roaming_group_id(const struct sipe_roaming_item *item)
+{
+	return(item->id ? (int) g_ascii_strtod(item->id, NULL) : 0);
+}
+
 /* Replace "~" with localized version of "Other Contacts" */
-static const gchar *get_group_name(const sipe_xml *node)
+static const gchar *get_group_name(const struct sipe_roaming_item *item)
 {
-	const gchar *name = sipe_xml_attribute(node, "name");
+	const gchar *name = item->name;
 	return(g_str_has_prefix(name, "~") ? _("Other Contacts") : name);
 }
 
 static void add_new_group(struct sipe_core_private *sipe_private,
-			  const sipe_xml *node)
+			  const struct sipe_roaming_item *item)
 {
 	sipe_group_add(sipe_private,
-		       get_group_name(node),
+		       get_group_name(item),
 		       NULL,
 		       NULL,
-		       sipe_xml_int_attribute(node, "id", 0));
+		       item->id ? g_ascii_strtoull(item->id, NULL, 10) : 0);
 }
 
 static void add_new_buddy(struct sipe_core_private *sipe_private,
-			  const sipe_xml *node,
+			  const struct sipe_roaming_item *item,
 			  const gchar *uri)
 {
-	const gchar *name = sipe_xml_attribute(node, "name");
+	const gchar *name = item->name;
 	struct sipe_buddy *buddy = NULL;
 	gchar *tmp;
 	gchar **item_groups;
@@ -1218,7 +898,7 @@ static void add_new_buddy(struct sipe_core_private *sipe_private,
 	}
 
 	/* assign to group Other Contacts if nothing else received */
-	tmp = g_strdup(sipe_xml_attribute(node, "groups"));
+	tmp = g_strdup(item->groups);
 	if (is_empty(tmp)) {
 		struct sipe_group *group = sipe_group_find_by_name(sipe_private,
 								   _("Other Contacts"));
@@ -1260,31 +940,225 @@ static void add_new_buddy(struct sipe_core_private *sipe_private,
 	g_strfreev(item_groups);
 }
 
+static void sipe_process_roaming_contacts_delta(struct sipe_core_private *sipe_private,
+						struct sipe_process_roaming_contacts_data *data)
+{
+	const GSList *entry;
+
+	/* Process new groups */
+	for (entry = data->items[SIPE_ROAMING_ADDED_GROUP]; entry; entry = entry->next)
+		add_new_group(sipe_private, entry->data);
+
+	/* Process modified groups */
+	for (entry = data->items[SIPE_ROAMING_MODIFIED_GROUP]; entry; entry = entry->next) {
+		const struct sipe_roaming_item *item = entry->data;
+		struct sipe_group *group = sipe_group_find_by_id(sipe_private,
+								 roaming_group_id(item));
+		if (group) {
+			const gchar *name = get_group_name(item);
+
+			if (!(is_empty(name) ||
+			      sipe_strequal(group->name, name)) &&
+			    sipe_group_rename(sipe_private,
+					      group,
+					      name))
+				SIPE_DEBUG_INFO("Replaced group %d name with %s", group->id, name);
+		}
+	}
+
+	/* Process new buddies */
+	for (entry = data->items[SIPE_ROAMING_ADDED_CONTACT]; entry; entry = entry->next) {
+		const struct sipe_roaming_item *item = entry->data;
+		add_new_buddy(sipe_private,
+			      item,
+			      item->uri);
+	}
+
+	/* Process modified buddies */
+	for (entry = data->items[SIPE_ROAMING_MODIFIED_CONTACT]; entry; entry = entry->next) {
+		const struct sipe_roaming_item *item = entry->data;
+		const gchar *uri = item->uri;
+		struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
+								  uri);
+
+		if (buddy) {
+			gchar **item_groups = g_strsplit(item->groups,
+							 " ", 0);
+
+			/* this should be defined. Otherwise we would get "deletedContact" */
+			if (item_groups) {
+				const gchar *name = item->name;
+				gboolean empty_name = is_empty(name);
+				GSList *found = NULL;
+				int i = 0;
+
+				while (item_groups[i]) {
+					struct sipe_group *group = sipe_group_find_by_id(sipe_private,
+											 g_ascii_strtod(item_groups[i],
+													NULL));
+					/* ignore unkown groups */
+					if (group) {
+						sipe_backend_buddy b = sipe_buddy_backend_find(sipe_private,
+											       uri,
+											       group->name);
+
+						/* add group to found list */
+						found = g_slist_prepend(found, group);
+
+						if (b) {
+							/* new alias? */
+							gchar *b_alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC,
+												      b);
+
+							if (!(empty_name ||
+							      sipe_strequal(b_alias, name))) {
+								sipe_backend_buddy_set_alias(SIPE_CORE_PUBLIC,
+											     b,
+											     name);
+								SIPE_DEBUG_INFO("Replaced for buddy %s in group '%s' old alias '%s' with '%s'",
+										uri, group->name, b_alias, name);
+							}
+							g_free(b_alias);
+
+						} else {
+							const gchar *alias = empty_name ? uri : name;
+							/* buddy was not in this group */
+							sipe_buddy_backend_add(sipe_private,
+									       uri,
+									       alias,
+									       group->name);
+							sipe_buddy_insert_group(buddy, group);
+							SIPE_DEBUG_INFO("Added buddy %s (alias '%s' to group '%s'",
+									uri, alias, group->name);
+						}
+					}
+
+					/* next group */
+					i++;
+				}
+				g_strfreev(item_groups);
+
+ 					/* removed from groups? */
+				sipe_buddy_update_groups(sipe_private,
+							 buddy,
+							 found);
+				g_slist_free(found);
+			}
+		}
+	}
+
+	/* Process deleted buddies */
+	for (entry = data->items[SIPE_ROAMING_DELETED_CONTACT]; entry; entry = entry->next) {
+		const struct sipe_roaming_item *item = entry->data;
+		const gchar *uri = item->uri;
+		struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
+								  uri);
+
+		if (buddy) {
+			SIPE_DEBUG_INFO("Removing buddy %s", uri);
+			sipe_buddy_remove(sipe_private, buddy);
+		}
+	}
+
+	/* Process deleted groups
+	 *
+	 * NOTE: all buddies will already have been removed from the
+	 *       group prior to this. The log shows that OCS actually
+	 *       sends two separate updates when you delete a group:
+	 *
+	 *         - first one with "modifiedContact" removing buddies
+	 *           from the group, leaving it empty, and
+	 *
+	 *         - then one with "deletedGroup" removing the group
+	 */
+	for (entry = data->items[SIPE_ROAMING_DELETED_GROUP]; entry; entry = entry->next)
+		sipe_group_remove(sipe_private,
+				  sipe_group_find_by_id(sipe_private,
+							roaming_group_id(entry->data)));
+
+}
+
+static void sipe_process_roaming_contacts_root(const sipe_xml *isc,
+					       gpointer user_data)
+{
+	struct sipe_process_roaming_contacts_data *data = user_data;
+
+	/* [MS-SIP]: deltaNum MUST be non-zero */
+	data->delta = sipe_xml_int_attribute(isc, "deltaNum", 0);
+
+	if (sipe_strequal(sipe_xml_name(isc), "contactList")) {
+		data->contact_list = TRUE;
+		data->ucsmode      = g_strdup(sipe_xml_attribute(isc, "ucsmode"));
+	} else {
+		data->contact_delta = TRUE;
+	}
+}
+
+static void sipe_process_roaming_contacts_item(const sipe_xml *node,
+					       gpointer user_data)
+{
+	struct sipe_process_roaming_contacts_data *data = user_data;
+	const gchar *name = sipe_xml_name(node);
+	guint type;
+
+	for (type = 0; type < SIPE_ROAMING_ITEM_TYPES; type++) {
+		if (sipe_strequal(name, roaming_item_names[type])) {
+			struct sipe_roaming_item *item = g_new0(struct sipe_roaming_item, 1);
+
+			item->id     = g_strdup(sipe_xml_attribute(node, "id"));
+			item->uri    = g_strdup(sipe_xml_attribute(node, "uri"));
+			item->name   = g_strdup(sipe_xml_attribute(node, "name"));
+			item->groups = g_strdup(sipe_xml_attribute(node, "groups"));
+
+			/* reversed after parsing */
+			data->items[type] = g_slist_prepend(data->items[type],
+							    item);
+			break;
+		}
+	}
+}
+
 static gboolean sipe_process_roaming_contacts(struct sipe_core_private *sipe_private,
 					      struct sipmsg *msg)
 {
-	int len = msg->bodylen;
-
+	/*
+	 * The document is processed one group/contact at a time instead of
+	 * building the complete tree, see struct sipe_roaming_item.
+	 */
+	static const struct sipe_xml_stream_handler handlers[] = {
+		{ "contactList",                  sipe_process_roaming_contacts_root, NULL },
+		{ "contactList/group",            NULL, sipe_process_roaming_contacts_item },
+		{ "contactList/contact",          NULL, sipe_process_roaming_contacts_item },
+		{ "contactDelta",                 sipe_process_roaming_contacts_root, NULL },
+		{ "contactDelta/addedGroup",      NULL, sipe_process_roaming_contacts_item },
+		{ "contactDelta/modifiedGroup",   NULL, sipe_process_roaming_contacts_item },
+		{ "contactDelta/addedContact",    NULL, sipe_process_roaming_contacts_item },
+		{ "contactDelta/modifiedContact", NULL, sipe_process_roaming_contacts_item },
+		{ "contactDelta/deletedContact",  NULL, sipe_process_roaming_contacts_item },
+		{ "contactDelta/deletedGroup",    NULL, sipe_process_roaming_contacts_item },
+		{ NULL, NULL, NULL }
+	};
+	struct sipe_process_roaming_contacts_data data;
 	const gchar *tmp = sipmsg_find_header(msg, "Event");
-	const sipe_xml *item;
-	sipe_xml *isc;
-	guint delta;
-	const sipe_xml *group_node;
+	guint type;
 
 	if (!g_str_has_prefix(tmp, "vnd-microsoft-roaming-contacts")) {
 		return FALSE;
 	}
 
+	memset(&data, 0, sizeof(data));
+
 	/* Convert the contact from XML to backend Buddies */
-	isc = sipe_xml_parse(msg->body, len);
-	if (!isc) {
+	if (!sipe_xml_stream(msg->body, msg->bodylen, handlers, &data)) {
+		SIPE_DEBUG_ERROR_NOFORMAT("sipe_process_roaming_contacts: discarding incomplete document");
+		roaming_contacts_data_free(&data);
 		return FALSE;
 	}
+	for (type = 0; type < SIPE_ROAMING_ITEM_TYPES; type++)
+		data.items[type] = g_slist_reverse(data.items[type]);
 
-	/* [MS-SIP]: deltaNum MUST be non-zero */
-	delta = sipe_xml_int_attribute(isc, "deltaNum", 0);
-	if (delta) {
-		sipe_private->deltanum_contacts = delta;
+	if (data.delta) {
+		sipe_private->deltanum_contacts = data.delta;
 	}
 
 	/*
@@ -1298,8 +1172,8 @@ static gboolean sipe_process_roaming_contacts(struct sipe_core_private *sipe_pri
 	 *    * Notify piggy-backed on SUBSCRIBE response with empty list
 	 *    * NOTIFY send by server with standard list (ignored by us)
 	 */
-	if (sipe_strequal(sipe_xml_name(isc), "contactList")) {
-		const gchar *ucsmode = sipe_xml_attribute(isc, "ucsmode");
+	if (data.contact_list) {
+		const gchar *ucsmode = data.ucsmode;
 
 		SIPE_CORE_PRIVATE_FLAG_UNSET(LYNC2013);
 		if (ucsmode) {
@@ -1314,12 +1188,14 @@ static gboolean sipe_process_roaming_contacts(struct sipe_core_private *sipe_pri
 		}
 
 		if (!sipe_ucs_is_migrated(sipe_private)) {
+			const GSList *entry;
+
 			/* Start processing contact list */
 			sipe_backend_buddy_list_processing_start(SIPE_CORE_PUBLIC);
 
 			/* Parse groups */
-			for (group_node = sipe_xml_child(isc, "group"); group_node; group_node = sipe_xml_twin(group_node))
-				add_new_group(sipe_private, group_node);
+			for (entry = data.items[SIPE_ROAMING_GROUP]; entry; entry = entry->next)
+				add_new_group(sipe_private, entry->data);
 
 			/* Make sure we have at least one group */
 			if (sipe_group_count(sipe_private) == 0) {
@@ -1330,9 +1206,9 @@ static gboolean sipe_process_roaming_contacts(struct sipe_core_private *sipe_pri
 			}
 
 			/* Parse contacts */
-			for (item = sipe_xml_child(isc, "contact"); item; item = sipe_xml_twin(item)) {
-				const gchar *name = sipe_xml_attribute(item, "uri");
-				gchar *uri        = sip_uri_from_name(name);
+			for (entry = data.items[SIPE_ROAMING_CONTACT]; entry; entry = entry->next) {
+				const struct sipe_roaming_item *item = entry->data;
+				gchar *uri = sip_uri_from_name(item->uri);
 				add_new_buddy(sipe_private, item, uri);
 				g_free(uri);
 			}
@@ -1355,140 +1231,11 @@ static gboolean sipe_process_roaming_contacts(struct sipe_core_private *sipe_pri
 		}
 
 	/* Process buddy list updates */
-	} else if (sipe_strequal(sipe_xml_name(isc), "contactDelta")) {
-
-		/* Process new groups */
-		for (group_node = sipe_xml_child(isc, "addedGroup"); group_node; group_node = sipe_xml_twin(group_node))
-			add_new_group(sipe_private, group_node);
-
-		/* Process modified groups */
-		for (group_node = sipe_xml_child(isc, "modifiedGroup"); group_node; group_node = sipe_xml_twin(group_node)) {
-			struct sipe_group *group = sipe_group_find_by_id(sipe_private,
-									 (int)g_ascii_strtod(sipe_xml_attribute(group_node, "id"),
-											     NULL));
-			if (group) {
-				const gchar *name = get_group_name(group_node);
-
-				if (!(is_empty(name) ||
-				      sipe_strequal(group->name, name)) &&
-				    sipe_group_rename(sipe_private,
-						      group,
-						      name))
-					SIPE_DEBUG_INFO("Replaced group %d name with %s", group->id, name);
-			}
-		}
-
-		/* Process new buddies */
-		for (item = sipe_xml_child(isc, "addedContact"); item; item = sipe_xml_twin(item)) {
-			add_new_buddy(sipe_private,
-				      item,
-				      sipe_xml_attribute(item, "uri"));
-		}
-
-		/* Process modified buddies */
-		for (item = sipe_xml_child(isc, "modifiedContact"); item; item = sipe_xml_twin(item)) {
-			const gchar *uri = sipe_xml_attribute(item, "uri");
-			struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
-									  uri);
-
-			if (buddy) {
-				gchar **item_groups = g_strsplit(sipe_xml_attribute(item,
-										    "groups"),
-								 " ", 0);
-
-				/* this should be defined. Otherwise we would get "deletedContact" */
-				if (item_groups) {
-					const gchar *name = sipe_xml_attribute(item, "name");
-					gboolean empty_name = is_empty(name);
-					GSList *found = NULL;
-					int i = 0;
-
-					while (item_groups[i]) {
-						struct sipe_group *group = sipe_group_find_by_id(sipe_private,
-												 g_ascii_strtod(item_groups[i],
-														NULL));
-						/* ignore unkown groups */
-						if (group) {
-							sipe_backend_buddy b = sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
-												       uri,
-												       group->name);
-
-							/* add group to found list */
-							found = g_slist_prepend(found, group);
-
-							if (b) {
-								/* new alias? */
-								gchar *b_alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC,
-													      b);
-
-								if (!(empty_name ||
-								      sipe_strequal(b_alias, name))) {
-									sipe_backend_buddy_set_alias(SIPE_CORE_PUBLIC,
-												     b,
-												     name);
-									SIPE_DEBUG_INFO("Replaced for buddy %s in group '%s' old alias '%s' with '%s'",
-											uri, group->name, b_alias, name);
-								}
-								g_free(b_alias);
-
-							} else {
-								const gchar *alias = empty_name ? uri : name;
-								/* buddy was not in this group */
-								sipe_backend_buddy_add(SIPE_CORE_PUBLIC,
-										       uri,
-										       alias,
-										       group->name);
-								sipe_buddy_insert_group(buddy, group);
-								SIPE_DEBUG_INFO("Added buddy %s (alias '%s' to group '%s'",
-										uri, alias, group->name);
-							}
-						}
-
-						/* next group */
-						i++;
-					}
-					g_strfreev(item_groups);
-
- 					/* removed from groups? */
-					sipe_buddy_update_groups(sipe_private,
-								 buddy,
-								 found);
-					g_slist_free(found);
-				}
-			}
-		}
-
-		/* Process deleted buddies */
-		for (item = sipe_xml_child(isc, "deletedContact"); item; item = sipe_xml_twin(item)) {
-			const gchar *uri = sipe_xml_attribute(item, "uri");
-			struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
-									  uri);
-
-			if (buddy) {
-				SIPE_DEBUG_INFO("Removing buddy %s", uri);
-				sipe_buddy_remove(sipe_private, buddy);
-			}
-		}
-
-		/* Process deleted groups
-		 *
-		 * NOTE: all buddies will already have been removed from the
-		 *       group prior to this. The log shows that OCS actually
-		 *       sends two separate updates when you delete a group:
-		 *
-		 *         - first one with "modifiedContact" removing buddies
-		 *           from the group, leaving it empty, and
-		 *
-		 *         - then one with "deletedGroup" removing the group
-		 */
-		for (group_node = sipe_xml_child(isc, "deletedGroup"); group_node; group_node = sipe_xml_twin(group_node))
-			sipe_group_remove(sipe_private,
-					  sipe_group_find_by_id(sipe_private,
-								(int)g_ascii_strtod(sipe_xml_attribute(group_node, "id"),
-										    NULL)));
-
+	} else if (data.contact_delta) {
+		sipe_process_roaming_contacts_delta(sipe_private, &data);
 	}
-	sipe_xml_free(isc);
+
+	roaming_contacts_data_free(&data);
 
 	/* Subscribe to buddies, if contact list not migrated to UCS */
 	if (!sipe_ucs_is_migrated(sipe_private))
@@ -2070,6 +2070,22 @@ static void sipe_refresh_blocked_status(struct sipe_core_private *sipe_private)
   *   we sends a setSubscribers request to him [SIP-PRES] 4.8
   *
   */
+/* compiled paths for roaming self processing */
+static struct sipe_xml_path path_activity = SIPE_XML_PATH_INIT("activity");
+static struct sipe_xml_path path_availability = SIPE_XML_PATH_INIT("availability");
+static struct sipe_xml_path path_calendar_data_free_busy = SIPE_XML_PATH_INIT("calendarData/freeBusy");
+static struct sipe_xml_path path_calendar_data_working_hours = SIPE_XML_PATH_INIT("calendarData/WorkingHours");
+static struct sipe_xml_path path_categories_category = SIPE_XML_PATH_INIT("categories/category");
+static struct sipe_xml_path path_containers = SIPE_XML_PATH_INIT("containers");
+static struct sipe_xml_path path_containers_container = SIPE_XML_PATH_INIT("containers/container");
+static struct sipe_xml_path path_meeting_location = SIPE_XML_PATH_INIT("meetingLocation");
+static struct sipe_xml_path path_meeting_subject = SIPE_XML_PATH_INIT("meetingSubject");
+static struct sipe_xml_path path_member = SIPE_XML_PATH_INIT("member");
+static struct sipe_xml_path path_note_body = SIPE_XML_PATH_INIT("note/body");
+static struct sipe_xml_path path_state = SIPE_XML_PATH_INIT("state");
+static struct sipe_xml_path path_subscribers_subscriber = SIPE_XML_PATH_INIT("subscribers/subscriber");
+static struct sipe_xml_path path_user_properties_lines_line = SIPE_XML_PATH_INIT("userProperties/lines/line");
+
 void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 				       struct sipmsg *msg)
 {
@@ -2097,7 +2113,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 
 	/* categories */
 	/* set list of categories participating in this XML */
-	for (node = sipe_xml_child(xml, "categories/category"); node; node = sipe_xml_twin(node)) {
+	for (node = sipe_xml_path_child(xml, &path_categories_category); node; node = sipe_xml_twin(node)) {
 		const gchar *name = sipe_xml_attribute(node, "name");
 		category_names = sipe_utils_slist_insert_unique_sorted(category_names,
 								       (gchar *)name,
@@ -2126,7 +2142,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 	/* filling our categories reflected in roaming data */
 	devices = g_hash_table_new_full(g_str_hash, g_str_equal,
 					g_free, NULL);
-	for (node = sipe_xml_child(xml, "categories/category"); node; node = sipe_xml_twin(node)) {
+	for (node = sipe_xml_path_child(xml, &path_categories_category); node; node = sipe_xml_twin(node)) {
 		const char *tmp;
 		const gchar *name = sipe_xml_attribute(node, "name");
 		guint container = sipe_xml_int_attribute(node, "container", -1);
@@ -2164,7 +2180,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 
 		/* capture all userState publication for later clean up if required */
 		if (sipe_strequal(name, "state") && (container == 2 || container == 3)) {
-			const sipe_xml *xn_state = sipe_xml_child(node, "state");
+			const sipe_xml *xn_state = sipe_xml_path_child(node, &path_state);
 
 			if (xn_state && sipe_strequal(sipe_xml_attribute(xn_state, "type"), "userState")) {
 				struct sipe_publication *publication = g_new0(struct sipe_publication, 1);
@@ -2198,8 +2214,8 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 
 			/* filling publication->availability */
 			if (sipe_strequal(name, "state")) {
-				const sipe_xml *xn_state = sipe_xml_child(node, "state");
-				const sipe_xml *xn_avail = sipe_xml_child(xn_state, "availability");
+				const sipe_xml *xn_state = sipe_xml_path_child(node, &path_state);
+				const sipe_xml *xn_avail = sipe_xml_path_child(xn_state, &path_availability);
 
 				if (xn_avail) {
 					gchar *avail_str = sipe_xml_data(xn_avail);
@@ -2210,7 +2226,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 				}
 				/* for calendarState */
 				if (xn_state && sipe_strequal(sipe_xml_attribute(xn_state, "type"), "calendarState")) {
-					const sipe_xml *xn_activity = sipe_xml_child(xn_state, "activity");
+					const sipe_xml *xn_activity = sipe_xml_path_child(xn_state, &path_activity);
 					struct sipe_cal_event *event = g_new0(struct sipe_cal_event, 1);
 
 					event->start_time = sipe_utils_str_to_time(sipe_xml_attribute(xn_state, "startTime"));
@@ -2221,8 +2237,8 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 							event->is_meeting = TRUE;
 						}
 					}
-					event->subject = sipe_xml_data(sipe_xml_child(xn_state, "meetingSubject"));
-					event->location = sipe_xml_data(sipe_xml_child(xn_state, "meetingLocation"));
+					event->subject = sipe_xml_data(sipe_xml_path_child(xn_state, &path_meeting_subject));
+					event->location = sipe_xml_data(sipe_xml_path_child(xn_state, &path_meeting_location));
 
 					publication->cal_event_hash = sipe_cal_event_hash(event);
 					SIPE_DEBUG_INFO("sipe_ocs2007_process_roaming_self: hash=%s",
@@ -2232,7 +2248,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 			}
 			/* filling publication->note */
 			if (sipe_strequal(name, "note")) {
-				const sipe_xml *xn_body = sipe_xml_child(node, "note/body");
+				const sipe_xml *xn_body = sipe_xml_path_child(node, &path_note_body);
 
 				if (!has_note_cleaned) {
 					has_note_cleaned = TRUE;
@@ -2267,8 +2283,8 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 
 			/* filling publication->fb_start_str, free_busy_base64, working_hours_xml_str */
 			if (sipe_strequal(name, "calendarData") && (publication->container == 300)) {
-				const sipe_xml *xn_free_busy = sipe_xml_child(node, "calendarData/freeBusy");
-				const sipe_xml *xn_working_hours = sipe_xml_child(node, "calendarData/WorkingHours");
+				const sipe_xml *xn_free_busy = sipe_xml_path_child(node, &path_calendar_data_free_busy);
+				const sipe_xml *xn_working_hours = sipe_xml_path_child(node, &path_calendar_data_working_hours);
 				if (xn_free_busy) {
 					publication->fb_start_str = g_strdup(sipe_xml_attribute(xn_free_busy, "startTime"));
 					publication->free_busy_base64 = sipe_xml_data(xn_free_busy);
@@ -2292,11 +2308,11 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 
 		/* aggregateState (not an our publication) from 2-nd container */
 		if (sipe_strequal(name, "state") && container == 2) {
-			const sipe_xml *xn_state = sipe_xml_child(node, "state");
-			const sipe_xml *xn_activity = sipe_xml_child(xn_state, "activity");
+			const sipe_xml *xn_state = sipe_xml_path_child(node, &path_state);
+			const sipe_xml *xn_activity = sipe_xml_path_child(xn_state, &path_activity);
 
 			if (xn_state && sipe_strequal(sipe_xml_attribute(xn_state, "type"), "aggregateState")) {
-				const sipe_xml *xn_avail = sipe_xml_child(xn_state, "availability");
+				const sipe_xml *xn_avail = sipe_xml_path_child(xn_state, &path_availability);
 
 				if (xn_avail) {
 					gchar *avail_str = sipe_xml_data(xn_avail);
@@ -2319,7 +2335,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 		    sipe_strequal(name, "userProperties")) {
 			const sipe_xml *line;
 			/* line, for Remote Call Control (RCC) or external Lync/Communicator call */
-			for (line = sipe_xml_child(node, "userProperties/lines/line"); line; line = sipe_xml_twin(line)) {
+			for (line = sipe_xml_path_child(node, &path_user_properties_lines_line); line; line = sipe_xml_twin(line)) {
 				const gchar *line_type = sipe_xml_attribute(line, "lineType");
 				gchar *line_uri = sipe_xml_data(line);
 				if (!line_uri) {
@@ -2370,7 +2386,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 	g_hash_table_destroy(devices);
 
 	/* containers */
-	for (node = sipe_xml_child(xml, "containers/container"); node; node = sipe_xml_twin(node)) {
+	for (node = sipe_xml_path_child(xml, &path_containers_container); node; node = sipe_xml_twin(node)) {
 		guint id = sipe_xml_int_attribute(node, "id", 0);
 		struct sipe_container *container = sipe_find_container(sipe_private, id);
 
@@ -2385,7 +2401,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 		sipe_private->containers = g_slist_append(sipe_private->containers, container);
 		SIPE_DEBUG_INFO("sipe_ocs2007_process_roaming_self: added container id=%d v%d", container->id, container->version);
 
-		for (node2 = sipe_xml_child(node, "member"); node2; node2 = sipe_xml_twin(node2)) {
+		for (node2 = sipe_xml_path_child(node, &path_member); node2; node2 = sipe_xml_twin(node2)) {
 			struct sipe_container_member *member = g_new0(struct sipe_container_member, 1);
 			member->type = g_strdup(sipe_xml_attribute(node2, "type"));
 			member->value = g_strdup(sipe_xml_attribute(node2, "value"));
@@ -2397,7 +2413,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 
 	SIPE_DEBUG_INFO("sipe_ocs2007_process_roaming_self: access_level_set=%s",
 			SIPE_CORE_PRIVATE_FLAG_IS(ACCESS_LEVEL_SET) ? "TRUE" : "FALSE");
-	if (!SIPE_CORE_PRIVATE_FLAG_IS(ACCESS_LEVEL_SET) && sipe_xml_child(xml, "containers")) {
+	if (!SIPE_CORE_PRIVATE_FLAG_IS(ACCESS_LEVEL_SET) && sipe_xml_path_child(xml, &path_containers)) {
 		char *container_xmls = NULL;
 		int sameEnterpriseAL = sipe_ocs2007_find_access_level(sipe_private, "sameEnterprise", NULL, NULL);
 		int federatedAL      = sipe_ocs2007_find_access_level(sipe_private, "federated", NULL, NULL);
@@ -2427,7 +2443,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 	sipe_refresh_blocked_status(sipe_private);
 
 	/* subscribers */
-	for (node = sipe_xml_child(xml, "subscribers/subscriber"); node; node = sipe_xml_twin(node)) {
+	for (node = sipe_xml_path_child(xml, &path_subscribers_subscriber); node; node = sipe_xml_twin(node)) {
 		const char *user;
 		const char *acknowledged;
 		gchar *hdr;
@@ -2445,7 +2461,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 	        acknowledged= sipe_xml_attribute(node, "acknowledged");
 		if(sipe_strcase_equal(acknowledged,"false")){
                         SIPE_DEBUG_INFO("sipe_ocs2007_process_roaming_self: user added you %s", user);
-			if (!sipe_backend_buddy_find(SIPE_CORE_PUBLIC, uri, NULL)) {
+			if (!sipe_buddy_backend_find(sipe_private, uri, NULL)) {
 				sipe_backend_buddy_request_add(SIPE_CORE_PUBLIC, uri, display_name);
 			}
 
@@ -27,6 +27,21 @@
 #include "sipe-core-private.h"
 #include "sipe-schedule.h"
 
+/*
+ * Pending actions are kept in a binary min-heap ordered by deadline and in a
+ * hash table indexed by name. Only one backend timer is active at any time.
+ * It is armed for the earliest deadline.
+ */
+struct sipe_scheduler {
+	struct sipe_core_private *sipe_private;
+	GHashTable *names;     /* name -> struct sipe_schedule (not owned) */
+	GPtrArray *heap;       /* struct sipe_schedule, earliest deadline first */
+	GTimer *clock;         /* monotonic time base for deadlines */
+	gpointer backend_private;
+	guint64 armed;         /* deadline (ms) of the backend timer */
+	guint64 sequence;      /* keeps FIFO order for identical deadlines */
+};
+
 struct sipe_schedule {
 	/**
 	 * Name of action.
@@ -34,13 +49,129 @@ struct sipe_schedule {
 	 * Example:  <presence><sip:user@domain.com> or <registration>
 	 */
 	gchar *name;
-	struct sipe_core_private *sipe_private;
-	gpointer backend_private;
 	gpointer payload;
 	sipe_schedule_action action;
 	GDestroyNotify destroy;
+	guint64 deadline;      /* in milliseconds since scheduler creation */
+	guint64 sequence;
+	guint index;           /* position in heap */
+	gboolean seconds;      /* low resolution timeout requested */
 };
 
+#define HEAP_ENTRY(heap, i) ((struct sipe_schedule *) g_ptr_array_index(heap, i))
+
+static guint64 scheduler_now(struct sipe_scheduler *scheduler)
+{
+	return((guint64) (g_timer_elapsed(scheduler->clock, NULL) * 1000));
+}
+
+static gboolean schedule_before(const struct sipe_schedule *a,
+				const struct sipe_schedule *b)
+{
+	return((a->deadline < b->deadline) ||
+	       ((a->deadline == b->deadline) && (a->sequence < b->sequence)));
+}
+
+static void heap_set(GPtrArray *heap, guint index, struct sipe_schedule *schedule)
+{
+	g_ptr_array_index(heap, index) = schedule;
+	schedule->index = index;
+}
+
+static void heap_up(GPtrArray *heap, guint index)
+{
+	struct sipe_schedule *schedule = HEAP_ENTRY(heap, index);
+
+	while (index > 0) {
+		guint parent = (index - 1) / 2;
+		if (!schedule_before(schedule, HEAP_ENTRY(heap, parent)))
+			break;
+		heap_set(heap, index, HEAP_ENTRY(heap, parent));
+		index = parent;
+	}
+	heap_set(heap, index, schedule);
+}
+
+static void heap_down(GPtrArray *heap, guint index)
+{
+	struct sipe_schedule *schedule = HEAP_ENTRY(heap, index);
+	guint length = heap->len;
+
+	while (TRUE) {
+		guint child = 2 * index + 1;
+		if (child >= length)
+			break;
+		if ((child + 1 < length) &&
+		    schedule_before(HEAP_ENTRY(heap, child + 1),
+				    HEAP_ENTRY(heap, child)))
+			child++;
+		if (!schedule_before(HEAP_ENTRY(heap, child), schedule))
+			break;
+		heap_set(heap, index, HEAP_ENTRY(heap, child));
+		index = child;
+	}
+	heap_set(heap, index, schedule);
+}
+
+static void heap_remove(GPtrArray *heap, struct sipe_schedule *schedule)
+{
+	guint index = schedule->index;
+	struct sipe_schedule *last = g_ptr_array_remove_index(heap, heap->len - 1);
+
+	if (last != schedule) {
+		heap_set(heap, index, last);
+		if ((index > 0) &&
+		    schedule_before(last, HEAP_ENTRY(heap, (index - 1) / 2)))
+			heap_up(heap, index);
+		else
+			heap_down(heap, index);
+	}
+}
+
+static void scheduler_disarm(struct sipe_core_private *sipe_private)
+{
+	struct sipe_scheduler *scheduler = sipe_private->scheduler;
+
+	if (scheduler->backend_private) {
+		sipe_backend_schedule_cancel(SIPE_CORE_PUBLIC,
+					     scheduler->backend_private);
+		scheduler->backend_private = NULL;
+	}
+}
+
+/* make sure the backend timer expires at the earliest deadline */
+static void scheduler_arm(struct sipe_core_private *sipe_private)
+{
+	struct sipe_scheduler *scheduler = sipe_private->scheduler;
+	struct sipe_schedule *first;
+	guint64 now;
+	guint64 timeout;
+
+	if (scheduler->heap->len == 0) {
+		scheduler_disarm(sipe_private);
+		return;
+	}
+
+	first = HEAP_ENTRY(scheduler->heap, 0);
+	if (scheduler->backend_private && (scheduler->armed == first->deadline))
+		return;
+	scheduler_disarm(sipe_private);
+
+	now     = scheduler_now(scheduler);
+	timeout = (first->deadline > now) ? first->deadline - now : 0;
+	scheduler->armed = first->deadline;
+
+	/* preserve the low resolution of the backend timer when possible */
+	if (first->seconds && (timeout >= 1000))
+		scheduler->backend_private = sipe_backend_schedule_seconds(SIPE_CORE_PUBLIC,
+									   (timeout + 999) / 1000,
+									   scheduler);
+	else
+		scheduler->backend_private = sipe_backend_schedule_mseconds(SIPE_CORE_PUBLIC,
+									    timeout,
+									    scheduler);
+}
+
 static void sipe_schedule_deallocate(struct sipe_schedule *schedule)
 {
 	if (schedule->destroy) (*schedule->destroy)(schedule->payload);
@@ -50,39 +181,95 @@ static void sipe_schedule_deallocate(struct sipe_schedule *schedule)
 
 void sipe_core_schedule_execute(gpointer data)
 {
-	struct sipe_schedule *expired = data;
-	struct sipe_core_private *sipe_private = expired->sipe_private;
+	struct sipe_scheduler *scheduler = data;
+	struct sipe_core_private *sipe_private = scheduler->sipe_private;
+	struct sipe_schedule *expired;
+
+	/* backend timer has expired */
+	scheduler->backend_private = NULL;
+	if (scheduler->heap->len == 0)
+		return;
+	expired = HEAP_ENTRY(scheduler->heap, 0);
+
+	/* backend timer may expire early */
+	if (expired->deadline > scheduler_now(scheduler)) {
+		scheduler_arm(sipe_private);
+		return;
+	}
 
 	SIPE_DEBUG_INFO("sipe_core_schedule_execute: executing %s", expired->name);
-	sipe_private->timeouts = g_slist_remove(sipe_private->timeouts, expired);
+	heap_remove(scheduler->heap, expired);
+	g_hash_table_remove(scheduler->names, expired->name);
 	SIPE_DEBUG_INFO("sipe_core_schedule_execute timeouts count %d after removal",
-			g_slist_length(sipe_private->timeouts));
+			scheduler->heap->len);
+
+	/*
+	 * Re-arm before executing the action, because the action might
+	 * cancel all actions and "scheduler" is no longer valid afterwards.
+	 * Other expired actions will be executed by the next timer callback.
+	 */
+	scheduler_arm(sipe_private);
 
 	(*expired->action)(sipe_private, expired->payload);
 	sipe_schedule_deallocate(expired);
 }
 
-static struct sipe_schedule *sipe_schedule_allocate(struct sipe_core_private *sipe_private,
-						    const gchar *name,
-						    gpointer payload,
-						    sipe_schedule_action action,
-						    GDestroyNotify destroy)
+/* does not update the backend timer */
+static gboolean sipe_schedule_remove(struct sipe_scheduler *scheduler,
+				     const gchar *name)
 {
+	struct sipe_schedule *schedule = g_hash_table_lookup(scheduler->names,
+							     name);
+
+	if (!schedule)
+		return(FALSE);
+
+	SIPE_DEBUG_INFO("sipe_schedule_remove: action name=%s",
+			schedule->name);
+	g_hash_table_remove(scheduler->names, name);
+	heap_remove(scheduler->heap, schedule);
+	sipe_schedule_deallocate(schedule);
+	return(TRUE);
+}
+
+static void sipe_schedule_allocate(struct sipe_core_private *sipe_private,
+				   const gchar *name,
+				   gpointer payload,
+				   guint milliseconds,
+				   gboolean seconds,
+				   sipe_schedule_action action,
+				   GDestroyNotify destroy)
+{
+	struct sipe_scheduler *scheduler = sipe_private->scheduler;
 	struct sipe_schedule *new;
 
+	if (!scheduler) {
+		scheduler = sipe_private->scheduler = g_new0(struct sipe_scheduler, 1);
+		scheduler->sipe_private = sipe_private;
+		scheduler->names = g_hash_table_new(g_str_hash, g_str_equal);
+		scheduler->heap  = g_ptr_array_new();
+		scheduler->clock = g_timer_new();
+	}
+
 	/* Make sure each action only exists once */
-	sipe_schedule_cancel(sipe_private, name);
+	sipe_schedule_remove(scheduler, name);
 
 	new = g_new0(struct sipe_schedule, 1);
 	new->name = g_strdup(name);
-	new->sipe_private = sipe_private;
 	new->payload = payload;
 	new->action = action;
 	new->destroy = destroy;
-	sipe_private->timeouts = g_slist_append(sipe_private->timeouts, new);
+	new->deadline = scheduler_now(scheduler) + milliseconds;
+	new->sequence = scheduler->sequence++;
+	new->seconds = seconds;
+
+	g_hash_table_insert(scheduler->names, new->name, new);
+	g_ptr_array_add(scheduler->heap, new);
+	heap_up(scheduler->heap, scheduler->heap->len - 1);
 	SIPE_DEBUG_INFO("sipe_schedule_allocate timeouts count %d after addition",
-			g_slist_length(sipe_private->timeouts));
-	return(new);
+			scheduler->heap->len);
+
+	scheduler_arm(sipe_private);
 }
 
 void sipe_schedule_seconds(struct sipe_core_private *sipe_private,
@@ -92,16 +279,15 @@ void sipe_schedule_seconds(struct sipe_core_private *sipe_private,
 			   sipe_schedule_action action,
 			   GDestroyNotify destroy)
 {
-	struct sipe_schedule *new = sipe_schedule_allocate(sipe_private,
-							   name,
-							   payload,
-							   action,
-							   destroy);
 	SIPE_DEBUG_INFO("scheduling action %s timeout %d seconds",
 			name, seconds);
-	new->backend_private = sipe_backend_schedule_seconds(SIPE_CORE_PUBLIC,
-							     seconds,
-							     new);
+	sipe_schedule_allocate(sipe_private,
+			       name,
+			       payload,
+			       seconds * 1000,
+			       TRUE,
+			       action,
+			       destroy);
 }
 
 void sipe_schedule_mseconds(struct sipe_core_private *sipe_private,
@@ -111,61 +297,45 @@ void sipe_schedule_mseconds(struct sipe_core_private *sipe_private,
 			    sipe_schedule_action action,
 			    GDestroyNotify destroy)
 {
-	struct sipe_schedule *new = sipe_schedule_allocate(sipe_private,
-							   name,
-							   payload,
-							   action,
-							   destroy);
 	SIPE_DEBUG_INFO("scheduling action %s timeout %d milliseconds",
 			name, milliseconds);
-	new->backend_private = sipe_backend_schedule_mseconds(SIPE_CORE_PUBLIC,
-							      milliseconds,
-							      new);
-}
-
-static void sipe_schedule_remove(struct sipe_core_private *sipe_private,
-				 struct sipe_schedule *schedule)
-{
-	SIPE_DEBUG_INFO("sipe_schedule_remove: action name=%s",
-			schedule->name);
-	sipe_backend_schedule_cancel(SIPE_CORE_PUBLIC,
-				     schedule->backend_private);
-	sipe_schedule_deallocate(schedule);
+	sipe_schedule_allocate(sipe_private,
+			       name,
+			       payload,
+			       milliseconds,
+			       FALSE,
+			       action,
+			       destroy);
 }
 
 void sipe_schedule_cancel(struct sipe_core_private *sipe_private,
 			  const gchar *name)
 {
-	GSList *entry;
-
-	if (!sipe_private->timeouts || !name) return;
-
-	entry = sipe_private->timeouts;
-	while (entry) {
-		struct sipe_schedule *schedule = entry->data;
-		if (sipe_strequal(schedule->name, name)) {
-			GSList *to_delete = entry;
-			entry = entry->next;
-			sipe_private->timeouts = g_slist_delete_link(sipe_private->timeouts,
-								     to_delete);
-			sipe_schedule_remove(sipe_private, schedule);
-		} else {
-			entry = entry->next;
-		}
-	}
+	struct sipe_scheduler *scheduler = sipe_private->scheduler;
+
+	if (!scheduler || !name) return;
+
+	if (sipe_schedule_remove(scheduler, name))
+		scheduler_arm(sipe_private);
 }
 
 void sipe_schedule_cancel_all(struct sipe_core_private *sipe_private)
 {
-	GSList *entry = sipe_private->timeouts;
+	struct sipe_scheduler *scheduler = sipe_private->scheduler;
+	guint i;
 
-	while (entry) {
-		sipe_schedule_remove(sipe_private, entry->data);
-		entry = entry->next;
-	}
+	if (!scheduler) return;
+
+	scheduler_disarm(sipe_private);
+
+	for (i = 0; i < scheduler->heap->len; i++)
+		sipe_schedule_deallocate(HEAP_ENTRY(scheduler->heap, i));
 
-	g_slist_free(sipe_private->timeouts);
-	sipe_private->timeouts = NULL;
+	g_hash_table_destroy(scheduler->names);
+	g_ptr_array_free(scheduler->heap, TRUE);
+	g_timer_destroy(scheduler->clock);
+	g_free(scheduler);
+	sipe_private->scheduler = NULL;
 }
 
 /*
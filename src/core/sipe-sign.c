@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2011-2013 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2011-2018 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2008 Novell, Inc.
  *
  * This program is free software; you can redistribute it and/or modify
@@ -45,9 +45,9 @@ void sipmsg_breakdown_parse(struct sipmsg_breakdown * msg, gchar * realm, gchar
 		msg->p_assertet_identity_sip_uri = msg->p_assertet_identity_tel_uri = empty_string;
 	msg->call_id = msg->expires = empty_string;
 
-	if ((hdr = sipmsg_find_header(msg->msg, "Proxy-Authorization")) ||
-	    (hdr = sipmsg_find_header(msg->msg, "Proxy-Authentication-Info")) ||
-	    (hdr = sipmsg_find_header(msg->msg, "Authentication-Info")) ) {
+	if ((hdr = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_PROXY_AUTHORIZATION)) ||
+	    (hdr = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_PROXY_AUTHENTICATION_INFO)) ||
+	    (hdr = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_AUTHENTICATION_INFO)) ) {
 		msg->protocol = sipmsg_find_part_of_header(hdr, NULL, " ", empty_string);
 		msg->rand   = sipmsg_find_part_of_header(hdr, "rand=\"", "\"", empty_string);
 		msg->num    = sipmsg_find_part_of_header(hdr, "num=\"", "\"", empty_string);
@@ -59,28 +59,28 @@ void sipmsg_breakdown_parse(struct sipmsg_breakdown * msg, gchar * realm, gchar
 		msg->target_name = g_strdup(target);
 	}
 
-	msg->call_id = sipmsg_find_header(msg->msg, "Call-ID");
+	msg->call_id = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_CALL_ID);
 
-	hdr = sipmsg_find_header(msg->msg, "CSeq");
+	hdr = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_CSEQ);
 	if (NULL != hdr) {
 		msg->cseq = sipmsg_find_part_of_header(hdr, NULL, " ", empty_string);
 	}
 
-	hdr = sipmsg_find_header(msg->msg, "From");
+	hdr = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_FROM);
 	if (NULL != hdr) {
 		msg->from_url = sipmsg_find_part_of_header(hdr, "<", ">", empty_string);
 		msg->from_tag = sipmsg_find_part_of_header(hdr, ";tag=", ";", empty_string);
 	}
 
-	hdr = sipmsg_find_header(msg->msg, "To");
+	hdr = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_TO);
 	if (NULL != hdr) {
 		msg->to_url = sipmsg_find_part_of_header(hdr, "<", ">", empty_string);
 		msg->to_tag = sipmsg_find_part_of_header(hdr, ";tag=", ";", empty_string);
 	}
 
-	hdr = sipmsg_find_header(msg->msg, "P-Asserted-Identity");
+	hdr = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_P_ASSERTED_IDENTITY);
 	if (NULL == hdr) {
-		hdr = sipmsg_find_header(msg->msg, "P-Preferred-Identity");
+		hdr = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_P_PREFERRED_IDENTITY);
 	}
 	if (NULL != hdr) {
 		gchar *sip_uri = NULL;
@@ -93,7 +93,7 @@ void sipmsg_breakdown_parse(struct sipmsg_breakdown * msg, gchar * realm, gchar
 			msg->p_assertet_identity_tel_uri = tel_uri;
 	}
 
-	msg->expires = sipmsg_find_header(msg->msg, "Expires");
+	msg->expires = sipmsg_find_header_id(msg->msg, SIPMSG_HEADER_EXPIRES);
 }
 
 void
@@ -171,6 +171,178 @@ sipmsg_breakdown_get_string(int version,
 	return msg;
 }
 
+/* "<part>": same rules as sipmsg_find_part_of_header() */
+static void signature_append_part(GString *buffer,
+				  const gchar *hdr,
+				  const gchar *before,
+				  const gchar *after)
+{
+	g_string_append_c(buffer, '<');
+	if (hdr) {
+		const gchar *start = before ? strstr(hdr, before) : hdr;
+
+		if (start) {
+			const gchar *end;
+
+			if (before)
+				start += strlen(before);
+			end = after ? strstr(start, after) : NULL;
+
+			if (end)
+				g_string_append_len(buffer, start, end - start);
+			else
+				g_string_append(buffer, start);
+		}
+	}
+	g_string_append_c(buffer, '>');
+}
+
+static void signature_append(GString *buffer, const gchar *value)
+{
+	g_string_append_c(buffer, '<');
+	if (value)
+		g_string_append(buffer, value);
+	g_string_append_c(buffer, '>');
+}
+
+/* same rules as sipmsg_parse_p_asserted_identity() */
+static void signature_append_p_asserted_identity(GString *buffer,
+						 const gchar *hdr)
+{
+	const gchar *sip_uri = NULL;
+	const gchar *tel_uri = NULL;
+	gsize sip_length = 0;
+	gsize tel_length = 0;
+
+	if (!hdr) {
+		/* nothing to do */
+	} else if (g_ascii_strncasecmp(hdr, "tel:", 4) == 0) {
+		tel_uri    = hdr;
+		tel_length = strlen(hdr);
+	} else {
+		const gchar *part = hdr;
+
+		while (*part) {
+			const gchar *comma = strchr(part, ',');
+			const gchar *end   = comma ? comma : part + strlen(part);
+			const gchar *uri   = memchr(part, '<', end - part);
+
+			if (uri) {
+				const gchar *uri_end;
+				gsize length;
+
+				uri++;
+				uri_end = memchr(uri, '>', end - uri);
+				length  = (uri_end ? uri_end : end) - uri;
+
+				if ((length >= 4) &&
+				    (g_ascii_strncasecmp(uri, "sip:", 4) == 0)) {
+					if (!sip_uri) {
+						sip_uri    = uri;
+						sip_length = length;
+					}
+				} else if ((length >= 4) &&
+					   (g_ascii_strncasecmp(uri, "tel:", 4) == 0)) {
+					if (!tel_uri) {
+						tel_uri    = uri;
+						tel_length = length;
+					}
+				}
+			}
+
+			if (!comma)
+				break;
+			part = comma + 1;
+		}
+	}
+
+	g_string_append_c(buffer, '<');
+	if (sip_uri)
+		g_string_append_len(buffer, sip_uri, sip_length);
+	g_string_append(buffer, "><");
+	if (tel_uri)
+		g_string_append_len(buffer, tel_uri, tel_length);
+	g_string_append_c(buffer, '>');
+}
+
+const gchar *sipmsg_signature_input(GString *buffer,
+				    int version,
+				    const struct sipmsg *msg,
+				    const gchar *realm,
+				    const gchar *target,
+				    const gchar *protocol,
+				    const gchar *rand,
+				    const gchar *num)
+{
+	const gchar *auth;
+	const gchar *hdr;
+	gsize realm_start;
+	gboolean no_realm;
+
+	g_string_truncate(buffer, 0);
+
+	if ((auth = sipmsg_find_header_id(msg, SIPMSG_HEADER_PROXY_AUTHORIZATION)) ||
+	    (auth = sipmsg_find_header_id(msg, SIPMSG_HEADER_PROXY_AUTHENTICATION_INFO)) ||
+	    (auth = sipmsg_find_header_id(msg, SIPMSG_HEADER_AUTHENTICATION_INFO))) {
+		signature_append_part(buffer, auth, NULL, " ");
+		if (rand)
+			signature_append(buffer, rand);
+		else
+			signature_append_part(buffer, auth, "rand=\"", "\"");
+		if (num)
+			signature_append(buffer, num);
+		else
+			signature_append_part(buffer, auth, "num=\"", "\"");
+		realm_start = buffer->len;
+		signature_append_part(buffer, auth, "realm=\"", "\"");
+		no_realm = buffer->len == realm_start + 2; /* "<>" */
+		signature_append_part(buffer, auth, "targetname=\"", "\"");
+	} else {
+		signature_append(buffer, protocol);
+		signature_append(buffer, rand);
+		signature_append(buffer, num);
+		realm_start = buffer->len;
+		signature_append(buffer, realm);
+		no_realm = buffer->len == realm_start + 2; /* "<>" */
+		signature_append(buffer, target);
+	}
+
+	if (no_realm) {
+		SIPE_DEBUG_INFO_NOFORMAT("realm NULL, so returning NULL signature string");
+		return(NULL);
+	}
+
+	signature_append(buffer, sipmsg_find_header_id(msg, SIPMSG_HEADER_CALL_ID));
+
+	hdr = sipmsg_find_header_id(msg, SIPMSG_HEADER_CSEQ);
+	signature_append_part(buffer, hdr, NULL, " ");
+
+	signature_append(buffer, msg->method);
+
+	hdr = sipmsg_find_header_id(msg, SIPMSG_HEADER_FROM);
+	signature_append_part(buffer, hdr, "<", ">");
+	signature_append_part(buffer, hdr, ";tag=", ";");
+
+	hdr = sipmsg_find_header_id(msg, SIPMSG_HEADER_TO);
+	if (version >= 3)
+		signature_append_part(buffer, hdr, "<", ">");
+	signature_append_part(buffer, hdr, ";tag=", ";");
+
+	if (version >= 3) {
+		hdr = sipmsg_find_header_id(msg, SIPMSG_HEADER_P_ASSERTED_IDENTITY);
+		if (!hdr)
+			hdr = sipmsg_find_header_id(msg, SIPMSG_HEADER_P_PREFERRED_IDENTITY);
+		signature_append_p_asserted_identity(buffer, hdr);
+	}
+
+	signature_append(buffer, sipmsg_find_header_id(msg, SIPMSG_HEADER_EXPIRES));
+
+	if (msg->response != 0)
+		g_string_append_printf(buffer, "<%d>", msg->response);
+
+	return(buffer->str);
+}
+
 /*
   Local Variables:
   mode: c
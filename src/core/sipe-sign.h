@@ -49,3 +49,31 @@ gchar*
 sipmsg_breakdown_get_string(int version,
 			    struct sipmsg_breakdown * msgbd);
 void sipmsg_breakdown_free(struct sipmsg_breakdown * msg);
+
+/**
+ * Create signature input string for a message
+ *
+ * Same result as sipmsg_breakdown_parse() & sipmsg_breakdown_get_string(),
+ * but the parts are appended directly from the message headers to the
+ * buffer, i.e. no intermediate strings are allocated. The buffer should be
+ * reused for all messages of a connection.
+ *
+ * @param buffer   buffer for the signature input (contents are replaced)
+ * @param version  authentication protocol version
+ * @param msg      message
+ * @param realm    realm    (used when message has no authentication header)
+ * @param target   target   (used when message has no authentication header)
+ * @param protocol protocol (used when message has no authentication header)
+ * @param rand     rand value for outgoing message (may be @c NULL)
+ * @param num      num value for outgoing message  (may be @c NULL)
+ *
+ * @return signature input (@c buffer->str) or @c NULL if realm is unknown
+ */
+const gchar *sipmsg_signature_input(GString *buffer,
+				    int version,
+				    const struct sipmsg *msg,
+				    const gchar *realm,
+				    const gchar *target,
+				    const gchar *protocol,
+				    const gchar *rand,
+				    const gchar *num);
@@ -53,6 +53,21 @@ struct sip_subscription {
 	GSList *buddies; /* batched subscriptions */
 };
 
+/* transaction payload for presence subscriptions */
+struct presence_subscribe_data {
+	gchar *key;        /* subscription key */
+	GSList *resources; /* batch chunk: "<resource .../>" elements */
+	guint retries;     /* batch chunk: rejections so far */
+};
+
+static void presence_subscribe_data_free(gpointer data)
+{
+	struct presence_subscribe_data *psd = data;
+	g_free(psd->key);
+	sipe_utils_slist_free_full(psd->resources, g_free);
+	g_free(psd);
+}
+
 static void sipe_subscription_free(struct sip_subscription *subscription)
 {
 
@@ -108,8 +123,10 @@ void sipe_subscriptions_unsubscribe(struct sipe_core_private *sipe_private)
 
 }
 
+static void presence_batch_free(struct sipe_core_private *sipe_private);
 void sipe_subscriptions_destroy(struct sipe_core_private *sipe_private)
 {
+	presence_batch_free(sipe_private);
 	g_hash_table_destroy(sipe_private->subscriptions);
 }
 
@@ -152,7 +169,8 @@ static struct sip_dialog *sipe_subscribe_dialog(struct sipe_core_private *sipe_p
 
 static void sipe_subscription_expiration(struct sipe_core_private *sipe_private,
 					 struct sipmsg *msg,
-					 const gchar *event);
+					 const gchar *event,
+					 const gchar *key);
 static gboolean process_subscribe_response(struct sipe_core_private *sipe_private,
 					   struct sipmsg *msg,
 					   struct transaction *trans)
@@ -169,7 +187,11 @@ static gboolean process_subscribe_response(struct sipe_core_private *sipe_privat
 		gchar *with = parse_from(sipmsg_find_header(msg, "To"));
 		const gchar *subscription_state = sipmsg_find_header(msg, "subscription-state");
 		gboolean terminated = subscription_state && strstr(subscription_state, "terminated");
-		gchar *key = sipe_subscription_key(event, with);
+		struct presence_subscribe_data *psd = trans->payload ? trans->payload->data : NULL;
+		/* presence subscriptions can be sent with an explicit key */
+		gchar *key = psd ?
+			g_strdup(psd->key) :
+			sipe_subscription_key(event, with);
 
 		/*
 		 * @TODO: does the server send this only for one-off
@@ -224,9 +246,8 @@ static gboolean process_subscribe_response(struct sipe_core_private *sipe_privat
 						key);
 
 				g_hash_table_insert(sipe_private->subscriptions,
-						    key,
+						    g_strdup(key),
 						    subscription);
-				key = NULL; /* table takes ownership of key */
 
 				subscription->dialog.callid = g_strdup(sipmsg_find_header(msg, "Call-ID"));
 				subscription->dialog.cseq   = sipmsg_parse_cseq(msg);
@@ -238,7 +259,10 @@ static gboolean process_subscribe_response(struct sipe_core_private *sipe_privat
 
 			sipe_dialog_parse(dialog, msg, TRUE);
 
-			sipe_subscription_expiration(sipe_private, msg, event);
+			sipe_subscription_expiration(sipe_private,
+						     msg,
+						     event,
+						     key);
 		}
 		g_free(key);
 		g_free(with);
@@ -461,6 +485,7 @@ static void sipe_subscribe_presence_batched_schedule(struct sipe_core_private *s
 static void sipe_process_presence_timeout(struct sipe_core_private *sipe_private,
 					  struct sipmsg *msg,
 					  const gchar *who,
+					  const gchar *key,
 					  int timeout)
 {
 	const char *ctype = sipmsg_find_header(msg, "Content-Type");
@@ -476,9 +501,10 @@ static void sipe_process_presence_timeout(struct sipe_core_private *sipe_private
 
 		sipe_mime_parts_foreach(ctype, msg->body, sipe_presence_timeout_mime_cb, &buddies);
 
+		/* batched subscription is identified by its key */
 		if (buddies)
 			sipe_subscribe_presence_batched_schedule(sipe_private,
-								 action_name,
+								 key,
 								 who,
 								 buddies,
 								 timeout);
@@ -514,21 +540,35 @@ void sipe_subscribe_conference(struct sipe_core_private *sipe_private,
 /**
  * code for presence subscription
  */
-static void sipe_subscribe_presence_buddy(struct sipe_core_private *sipe_private,
-					  const gchar *uri,
-					  const gchar *request,
-					  const gchar *body)
+static struct transaction *sipe_subscribe_presence_buddy(struct sipe_core_private *sipe_private,
+							 const gchar *uri,
+							 const gchar *key,
+							 const gchar *request,
+							 const gchar *body,
+							 TransCallback callback)
 {
-	gchar *key = sipe_utils_presence_key(uri);
-
-	sip_transport_subscribe(sipe_private,
-				uri,
-				request,
-				body,
-				sipe_subscribe_dialog(sipe_private, key),
-				process_subscribe_response);
+	gchar *default_key = key ? NULL : sipe_utils_presence_key(uri);
+	struct transaction *trans = sip_transport_subscribe(sipe_private,
+							    uri,
+							    request,
+							    body,
+							    sipe_subscribe_dialog(sipe_private,
+										  key ? key : default_key),
+							    callback);
+
+	/* explicit key is required to find the subscription dialog */
+	if (trans && key) {
+		struct transaction_payload *payload = g_new0(struct transaction_payload, 1);
+		struct presence_subscribe_data *psd = g_new0(struct presence_subscribe_data, 1);
+
+		psd->key         = g_strdup(key);
+		payload->destroy = presence_subscribe_data_free;
+		payload->data    = psd;
+		trans->payload   = payload;
+	}
 
-	g_free(key);
+	g_free(default_key);
+	return(trans);
 }
 
 /**
@@ -598,7 +638,12 @@ void sipe_subscribe_presence_single(struct sipe_core_private *sipe_private,
 				  contact);
 	g_free(contact);
 
-	sipe_subscribe_presence_buddy(sipe_private, to, request, content);
+	sipe_subscribe_presence_buddy(sipe_private,
+				      to,
+				      NULL,
+				      request,
+				      content,
+				      process_subscribe_response);
 
 	g_free(content);
 	g_free(self);
@@ -619,10 +664,13 @@ void sipe_subscribe_presence_single_cb(struct sipe_core_private *sipe_private,
  *   A batch category SUBSCRIBE request MUST have the same To-URI and From-URI.
  *   This header will be send only if adhoclist there is a "Supported: adhoclist" in REGISTER answer else will be send a Single Category SUBSCRIBE
  */
-static void sipe_subscribe_presence_batched_to(struct sipe_core_private *sipe_private,
-					       gchar *resources_uri,
-					       const gchar *to)
+static struct transaction *sipe_subscribe_presence_batched_to(struct sipe_core_private *sipe_private,
+							      const gchar *resources_uri,
+							      const gchar *to,
+							      const gchar *key,
+							      TransCallback callback)
 {
+	struct transaction *trans;
 	gchar *contact = get_contact(sipe_private);
 	gchar *request;
 	gchar *content;
@@ -658,7 +706,6 @@ static void sipe_subscribe_presence_batched_to(struct sipe_core_private *sipe_pr
 					  sipe_private->username,
 					  resources_uri);
 	}
-	g_free(resources_uri);
 
 	request = g_strdup_printf("Require: adhoclist%s\r\n"
 				  "Supported: eventlist\r\n"
@@ -676,14 +723,22 @@ static void sipe_subscribe_presence_batched_to(struct sipe_core_private *sipe_pr
 				  contact);
 	g_free(contact);
 
-	sipe_subscribe_presence_buddy(sipe_private, to, request, content);
+	trans = sipe_subscribe_presence_buddy(sipe_private,
+					      to,
+					      key,
+					      request,
+					      content,
+					      callback);
 
 	g_free(content);
 	g_free(request);
+
+	return(trans);
 }
 
 struct presence_batched_routed {
 	gchar  *host;
+	gchar  *key;           /* NULL: default presence key for host */
 	const GSList *buddies; /* points to subscription->buddies */
 };
 
@@ -691,6 +746,7 @@ static void sipe_subscribe_presence_batched_routed_free(gpointer payload)
 {
 	struct presence_batched_routed *data = payload;
 	g_free(data->host);
+	g_free(data->key);
 	g_free(payload);
 }
 
@@ -699,16 +755,20 @@ static void sipe_subscribe_presence_batched_routed(struct sipe_core_private *sip
 {
 	struct presence_batched_routed *data = payload;
 	const GSList *buddies = data->buddies;
-	gchar *resources_uri = g_strdup("");
+	GString *resources_uri = g_string_new("");
+
 	while (buddies) {
-		gchar *tmp = resources_uri;
-		resources_uri = g_strdup_printf("%s<resource uri=\"%s\"/>\n", tmp, (char *) buddies->data);
-		g_free(tmp);
+		g_string_append_printf(resources_uri,
+				       "<resource uri=\"%s\"/>\n",
+				       (const gchar *) buddies->data);
 		buddies = buddies->next;
 	}
 	sipe_subscribe_presence_batched_to(sipe_private,
-					   resources_uri,
-					   data->host);
+					   resources_uri->str,
+					   data->host,
+					   data->key,
+					   process_subscribe_response);
+	g_string_free(resources_uri, TRUE);
 }
 
 static void sipe_subscribe_presence_batched_schedule(struct sipe_core_private *sipe_private,
@@ -738,6 +798,7 @@ static void sipe_subscribe_presence_batched_schedule(struct sipe_core_private *s
 	}
 
 	payload->host    = g_strdup(who);
+	payload->key     = g_strdup(action_name);
 	payload->buddies = subscription->buddies;
 	sipe_schedule_seconds(sipe_private,
 			      action_name,
@@ -750,27 +811,25 @@ static void sipe_subscribe_presence_batched_schedule(struct sipe_core_private *s
 
 static void sipe_subscribe_resource_uri_with_context(const gchar *name,
 						     gpointer value,
-						     gchar **resources_uri)
+						     GQueue *resources)
 {
 	struct sipe_buddy *sbuddy = (struct sipe_buddy *)value;
 	gchar *context = sbuddy && sbuddy->just_added ? "><context/></resource>" : "/>";
-	gchar *tmp = *resources_uri;
 
 	/* should be enough to include context one time */
 	if (sbuddy)
 		sbuddy->just_added = FALSE;
 
-	*resources_uri = g_strdup_printf("%s<resource uri=\"%s\"%s\n", tmp, name, context);
-	g_free(tmp);
+	g_queue_push_tail(resources,
+			  g_strdup_printf("<resource uri=\"%s\"%s\n", name, context));
 }
 
 static void sipe_subscribe_resource_uri(const char *name,
 					SIPE_UNUSED_PARAMETER gpointer value,
-					gchar **resources_uri)
+					GQueue *resources)
 {
-	gchar *tmp = *resources_uri;
-        *resources_uri = g_strdup_printf("%s<resource uri=\"%s\"/>\n", tmp, name);
-	g_free(tmp);
+	g_queue_push_tail(resources,
+			  g_strdup_printf("<resource uri=\"%s\"/>\n", name));
 }
 
 /**
@@ -800,6 +859,265 @@ static void schedule_buddy_resubscription_cb(char *buddy_name,
 	}
 }
 
+/*
+ * Initial batched presence subscription
+ *
+ * The resource list is split into chunks. Each chunk is sent as a separate
+ * batched SUBSCRIBE, i.e. it creates its own subscription dialog. New
+ * chunks are only sent while less than PRESENCE_BATCH_PIPELINE chunks are
+ * outstanding, i.e. in flight or waiting for a retry.
+ *
+ * Rejected chunks are retried up to PRESENCE_BATCH_RETRIES_MAX times each.
+ * If the request was too large (413) the chunk size is halved and the chunk
+ * is re-sent immediately in smaller pieces. If the server is overloaded
+ * (503) the chunk is re-sent after the Retry-After period or an exponential
+ * back-off based on its own number of retries.
+ */
+#define PRESENCE_BATCH_SIZE_DEFAULT 200
+#define PRESENCE_BATCH_SIZE_MIN      10
+#define PRESENCE_BATCH_PIPELINE       4
+#define PRESENCE_BATCH_BACKOFF_MIN    2 /* seconds */
+#define PRESENCE_BATCH_BACKOFF_MAX   64 /* seconds */
+#define PRESENCE_BATCH_RETRIES_MAX    8
+#define PRESENCE_BATCH_ACTION_NAME  "<+presence-batch>"
+
+struct sipe_presence_batch {
+	GQueue *resources; /* "<resource .../>" elements to send */
+	GSList *waiting;   /* action names of chunks waiting for back-off */
+	gchar *to;
+	guint in_flight;   /* outstanding chunks */
+	guint chunks;      /* chunks sent, used for subscription keys */
+};
+
+static void presence_batch_free(struct sipe_core_private *sipe_private)
+{
+	struct sipe_presence_batch *batch = sipe_private->presence_batch;
+
+	if (batch) {
+		GSList *entry;
+		gchar *resource;
+
+		for (entry = batch->waiting; entry; entry = entry->next)
+			sipe_schedule_cancel(sipe_private, entry->data);
+		sipe_utils_slist_free_full(batch->waiting, g_free);
+		while ((resource = g_queue_pop_head(batch->resources)) != NULL)
+			g_free(resource);
+		g_queue_free(batch->resources);
+		g_free(batch->to);
+		g_free(batch);
+		sipe_private->presence_batch = NULL;
+	}
+}
+
+static gboolean process_presence_batch_response(struct sipe_core_private *sipe_private,
+						struct sipmsg *msg,
+						struct transaction *trans);
+
+/* takes ownership of chunk */
+static void presence_batch_send_chunk(struct sipe_core_private *sipe_private,
+				      GSList *chunk,
+				      guint retries)
+{
+	struct sipe_presence_batch *batch = sipe_private->presence_batch;
+	GString *resources_uri = g_string_new("");
+	struct transaction *trans;
+	GSList *entry;
+	gchar *key;
+
+	for (entry = chunk; entry; entry = entry->next)
+		g_string_append(resources_uri, entry->data);
+
+	/* first chunk uses the standard key for the self URI */
+	key = batch->chunks ?
+		g_strdup_printf("<presence><%s><%u>", batch->to, batch->chunks) :
+		sipe_utils_presence_key(batch->to);
+	batch->chunks++;
+
+	SIPE_DEBUG_INFO("presence_batch_send_chunk: %s with %u resources (retry %u, %u pending)",
+			key, g_slist_length(chunk), retries,
+			g_queue_get_length(batch->resources));
+
+	trans = sipe_subscribe_presence_batched_to(sipe_private,
+						   resources_uri->str,
+						   batch->to,
+						   key,
+						   process_presence_batch_response);
+	g_string_free(resources_uri, TRUE);
+	g_free(key);
+
+	if (trans) {
+		struct presence_subscribe_data *psd = trans->payload->data;
+		psd->resources = chunk;
+		psd->retries   = retries;
+		batch->in_flight++;
+	} else {
+		sipe_utils_slist_free_full(chunk, g_free);
+	}
+}
+
+static void presence_batch_send(struct sipe_core_private *sipe_private)
+{
+	struct sipe_presence_batch *batch = sipe_private->presence_batch;
+
+	if (!batch)
+		return;
+
+	while ((batch->in_flight < PRESENCE_BATCH_PIPELINE) &&
+	       !g_queue_is_empty(batch->resources)) {
+		GSList *chunk = NULL;
+		guint count = 0;
+
+		while ((count < sipe_private->presence_batch_size) &&
+		       !g_queue_is_empty(batch->resources)) {
+			chunk = g_slist_prepend(chunk,
+						g_queue_pop_head(batch->resources));
+			count++;
+		}
+
+		presence_batch_send_chunk(sipe_private,
+					  g_slist_reverse(chunk),
+					  0);
+	}
+
+	if (!batch->in_flight &&
+	    g_queue_is_empty(batch->resources)) {
+		SIPE_DEBUG_INFO("presence_batch_send: completed with %u chunks",
+				batch->chunks);
+		presence_batch_free(sipe_private);
+	}
+}
+
+/* back-off for chunk has expired */
+static void presence_batch_retry(struct sipe_core_private *sipe_private,
+				 gpointer data)
+{
+	struct sipe_presence_batch *batch = sipe_private->presence_batch;
+	struct presence_subscribe_data *psd = data;
+	GSList *entry;
+
+	/* chunk of a previous batch? */
+	entry = batch ?
+		g_slist_find_custom(batch->waiting, psd->key, (GCompareFunc) strcmp) :
+		NULL;
+	if (!entry)
+		return;
+	g_free(entry->data);
+	batch->waiting = g_slist_delete_link(batch->waiting, entry);
+	batch->in_flight--;
+
+	presence_batch_send_chunk(sipe_private, psd->resources, psd->retries);
+	psd->resources = NULL;
+	presence_batch_send(sipe_private);
+}
+
+static gboolean process_presence_batch_response(struct sipe_core_private *sipe_private,
+						struct sipmsg *msg,
+						struct transaction *trans)
+{
+	struct sipe_presence_batch *batch = sipe_private->presence_batch;
+	struct presence_subscribe_data *psd = trans->payload->data;
+
+	if (!batch)
+		return(process_subscribe_response(sipe_private, msg, trans));
+	batch->in_flight--;
+
+	/* 413 Request Entity Too Large, 503 Service Unavailable */
+	if (((msg->response == 413) || (msg->response == 503)) &&
+	    psd->resources &&
+	    (psd->retries < PRESENCE_BATCH_RETRIES_MAX)) {
+		GSList *chunk  = psd->resources;
+		guint retries  = psd->retries + 1;
+
+		psd->resources = NULL;
+
+		if (msg->response == 413) {
+			guint size = MAX(sipe_private->presence_batch_size / 2,
+					 PRESENCE_BATCH_SIZE_MIN);
+
+			sipe_private->presence_batch_size = size;
+			SIPE_DEBUG_INFO("process_presence_batch_response: request too large, reducing chunk size to %u",
+					size);
+
+			/* re-send rejected resources in pieces of the new size */
+			while (chunk) {
+				GSList *last = g_slist_nth(chunk, size - 1);
+				GSList *rest = last ? last->next : NULL;
+
+				if (last)
+					last->next = NULL;
+				presence_batch_send_chunk(sipe_private,
+							  chunk,
+							  retries);
+				chunk = rest;
+			}
+
+		} else {
+			struct presence_subscribe_data *waiting = g_new0(struct presence_subscribe_data, 1);
+			const gchar *retry_after = sipmsg_find_header(msg, "Retry-After");
+			guint delay = retry_after ? strtoul(retry_after, NULL, 10) : 0;
+
+			if (!delay)
+				delay = MIN(PRESENCE_BATCH_BACKOFF_MIN << MIN(retries - 1, 5),
+					    PRESENCE_BATCH_BACKOFF_MAX);
+
+			/* action name is unique: derived from subscription key */
+			waiting->key       = g_strdup_printf(PRESENCE_BATCH_ACTION_NAME "%s",
+							     psd->key);
+			waiting->resources = chunk;
+			waiting->retries   = retries;
+			batch->waiting     = g_slist_prepend(batch->waiting,
+							     g_strdup(waiting->key));
+			batch->in_flight++;
+
+			SIPE_DEBUG_INFO("process_presence_batch_response: server overloaded, retrying %s in %u seconds",
+					psd->key, delay);
+			sipe_schedule_seconds(sipe_private,
+					      waiting->key,
+					      waiting,
+					      delay,
+					      presence_batch_retry,
+					      presence_subscribe_data_free);
+		}
+
+	} else {
+		if ((msg->response != 200) && psd->resources) {
+			SIPE_DEBUG_ERROR("process_presence_batch_response: dropping chunk with %u resources after response %d (%u retries)",
+					 g_slist_length(psd->resources),
+					 msg->response,
+					 psd->retries);
+		}
+
+		process_subscribe_response(sipe_private, msg, trans);
+	}
+
+	presence_batch_send(sipe_private);
+	return(TRUE);
+}
+
+static void presence_batch_start(struct sipe_core_private *sipe_private)
+{
+	struct sipe_presence_batch *batch = g_new0(struct sipe_presence_batch, 1);
+
+	presence_batch_free(sipe_private);
+	sipe_private->presence_batch = batch;
+	if (!sipe_private->presence_batch_size)
+		sipe_private->presence_batch_size = PRESENCE_BATCH_SIZE_DEFAULT;
+
+	batch->resources = g_queue_new();
+	batch->to        = sip_uri_self(sipe_private);
+	if (SIPE_CORE_PRIVATE_FLAG_IS(OCS2007)) {
+		sipe_buddy_foreach(sipe_private,
+				   (GHFunc) sipe_subscribe_resource_uri_with_context,
+				   batch->resources);
+	} else {
+		sipe_buddy_foreach(sipe_private,
+				   (GHFunc) sipe_subscribe_resource_uri,
+				   batch->resources);
+	}
+
+	presence_batch_send(sipe_private);
+}
+
 void sipe_subscribe_presence_initial(struct sipe_core_private *sipe_private)
 {
 	/*
@@ -811,20 +1129,7 @@ void sipe_subscribe_presence_initial(struct sipe_core_private *sipe_private)
 		/* Only try to subscribe if we have any buddies */
 		if (sipe_buddy_count(sipe_private) > 0) {
 			if (SIPE_CORE_PRIVATE_FLAG_IS(BATCHED_SUPPORT)) {
-				gchar *to = sip_uri_self(sipe_private);
-				gchar *resources_uri = g_strdup("");
-				if (SIPE_CORE_PRIVATE_FLAG_IS(OCS2007)) {
-					sipe_buddy_foreach(sipe_private,
-							   (GHFunc) sipe_subscribe_resource_uri_with_context,
-							   &resources_uri);
-				} else {
-					sipe_buddy_foreach(sipe_private,
-							   (GHFunc) sipe_subscribe_resource_uri,
-							   &resources_uri);
-				}
-				sipe_subscribe_presence_batched_to(sipe_private, resources_uri, to);
-				g_free(to);
-
+				presence_batch_start(sipe_private);
 			} else {
 				sipe_buddy_foreach(sipe_private,
 						   (GHFunc) schedule_buddy_resubscription_cb,
@@ -843,6 +1148,7 @@ void sipe_subscribe_poolfqdn_resource_uri(const char *host,
 	struct presence_batched_routed *payload = g_malloc(sizeof(struct presence_batched_routed));
 	SIPE_DEBUG_INFO("process_incoming_notify_rlmi_resub: pool(%s)", host);
 	payload->host    = g_strdup(host);
+	payload->key     = NULL;
 	payload->buddies = server;
 	sipe_subscribe_presence_batched_routed(sipe_private,
 					       payload);
@@ -901,7 +1207,8 @@ static const struct event_subscription_data events_table[] =
 
 static void sipe_subscription_expiration(struct sipe_core_private *sipe_private,
 					 struct sipmsg *msg,
-					 const gchar *event)
+					 const gchar *event,
+					 const gchar *key)
 {
 	const gchar *expires_header = sipmsg_find_header(msg, "Expires");
 	guint timeout = expires_header ? strtol(expires_header, NULL, 10) : 0;
@@ -914,7 +1221,7 @@ static void sipe_subscription_expiration(struct sipe_core_private *sipe_private,
 			gchar *who = parse_from(sipmsg_find_header(msg, "To"));
 
 			if (SIPE_CORE_PRIVATE_FLAG_IS(BATCHED_SUPPORT)) {
-				sipe_process_presence_timeout(sipe_private, msg, who, timeout);
+				sipe_process_presence_timeout(sipe_private, msg, who, key, timeout);
 			} else {
 				gchar *action_name = sipe_utils_presence_key(who);
 				sipe_schedule_seconds(sipe_private,
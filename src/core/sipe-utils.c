@@ -529,14 +529,6 @@ gchar *sipe_utils_str_replace(const gchar *string,
 	return result;
 }
 
-void sipe_utils_shrink_buffer(struct sipe_transport_connection *conn,
-			      const gchar *unread)
-{
-	conn->buffer_used -= unread - conn->buffer;
-	/* string terminator is not included in buffer_used */
-	memmove(conn->buffer, unread, conn->buffer_used + 1);
-}
-
 gboolean sipe_utils_ip_is_private(const char *ip)
 {
 	return /* IPv4 */
@@ -557,6 +549,38 @@ gchar *sipe_utils_presence_key(const gchar *uri)
 	return g_strdup_printf("<presence><%s>", uri);
 }
 
+gchar *sipe_utils_uri_key(const gchar *uri, gchar *buffer, gsize size)
+{
+	const gchar *p;
+	gchar *key;
+	gsize length;
+	gsize i;
+
+	for (p = uri; *p; p++)
+		if (*p & 0x80)
+			break;
+
+	if (*p) {
+		if (g_utf8_validate(uri, -1, NULL)) {
+			gchar *folded = g_utf8_casefold(uri, -1);
+			key = g_utf8_normalize(folded, -1, G_NORMALIZE_DEFAULT);
+			g_free(folded);
+			return(key);
+		}
+		/* invalid UTF-8: ASCII lower case only */
+		length = (p - uri) + strlen(p);
+	} else {
+		length = p - uri;
+	}
+
+	key = (buffer && (length < size)) ? buffer : g_malloc(length + 1);
+	for (i = 0; i < length; i++)
+		key[i] = g_ascii_tolower(uri[i]);
+	key[length] = '\0';
+
+	return(key);
+}
+
 gchar *
 sipe_utils_uri_unescape(const gchar *string)
 {
@@ -414,14 +414,6 @@ gchar *sipe_utils_str_replace(const gchar *string,
 			      const gchar *delimiter,
 			      const gchar *replacement);
 
-/**
- * Remove read characters from transport buffer
- *
- * @param conn   the transport connection
- * @param unread pointer to the first character in the buffer
- */
-void sipe_utils_shrink_buffer(struct sipe_transport_connection *conn,
-			      const gchar *unread);
 /**
  * Checks whether given IP address belongs to private block as defined in RFC1918
  *
@@ -448,6 +440,20 @@ const gchar *sipe_utils_ip_sdp_address_marker(const gchar *ip);
  */
 gchar *sipe_utils_presence_key(const gchar *uri);
 
+/**
+ * Normalizes a URI for case-insensitive hashing and comparison.
+ *
+ * ASCII URIs are converted to lower case. URIs with non-ASCII characters
+ * are Unicode case folded and normalized.
+ *
+ * @param uri    URI
+ * @param buffer buffer for the result (may be @c NULL)
+ * @param size   size of the buffer
+ *
+ * @return key string. Must be g_free()'d after use if not equal to @c buffer.
+ */
+gchar *sipe_utils_uri_key(const gchar *uri, gchar *buffer, gsize size);
+
 /**
  * Decodes a URI into a plain string.
  *
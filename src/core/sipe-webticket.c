@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2011-2016 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2011-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  *
  * This program is free software; you can redistribute it and/or modify
@@ -35,6 +35,7 @@
 
 #include "sipe-common.h"
 #include "sipe-backend.h"
+#include "sipe-cache.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
 #include "sipe-digest.h"
@@ -44,6 +45,12 @@
 #include "sipe-utils.h"
 #include "sipe-xml.h"
 
+/* keys for persistent cache */
+#define WEBTICKET_CACHE_PREFIX         "webticket:"
+#define WEBTICKET_CACHE_ADFS_URI       "webticket-adfs-uri"
+#define WEBTICKET_CACHE_ADFS_TOKEN     "webticket-adfs-token"
+#define WEBTICKET_CACHE_ADFS_TIMEOUT   (7 * 24 * 60 * 60) /* 7 days */
+
 struct webticket_queued_data {
 	sipe_webticket_callback *callback;
 	gpointer callback_data;
@@ -139,11 +146,11 @@ static void sipe_webticket_init(struct sipe_core_private *sipe_private)
 }
 
 /* takes ownership of "token" */
-static void cache_token(struct sipe_core_private *sipe_private,
-			const gchar *service_uri,
-			const gchar *auth_uri,
-			gchar *token,
-			time_t expires)
+static struct webticket_token *cache_insert(struct sipe_core_private *sipe_private,
+					    const gchar *service_uri,
+					    const gchar *auth_uri,
+					    gchar *token,
+					    time_t expires)
 {
 	struct webticket_token *wt = g_new0(struct webticket_token, 1);
 	wt->auth_uri = g_strdup(auth_uri);
@@ -152,6 +159,26 @@ static void cache_token(struct sipe_core_private *sipe_private,
 	g_hash_table_insert(sipe_private->webticket->cache,
 			    g_strdup(service_uri),
 			    wt);
+	return(wt);
+}
+
+/* takes ownership of "token" */
+static void cache_token(struct sipe_core_private *sipe_private,
+			const gchar *service_uri,
+			const gchar *auth_uri,
+			gchar *token,
+			time_t expires)
+{
+	/* persistent cache entry: "<Auth URI>\n<token>" */
+	if (auth_uri && expires) {
+		gchar *key   = g_strconcat(WEBTICKET_CACHE_PREFIX, service_uri, NULL);
+		gchar *value = g_strconcat(auth_uri, "\n", token, NULL);
+		sipe_cache_store(sipe_private, key, value, expires, TRUE);
+		g_free(value);
+		g_free(key);
+	}
+
+	cache_insert(sipe_private, service_uri, auth_uri, token, expires);
 }
 
 static const struct webticket_token *cache_hit(struct sipe_core_private *sipe_private,
@@ -168,9 +195,46 @@ static const struct webticket_token *cache_hit(struct sipe_core_private *sipe_pr
 		wt = NULL;
 	}
 
+	/* Web Ticket from previous session? */
+	if (!wt) {
+		gchar *key = g_strconcat(WEBTICKET_CACHE_PREFIX, service_uri, NULL);
+		time_t expires;
+		const gchar *value = sipe_cache_lookup(sipe_private, key, &expires);
+		const gchar *token = value ? strchr(value, '\n') : NULL;
+
+		if (token && (expires >= time(NULL) + 60)) {
+			gchar *auth_uri = g_strndup(value, token - value);
+
+			SIPE_DEBUG_INFO("cache_hit: using token for URI %s from persistent cache",
+					service_uri);
+			wt = cache_insert(sipe_private,
+					  service_uri,
+					  auth_uri,
+					  g_strdup(token + 1),
+					  expires);
+			g_free(auth_uri);
+		}
+		g_free(key);
+	}
+
 	return(wt);
 }
 
+void sipe_webticket_invalidate(struct sipe_core_private *sipe_private,
+			       const gchar *base_uri)
+{
+	struct sipe_webticket *webticket = sipe_private->webticket;
+	gchar *key = g_strconcat(WEBTICKET_CACHE_PREFIX, base_uri, NULL);
+
+	SIPE_DEBUG_INFO("sipe_webticket_invalidate: dropping token for URI %s",
+			base_uri);
+
+	if (webticket)
+		g_hash_table_remove(webticket->cache, base_uri);
+	sipe_cache_invalidate(sipe_private, key);
+	g_free(key);
+}
+
 /* frees just the main request data, when this is called "queued" is cleared */
 static void callback_data_free(struct webticket_callback_data *wcd)
 {
@@ -291,9 +355,10 @@ static gchar *generate_fedbearer_wsse(const gchar *raw)
 	return(wsse_security);
 }
 
-static void generate_federation_wsse(struct sipe_webticket *webticket,
+static void generate_federation_wsse(struct sipe_core_private *sipe_private,
 				     const gchar *raw)
 {
+	struct sipe_webticket *webticket = sipe_private->webticket;
 	gchar *timestamp = generate_timestamp(raw);
 	gchar *keydata   = generate_keydata(raw);
 
@@ -315,6 +380,13 @@ static void generate_federation_wsse(struct sipe_webticket *webticket,
 								    NULL);
 			webticket->adfs_token_expires = sipe_utils_str_to_time(expires_string);
 			g_free(expires_string);
+
+			if (webticket->adfs_token_expires)
+				sipe_cache_store(sipe_private,
+						 WEBTICKET_CACHE_ADFS_TOKEN,
+						 webticket->adfs_token,
+						 webticket->adfs_token_expires,
+						 TRUE);
 		}
 	}
 
@@ -499,7 +571,7 @@ static void webticket_token(struct sipe_core_private *sipe_private,
 
 		case TOKEN_STATE_FEDERATION:
 			/* WebTicket from ADFS for federated authentication */
-			generate_federation_wsse(sipe_private->webticket,
+			generate_federation_wsse(sipe_private,
 						 raw);
 
 			if (sipe_private->webticket->adfs_token) {
@@ -558,6 +630,10 @@ static void webticket_token(struct sipe_core_private *sipe_private,
 				/* forget ADFS URI */
 				g_free(webticket->webticket_adfs_uri);
 				webticket->webticket_adfs_uri = NULL;
+				sipe_cache_invalidate(sipe_private,
+						      WEBTICKET_CACHE_ADFS_URI);
+				sipe_cache_invalidate(sipe_private,
+						      WEBTICKET_CACHE_ADFS_TOKEN);
 			}
 
 			if (!wcd->tried_fedbearer) {
@@ -617,6 +693,14 @@ static gboolean fedbearer_authentication(struct sipe_core_private *sipe_private,
 	struct sipe_webticket *webticket = sipe_private->webticket;
 	gboolean success;
 
+	/* ADFS token from previous session? */
+	if (!webticket->adfs_token) {
+		const gchar *token = sipe_cache_lookup(sipe_private,
+						       WEBTICKET_CACHE_ADFS_TOKEN,
+						       &webticket->adfs_token_expires);
+		webticket->adfs_token = g_strdup(token);
+	}
+
 	/* make sure a cached ADFS token is still valid for 60 seconds */
 	if (webticket->adfs_token &&
 	    (webticket->adfs_token_expires >= time(NULL) + 60)) {
@@ -676,6 +760,13 @@ static void realminfo(struct sipe_core_private *sipe_private,
 										     "STSAuthURL"));
 		}
 
+		/* empty string: no ADFS setup */
+		sipe_cache_store(sipe_private,
+				 WEBTICKET_CACHE_ADFS_URI,
+				 webticket->webticket_adfs_uri ? webticket->webticket_adfs_uri : "",
+				 time(NULL) + WEBTICKET_CACHE_ADFS_TIMEOUT,
+				 FALSE);
+
 		if (webticket->webticket_adfs_uri) {
 			SIPE_LOG_INFO_NOFORMAT("realminfo: ADFS setup detected");
 			SIPE_DEBUG_INFO("realminfo: ADFS URI: %s",
@@ -702,9 +793,25 @@ static void realminfo(struct sipe_core_private *sipe_private,
 static gboolean initiate_fedbearer(struct sipe_core_private *sipe_private,
 				   struct webticket_callback_data *wcd)
 {
+	struct sipe_webticket *webticket = sipe_private->webticket;
 	gboolean success;
 
-	if (sipe_private->webticket->retrieved_realminfo) {
+	/* RealmInfo from previous session? */
+	if (!webticket->retrieved_realminfo) {
+		const gchar *adfs_uri = sipe_cache_lookup(sipe_private,
+							  WEBTICKET_CACHE_ADFS_URI,
+							  NULL);
+
+		if (adfs_uri) {
+			SIPE_DEBUG_INFO("initiate_fedbearer: using cached RealmInfo (ADFS URI '%s')",
+					adfs_uri);
+			webticket->retrieved_realminfo = TRUE;
+			if (*adfs_uri)
+				webticket->webticket_adfs_uri = g_strdup(adfs_uri);
+		}
+	}
+
+	if (webticket->retrieved_realminfo) {
 		/* skip retrieval and go to authentication */
 		wcd->tried_fedbearer = TRUE;
 		success = fedbearer_authentication(sipe_private, wcd);
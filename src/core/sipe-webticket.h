@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2011-2016 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2011-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  *
  * This program is free software; you can redistribute it and/or modify
@@ -88,6 +88,17 @@ gboolean sipe_webticket_request_with_auth(struct sipe_core_private *sipe_private
 					  sipe_webticket_callback *callback,
 					  gpointer callback_data);
 
+/**
+ * Drop cached Web Ticket for Web Service URI
+ *
+ * Must be called when the Web Service rejects the Web Ticket.
+ *
+ * @param sipe_private  SIPE core private data
+ * @param base_uri      Web Service base URI
+ */
+void sipe_webticket_invalidate(struct sipe_core_private *sipe_private,
+			       const gchar *base_uri);
+
 /**
  * Free webticket data
  *
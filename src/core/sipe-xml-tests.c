@@ -30,12 +30,37 @@
 
 #include <glib.h>
 
+/*
+ * Count the heap allocations made by sipe-xml.c itself: it is compiled
+ * into the test with counting wrappers for the GLib allocators it uses.
+ */
+static guint allocations = 0;
+static gpointer count_allocation(gpointer mem)
+{
+	allocations++;
+	return(mem);
+}
+#undef  g_new0
+#define g_new0(type, n)        ((type *) count_allocation(g_malloc0(sizeof(type) * (n))))
+#define g_malloc(n)            count_allocation(g_malloc(n))
+#define g_strdup(s)            count_allocation(g_strdup(s))
+#define g_strndup(s, n)        count_allocation(g_strndup(s, n))
+#define g_strdup_printf(...)   count_allocation(g_strdup_printf(__VA_ARGS__))
+#define g_strdup_vprintf(f, a) count_allocation(g_strdup_vprintf(f, a))
+#define g_string_new(s)        ((GString *) count_allocation(g_string_new(s)))
+#include "sipe-xml.c"
+#undef g_new0
+#undef g_malloc
+#undef g_strdup
+#undef g_strndup
+#undef g_strdup_printf
+#undef g_strdup_vprintf
+#undef g_string_new
+
+/* sipe-backend.h, sipe-utils.h & sipe-xml.h are included by sipe-xml.c */
 #include "sip-transport.h"
 #include "sipe-common.h"
-#include "sipe-backend.h"
 #include "sipe-digest.h"
-#include "sipe-xml.h"
-#include "sipe-utils.h"
 #include "uuid.h"
 
 /* stub functions for backend API */
@@ -77,9 +102,15 @@ static guint succeeded = 0;
 static guint failed    = 0;
 static const gchar *teststring;
 
+static guint parse_allocations;
+
 static sipe_xml *assert_parse(const gchar *s, gboolean ok)
 {
-	sipe_xml *xml = sipe_xml_parse(s, s ? strlen(s) : 0);
+	sipe_xml *xml;
+
+	allocations       = 0;
+	xml               = sipe_xml_parse(s, s ? strlen(s) : 0);
+	parse_allocations = allocations;
 
 	teststring = s ? s : "(nil)";
 
@@ -121,6 +152,23 @@ static const sipe_xml *assert_child(const sipe_xml *xml, const gchar *s, gboolea
 	return(child);
 }
 
+static const sipe_xml *assert_path_child(const sipe_xml *xml,
+					 struct sipe_xml_path *path,
+					 const gchar *name)
+{
+	const sipe_xml *child = sipe_xml_path_child(xml, path);
+
+	if (name ? sipe_strequal(sipe_xml_name(child), name) : !child) {
+		succeeded++;
+	} else {
+		printf("[%s]\nXML path child FAILED: %p '%s' expected: '%s'\n",
+		       teststring, xml, path->path ? path->path : "(nil)",
+		       name ? name : "(nil)");
+		failed++;
+	}
+	return(child);
+}
+
 static void assert_data(const sipe_xml *xml, const gchar *s)
 {
 	gchar *data = sipe_xml_data(xml);
@@ -193,6 +241,62 @@ static void assert_stringify(const sipe_xml *xml,
 	g_free(string);
 }
 
+/* heap allocations made by the last assert_parse() */
+static void assert_allocations(guint max)
+{
+	if (parse_allocations <= max) {
+		succeeded++;
+	} else {
+		printf("[%.40s...]\nXML allocations FAILED: %d expected: <= %d\n",
+		       teststring, parse_allocations, max);
+		failed++;
+	}
+}
+
+/* streaming parser: record callbacks */
+static void stream_start(const sipe_xml *node, gpointer user_data)
+{
+	g_string_append_printf(user_data, "<%s %s>",
+			       sipe_xml_name(node),
+			       sipe_xml_attribute(node, "uri"));
+}
+
+static void stream_end(const sipe_xml *node, gpointer user_data)
+{
+	gchar *string = sipe_xml_stringify(node);
+	g_string_append_printf(user_data, "[%s]", string);
+	g_free(string);
+}
+
+static void stream_data(const sipe_xml *node, gpointer user_data)
+{
+	gchar *data = sipe_xml_data(node);
+	g_string_append_printf(user_data, "(%s)", data);
+	g_free(data);
+}
+
+static void assert_stream(const gchar *s,
+			  const struct sipe_xml_stream_handler *handlers,
+			  gboolean ok,
+			  const gchar *expected)
+{
+	GString *events = g_string_new("");
+	gboolean result = sipe_xml_stream(s, s ? strlen(s) : 0,
+					  handlers, events);
+
+	teststring = s ? s : "(nil)";
+
+	if (((ok && result) || (!ok && !result)) &&
+	    sipe_strequal(events->str, expected)) {
+		succeeded++;
+	} else {
+		printf("[%s]\nXML stream FAILED: %d '%s' expected: '%s'\n",
+		       teststring, result, events->str, expected);
+		failed++;
+	}
+	g_string_free(events, TRUE);
+}
+
 static void assert_raw(const gchar *raw,
 		       const gchar *tag,
 		       gboolean include_tag,
@@ -274,6 +378,9 @@ int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
 {
 	sipe_xml *xml;
 	const sipe_xml *child1, *child2;
+	GString *large;
+	gchar *data;
+	guint i;
 
 #if 0
 	/*
@@ -429,6 +536,127 @@ int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
 	assert_data(child1, "15500");
 	sipe_xml_free(xml);
 
+	/* attribute names are case insensitive */
+	xml = assert_parse("<test Uri=\"sip:\" a=\"x&amp;y&amp;z\"/>", TRUE);
+	assert_attribute(xml, "uri", "sip:");
+	assert_attribute(xml, "URI", "sip:");
+	assert_attribute(xml, "A", "x&y&z");
+	assert_allocations(1);
+	sipe_xml_free(xml);
+
+	/* large documents are allocated with a few allocations */
+	large = g_string_new("<contacts>");
+	for (i = 0; i < 5000; i++)
+		g_string_append_printf(large,
+				       "<contact uri=\"sip:user%d@example.com\" name=\"User %d\" groups=\"1 %d\"><tag>%d</tag></contact>",
+				       i, i, i % 10, i);
+	g_string_append(large, "</contacts>");
+	xml = assert_parse(large->str, TRUE);
+	child1 = assert_child(xml, "contact", TRUE);
+	for (i = 0; child1 && (i < 4999); i++)
+		child1 = sipe_xml_twin(child1);
+	assert_attribute(child1, "URI", "sip:user4999@example.com");
+	assert_attribute(child1, "groups", "1 9");
+	child1 = assert_child(child1, "tag", TRUE);
+	assert_data(child1, "4999");
+	/* 10000 elements + 15000 attributes: was > 50000 allocations */
+	assert_allocations(32);
+	sipe_xml_free(xml);
+	g_string_free(large, TRUE);
+
+	/* long text is delivered in pieces by libxml2 */
+	large = g_string_new("<test>");
+	for (i = 0; i < 10000; i++)
+		g_string_append(large, "0123456789");
+	data = g_strdup(large->str + 6);
+	g_string_append(large, "<child/></test>");
+	xml = assert_parse(large->str, TRUE);
+	assert_data(xml, data);
+	assert_allocations(8);
+	sipe_xml_free(xml);
+	g_string_free(large, TRUE);
+	g_free(data);
+
+	/* streaming parser */
+	{
+		static const gchar *categories =
+			"<categories uri=\"sip:a\">"
+			"<category name=\"note\"><note><body>n</body></note></category>"
+			"<category name=\"contactCard\"><contactCard><identity><name><displayName>A</displayName></name></identity></contactCard></category>"
+			"<c:category xmlns:c=\"urn:c\" c:name=\"state\"><state>s</state></c:category>"
+			"</categories>";
+		static const struct sipe_xml_stream_handler root[] = {
+			{ "categories", stream_start, NULL },
+			{ NULL, NULL, NULL }
+		};
+		static const struct sipe_xml_stream_handler category[] = {
+			{ "categories/category", NULL, stream_end },
+			{ NULL, NULL, NULL }
+		};
+		static const struct sipe_xml_stream_handler predicate[] = {
+			{ "categories/category[@name='contactCard']/contactCard/identity/name/displayName", NULL, stream_data },
+			{ "categories/category[@NAME]/state", NULL, stream_data },
+			{ "categories/*/note/body", NULL, stream_data },
+			{ NULL, NULL, NULL }
+		};
+		static const struct sipe_xml_stream_handler nested[] = {
+			{ "categories/category[@name=\"note\"]", NULL, stream_end },
+			{ "categories/category/note/body", NULL, stream_data },
+			{ "categories/category/note", stream_start, NULL },
+			{ NULL, NULL, NULL }
+		};
+		static const struct sipe_xml_stream_handler invalid[] = {
+			{ "categories/category[name]", NULL, stream_end },
+			{ NULL, NULL, NULL }
+		};
+
+		assert_stream(NULL, root, FALSE, "");
+		assert_stream(categories, root, TRUE, "<categories sip:a>");
+		assert_stream(categories, category, TRUE,
+			      "[<category name=\"note\"><note><body>n</body></note></category>]"
+			      "[<category name=\"contactCard\"><contactCard><identity><name><displayName>A</displayName></name></identity></contactCard></category>]"
+			      "[<category c=\"urn:c\" name=\"state\"><state>s</state></category>]");
+		assert_stream(categories, predicate, TRUE, "(n)(A)(s)");
+		assert_stream(categories, nested, TRUE,
+			      "<note (null)>(n)[<category name=\"note\"><note><body>n</body></note></category>]");
+		assert_stream(categories, invalid, FALSE, "");
+		assert_stream("<categories uri=\"sip:a\"><category>", root, FALSE, "<categories sip:a>");
+	}
+
+	/* compiled paths */
+	{
+		static struct sipe_xml_path inner = SIPE_XML_PATH_INIT("child/inner");
+		static struct sipe_xml_path innerinner = SIPE_XML_PATH_INIT("child/inner/innerinner");
+		static struct sipe_xml_path nomatch = SIPE_XML_PATH_INIT("child/shouldnotmatch");
+		static struct sipe_xml_path empty = SIPE_XML_PATH_INIT("");
+		static struct sipe_xml_path deep = SIPE_XML_PATH_INIT("1/2/3/4/5/6/7/8/9");
+		const gchar *doc = "<test><other/><child><inner>c<innerinner>d</innerinner></inner></child><child><inner>e</inner></child></test>";
+
+		/* tree parsed before paths have been compiled */
+		xml = assert_parse(doc, TRUE);
+		child1 = assert_path_child(xml, &inner, "inner");
+		assert_data(child1, "c");
+		child2 = assert_child(xml, "child", TRUE);
+		child2 = sipe_xml_twin(child2);
+		assert_data(sipe_xml_child(child2, "inner"), "e");
+		sipe_xml_free(xml);
+
+		/* tree parsed with interned names */
+		xml = assert_parse(doc, TRUE);
+		child1 = assert_path_child(xml, &innerinner, "innerinner");
+		assert_data(child1, "d");
+		assert_path_child(xml, &nomatch, NULL);
+		assert_path_child(xml, &empty, NULL);
+		assert_path_child(xml, &deep, NULL);
+		assert_path_child(NULL, &inner, NULL);
+		child2 = assert_child(xml, "child", TRUE);
+		child2 = sipe_xml_twin(child2);
+		assert_data(sipe_xml_path_child(child2, &inner), NULL);
+		assert_data(assert_child(child2, "inner", TRUE), "e");
+		assert_stringify(xml, 1, teststring);
+		sipe_xml_free(xml);
+	}
+
 	/* broken XML */
 	xml = assert_parse("t", FALSE);
 	sipe_xml_free(xml);
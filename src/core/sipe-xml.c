@@ -38,30 +38,120 @@
 #include "sipe-utils.h"
 #include "sipe-xml.h"
 
+/*
+ * All nodes, names, attribute arrays and data of a tree are allocated from
+ * a chain of memory blocks. The root node owns the chain. This replaces
+ * several small allocations per element by a few large ones and the whole
+ * tree is released at once by sipe_xml_free().
+ */
+#define SIPE_XML_ALIGN(n)          (((n) + sizeof(gpointer) - 1) & ~(sizeof(gpointer) - 1))
+#define SIPE_XML_BLOCK_MIN_SIZE    1024
+#define SIPE_XML_BLOCK_MAX_SIZE    (64 * 1024)
+#define SIPE_XML_BLOCK_HEADER_SIZE SIPE_XML_ALIGN(sizeof(struct sipe_xml_block))
+#define SIPE_XML_BLOCK_DATA(b)     (((gchar *) (b)) + SIPE_XML_BLOCK_HEADER_SIZE)
+
+struct sipe_xml_block {
+	struct sipe_xml_block *next;
+	gsize size;
+	gsize used;
+};
+
+struct sipe_xml_attr {
+	const gchar *name;
+	const gchar *value;
+};
+
 struct _sipe_xml {
-	gchar *name;
+	const gchar *name;
 	sipe_xml *parent;
 	sipe_xml *sibling;
 	sipe_xml *first;
 	sipe_xml *last;
-	GString *data;
-	GHashTable *attributes;
+	gchar *data;
+	gsize data_length;
+	gsize data_size;
+	struct sipe_xml_attr *attributes;
+	guint attribute_count;
+	struct sipe_xml_block *blocks; /* root node only */
+	gboolean interned;             /* name is an interned string */
 };
 
 struct _parser_data {
 	sipe_xml *root;
 	sipe_xml *current;
+	struct sipe_xml_block *blocks; /* current block is first */
+	gsize block_size;
 	gboolean error;
 };
 
-/* our string equal function is case insensitive -> hash must be too! */
-static guint sipe_ascii_strdown_hash(gconstpointer key)
+static void sipe_xml_blocks_free(struct sipe_xml_block *block)
+{
+	while (block) {
+		struct sipe_xml_block *next = block->next;
+		g_free(block);
+		block = next;
+	}
+}
+
+static gpointer sipe_xml_alloc(struct _parser_data *pd, gsize size)
+{
+	struct sipe_xml_block *block = pd->blocks;
+	gsize start = block ? SIPE_XML_ALIGN(block->used) : 0;
+
+	if (!block || (start + size > block->size)) {
+		gsize block_size = MAX(pd->block_size, size);
+
+		block = g_malloc(SIPE_XML_BLOCK_HEADER_SIZE + block_size);
+		block->size = block_size;
+		block->used = 0;
+		start       = 0;
+
+		/* oversized allocations don't replace the current block */
+		if (pd->blocks && (size > pd->block_size)) {
+			block->next      = pd->blocks->next;
+			pd->blocks->next = block;
+		} else {
+			block->next = pd->blocks;
+			pd->blocks  = block;
+		}
+
+		if (pd->block_size < SIPE_XML_BLOCK_MAX_SIZE)
+			pd->block_size *= 2;
+	}
+
+	block->used = start + size;
+	return(SIPE_XML_BLOCK_DATA(block) + start);
+}
+
+static gchar *sipe_xml_strdup(struct _parser_data *pd, const gchar *string)
 {
-	gchar *lc = g_ascii_strdown((const gchar *) key, -1);
-	guint bucket = g_str_hash(lc);
-	g_free(lc);
+	gsize length = strlen(string) + 1;
+	return(memcpy(sipe_xml_alloc(pd, length), string, length));
+}
+
+/* libxml2 decodes all entities except &amp;.
+   &amp; is replaced by the equivalent &#38; */
+static gchar *sipe_xml_strdup_value(struct _parser_data *pd, const gchar *string)
+{
+	gchar *value = sipe_xml_strdup(pd, string);
+	gchar *amp   = strstr(value, "&#38;");
+
+	if (amp) {
+		const gchar *in = amp;
+		gchar *out      = amp;
+
+		while (*in) {
+			if (g_str_has_prefix(in, "&#38;")) {
+				*out++ = '&';
+				in    += 5;
+			} else {
+				*out++ = *in++;
+			}
+		}
+		*out = '\0';
+	}
 
-	return(bucket);
+	return(value);
 }
 
 static void callback_start_element(void *user_data, const xmlChar *name, const xmlChar **attrs)
@@ -72,12 +162,23 @@ static void callback_start_element(void *user_data, const xmlChar *name, const x
 
 	if (!name || pd->error) return;
 
-	node = g_new0(sipe_xml, 1);
+	node = memset(sipe_xml_alloc(pd, sizeof(sipe_xml)), 0, sizeof(sipe_xml));
 
 	if ((tmp = strchr((char *)name, ':')) != NULL) {
 		name = (xmlChar *)tmp + 1;
 	}
-	node->name = g_strdup((gchar *)name);
+
+	/*
+	 * Names used by compiled paths are interned. Don't intern other
+	 * names, as the interned strings are never released.
+	 */
+	tmp = g_quark_to_string(g_quark_try_string((gchar *)name));
+	if (tmp) {
+		node->name     = tmp;
+		node->interned = TRUE;
+	} else {
+		node->name     = sipe_xml_strdup(pd, (gchar *)name);
+	}
 
 	if (!pd->root) {
 		pd->root = node;
@@ -95,19 +196,21 @@ static void callback_start_element(void *user_data, const xmlChar *name, const x
 
 	if (attrs) {
 		const xmlChar *key;
+		guint count = 0;
+
+		while (attrs[2 * count])
+			count++;
 
-		node->attributes = g_hash_table_new_full(sipe_ascii_strdown_hash,
-							 (GEqualFunc) sipe_strcase_equal,
-							 g_free, g_free);
+		node->attributes = sipe_xml_alloc(pd,
+						  count * sizeof(struct sipe_xml_attr));
 		while ((key = *attrs++) != NULL) {
+			struct sipe_xml_attr *attr = node->attributes + node->attribute_count++;
+
 			if ((tmp = strchr((char *)key, ':')) != NULL) {
 				key = (xmlChar *)tmp + 1;
 			}
-			/* libxml2 decodes all entities except &amp;.
-			   &amp; is replaced by the equivalent &#38; */
-			g_hash_table_insert(node->attributes,
-					    g_strdup((gchar *) key),
-					    sipe_utils_str_replace((gchar *) *attrs++, "&#38;", "&"));
+			attr->name  = sipe_xml_strdup(pd, (gchar *) key);
+			attr->value = sipe_xml_strdup_value(pd, (gchar *) *attrs++);
 		}
 	}
 
@@ -127,15 +230,36 @@ static void callback_end_element(void *user_data, const xmlChar *name)
 static void callback_characters(void *user_data, const xmlChar *text, int text_len)
 {
 	struct _parser_data *pd = user_data;
+	struct sipe_xml_block *block = pd->blocks;
 	sipe_xml *node;
+	gsize size;
 
 	if (!pd->current || pd->error || !text || !text_len) return;
 
 	node = pd->current;
-	if (node->data)
-		node->data = g_string_append_len(node->data, (gchar *)text, text_len);
-	else
-		node->data = g_string_new_len((gchar *)text, text_len);
+	size = node->data_length + text_len + 1;
+
+	if (node->data && (size <= node->data_size)) {
+		/* fits into spare space */
+	} else if (node->data &&
+		   (node->data + node->data_size == SIPE_XML_BLOCK_DATA(block) + block->used) &&
+		   (block->used + size - node->data_size <= block->size)) {
+		/* last allocation in the current block can be extended */
+		block->used      += size - node->data_size;
+		node->data_size   = size;
+	} else {
+		/* libxml2 splits long text -> grow exponentially */
+		gsize allocate = node->data ? 2 * size : size;
+		gchar *data    = sipe_xml_alloc(pd, allocate);
+		if (node->data)
+			memcpy(data, node->data, node->data_length);
+		node->data      = data;
+		node->data_size = allocate;
+	}
+
+	memcpy(node->data + node->data_length, text, text_len);
+	node->data_length += text_len;
+	node->data[node->data_length] = '\0';
 }
 
 static void callback_error(void *user_data, const char *msg, ...)
@@ -215,18 +339,23 @@ sipe_xml *sipe_xml_parse(const gchar *string, gsize length)
 	sipe_xml *result = NULL;
 
 	if (string && length) {
-		struct _parser_data *pd = g_new0(struct _parser_data, 1);
+		struct _parser_data pd;
+
+		memset(&pd, 0, sizeof(pd));
+		/* tree size is roughly proportional to the XML string length */
+		pd.block_size = CLAMP(SIPE_XML_ALIGN(length),
+				      SIPE_XML_BLOCK_MIN_SIZE,
+				      SIPE_XML_BLOCK_MAX_SIZE);
 
-		if (xmlSAXUserParseMemory(&parser, pd, string, length))
-			pd->error = TRUE;
+		if (xmlSAXUserParseMemory(&parser, &pd, string, length))
+			pd.error = TRUE;
 
-		if (pd->error) {
-			sipe_xml_free(pd->root);
+		if (pd.error || !pd.root) {
+			sipe_xml_blocks_free(pd.blocks);
 		} else {
-			result = pd->root;
+			result         = pd.root;
+			result->blocks = pd.blocks;
 		}
-
-		g_free(pd);
 	}
 
 	return result;
@@ -234,53 +363,327 @@ sipe_xml *sipe_xml_parse(const gchar *string, gsize length)
 
 void sipe_xml_free(sipe_xml *node)
 {
-	sipe_xml *child;
-
 	if (!node) return;
 
-	/* we don't support partial tree deletion */
-	if (node->parent != NULL) {
-		SIPE_DEBUG_ERROR_NOFORMAT("sipe_xml_free: partial delete attempt! Expect crash or memory leaks...");
+	/*
+	 * Nodes are allocated from the memory blocks owned by the root,
+	 * i.e. a subtree can't be released on its own.
+	 */
+	g_return_if_fail(node->parent == NULL);
+
+	/* root node is allocated from the blocks too */
+	sipe_xml_blocks_free(node->blocks);
+}
+
+/*
+ * Streaming XML parser
+ *
+ * Only elements requested by an "end" handler are converted to a tree.
+ * The memory blocks of that tree are re-used for the next match.
+ */
+struct sipe_xml_step {
+	gchar *name;  /* NULL: any element */
+	gchar *attr;  /* NULL: no predicate */
+	gchar *value; /* NULL: attribute must exist */
+};
+
+struct sipe_xml_pattern {
+	const struct sipe_xml_stream_handler *handler;
+	struct sipe_xml_step *steps;
+	guint count;
+	guint matched; /* number of steps matched by current path */
+};
+
+struct _stream_data {
+	struct _parser_data tree;    /* MUST BE FIRST: see callback_error() */
+	struct _parser_data scratch; /* node for "start" handlers */
+	struct sipe_xml_pattern *patterns;
+	guint count;
+	gpointer user_data;
+	guint depth;
+	guint build_depth;           /* depth of tree root, 0 if not building */
+};
+
+static void sipe_xml_blocks_reset(struct _parser_data *pd)
+{
+	/* keep the first block for the next tree */
+	if (pd->blocks) {
+		sipe_xml_blocks_free(pd->blocks->next);
+		pd->blocks->next = NULL;
+		pd->blocks->used = 0;
+	}
+	pd->root    = NULL;
+	pd->current = NULL;
+}
+
+static const gchar *sipe_xml_strip_prefix(const xmlChar *name)
+{
+	const gchar *tmp = strchr((const gchar *) name, ':');
+	return(tmp ? tmp + 1 : (const gchar *) name);
+}
+
+/* "name", "*", "name[@attr]" or "name[@attr='value']" */
+static gboolean sipe_xml_step_compile(struct sipe_xml_step *step,
+				      const gchar *string)
+{
+	const gchar *predicate = strchr(string, '[');
+
+	step->name  = g_strndup(string,
+				predicate ? (gsize) (predicate - string) : strlen(string));
+	step->attr  = NULL;
+	step->value = NULL;
+
+	if (sipe_strequal(step->name, "*")) {
+		g_free(step->name);
+		step->name = NULL;
 	}
 
-	/* free children */
-	child = node->first;
-	while (child) {
-		sipe_xml *tmp = child->sibling;
-		child->parent = NULL; /* detach from tree, see above */
-		sipe_xml_free(child);
-		child = tmp;
+	if (predicate) {
+		const gchar *end = strchr(predicate, ']');
+		const gchar *equal;
+
+		if (!g_str_has_prefix(predicate, "[@") ||
+		    !end || (end[1] != '\0'))
+			return(FALSE);
+
+		equal = memchr(predicate, '=', end - predicate);
+		if (equal) {
+			gsize length = end - equal - 1;
+
+			if ((length < 2) ||
+			    !((equal[1] == '\'') || (equal[1] == '"')) ||
+			    (end[-1] != equal[1]))
+				return(FALSE);
+			step->attr  = g_strndup(predicate + 2, equal - predicate - 2);
+			step->value = g_strndup(equal + 2, length - 2);
+		} else {
+			step->attr  = g_strndup(predicate + 2, end - predicate - 2);
+		}
 	}
 
-	/* free node */
-	g_free(node->name);
-	if (node->data)       g_string_free(node->data, TRUE);
-	if (node->attributes) g_hash_table_destroy(node->attributes);
-	g_free(node);
+	return(TRUE);
 }
 
-static void sipe_xml_stringify_attribute(gpointer key, gpointer value,
-					 gpointer user_data)
+static gboolean sipe_xml_step_match(const struct sipe_xml_step *step,
+				    const xmlChar *name,
+				    const xmlChar **attrs)
 {
-	g_string_append_printf(user_data, " %s=\"%s\"",
-			       (const gchar *) key, (const gchar *) value);
+	if (step->name && !sipe_strequal(step->name, sipe_xml_strip_prefix(name)))
+		return(FALSE);
+
+	if (step->attr) {
+		const xmlChar *key;
+
+		if (!attrs)
+			return(FALSE);
+		while ((key = *attrs++) != NULL) {
+			const gchar *value = (const gchar *) *attrs++;
+			if (g_ascii_strcasecmp(sipe_xml_strip_prefix(key),
+					       step->attr) == 0)
+				return(!step->value ||
+				       sipe_strequal(step->value, value));
+		}
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+static void callback_stream_start_element(void *user_data,
+					  const xmlChar *name,
+					  const xmlChar **attrs)
+{
+	struct _stream_data *sd = user_data;
+	guint depth;
+	guint i;
+
+	if (!name || sd->tree.error) return;
+
+	depth = ++sd->depth;
+
+	if (sd->build_depth)
+		callback_start_element(&sd->tree, name, attrs);
+
+	for (i = 0; i < sd->count; i++) {
+		struct sipe_xml_pattern *pattern = sd->patterns + i;
+
+		/* extend matched path prefix */
+		if ((pattern->matched != depth - 1) ||
+		    (depth > pattern->count) ||
+		    !sipe_xml_step_match(pattern->steps + depth - 1, name, attrs))
+			continue;
+		pattern->matched = depth;
+		if (depth != pattern->count)
+			continue;
+
+		if (pattern->handler->start) {
+			sipe_xml_blocks_reset(&sd->scratch);
+			callback_start_element(&sd->scratch, name, attrs);
+			pattern->handler->start(sd->scratch.root, sd->user_data);
+		}
+
+		if (pattern->handler->end && !sd->build_depth) {
+			sd->build_depth = depth;
+			callback_start_element(&sd->tree, name, attrs);
+		}
+	}
+}
+
+static void callback_stream_end_element(void *user_data,
+					const xmlChar *name)
+{
+	struct _stream_data *sd = user_data;
+	guint depth = sd->depth;
+	guint i;
+
+	if (!name || !depth || sd->tree.error) return;
+
+	for (i = 0; i < sd->count; i++) {
+		struct sipe_xml_pattern *pattern = sd->patterns + i;
+
+		if (pattern->matched != depth)
+			continue;
+		pattern->matched--;
+
+		if ((depth == pattern->count) &&
+		    pattern->handler->end &&
+		    sd->build_depth)
+			pattern->handler->end(sd->tree.current, sd->user_data);
+	}
+
+	if (sd->build_depth) {
+		callback_end_element(&sd->tree, name);
+		if (depth == sd->build_depth) {
+			sipe_xml_blocks_reset(&sd->tree);
+			sd->build_depth = 0;
+		}
+	}
+
+	sd->depth--;
+}
+
+static void callback_stream_characters(void *user_data,
+				       const xmlChar *text,
+				       int text_len)
+{
+	struct _stream_data *sd = user_data;
+
+	if (sd->build_depth)
+		callback_characters(&sd->tree, text, text_len);
+}
+
+/* API doesn't accept const data structure */
+static xmlSAXHandler stream_parser = {
+	NULL,                          /* internalSubset */
+	NULL,                          /* isStandalone */
+	NULL,                          /* hasInternalSubset */
+	NULL,                          /* hasExternalSubset */
+	NULL,                          /* resolveEntity */
+	NULL,                          /* getEntity */
+	NULL,                          /* entityDecl */
+	NULL,                          /* notationDecl */
+	NULL,                          /* attributeDecl */
+	NULL,                          /* elementDecl */
+	NULL,                          /* unparsedEntityDecl */
+	NULL,                          /* setDocumentLocator */
+	NULL,                          /* startDocument */
+	NULL,                          /* endDocument */
+	callback_stream_start_element, /* startElement */
+	callback_stream_end_element,   /* endElement   */
+	NULL,                          /* reference */
+	callback_stream_characters,    /* characters */
+	NULL,                          /* ignorableWhitespace */
+	NULL,                          /* processingInstruction */
+	NULL,                          /* comment */
+	NULL,                          /* warning */
+	callback_error,                /* error */
+	NULL,                          /* fatalError */
+	NULL,                          /* getParameterEntity */
+	NULL,                          /* cdataBlock */
+	NULL,                          /* externalSubset */
+	XML_SAX2_MAGIC,                /* initialized */
+	NULL,                          /* _private */
+	NULL,                          /* startElementNs */
+	NULL,                          /* endElementNs   */
+	callback_serror,               /* serror */
+};
+
+gboolean sipe_xml_stream(const gchar *string, gsize length,
+			 const struct sipe_xml_stream_handler *handlers,
+			 gpointer user_data)
+{
+	struct _stream_data sd;
+	const struct sipe_xml_stream_handler *handler;
+	guint i;
+
+	if (!string || !length || !handlers) return(FALSE);
+
+	memset(&sd, 0, sizeof(sd));
+	sd.tree.block_size    = SIPE_XML_BLOCK_MIN_SIZE;
+	sd.scratch.block_size = SIPE_XML_BLOCK_MIN_SIZE;
+	sd.user_data          = user_data;
+
+	for (handler = handlers; handler->path; handler++)
+		sd.count++;
+	sd.patterns = g_new0(struct sipe_xml_pattern, sd.count);
+
+	for (i = 0; i < sd.count; i++) {
+		struct sipe_xml_pattern *pattern = sd.patterns + i;
+		gchar **steps = g_strsplit(handlers[i].path, "/", 0);
+		guint j;
+
+		pattern->handler = handlers + i;
+		pattern->count   = g_strv_length(steps);
+		pattern->steps   = g_new0(struct sipe_xml_step, pattern->count);
+
+		for (j = 0; j < pattern->count; j++)
+			if (!sipe_xml_step_compile(pattern->steps + j, steps[j])) {
+				SIPE_DEBUG_ERROR("sipe_xml_stream: invalid path '%s'",
+						 handlers[i].path);
+				sd.tree.error = TRUE;
+			}
+
+		g_strfreev(steps);
+	}
+
+	if (!sd.tree.error &&
+	    xmlSAXUserParseMemory(&stream_parser, &sd, string, length))
+		sd.tree.error = TRUE;
+
+	for (i = 0; i < sd.count; i++) {
+		struct sipe_xml_pattern *pattern = sd.patterns + i;
+		guint j;
+
+		for (j = 0; j < pattern->count; j++) {
+			g_free(pattern->steps[j].name);
+			g_free(pattern->steps[j].attr);
+			g_free(pattern->steps[j].value);
+		}
+		g_free(pattern->steps);
+	}
+	g_free(sd.patterns);
+	sipe_xml_blocks_free(sd.tree.blocks);
+	sipe_xml_blocks_free(sd.scratch.blocks);
+
+	return(!sd.tree.error);
 }
 
 static void sipe_xml_stringify_node(GString *s, const sipe_xml *node)
 {
+	guint i;
+
 	g_string_append_printf(s, "<%s", node->name);
 
-	if (node->attributes) {
-		g_hash_table_foreach(node->attributes,
-				     (GHFunc) sipe_xml_stringify_attribute,
-				     s);
-	}
+	for (i = 0; i < node->attribute_count; i++)
+		g_string_append_printf(s, " %s=\"%s\"",
+				       node->attributes[i].name,
+				       node->attributes[i].value);
 
 	if (node->data || node->first) {
 		const sipe_xml *child;
 
 		g_string_append_printf(s, ">%s",
-				       node->data ? node->data->str : "");
+				       node->data ? node->data : "");
 
 		for (child = node->first; child; child = child->sibling)
 			sipe_xml_stringify_node(s, child);
@@ -304,25 +707,80 @@ gchar *sipe_xml_stringify(const sipe_xml *node)
 
 const sipe_xml *sipe_xml_child(const sipe_xml *parent, const gchar *name)
 {
-	gchar **names;
 	const sipe_xml *child = NULL;
 
 	if (!parent || !name) return NULL;
 
-	/* 0: child name */
-	/* 1: trailing path (optional) */
-	names = g_strsplit(name, "/", 2);
+	/* walk path one step at a time */
+	while (TRUE) {
+		const gchar *next = strchr(name, '/');
+		gsize length = next ? (gsize) (next - name) : strlen(name);
 
-	for (child = parent->first; child; child = child->sibling) {
-		if (sipe_strequal(names[0], child->name))
-			break;
+		for (child = parent->first; child; child = child->sibling) {
+			if ((strncmp(child->name, name, length) == 0) &&
+			    (child->name[length] == '\0'))
+				break;
+		}
+
+		if (!child || !next)
+			return child;
+
+		parent = child;
+		name   = next + 1;
 	}
+}
 
-	/* recurse into path */
-	if (child && names[1])
-		child = sipe_xml_child(child, names[1]);
+gboolean sipe_xml_path_compile(struct sipe_xml_path *path)
+{
+	const gchar *step = path->path;
+	guint count = 0;
+
+	if (path->count)
+		return(TRUE);
+	if (is_empty(step))
+		return(FALSE);
+
+	while (step) {
+		const gchar *next = strchr(step, '/');
+		gchar *name;
+
+		if (count == SIPE_XML_PATH_MAX_STEPS) {
+			SIPE_DEBUG_ERROR("sipe_xml_path_compile: too many steps in '%s'",
+					 path->path);
+			return(FALSE);
+		}
+
+		name = next ? g_strndup(step, next - step) : g_strdup(step);
+		path->steps[count++] = g_intern_string(name);
+		g_free(name);
+
+		step = next ? next + 1 : NULL;
+	}
+
+	path->count = count;
+	return(TRUE);
+}
+
+const sipe_xml *sipe_xml_path_child(const sipe_xml *parent,
+				    struct sipe_xml_path *path)
+{
+	const sipe_xml *child = parent;
+	guint i;
+
+	if (!parent || !sipe_xml_path_compile(path)) return NULL;
+
+	for (i = 0; child && (i < path->count); i++) {
+		const gchar *name = path->steps[i];
+
+		/* interned names can be compared by pointer */
+		for (child = child->first; child; child = child->sibling) {
+			if (child->interned ?
+			    (child->name == name) :
+			    sipe_strequal(child->name, name))
+				break;
+		}
+	}
 
-	g_strfreev(names);
 	return child;
 }
 
@@ -333,7 +791,9 @@ const sipe_xml *sipe_xml_twin(const sipe_xml *node)
 	if (!node) return NULL;
 
 	for (sibling = node->sibling; sibling; sibling = sibling->sibling) {
-		if (sipe_strequal(node->name, sibling->name))
+		if ((node->interned && sibling->interned) ?
+		    (node->name == sibling->name) :
+		    sipe_strequal(node->name, sibling->name))
 			return sibling;
 	}
 	return NULL;
@@ -346,8 +806,16 @@ const gchar *sipe_xml_name(const sipe_xml *node)
 
 const gchar *sipe_xml_attribute(const sipe_xml *node, const gchar *attr)
 {
-	if (!node || !attr || !node->attributes) return NULL;
-	return(g_hash_table_lookup(node->attributes, attr));
+	guint i;
+
+	if (!node || !attr) return NULL;
+
+	/* last definition wins, e.g. for "xsi:type" & "type" */
+	for (i = node->attribute_count; i > 0; i--)
+		if (g_ascii_strcasecmp(node->attributes[i - 1].name, attr) == 0)
+			return(node->attributes[i - 1].value);
+
+	return(NULL);
 }
 
 guint sipe_xml_int_attribute(const sipe_xml *node, const gchar *attr,
@@ -359,8 +827,8 @@ guint sipe_xml_int_attribute(const sipe_xml *node, const gchar *attr,
 
 gchar *sipe_xml_data(const sipe_xml *node)
 {
-	if (!node || !node->data || !node->data->str) return NULL;
-	return g_strdup(node->data->str);
+	if (!node || !node->data) return NULL;
+	return g_strdup(node->data);
 }
 
 /**
@@ -375,17 +843,13 @@ void sipe_xml_dump(const sipe_xml *node, const gchar *path)
 	gchar *new_path;
 	if (!node) return;
 	new_path = g_strdup_printf("%s/%s", path ? path : "", node->name);
-	if (node->attributes) {
-		GList *attrs = g_hash_table_get_keys(node->attributes);
+	if (node->attribute_count) {
 		GString *buf = g_string_new("");
-		GList *entry = attrs;
-		while (entry) {
-			g_string_append_printf(buf, "%s ", (gchar *)entry->data);
-			entry = entry->next;
-		}
+		guint i;
+		for (i = 0; i < node->attribute_count; i++)
+			g_string_append_printf(buf, "%s ", node->attributes[i].name);
 		SIPE_DEBUG_INFO("%s [%s]", new_path, buf->str);
 		g_string_free(buf, TRUE);
-		g_list_free(attrs);
 	} else {
 		SIPE_DEBUG_INFO_NOFORMAT(new_path);
 	}
@@ -477,7 +941,7 @@ static gchar *sipe_xml_extract_any_raw(const gchar *xml, const gchar *tag,
 		const gchar *p = start - 1;
 
 		/* search for beginning of tag */
-		while ((*p != '<') && (p >= xml)) p--;
+		while ((p >= xml) && (*p != '<')) p--;
 
 		/* namespace identifier found? */
 		if ((p >= xml) && (p != (start - 1))) {
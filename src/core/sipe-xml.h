@@ -35,10 +35,61 @@ sipe_xml *sipe_xml_parse(const gchar *string, gsize length);
 /**
  * Free XML information.
  *
+ * Only the complete tree can be freed. Passing any other node than the
+ * root returned by @c sipe_xml_parse() is a programming error: it is
+ * reported with @c g_return_if_fail() and nothing is freed.
+ *
  * @param string XML information to be freed.
  */
 void sipe_xml_free(sipe_xml *xml);
 
+/**
+ * Streaming XML parser callback
+ *
+ * @param node      The matching element. Only valid during the callback.
+ *                  Never try to @c sipe_xml_free() it!
+ * @param user_data user data passed to @c sipe_xml_stream()
+ */
+typedef void sipe_xml_stream_callback(const sipe_xml *node,
+				      gpointer user_data);
+
+/**
+ * Streaming XML parser handler
+ *
+ * @c path is absolute, starting with the name of the document element.
+ * Each step is an element name without name space prefix or "*". It can be
+ * followed by a predicate "[@attr]" or "[@attr='value']". Example:
+ *
+ *   categories/category[@name='contactCard']/contactCard
+ *
+ * @c start is called with the element and its attributes only.
+ * @c end is called with the complete element including children and data.
+ * Both can be @c NULL.
+ */
+struct sipe_xml_stream_handler {
+	const gchar *path;
+	sipe_xml_stream_callback *start;
+	sipe_xml_stream_callback *end;
+};
+
+/**
+ * Parse XML from a string and call handlers for matching elements.
+ *
+ * Only elements matched by an @c end handler are kept in memory, i.e.
+ * memory usage doesn't depend on the size of the document.
+ *
+ * @param string    String with the XML to be parsed.
+ * @param length    Length of the string.
+ * @param handlers  Array of handlers terminated by a @c NULL path.
+ * @param user_data user data for the callbacks
+ *
+ * @return @c FALSE if the XML is invalid. Callbacks for elements before the
+ *         error have already been called.
+ */
+gboolean sipe_xml_stream(const gchar *string, gsize length,
+			 const struct sipe_xml_stream_handler *handlers,
+			 gpointer user_data);
+
 /**
  * Convert XML information to string.
  *
@@ -58,6 +109,48 @@ gchar *sipe_xml_stringify(const sipe_xml *xml);
  */
 const sipe_xml *sipe_xml_child(const sipe_xml *parent, const gchar *name);
 
+/**
+ * Maximum number of steps in a compiled path
+ */
+#define SIPE_XML_PATH_MAX_STEPS 8
+
+/**
+ * Compiled relative path for @c sipe_xml_path_child()
+ *
+ * Intended to be defined with static storage at the call site, e.g.
+ *
+ *   static struct sipe_xml_path display_name = SIPE_XML_PATH_INIT("name/displayName");
+ *
+ * The path is compiled on first use. Lookups don't allocate memory and
+ * compare interned element names.
+ */
+struct sipe_xml_path {
+	const gchar *path;
+	guint count;  /* 0: not compiled yet */
+	const gchar *steps[SIPE_XML_PATH_MAX_STEPS];
+};
+#define SIPE_XML_PATH_INIT(p) { (p), 0, { NULL } }
+
+/**
+ * Compile path. Called implicitly by @c sipe_xml_path_child().
+ *
+ * @param path Path object initialized with @c SIPE_XML_PATH_INIT().
+ *
+ * @return @c FALSE if the path is empty or has too many steps.
+ */
+gboolean sipe_xml_path_compile(struct sipe_xml_path *path);
+
+/**
+ * Gets a child node with a compiled path.
+ *
+ * @param parent The parent node.
+ * @param path   compiled path of the child.
+ *
+ * @return The child or @c NULL. Never try to @c sipe_xml_free() it!
+ */
+const sipe_xml *sipe_xml_path_child(const sipe_xml *parent,
+				    struct sipe_xml_path *path);
+
 /**
  * Gets the next node with the same name as node.
  *
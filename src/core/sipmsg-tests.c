@@ -0,0 +1,316 @@
+/**
+ * @file sipmsg-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2018 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests for sipmsg.c header parser & well-known header index */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <glib.h>
+
+#include "sip-transport.h"
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-mime.h"
+#include "sipe-utils.h"
+#include "sipmsg.h"
+#include "uuid.h"
+
+/* stub functions for backend API */
+void sipe_backend_debug_literal(sipe_debug_level level,
+				const gchar *msg)
+{
+	printf("DEBUG %d: %s\n", level, msg);
+}
+void sipe_backend_debug(sipe_debug_level level,
+			const gchar *format,
+			...)
+{
+	va_list args;
+	gchar *msg;
+	va_start(args, format);
+	msg = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	sipe_backend_debug_literal(level, msg);
+	g_free(msg);
+}
+gboolean sipe_backend_debug_enabled(void)
+{
+	return TRUE;
+}
+gchar *sipe_backend_markup_css_property(SIPE_UNUSED_PARAMETER const gchar *style,
+					SIPE_UNUSED_PARAMETER const gchar *option) { return(NULL); }
+void sipe_mime_parts_foreach(SIPE_UNUSED_PARAMETER const gchar *type,
+			     SIPE_UNUSED_PARAMETER const gchar *body,
+			     SIPE_UNUSED_PARAMETER sipe_mime_parts_cb callback,
+			     SIPE_UNUSED_PARAMETER gpointer user_data) {}
+
+const gchar *sip_transport_epid(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private) { return(NULL); }
+char *generateUUIDfromEPID(SIPE_UNUSED_PARAMETER const gchar *epid) { return(NULL); }
+char *sipe_get_epid(SIPE_UNUSED_PARAMETER const char *self_sip_uri,
+		    SIPE_UNUSED_PARAMETER const char *hostname,
+		    SIPE_UNUSED_PARAMETER const char *ip_address) { return(NULL); }
+
+/* recorded (anonymized) OCS traffic: header blocks only */
+static const gchar benotify[] =
+	"BENOTIFY sip:alice@contoso.com SIP/2.0\r\n"
+	"Authentication-Info: NTLM rspauth=\"01000000B3C4D5E6F7A8B9C065000000\", srand=\"9E1D0A7B\", snum=\"115\", opaque=\"6C9B2E30\", qop=\"auth\", targetname=\"ocs1.contoso.com\", realm=\"SIP Communications Service\"\r\n"
+	"Via: SIP/2.0/TLS 10.1.2.3:51524;branch=z9hG4bK0A1B2C3D.6E7F8091A2B3C4D5;branched=FALSE;received=192.0.2.17\r\n"
+	"Max-Forwards: 70\r\n"
+	"From: <sip:alice@contoso.com>;tag=1f2e3d4c5b;epid=28f8c4e5b7\r\n"
+	"To: <sip:alice@contoso.com>;tag=77aa88bb99;epid=28f8c4e5b7\r\n"
+	"Call-ID: 5b4a39281706f5e4d3c2b1a098877665\r\n"
+	"CSeq: 42 BENOTIFY\r\n"
+	"Content-Type: multipart/related; type=\"application/rlmi+xml\";start=resourceList; boundary=\r\n"
+	" \tb9f5c8a1e0d34c6a8e7f1a2b3c4d5e6f\r\n"
+	"Require: eventlist\r\n"
+	"Event: presence\r\n"
+	"subscription-state: active;expires=27200\r\n"
+	"ms-piggyback-cseq: 2\r\n"
+	"Content-Length: 5120\r\n";
+
+static const gchar response[] =
+	"SIP/2.0 200 OK\r\n"
+	"Via: SIP/2.0/TLS 10.1.2.3:51524;branch=z9hG4bKAABBCCDD;received=192.0.2.17\r\n"
+	"VIA: SIP/2.0/TLS 10.1.2.4:5061;branch=z9hG4bK11223344\r\n"
+	"From: \"Alice Example\"<sip:alice@contoso.com>;tag=5e6f708192;epid=28f8c4e5b7\r\n"
+	"To: <sip:alice@contoso.com>;tag=8090A0B0C0\r\n"
+	"Call-ID: 9b1c2d3e4f5a6b7c0f6d4b6c3e8a4e7f\r\n"
+	"CSeq: 5 SUBSCRIBE\r\n"
+	"Expires: 28800\r\n"
+	"Event: presence\r\n"
+	"Event: vnd-microsoft-roaming-self\r\n"
+	"Content-Length: 0\r\n";
+
+/* test helpers */
+static guint succeeded = 0;
+static guint failed    = 0;
+static const gchar *testname;
+
+static void assert_string(const gchar *what,
+			  const gchar *value,
+			  const gchar *expected)
+{
+	if (sipe_strequal(value, expected)) {
+		succeeded++;
+	} else {
+		printf("[%s]\n%s FAILED: '%s' expected: '%s'\n",
+		       testname, what,
+		       value    ? value    : "(nil)",
+		       expected ? expected : "(nil)");
+		failed++;
+	}
+}
+
+static void assert_int(const gchar *what,
+		       int value,
+		       int expected)
+{
+	if (value == expected) {
+		succeeded++;
+	} else {
+		printf("[%s]\n%s FAILED: %d expected: %d\n",
+		       testname, what, value, expected);
+		failed++;
+	}
+}
+
+static void assert_header(const struct sipmsg *msg,
+			  const gchar *name,
+			  const gchar *expected)
+{
+	assert_string(name, sipmsg_find_header(msg, name), expected);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
+{
+	struct sipmsg *msg;
+	struct sipmsg *copy;
+	gchar *snum;
+	static const gchar *keepers[] = { "Call-ID", "Via", NULL };
+
+	/* request line, folding, case-insensitive lookup */
+	testname = "BENOTIFY";
+	msg = sipmsg_parse_header(benotify);
+	if (!msg) {
+		printf("[%s]\nparse FAILED\n", testname);
+		return(1);
+	}
+	assert_string("method", msg->method, "BENOTIFY");
+	assert_string("target", msg->target, "sip:alice@contoso.com");
+	assert_int("response", msg->response, 0);
+	assert_int("bodylen",  msg->bodylen,  5120);
+	assert_header(msg, "Call-ID", "5b4a39281706f5e4d3c2b1a098877665");
+	assert_header(msg, "call-id", "5b4a39281706f5e4d3c2b1a098877665");
+	assert_header(msg, "CALL-ID", "5b4a39281706f5e4d3c2b1a098877665");
+	assert_header(msg, "CSeq",    "42 BENOTIFY");
+	assert_header(msg, "Content-Type",
+		      "multipart/related; type=\"application/rlmi+xml\";start=resourceList; boundary= b9f5c8a1e0d34c6a8e7f1a2b3c4d5e6f");
+	assert_header(msg, "Subscription-State", "active;expires=27200");
+	assert_header(msg, "Require",            "eventlist");
+	assert_header(msg, "ms-piggyback-cseq",  "2");
+	assert_header(msg, "Max-Forwards",       "70");
+	assert_header(msg, "Expires",             NULL);
+	assert_header(msg, "Contact",             NULL);
+	assert_header(msg, "P-Asserted-Identity", NULL);
+	assert_header(msg, "X-Unknown",           NULL);
+	assert_string("index Event",
+		      sipmsg_find_header_id(msg, SIPMSG_HEADER_EVENT),
+		      "presence");
+	snum = sipmsg_find_part_of_header(sipmsg_find_header_id(msg, SIPMSG_HEADER_AUTHENTICATION_INFO),
+					  "snum=\"", "\"", NULL);
+	assert_string("index Authentication-Info", snum, "115");
+	g_free(snum);
+
+	/* index follows header changes */
+	testname = "BENOTIFY modified";
+	sipmsg_add_header_now(msg, "Expires", "300");
+	assert_header(msg, "Expires", "300");
+	sipmsg_remove_header_now(msg, "call-id");
+	assert_header(msg, "Call-ID", NULL);
+	sipmsg_add_header(msg, "Call-ID", "new-call-id");
+	assert_header(msg, "Call-ID", NULL);
+	sipmsg_merge_new_headers(msg);
+	assert_header(msg, "Call-ID", "new-call-id");
+
+	copy = sipmsg_copy(msg);
+	sipmsg_free(msg);
+	testname = "BENOTIFY copy";
+	assert_header(copy, "Call-ID", "new-call-id");
+	assert_header(copy, "Expires", "300");
+	assert_header(copy, "Event",   "presence");
+	sipmsg_strip_headers(copy, keepers);
+	assert_header(copy, "Call-ID", "new-call-id");
+	assert_header(copy, "Via",     "SIP/2.0/TLS 10.1.2.3:51524;branch=z9hG4bK0A1B2C3D.6E7F8091A2B3C4D5;branched=FALSE;received=192.0.2.17");
+	assert_header(copy, "Expires", NULL);
+	assert_header(copy, "Event",   NULL);
+	assert_header(copy, "Require", NULL);
+	sipmsg_free(copy);
+
+	/* response, multiple instances */
+	testname = "200 OK";
+	msg = sipmsg_parse_header(response);
+	if (!msg) {
+		printf("[%s]\nparse FAILED\n", testname);
+		return(1);
+	}
+	assert_int("response",       msg->response, 200);
+	assert_string("responsestr", msg->responsestr, "OK");
+	assert_string("method",      msg->method, "SUBSCRIBE");
+	assert_int("bodylen",        msg->bodylen, 0);
+	assert_header(msg, "Via", "SIP/2.0/TLS 10.1.2.3:51524;branch=z9hG4bKAABBCCDD;received=192.0.2.17");
+	assert_string("Via #2",
+		      sipmsg_find_header_instance(msg, "Via", 1),
+		      "SIP/2.0/TLS 10.1.2.4:5061;branch=z9hG4bK11223344");
+	assert_header(msg, "Event", "presence");
+	assert_string("Event #2",
+		      sipmsg_find_header_instance(msg, "Event", 1),
+		      "vnd-microsoft-roaming-self");
+	assert_int("CSeq", sipmsg_parse_cseq(msg), 5);
+
+	/* removing the first instance promotes the next one */
+	testname = "200 OK modified";
+	sipmsg_remove_header_now(msg, "Via");
+	assert_header(msg, "Via", "SIP/2.0/TLS 10.1.2.4:5061;branch=z9hG4bK11223344");
+	sipmsg_remove_header_now(msg, "Event");
+	assert_header(msg, "Event", "vnd-microsoft-roaming-self");
+	sipmsg_remove_header_now(msg, "Event");
+	assert_header(msg, "Event", NULL);
+	sipmsg_free(msg);
+
+	/* request builder */
+	testname = "request builder";
+	msg = sipmsg_new_request("SUBSCRIBE", "sip:alice@contoso.com");
+	sipmsg_add_header_lines_now(msg,
+				    "Event: presence\r\n"
+				    "Accept: application/msrtc-event-categories+xml,\r\n"
+				    " \ttext/xml+msrtc.pidf,\r\n"
+				    "\tapplication/pidf+xml\r\n"
+				    "Supported: eventlist\r\n"
+				    "Require:  adhoclist, categoryList");
+	assert_header(msg, "Event",     "presence");
+	assert_header(msg, "Accept",    "application/msrtc-event-categories+xml, text/xml+msrtc.pidf, application/pidf+xml");
+	assert_header(msg, "Supported", "eventlist");
+	assert_header(msg, "Require",   "adhoclist, categoryList");
+	assert_int("headers", g_slist_length(msg->headers), 4);
+	sipmsg_free(msg);
+
+	/* header names */
+	testname = "header IDs";
+	assert_int("Content-Length",
+		   sipmsg_header_id("content-length", 14),
+		   SIPMSG_HEADER_CONTENT_LENGTH);
+	assert_int("Content-Length prefix",
+		   sipmsg_header_id("Content-Length: 0", 14),
+		   SIPMSG_HEADER_CONTENT_LENGTH);
+	assert_int("Content",
+		   sipmsg_header_id("Content-Length", 7),
+		   SIPMSG_HEADER_UNKNOWN);
+	assert_int("Max-Forwards",
+		   sipmsg_header_id("Max-Forwards", 12),
+		   SIPMSG_HEADER_UNKNOWN);
+
+	/* broken messages */
+	testname = "no colon";
+	msg = sipmsg_parse_header("NOTIFY sip:alice@contoso.com SIP/2.0\r\n"
+				  "Call-ID 1234\r\n");
+	assert_int("parse", msg == NULL, TRUE);
+	sipmsg_free(msg);
+
+	testname = "no request line";
+	msg = sipmsg_parse_header("NOTIFY\r\n"
+				  "Call-ID: 1234\r\n");
+	assert_int("parse", msg == NULL, TRUE);
+	sipmsg_free(msg);
+
+	testname = "no Content-Length";
+	msg = sipmsg_parse_header("NOTIFY sip:alice@contoso.com SIP/2.0\r\n"
+				  "Content-Type: text/plain\r\n");
+	assert_int("response",
+		   msg ? msg->response : 0,
+		   SIPMSG_RESPONSE_FATAL_ERROR);
+	sipmsg_free(msg);
+
+	testname = "chunked";
+	msg = sipmsg_parse_header("HTTP/1.1 200 OK\r\n"
+				  "Transfer-Encoding: chunked\r\n"
+				  "CSeq: 1 GET\r\n");
+	assert_int("bodylen",
+		   msg ? msg->bodylen : 0,
+		   SIPMSG_BODYLEN_CHUNKED);
+	sipmsg_free(msg);
+
+	printf("Result: %d PASSED %d FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
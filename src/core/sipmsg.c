@@ -22,6 +22,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -36,61 +37,242 @@
 
 struct sipmsg *sipmsg_parse_msg(const gchar *msg) {
 	const char *tmp = strstr(msg, "\r\n\r\n");
-	char *line;
 	struct sipmsg *smsg;
 
 	if(!tmp) return NULL;
 
-	line = g_strndup(msg, tmp - msg);
+	smsg = sipmsg_parse_header_block(msg, tmp - msg);
+	if (smsg)
+		smsg->body = g_strdup(tmp + 4);
 
-	smsg = sipmsg_parse_header(line);
-	smsg->body = g_strdup(tmp + 4);
-
-	g_free(line);
 	return smsg;
 }
 
+/* returns pointer to CR of next CRLF or to the terminating NUL */
+static gchar *sipmsg_line_end(gchar *line)
+{
+	while (*line && !((line[0] == '\r') && (line[1] == '\n')))
+		line++;
+	return(line);
+}
+
+static gchar *sipmsg_next_line(gchar *line_end)
+{
+	return(*line_end ? line_end + 2 : line_end);
+}
+
+#define SIPMSG_IS_LWS(c) (((c) == ' ') || ((c) == '\t'))
+
+#define SIPMSG_HEADER_NAME(s) { s, sizeof(s) - 1 }
+static const struct {
+	const gchar *name;
+	gsize length;
+} sipmsg_header_names[SIPMSG_HEADER_UNKNOWN] = {
+	SIPMSG_HEADER_NAME("Authentication-Info"),
+	SIPMSG_HEADER_NAME("Call-ID"),
+	SIPMSG_HEADER_NAME("Contact"),
+	SIPMSG_HEADER_NAME("Content-Length"),
+	SIPMSG_HEADER_NAME("Content-Type"),
+	SIPMSG_HEADER_NAME("CSeq"),
+	SIPMSG_HEADER_NAME("Event"),
+	SIPMSG_HEADER_NAME("Expires"),
+	SIPMSG_HEADER_NAME("From"),
+	SIPMSG_HEADER_NAME("ms-diagnostics"),
+	SIPMSG_HEADER_NAME("P-Asserted-Identity"),
+	SIPMSG_HEADER_NAME("P-Preferred-Identity"),
+	SIPMSG_HEADER_NAME("Proxy-Authentication-Info"),
+	SIPMSG_HEADER_NAME("Proxy-Authorization"),
+	SIPMSG_HEADER_NAME("Subscription-State"),
+	SIPMSG_HEADER_NAME("To"),
+	SIPMSG_HEADER_NAME("Transfer-Encoding"),
+	SIPMSG_HEADER_NAME("Via"),
+};
+
+enum sipmsg_header_id sipmsg_header_id(const gchar *name, gsize length)
+{
+	guint id;
+
+	for (id = 0; id < SIPMSG_HEADER_UNKNOWN; id++)
+		if ((sipmsg_header_names[id].length == length) &&
+		    (g_ascii_strncasecmp(sipmsg_header_names[id].name,
+					 name,
+					 length) == 0))
+			return(id);
+
+	return(SIPMSG_HEADER_UNKNOWN);
+}
+
+/* header was appended: index it if it is the first instance */
+static void sipmsg_header_index_add(struct sipmsg *msg,
+				    const struct sipnameval *elem)
+{
+	enum sipmsg_header_id id = sipmsg_header_id(elem->name,
+						    strlen(elem->name));
+	if ((id != SIPMSG_HEADER_UNKNOWN) && !msg->header_index[id])
+		msg->header_index[id] = elem;
+}
+
+/* header will be removed: move index entry to the next instance */
+static void sipmsg_header_index_remove(struct sipmsg *msg,
+				       const struct sipnameval *elem)
+{
+	enum sipmsg_header_id id = sipmsg_header_id(elem->name,
+						    strlen(elem->name));
+	if ((id != SIPMSG_HEADER_UNKNOWN) &&
+	    (msg->header_index[id] == elem)) {
+		const GSList *entry;
+
+		msg->header_index[id] = NULL;
+		for (entry = msg->headers; entry; entry = entry->next) {
+			const struct sipnameval *next = entry->data;
+			if ((next != elem) &&
+			    sipe_strcase_equal(next->name, elem->name)) {
+				msg->header_index[id] = next;
+				break;
+			}
+		}
+	}
+}
+
+/* parsed headers are owned by the message */
+static gboolean sipmsg_header_is_parsed(const struct sipmsg *msg,
+					const struct sipnameval *elem)
+{
+	return((msg->parsed_count > 0) &&
+	       (elem >= msg->parsed_namevals) &&
+	       (elem <  msg->parsed_namevals + msg->parsed_count));
+}
+
+static void sipmsg_header_free(const struct sipmsg *msg,
+			       struct sipnameval *elem)
+{
+	if (!sipmsg_header_is_parsed(msg, elem)) {
+		g_free(elem->name);
+		g_free(elem->value);
+		g_free(elem);
+	}
+}
+
 struct sipmsg *sipmsg_parse_header(const gchar *header) {
-	struct sipmsg *msg = g_new0(struct sipmsg,1);
-	gchar **lines = g_strsplit(header,"\r\n",0);
-	gchar **parts;
+	return(sipmsg_parse_header_block(header, strlen(header)));
+}
+
+struct sipmsg *sipmsg_parse_header_block(const gchar *header, gsize length) {
+	struct sipmsg *msg;
+	gchar *block = g_strndup(header, length);
+	gchar *line_end = sipmsg_line_end(block);
+	gchar *first_space;
+	gchar *second_space;
+	gchar *current;
 	const gchar *contentlength;
-	if(!lines[0]) {
-		g_strfreev(lines);
-		g_free(msg);
-		return NULL;
-	}
-	parts = g_strsplit(lines[0], " ", 3);
-	if(!parts[0] || !parts[1] || !parts[2]) {
-		g_strfreev(parts);
-		g_strfreev(lines);
-		g_free(msg);
+	GArray *headers;
+	gboolean failed = FALSE;
+	guint i;
+
+	/* request or status line: 3 space separated parts */
+	first_space = memchr(block, ' ', line_end - block);
+	second_space = first_space ?
+		memchr(first_space + 1, ' ', line_end - first_space - 1) :
+		NULL;
+	if (!second_space) {
+		g_free(block);
 		return NULL;
 	}
-	if(strstr(parts[0],"SIP") || strstr(parts[0],"HTTP")) { /* numeric response */
-		msg->responsestr = g_strdup(parts[2]);
-		msg->response = strtol(parts[1],NULL,10);
+
+	msg = g_new0(struct sipmsg, 1);
+	if (g_strstr_len(block, first_space - block, "SIP") ||
+	    g_strstr_len(block, first_space - block, "HTTP")) { /* numeric response */
+		msg->responsestr = g_strndup(second_space + 1,
+					     line_end - second_space - 1);
+		msg->response = strtol(first_space + 1, NULL, 10);
 	} else { /* request */
-		msg->method = g_strdup(parts[0]);
-		msg->target = g_strdup(parts[1]);
+		msg->method = g_strndup(block, first_space - block);
+		msg->target = g_strndup(first_space + 1,
+					second_space - first_space - 1);
 		msg->response = 0;
 	}
-	g_strfreev(parts);
-	if (sipe_utils_parse_lines(&msg->headers, lines + 1, ":") == FALSE) {
-		g_strfreev(lines);
+
+	/*
+	 * Header lines: split in-place into NUL terminated name & value.
+	 * Folded continuation lines are moved back to the end of the value.
+	 * This never overwrites data that hasn't been scanned yet.
+	 */
+	headers = g_array_new(FALSE, FALSE, sizeof(struct sipmsg_header));
+	current = sipmsg_next_line(line_end);
+	while (*current && !((current[0] == '\r') && (current[1] == '\n'))) {
+		struct sipmsg_header hdr;
+		gchar *colon;
+		gchar *value;
+		gchar *write;
+
+		line_end = sipmsg_line_end(current);
+		colon = memchr(current, ':', line_end - current);
+		if (!colon) {
+			failed = TRUE;
+			break;
+		}
+		*colon = '\0';
+		hdr.name.offset = current - block;
+		hdr.name.length = colon - current;
+
+		value = colon + 1;
+		while (SIPMSG_IS_LWS(*value)) value++;
+		write   = line_end;
+		current = sipmsg_next_line(line_end);
+
+		while (SIPMSG_IS_LWS(*current)) {
+			gsize fold_length;
+
+			while (SIPMSG_IS_LWS(*current)) current++;
+			line_end    = sipmsg_line_end(current);
+			fold_length = line_end - current;
+			*write++ = ' ';
+			memmove(write, current, fold_length);
+			write  += fold_length;
+			current = sipmsg_next_line(line_end);
+		}
+		*write = '\0';
+
+		hdr.value.offset = value - block;
+		hdr.value.length = write - value;
+		g_array_append_val(headers, hdr);
+	}
+
+	msg->header_block    = block;
+	msg->parsed_count    = headers->len;
+	msg->parsed_headers  = (struct sipmsg_header *) g_array_free(headers,
+								     FALSE);
+	msg->parsed_namevals = g_new(struct sipnameval, msg->parsed_count);
+	for (i = msg->parsed_count; i > 0; i--) {
+		const struct sipmsg_header *hdr = msg->parsed_headers + i - 1;
+		struct sipnameval *elem         = msg->parsed_namevals + i - 1;
+
+		enum sipmsg_header_id id;
+
+		elem->name  = block + hdr->name.offset;
+		elem->value = block + hdr->value.offset;
+		msg->headers = g_slist_prepend(msg->headers, elem);
+
+		/* reverse order: last update is the first instance */
+		id = sipmsg_header_id(elem->name, hdr->name.length);
+		if (id != SIPMSG_HEADER_UNKNOWN)
+			msg->header_index[id] = elem;
+	}
+
+	if (failed) {
 		sipmsg_free(msg);
 		return NULL;
 	}
-	g_strfreev(lines);
-	contentlength = sipmsg_find_header(msg, "Content-Length");
+
+	contentlength = sipmsg_find_header_id(msg, SIPMSG_HEADER_CONTENT_LENGTH);
 	if (contentlength) {
 		msg->bodylen = strtol(contentlength,NULL,10);
 	} else {
-		const gchar *tmp = sipmsg_find_header(msg, "Transfer-Encoding");
+		const gchar *tmp = sipmsg_find_header_id(msg, SIPMSG_HEADER_TRANSFER_ENCODING);
 		if (tmp && sipe_strcase_equal(tmp, "chunked")) {
 			msg->bodylen = SIPMSG_BODYLEN_CHUNKED;
 		} else {
-			tmp = sipmsg_find_header(msg, "Content-Type");
+			tmp = sipmsg_find_header_id(msg, SIPMSG_HEADER_CONTENT_TYPE);
 			if (tmp) {
 				/*
 				 * This is a fatal error situation: the message
@@ -108,14 +290,13 @@ struct sipmsg *sipmsg_parse_header(const gchar *header) {
 	}
 	if(msg->response) {
 		const gchar *tmp;
-		tmp = sipmsg_find_header(msg, "CSeq");
+		tmp = sipmsg_find_header_id(msg, SIPMSG_HEADER_CSEQ);
 		if(!tmp) {
 			/* SHOULD NOT HAPPEN */
 			msg->method = 0;
 		} else {
-			parts = g_strsplit(tmp, " ", 2);
-			msg->method = g_strdup(parts[1]);
-			g_strfreev(parts);
+			tmp = strchr(tmp, ' ');
+			msg->method = tmp ? g_strdup(tmp + 1) : NULL;
 		}
 	}
 	return msg;
@@ -153,10 +334,10 @@ struct sipmsg *sipmsg_copy(const struct sipmsg *other) {
 	return msg;
 }
 
-char *sipmsg_to_string(const struct sipmsg *msg) {
+void sipmsg_serialize(const struct sipmsg *msg, GString *outstr) {
 	GSList *cur;
-	GString *outstr = g_string_new("");
-	struct sipnameval *elem;
+
+	g_string_truncate(outstr, 0);
 
 	if(msg->response)
 		g_string_append_printf(outstr, "SIP/2.0 %d Unknown\r\n",
@@ -165,24 +346,105 @@ char *sipmsg_to_string(const struct sipmsg *msg) {
 		g_string_append_printf(outstr, "%s %s SIP/2.0\r\n",
 			msg->method, msg->target);
 
-	cur = msg->headers;
-	while(cur) {
-		elem = cur->data;
-                /*Todo: remove the LFCR in a good way*/
-                /*if(sipe_strequal(elem->name,"Proxy-Authorization"))
-                  g_string_append_printf(outstr, "%s: %s", elem->name,
-			elem->value);
-                else     */
-		   g_string_append_printf(outstr, "%s: %s\r\n", elem->name,
-			elem->value);
-		cur = g_slist_next(cur);
+	for (cur = msg->headers; cur; cur = cur->next) {
+		const struct sipnameval *elem = cur->data;
+		g_string_append(outstr, elem->name);
+		g_string_append_len(outstr, ": ", 2);
+		g_string_append(outstr, elem->value);
+		g_string_append_len(outstr, "\r\n", 2);
 	}
 
-	g_string_append_printf(outstr, "\r\n%s", msg->bodylen ? msg->body : "");
+	g_string_append_len(outstr, "\r\n", 2);
+	if (msg->bodylen && msg->body)
+		g_string_append(outstr, msg->body);
+}
 
+char *sipmsg_to_string(const struct sipmsg *msg) {
+	GString *outstr = g_string_new("");
+	sipmsg_serialize(msg, outstr);
 	return g_string_free(outstr, FALSE);
 }
 
+struct sipmsg *sipmsg_new_request(const gchar *method, const gchar *target) {
+	struct sipmsg *msg = g_new0(struct sipmsg, 1);
+	msg->method = g_strdup(method);
+	msg->target = g_strdup(target);
+	return msg;
+}
+
+static void sipmsg_append_header_now(struct sipmsg *msg,
+				     gchar *name,
+				     gchar *value)
+{
+	struct sipnameval *element = g_new(struct sipnameval, 1);
+
+	element->name = name;
+	element->value = value;
+	msg->headers = g_slist_append(msg->headers, element);
+	sipmsg_header_index_add(msg, element);
+}
+
+void sipmsg_add_header_printf_now(struct sipmsg *msg, const gchar *name,
+				  const gchar *format, ...) {
+	va_list args;
+	gchar *value;
+
+	va_start(args, format);
+	value = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	sipmsg_append_header_now(msg, g_strdup(name), value);
+}
+
+void sipmsg_add_header_lines_now(struct sipmsg *msg, const gchar *lines) {
+	while (lines && *lines) {
+		const gchar *end = strstr(lines, "\r\n");
+		const gchar *colon;
+		const gchar *value;
+
+		if (!end)
+			end = lines + strlen(lines);
+
+		colon = memchr(lines, ':', end - lines);
+		if (colon) {
+			GString *folded;
+
+			for (value = colon + 1;
+			     (value < end) && SIPMSG_IS_LWS(*value);
+			     value++);
+			folded = g_string_new_len(value, end - value);
+
+			/* folded continuation lines: same as the parser */
+			while (*end && SIPMSG_IS_LWS(end[2])) {
+				const gchar *fold = end + 2;
+
+				while (SIPMSG_IS_LWS(*fold)) fold++;
+				end = strstr(fold, "\r\n");
+				if (!end)
+					end = fold + strlen(fold);
+				g_string_append_c(folded, ' ');
+				g_string_append_len(folded, fold, end - fold);
+			}
+
+			sipmsg_append_header_now(msg,
+						 g_strndup(lines, colon - lines),
+						 g_string_free(folded, FALSE));
+		} else if (end != lines) {
+			/* SANITY CHECK: the calling code must be fixed if this happens! */
+			SIPE_DEBUG_ERROR("sipmsg_add_header_lines_now: ignoring invalid header line '%.*s'",
+					 (int) (end - lines), lines);
+		}
+
+		lines = *end ? end + 2 : end;
+	}
+}
+
+void sipmsg_set_body(struct sipmsg *msg, const gchar *body) {
+	g_free(msg->body);
+	msg->body    = g_strdup(body ? body : "");
+	msg->bodylen = strlen(msg->body);
+}
+
 /**
  * Adds header to current message headers
  */
@@ -199,6 +461,7 @@ void sipmsg_add_header_now(struct sipmsg *msg, const gchar *name, const gchar *v
 	element->name = g_strdup(name);
 	element->value = g_strdup(value);
 	msg->headers = g_slist_append(msg->headers, element);
+	sipmsg_header_index_add(msg, element);
 }
 
 /**
@@ -242,11 +505,10 @@ void sipmsg_strip_headers(struct sipmsg *msg, const gchar *keepers[]) {
 		if (!keeper) {
 			GSList *to_delete = entry;
 			SIPE_DEBUG_INFO("sipmsg_strip_headers: removing %s", elem->name);
+			sipmsg_header_index_remove(msg, elem);
 			entry = g_slist_next(entry);
 			msg->headers = g_slist_delete_link(msg->headers, to_delete);
-			g_free(elem->name);
-			g_free(elem->value);
-			g_free(elem);
+			sipmsg_header_free(msg, elem);
 		} else {
 			entry = g_slist_next(entry);
 		}
@@ -259,14 +521,22 @@ void sipmsg_strip_headers(struct sipmsg *msg, const gchar *keepers[]) {
 void sipmsg_merge_new_headers(struct sipmsg *msg) {
 	while(msg->new_headers) {
 		msg->headers = g_slist_append(msg->headers, msg->new_headers->data);
+		sipmsg_header_index_add(msg, msg->new_headers->data);
 		msg->new_headers = g_slist_remove(msg->new_headers, msg->new_headers->data);
 	}
 }
 
 void sipmsg_free(struct sipmsg *msg) {
 	if (msg) {
-		sipe_utils_nameval_free(msg->headers);
+		GSList *entry;
+
+		for (entry = msg->headers; entry; entry = entry->next)
+			sipmsg_header_free(msg, entry->data);
+		g_slist_free(msg->headers);
 		sipe_utils_nameval_free(msg->new_headers);
+		g_free(msg->parsed_namevals);
+		g_free(msg->parsed_headers);
+		g_free(msg->header_block);
 		g_free(msg->signature);
 		g_free(msg->rand);
 		g_free(msg->num);
@@ -285,10 +555,9 @@ void sipmsg_remove_header_now(struct sipmsg *msg, const gchar *name) {
 		elem = tmp->data;
 		// OCS2005 can send the same header in either all caps or mixed case
 		if (sipe_strcase_equal(elem->name, name)) {
+			sipmsg_header_index_remove(msg, elem);
 			msg->headers = g_slist_remove(msg->headers, elem);
-			g_free(elem->name);
-			g_free(elem->value);
-			g_free(elem);
+			sipmsg_header_free(msg, elem);
 			return;
 		}
 		tmp = g_slist_next(tmp);
@@ -297,11 +566,42 @@ void sipmsg_remove_header_now(struct sipmsg *msg, const gchar *name) {
 }
 
 const gchar *sipmsg_find_header(const struct sipmsg *msg, const gchar *name) {
-	return sipe_utils_nameval_find_instance (msg->headers, name, 0);
+	return sipmsg_find_header_instance(msg, name, 0);
+}
+
+const gchar *sipmsg_find_header_id(const struct sipmsg *msg,
+				   enum sipmsg_header_id id)
+{
+	const struct sipnameval *elem = msg->header_index[id];
+	return(elem ? elem->value : NULL);
 }
 
 const gchar *sipmsg_find_header_instance(const struct sipmsg *msg, const gchar *name, int which) {
-	return sipe_utils_nameval_find_instance(msg->headers, name, which);
+	gsize name_length = strlen(name);
+	const GSList *entry;
+
+	if (which == 0) {
+		enum sipmsg_header_id id = sipmsg_header_id(name, name_length);
+		if (id != SIPMSG_HEADER_UNKNOWN)
+			return(sipmsg_find_header_id(msg, id));
+	}
+
+	for (entry = msg->headers; entry; entry = entry->next) {
+		const struct sipnameval *elem = entry->data;
+		/* parsed headers: compare length first without strlen() */
+		gsize length = sipmsg_header_is_parsed(msg, elem) ?
+			msg->parsed_headers[elem - msg->parsed_namevals].name.length :
+			strlen(elem->name);
+
+		// OCS2005 can send the same header in either all caps or mixed case
+		if ((length == name_length) &&
+		    (g_ascii_strncasecmp(elem->name, name, length) == 0)) {
+			if (which == 0)
+				return elem->value;
+			which--;
+		}
+	}
+	return NULL;
 }
 
 gchar *sipmsg_find_part_of_header(const char *hdr, const char * before, const char * after, const char * def) {
@@ -31,6 +31,45 @@
 #define SIPMSG_RESPONSE_FATAL_ERROR -1
 #define SIPMSG_BODYLEN_CHUNKED      -1
 
+/*
+ * Well-known headers with O(1) lookup, see sipmsg_find_header_id()
+ *
+ * NOTE: keep in sync with sipmsg_header_names[] in sipmsg.c
+ */
+enum sipmsg_header_id {
+	SIPMSG_HEADER_AUTHENTICATION_INFO = 0,
+	SIPMSG_HEADER_CALL_ID,
+	SIPMSG_HEADER_CONTACT,
+	SIPMSG_HEADER_CONTENT_LENGTH,
+	SIPMSG_HEADER_CONTENT_TYPE,
+	SIPMSG_HEADER_CSEQ,
+	SIPMSG_HEADER_EVENT,
+	SIPMSG_HEADER_EXPIRES,
+	SIPMSG_HEADER_FROM,
+	SIPMSG_HEADER_MS_DIAGNOSTICS,
+	SIPMSG_HEADER_P_ASSERTED_IDENTITY,
+	SIPMSG_HEADER_P_PREFERRED_IDENTITY,
+	SIPMSG_HEADER_PROXY_AUTHENTICATION_INFO,
+	SIPMSG_HEADER_PROXY_AUTHORIZATION,
+	SIPMSG_HEADER_SUBSCRIPTION_STATE,
+	SIPMSG_HEADER_TO,
+	SIPMSG_HEADER_TRANSFER_ENCODING,
+	SIPMSG_HEADER_VIA,
+	SIPMSG_HEADER_UNKNOWN /* must be last */
+};
+
+/* location of a string inside sipmsg->header_block */
+struct sipmsg_slice {
+	guint offset;
+	guint length;
+};
+
+/* header parsed by sipmsg_parse_header() */
+struct sipmsg_header {
+	struct sipmsg_slice name;
+	struct sipmsg_slice value;
+};
+
 struct sipmsg {
 	int response; /* 0 means request, otherwise response code */
 	gchar *responsestr;
@@ -43,6 +82,19 @@ struct sipmsg {
 	gchar *signature;
 	gchar *rand;
 	gchar *num;
+	/*
+	 * private: storage for parsed headers
+	 *
+	 * The sipnameval entries in "headers" created by the parser are taken
+	 * from parsed_namevals. Their name & value point into header_block,
+	 * i.e. they are owned by the message and must not be freed separately.
+	 */
+	gchar *header_block;
+	struct sipmsg_header *parsed_headers;
+	struct sipnameval *parsed_namevals;
+	guint parsed_count;
+	/* private: first instance of each well-known header in "headers" */
+	const struct sipnameval *header_index[SIPMSG_HEADER_UNKNOWN];
 };
 
 struct sipendpoint {
@@ -53,8 +105,71 @@ struct sipendpoint {
 
 struct sipmsg *sipmsg_parse_msg(const gchar *msg);
 struct sipmsg *sipmsg_parse_header(const gchar *header);
+
+/**
+ * Parses SIP/HTTP header block in a single pass
+ *
+ * The block is copied once and header names & values are stored as slices
+ * of that copy. Folded continuation lines are joined with a single space.
+ *
+ * @param header (in) start of the header block. Doesn't need to be NUL terminated.
+ * @param length (in) length of the header block
+ *
+ * @return parsed message or @c NULL on parser error
+ */
+struct sipmsg *sipmsg_parse_header_block(const gchar *header, gsize length);
 struct sipmsg *sipmsg_copy(const struct sipmsg *other);
 void sipmsg_add_header_now(struct sipmsg *msg, const gchar *name, const gchar *value);
+
+/**
+ * Request builder: creates an empty SIP request
+ *
+ * Add headers with sipmsg_add_header_now() & friends, set the body with
+ * sipmsg_set_body() and send it with sipmsg_serialize().
+ *
+ * @param method (in) request method
+ * @param target (in) request URI
+ *
+ * @return new SIP message. Must be freed with sipmsg_free().
+ */
+struct sipmsg *sipmsg_new_request(const gchar *method, const gchar *target);
+
+/**
+ * Request builder: adds header with formatted value to current message headers
+ */
+void sipmsg_add_header_printf_now(struct sipmsg *msg, const gchar *name,
+				  const gchar *format, ...) G_GNUC_PRINTF(3, 4);
+
+/**
+ * Request builder: adds header lines to current message headers
+ *
+ * @param msg   (in) SIP message
+ * Folded continuation lines are joined to the value with one space, the
+ * same way as sipmsg_parse_header() does it.
+ *
+ * @param lines (in) header lines in the format "Name: value\r\n..." or @c NULL
+ */
+void sipmsg_add_header_lines_now(struct sipmsg *msg, const gchar *lines);
+
+/**
+ * Request builder: sets the message body
+ *
+ * NOTE: doesn't add Content-Length header
+ *
+ * @param msg  (in) SIP message
+ * @param body (in) body text or @c NULL for no body
+ */
+void sipmsg_set_body(struct sipmsg *msg, const gchar *body);
+
+/**
+ * Serializes SIP message into a string buffer
+ *
+ * Allows the caller to reuse the same buffer for multiple messages.
+ *
+ * @param msg    (in) SIP message
+ * @param buffer (in) string buffer. Old contents are replaced.
+ */
+void sipmsg_serialize(const struct sipmsg *msg, GString *buffer);
 void sipmsg_add_header(struct sipmsg *msg, const gchar *name, const gchar *value);
 void sipmsg_strip_headers(struct sipmsg *msg, const gchar *keepers[]);
 void sipmsg_merge_new_headers(struct sipmsg *msg);
@@ -86,6 +201,27 @@ GSList *sipmsg_parse_endpoints_header(const gchar *header);
 void sipmsg_parse_p_asserted_identity(const gchar *header, gchar **sip_uri,
 				      gchar **tel_uri);
 const gchar *sipmsg_find_header(const struct sipmsg *msg, const gchar *name);
+
+/**
+ * Maps header name to well-known header ID
+ *
+ * @param name   (in) header name (case insensitive)
+ * @param length (in) length of header name
+ *
+ * @return header ID or @c SIPMSG_HEADER_UNKNOWN
+ */
+enum sipmsg_header_id sipmsg_header_id(const gchar *name, gsize length);
+
+/**
+ * Finds the first instance of a well-known header in O(1)
+ *
+ * @param msg (in) SIP message
+ * @param id  (in) well-known header ID
+ *
+ * @return header value or @c NULL if the message doesn't contain the header
+ */
+const gchar *sipmsg_find_header_id(const struct sipmsg *msg,
+				   enum sipmsg_header_id id);
 const gchar *sipmsg_find_header_instance(const struct sipmsg *msg, const gchar *name, int which);
 gchar *sipmsg_find_part_of_header(const char *hdr, const char * before, const char * after, const char * def);
 const gchar *sipmsg_find_auth_header(struct sipmsg *msg, const gchar *name);
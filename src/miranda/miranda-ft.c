@@ -656,7 +656,8 @@ begin_transfer(struct sipe_file_transfer *ft)
 	}
 	UNLOCK;
 
-	if (xfer->fd)
+	/* ft->start() may have selected the watcher already */
+	if (xfer->fd && !xfer->watcher)
 		xfer->watcher = sipe_miranda_input_add(xfer->fd, xfer->incoming?SIPE_MIRANDA_INPUT_READ:SIPE_MIRANDA_INPUT_WRITE, transfer_cb, xfer);
 
 	FT_SIPE_DEBUG_INFO("watcher [%08x]", xfer->watcher);
@@ -697,6 +698,29 @@ sipe_backend_ft_start(struct sipe_file_transfer *ft, struct sipe_backend_fd *fd,
 	begin_transfer(ft);
 }
 
+void
+sipe_backend_ft_ready(struct sipe_file_transfer *ft)
+{
+	do_transfer(ft->backend_private);
+}
+
+void
+sipe_backend_ft_watch_readable(struct sipe_file_transfer *ft,
+			       gboolean readable)
+{
+	struct sipe_backend_file_transfer *xfer = ft->backend_private;
+
+	if (xfer->incoming || !xfer->fd)
+		return;
+
+	if (xfer->watcher)
+		sipe_miranda_input_remove(xfer->watcher);
+	xfer->watcher = sipe_miranda_input_add(xfer->fd,
+					       readable ? SIPE_MIRANDA_INPUT_READ : SIPE_MIRANDA_INPUT_WRITE,
+					       transfer_cb,
+					       xfer);
+}
+
 gboolean
 sipe_backend_ft_is_incoming(struct sipe_file_transfer *ft)
 {
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010-2017 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2018 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2010 Jakub Adam <jakub.adam@ktknet.cz>
  * Copyright (C) 2010 Tomáš Hrabčík <tomas.hrabcik@tieto.com>
  *
@@ -51,6 +51,7 @@
 #define purple_xfer_get_protocol_data(xfer)    xfer->data
 #define purple_xfer_get_status(xfer)           purple_xfer_get_status(xfer)
 #define purple_xfer_get_xfer_type(xfer)        purple_xfer_get_type(xfer)
+#define purple_xfer_protocol_ready(xfer)       purple_xfer_prpl_ready(xfer)
 #define purple_xfer_get_watcher(xfer)          xfer->watcher
 #define purple_xfer_set_protocol_data(xfer, d) xfer->data = d
 #define purple_xfer_set_watcher(xfer, w)       xfer->watcher = w
@@ -211,7 +212,8 @@ ft_start(PurpleXfer *xfer)
 {
 	struct sipe_file_transfer *ft = PURPLE_XFER_TO_SIPE_FILE_TRANSFER;
 
-	if (purple_xfer_get_xfer_type(xfer) == PURPLE_XFER_TYPE_RECEIVE) {
+	if ((purple_xfer_get_xfer_type(xfer) == PURPLE_XFER_TYPE_RECEIVE) &&
+	    (purple_xfer_get_fd(xfer) >= 0)) {
 		/* Set socket to non-blocking mode */
 		int flags = fcntl(purple_xfer_get_fd(xfer), F_GETFL, 0);
 		if (flags == -1) {
@@ -369,6 +371,39 @@ sipe_backend_ft_start(struct sipe_file_transfer *ft, struct sipe_backend_fd *fd,
 	purple_xfer_start(FT_TO_PURPLE_XFER, fd ? fd->fd : -1, ip, port);
 }
 
+void
+sipe_backend_ft_ready(struct sipe_file_transfer *ft)
+{
+	purple_xfer_protocol_ready(FT_TO_PURPLE_XFER);
+}
+
+static void
+ft_transfer_cb(gpointer data,
+	       SIPE_UNUSED_PARAMETER gint source,
+	       SIPE_UNUSED_PARAMETER PurpleInputCondition condition)
+{
+	purple_xfer_protocol_ready((PurpleXfer *) data);
+}
+
+void
+sipe_backend_ft_watch_readable(struct sipe_file_transfer *ft,
+			       gboolean readable)
+{
+	PurpleXfer *xfer = FT_TO_PURPLE_XFER;
+
+	if ((purple_xfer_get_xfer_type(xfer) != PURPLE_XFER_TYPE_SEND) ||
+	    (purple_xfer_get_fd(xfer) < 0))
+		return;
+
+	if (purple_xfer_get_watcher(xfer))
+		purple_input_remove(purple_xfer_get_watcher(xfer));
+	purple_xfer_set_watcher(xfer,
+				purple_input_add(purple_xfer_get_fd(xfer),
+						 readable ? PURPLE_INPUT_READ : PURPLE_INPUT_WRITE,
+						 ft_transfer_cb,
+						 xfer));
+}
+
 void sipe_purple_ft_send_file(PurpleConnection *gc,
 			      const char *who,
 			      const char *file)
@@ -965,6 +965,17 @@ GList * sipe_purple_account_options()
 	option = purple_account_option_string_new(_("Group Chat Proxy\n   company.com  or  user@company.com\n(leave empty to determine from Username)"), "groupchat_user", "");
 	options = g_list_append(options, option);
 
+	option = purple_account_option_list_new(_("File transfer block size"), "ft_block_size", NULL);
+	purple_account_option_add_list_item(option, _("ForeFront compatible"), "forefront");
+	purple_account_option_add_list_item(option, _("Maximum"), "maximum");
+	options = g_list_append(options, option);
+
+	option = purple_account_option_string_new(_("HTTP connections per server\n(leave empty for default)"), "http_connections", "");
+	options = g_list_append(options, option);
+
+	option = purple_account_option_string_new(_("HTTP requests in flight per connection\n(1 disables pipelining, leave empty for default)"), "http_pipeline_depth", "");
+	options = g_list_append(options, option);
+
 #ifdef HAVE_APPSHARE
 	option = purple_account_option_string_new(_("Remote desktop client"), "rdp_client", "");
 	options = g_list_append(options, option);
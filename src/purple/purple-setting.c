@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010-2016 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -44,7 +44,10 @@ static const gchar * const setting_name[SIPE_SETTING_LAST] = {
 	"email_password", /* SIPE_SETTING_EMAIL_PASSWORD */
 	"groupchat_user", /* SIPE_SETTING_GROUPCHAT_USER */
 	"rdp_client",     /* SIPE_SETTING_RDP_CLIENT     */
-	"useragent"       /* SIPE_SETTING_USER_AGENT     */
+	"useragent",      /* SIPE_SETTING_USER_AGENT     */
+	"ft_block_size",  /* SIPE_SETTING_FT_BLOCK_SIZE  */
+	"http_connections",    /* SIPE_SETTING_HTTP_CONNECTIONS    */
+	"http_pipeline_depth"  /* SIPE_SETTING_HTTP_PIPELINE_DEPTH */
 };
 
 const gchar *sipe_backend_setting(struct sipe_core_public *sipe_public,
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2012-2017 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2012-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -45,9 +45,10 @@ static void dns_srv_response(GObject *resolver,
 
 	if (targets) {
 		GSrvTarget *target = targets->data;
-		query->callback(query->extradata,
-				g_srv_target_get_hostname(target),
-				g_srv_target_get_port(target));
+		if (query->callback)
+			query->callback(query->extradata,
+					g_srv_target_get_hostname(target),
+					g_srv_target_get_port(target));
 		g_resolver_free_targets(targets);
 	} else {
 		SIPE_DEBUG_INFO("dns_srv_response: failed: %s",
@@ -100,7 +101,8 @@ static void dns_a_response(GObject *resolver,
 	if (addresses) {
 		GInetAddress *address  = addresses->data;
 		gchar        *ipstr    = g_inet_address_to_string(address);
-		query->callback(query->extradata, ipstr, query->port);
+		if (query->callback)
+			query->callback(query->extradata, ipstr, query->port);
 		g_free(ipstr);
 		g_resolver_free_addresses(addresses);
 	} else {
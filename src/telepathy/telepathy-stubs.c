@@ -148,6 +148,9 @@ void sipe_backend_ft_start(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft,
 			   SIPE_UNUSED_PARAMETER struct sipe_backend_fd *fd,
 			   SIPE_UNUSED_PARAMETER const char* ip,
 			   SIPE_UNUSED_PARAMETER unsigned port) {}
+void sipe_backend_ft_ready(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft) {}
+void sipe_backend_ft_watch_readable(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft,
+				    SIPE_UNUSED_PARAMETER gboolean readable) {}
 gboolean sipe_backend_ft_is_incoming(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft) { return(FALSE); }
 
 /** GROUP CHAT ***************************************************************/
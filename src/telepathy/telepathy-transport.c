@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2012-2017 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2012-2018 SIPE Project <http://sipe.sourceforge.net/>
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -54,6 +54,8 @@ struct sipe_transport_telepathy {
 	GSList *buffers; /* != NULL -> write operation in progress */
 	guint port;
 	gboolean do_flush;
+	gboolean connecting;   /* connect operation in progress */
+	gboolean disconnected; /* free when connect operation completes */
 };
 
 #define TELEPATHY_TRANSPORT ((struct sipe_transport_telepathy *) conn)
@@ -149,6 +151,7 @@ static void certificate_result(SIPE_UNUSED_PARAMETER GObject *unused,
 	}
 }
 
+static gboolean free_transport(gpointer data);
 static void socket_connected(GObject *client,
 			     GAsyncResult *result,
 			     gpointer data)
@@ -156,11 +159,20 @@ static void socket_connected(GObject *client,
 	struct sipe_transport_telepathy *transport = data;
 	GError *error = NULL;
 
+	transport->connecting = FALSE;
 	transport->socket = g_socket_client_connect_finish(G_SOCKET_CLIENT(client),
 							   result,
 							   &error);
 
-	if (transport->socket == NULL) {
+	if (transport->disconnected) {
+		/* transport was disconnected while connect was in progress */
+		SIPE_DEBUG_INFO("socket_connected: %p was disconnected", transport);
+		if (transport->socket)
+			g_object_unref(transport->socket);
+		if (error)
+			g_error_free(error);
+		free_transport(transport);
+	} else if (transport->socket == NULL) {
 		if (transport->tls_info) {
 			SIPE_DEBUG_INFO_NOFORMAT("socket_connected: need to wait for user interaction");
 			sipe_telepathy_tls_verify_async(G_OBJECT(transport->private->connection),
@@ -268,6 +280,7 @@ static gboolean internal_connect(gpointer data)
 	} else
 		SIPE_DEBUG_INFO_NOFORMAT("using TCP");
 
+	transport->connecting = TRUE;
 	g_socket_client_connect_async(client,
 				      g_network_address_new(transport->hostname,
 							    transport->port),
@@ -389,8 +402,12 @@ void sipe_backend_transport_disconnect(struct sipe_transport_connection *conn)
 		if (transport->cancel)
 			g_cancellable_cancel(transport->cancel);
 
-		/* queue transport to be deleted */
-		g_idle_add(free_transport, transport);
+		if (transport->connecting)
+			/* socket_connected() will delete transport */
+			transport->disconnected = TRUE;
+		else
+			/* queue transport to be deleted */
+			g_idle_add(free_transport, transport);
 	}
 }
 